@@ -15,8 +15,6 @@
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/quaternion.hpp>
 
-constexpr int WINDOW_WIDTH = 1920;
-constexpr int WINDOW_HEIGHT = 1080;
 constexpr bool WINDOW_RESIZABLE = true;
 constexpr float MIN_DELTA_TIME = 1.0f / 60.0f;
 
@@ -35,7 +33,7 @@ private:
 	bool rmb_down = false;
 	glm::vec2 cursor_pos = { 0.0f, 0.0f };
 	glm::vec2 prev_cursor_pos = { 0.0f, 0.0f };
-	glm::vec2 framebuffer_size = { WINDOW_WIDTH, WINDOW_HEIGHT };
+	glm::vec2 framebuffer_size = glm::vec2(getGlobalTestSceneConfiguration().window_width, getGlobalTestSceneConfiguration().window_height);
 	bool w_down = false; // todo use a hash map or something
 	bool s_down = false;
 	bool a_down = false;
@@ -43,6 +41,8 @@ private:
 	bool q_down = false;
 	bool e_down = false;
 	bool z_pressed = false;
+	bool t_pressed = false;
+	bool p_pressed = false;
 
 
 	GLFWwindow* createWindow()
@@ -60,7 +60,8 @@ private:
 			glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 		}
 
-		auto window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "VFPR - Vulkan Forward+ Renderer", nullptr, nullptr);
+		const auto& config = getGlobalTestSceneConfiguration();
+		auto window = glfwCreateWindow(config.window_width, config.window_height, "VFPR - Vulkan Forward+ Renderer", nullptr, nullptr);
 		
 		glfwSetWindowUserPointer(window, this);
 	
@@ -185,6 +186,19 @@ private:
 				renderer.changeDebugViewIndex(renderer.getDebugViewIndex() + 1);
 			}
 
+			if (p_pressed) // pause light animation
+			{
+				p_pressed = false;
+				renderer.setLightAnimationPaused(!renderer.isLightAnimationPaused());
+			}
+
+			if (t_pressed) // auto-tune tile size
+			{
+				t_pressed = false;
+				renderer.autoTuneTileSize();
+				previous = std::chrono::high_resolution_clock::now(); // don't count tuning time into the next frame
+			}
+
 			if (delta_time >= MIN_DELTA_TIME) //prevent underflow
 			{
 				tick(delta_time);
@@ -192,9 +206,16 @@ private:
 			}
 
 			renderer.setCamera(camera.getViewMatrix(), camera.position);
+			auto skipped_frames = renderer.getFrameSkipCounters().skipped_frames;
 			renderer.requestDraw(delta_time);
 			total_frames++;
 
+			if (renderer.getFrameSkipCounters().skipped_frames != skipped_frames)
+			{
+				// nothing changed, don't spin until there is input
+				glfwWaitEventsTimeout(MIN_DELTA_TIME);
+			}
+
 		}
 		auto end_time = std::chrono::high_resolution_clock::now();
 		total_time_past = std::chrono::duration<float>(end_time - start_time).count();
@@ -202,6 +223,33 @@ private:
 		{
 			std::cout << "FPS: " << total_frames / total_time_past << std::endl;
 		}
+		auto skip_counters = renderer.getFrameSkipCounters();
+		std::cout << "Frames drawn: " << skip_counters.drawn_frames
+			<< ", skipped: " << skip_counters.skipped_frames
+			<< ", drawn reusing light culling: " << skip_counters.skipped_light_culling_frames << std::endl;
+		if (skip_counters.drawn_frames > 0)
+		{
+			std::cout << "Uploaded: " << renderer.getUploadedBytes() / skip_counters.drawn_frames << " bytes/frame" << std::endl;
+		}
+		auto pacing = renderer.getFramePacingStats();
+		if (pacing.cpu_frames > 0)
+		{
+			auto fence_wait_ms = pacing.fence_wait_ms / pacing.cpu_frames;
+			std::cout << "Frames in flight: " << pacing.frames_in_flight << (pacing.async_compute ? " with async compute" : "")
+				<< (pacing.frame_graph ? " with a frame graph" : "")
+				<< ", CPU: " << pacing.cpu_ms / pacing.cpu_frames << " ms/frame"
+				<< ", submitting: " << pacing.queue_submits / static_cast<double>(pacing.cpu_frames) << " vkQueueSubmit, " << pacing.submit_ms / pacing.cpu_frames << " ms/frame"
+				<< ", waiting for the GPU: " << fence_wait_ms << " ms/frame";
+			if (pacing.gpu_frames > 0)
+			{
+				// the part of the GPU time the CPU spent on other frames instead of waiting
+				auto gpu_ms = pacing.gpu_ms / pacing.gpu_frames;
+				auto overlap = gpu_ms > 0.0 ? glm::clamp(1.0 - fence_wait_ms / gpu_ms, 0.0, 1.0) : 0.0;
+				std::cout << ", GPU: " << gpu_ms << " ms/frame, idle between passes: " << pacing.gpu_idle_ms / pacing.gpu_frames << " ms/frame"
+					<< ", overlap: " << overlap * 100.0 << "%";
+			}
+			std::cout << std::endl;
+		}
 		renderer.cleanUp();
 	}
 
@@ -296,6 +344,13 @@ private:
 					break;
 				case GLFW_KEY_Z:
 					z_pressed = true;
+					break;
+				case GLFW_KEY_T:
+					t_pressed = true;
+					break;
+				case GLFW_KEY_P:
+					p_pressed = true;
+					break;
 			}
 		}
 	}
@@ -338,6 +393,13 @@ public:
 	{
 		mainLoop();
 	}
+
+	void runBenchmark(const std::string& name)
+	{
+		renderer.setCamera(camera.getViewMatrix(), camera.position);
+		renderer.runBenchmark(name);
+		renderer.cleanUp();
+	}
 };
 
 void ShowBase::run()
@@ -345,6 +407,11 @@ void ShowBase::run()
 	p_impl->run();
 }
 
+void ShowBase::runBenchmark(const std::string& name)
+{
+	p_impl->runBenchmark(name);
+}
+
 ShowBase::ShowBase()
 	: p_impl(std::make_unique<_ShowBase_Impl>())
 {}
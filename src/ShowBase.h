@@ -4,6 +4,7 @@
 #pragma once
 
 #include <memory>
+#include <string>
 
 class _ShowBase_Impl; // pimpl idiom during development stage
 
@@ -11,6 +12,7 @@ class ShowBase
 {
 public:
 	void run();
+	void runBenchmark(const std::string& name); // run a named renderer benchmark without entering the interactive loop
 	ShowBase();
 	~ShowBase(); // need to define it in cpp otherwise it would try to generate inline destructor for unique_ptr and require ShowBase_Impl implementation
 
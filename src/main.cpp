@@ -12,6 +12,10 @@
 #include <stdexcept>
 #include <iostream>
 #include <string>
+#include <map>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
 
 // for test use
 TestSceneConfiguration sponza_full_10_lights
@@ -134,17 +138,216 @@ TestSceneConfiguration rungholt_20000_lights
 	glm::quat{ 0.883192122f, -0.292658001f, 0.347898334f, 0.115281112f }   // camera rotation
 };
 
-int main()
+TestSceneConfiguration sponza_full_200_spot_lights
+{
+	util::getContentPath("sponza_full/sponza.obj"),  //model_file
+	0.01f,  // scale
+	glm::vec3{ -15, -5, -5 },  // min_light_pos
+	glm::vec3{ 15, 20, 5 },  // max_light_pos
+	2.0f,  // radius
+	200,  // light num
+	glm::vec3{ 12.7101822f, 1.87933588f, -0.0333303586f },  // camera position
+	glm::quat{ 0.717312694f, -0.00208670134f, 0.696745396f, 0.00202676491f },   // camera rotation
+	200,  // spot light num
+	10.0f,  // spot light range
+	25.0f  // spot light angle
+};
+
+TestSceneConfiguration rungholt_1000_spot_lights
+{
+	util::getContentPath("rungholt/rungholt.obj"),  //model_file
+	0.10f,  // scale
+	glm::vec3{ -20, -5, -20 },  // min_light_pos
+	glm::vec3{ 20, 20, 20 },  // max_light_pos
+	5.0f,  // radius
+	200,  // light num
+	glm::vec3{ 31.8083534f, 27.5098400f, 36.7743378f },  // camera position
+	glm::quat{ 0.883192122f, -0.292658001f, 0.347898334f, 0.115281112f },   // camera rotation
+	1000,  // spot light num
+	15.0f,  // spot light range
+	20.0f  // spot light angle
+};
+
+const std::map<std::string, const TestSceneConfiguration*> TEST_SCENES =
+{
+	{ "sponza_full_10_lights", &sponza_full_10_lights },
+	{ "sponza_full_200_lights", &sponza_full_200_lights },
+	{ "sponza_full_1000_lights", &sponza_full_1000_lights },
+	{ "sponza_full_1000_small_lights", &sponza_full_1000_small_lights },
+	{ "sponza_full_1000_large_lights", &sponza_full_1000_large_lights },
+	{ "sponza_full_20000_small_lights", &sponza_full_20000_small_lights },
+	{ "rungholt_10_lights", &rungholt_10_lights },
+	{ "rungholt_200_lights", &rungholt_200_lights },
+	{ "rungholt_1000_lights", &rungholt_1000_lights },
+	{ "rungholt_20000_lights", &rungholt_20000_lights },
+	{ "sponza_full_200_spot_lights", &sponza_full_200_spot_lights },
+	{ "rungholt_1000_spot_lights", &rungholt_1000_spot_lights },
+};
+
+// usage: VulkanForwardPlus [--scene <scene name>] [--benchmark <benchmark name>] [--tile-budget <max lights per tile>] [--emulate-spot-lights 0|1] [--frames-in-flight 1|2|3] [--async-compute 0|1] [--frame-graph 0|1] [--synthetic-parts <mesh part count>] [--bindless 0|1] [--indirect-draws 0|1] [--gpu-culling 0|1] [--draw-sorting 0|1] [--cpu-culling 0|1] [--resolution <width>x<height>]
+int main(int argc, char* argv[])
 {
 	auto result = EXIT_SUCCESS;
 
 	// change this to test different scenes
 	getGlobalTestSceneConfiguration() = sponza_full_1000_small_lights;
 
+	std::string benchmark_name;
+	int tile_budget = 0;
+	int emulate_spot_lights = -1;
+	int frames_in_flight = 0;
+	int async_compute = -1;
+	int frame_graph = -1;
+	int synthetic_parts = 0;
+	int bindless = -1;
+	int indirect_draws = -1;
+	int gpu_culling = -1;
+	int draw_sorting = -1;
+	int cpu_culling = -1;
+	int window_width = 0;
+	int window_height = 0;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (std::strcmp(argv[i], "--scene") == 0)
+		{
+			auto scene = TEST_SCENES.find(argv[i + 1]);
+			if (scene == TEST_SCENES.end())
+			{
+				std::cerr << "Unknown scene " << argv[i + 1] << std::endl;
+				return EXIT_FAILURE;
+			}
+			getGlobalTestSceneConfiguration() = *scene->second;
+		}
+		else if (std::strcmp(argv[i], "--benchmark") == 0)
+		{
+			benchmark_name = argv[i + 1];
+		}
+		else if (std::strcmp(argv[i], "--tile-budget") == 0)
+		{
+			tile_budget = std::atoi(argv[i + 1]);
+		}
+		else if (std::strcmp(argv[i], "--emulate-spot-lights") == 0)
+		{
+			emulate_spot_lights = std::atoi(argv[i + 1]);
+		}
+		else if (std::strcmp(argv[i], "--frames-in-flight") == 0)
+		{
+			frames_in_flight = std::atoi(argv[i + 1]);
+		}
+		else if (std::strcmp(argv[i], "--async-compute") == 0)
+		{
+			async_compute = std::atoi(argv[i + 1]);
+		}
+		else if (std::strcmp(argv[i], "--frame-graph") == 0)
+		{
+			frame_graph = std::atoi(argv[i + 1]);
+		}
+		else if (std::strcmp(argv[i], "--synthetic-parts") == 0)
+		{
+			synthetic_parts = std::atoi(argv[i + 1]);
+		}
+		else if (std::strcmp(argv[i], "--bindless") == 0)
+		{
+			bindless = std::atoi(argv[i + 1]);
+		}
+		else if (std::strcmp(argv[i], "--indirect-draws") == 0)
+		{
+			indirect_draws = std::atoi(argv[i + 1]);
+		}
+		else if (std::strcmp(argv[i], "--gpu-culling") == 0)
+		{
+			gpu_culling = std::atoi(argv[i + 1]);
+		}
+		else if (std::strcmp(argv[i], "--draw-sorting") == 0)
+		{
+			draw_sorting = std::atoi(argv[i + 1]);
+		}
+		else if (std::strcmp(argv[i], "--cpu-culling") == 0)
+		{
+			cpu_culling = std::atoi(argv[i + 1]);
+		}
+		else if (std::strcmp(argv[i], "--resolution") == 0)
+		{
+			if (std::sscanf(argv[i + 1], "%dx%d", &window_width, &window_height) != 2)
+			{
+				std::cerr << "Resolution should look like 1920x1080, not " << argv[i + 1] << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	if (emulate_spot_lights >= 0)
+	{
+		getGlobalTestSceneConfiguration().emulate_spot_lights = emulate_spot_lights != 0;
+	}
+
+	if (tile_budget > 0)
+	{
+		getGlobalTestSceneConfiguration().max_point_light_per_tile = tile_budget;
+	}
+
+	if (frames_in_flight > 0)
+	{
+		getGlobalTestSceneConfiguration().frames_in_flight = frames_in_flight;
+	}
+
+	if (async_compute >= 0)
+	{
+		getGlobalTestSceneConfiguration().async_compute = async_compute != 0;
+	}
+
+	if (frame_graph >= 0)
+	{
+		getGlobalTestSceneConfiguration().frame_graph = frame_graph != 0;
+	}
+
+	if (synthetic_parts > 0)
+	{
+		getGlobalTestSceneConfiguration().synthetic_mesh_parts = synthetic_parts;
+	}
+
+	if (bindless >= 0)
+	{
+		getGlobalTestSceneConfiguration().bindless_materials = bindless != 0;
+	}
+
+	if (indirect_draws >= 0)
+	{
+		getGlobalTestSceneConfiguration().indirect_draws = indirect_draws != 0;
+	}
+
+	if (gpu_culling >= 0)
+	{
+		getGlobalTestSceneConfiguration().gpu_culling = gpu_culling != 0;
+	}
+
+	if (draw_sorting >= 0)
+	{
+		getGlobalTestSceneConfiguration().draw_sorting = draw_sorting != 0;
+	}
+
+	if (cpu_culling >= 0)
+	{
+		getGlobalTestSceneConfiguration().cpu_culling = cpu_culling != 0;
+	}
+
+	if (window_width > 0 && window_height > 0)
+	{
+		getGlobalTestSceneConfiguration().window_width = window_width;
+		getGlobalTestSceneConfiguration().window_height = window_height;
+	}
+
 	try
 	{
 		ShowBase app;
-		app.run();
+		if (benchmark_name.empty())
+		{
+			app.run();
+		}
+		else
+		{
+			app.runBenchmark(benchmark_name);
+		}
 	}
 	catch (const std::runtime_error& e)
 	{
@@ -8,11 +8,19 @@
 #include "VulkanRenderer.h"
 
 #include "../scene.h"
+#include "lights.h"
+#include "light_store.h"
 #include "model.h"
 #include "raii.h"
+#include "transfer_queue.h"
+#include "upload_ring.h"
 #include "../util.h"
 #include "vulkan_util.h"
 #include "context.h"
+#include "dirty_pages.h"
+#include "frame_graph.h"
+#include "thread_command_pools.h"
+#include "../thread_pool.h"
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/random.hpp>
@@ -27,29 +35,47 @@
 #include <algorithm>
 #include <fstream>
 #include <chrono>
+#include <iostream>
+#include <limits>
+#include <cstddef>
+#include <random>
+#include <numeric>
+#include <atomic>
 
 using util::Vertex;
 
-const int MAX_POINT_LIGHT_COUNT = 20000; //TODO: change it back smaller
 //const int MAX_POINT_LIGHT_PER_TILE = 63;
-const int MAX_POINT_LIGHT_PER_TILE = 1023;
-// const int TILE_SIZE = 16;
-const int TILE_SIZE = 16;
-
-struct PointLight
-{
-public:
-	//glm::vec3 pos = { 0.0f, 1.0f, 0.0f };
-	glm::vec3 pos;
-	float radius = { 5.0f };
-	glm::vec3 intensity = { 1.0f, 1.0f, 1.0f };
-	float padding;
-
-	PointLight() {}
-	PointLight(glm::vec3 pos, float radius, glm::vec3 intensity)
-		: pos(pos), radius(radius), intensity(intensity)
-	{};
-};
+const int DEFAULT_TILE_SIZE = 16;
+const int DEFAULT_MAX_SPOT_LIGHT_PER_TILE = 255;
+const int DEFAULT_LIGHT_CULLING_WORKGROUP_SIZE = 32;
+const std::array<int, 5> TILE_SIZE_CANDIDATES = { 8, 16, 32, 64, 128 }; // tried by the tile size auto-tuner
+const std::array<int, 6> WORKGROUP_SIZE_CANDIDATES = { 16, 32, 64, 128, 256, 512 }; // tried by the workgroup size benchmark
+const std::array<int, 6> TILE_BUDGET_CANDIDATES = { 16, 32, 64, 128, 256, 1023 }; // tried by the tile light budget benchmark
+const int TUNING_WARMUP_FRAMES = 10;
+const int TUNING_MEASURED_FRAMES = 60;
+const glm::vec3 LIGHT_VELOCITY = { 0.0f, 3.0f, 0.0f }; // every light drifts upwards and wraps around
+const uint32_t LIGHT_UPDATE_WORKGROUP_SIZE = 64; // local_size_x of light_update.comp.glsl, given as constant_id = 0
+const uint32_t MAX_FRAMES_IN_FLIGHT = 3; // sizes the per frame resources, frames_in_flight of them are used
+const int DEBUG_VIEW_COUNT = 5; // shader variants of forwardplus.frag, 0 is the render view
+const size_t LIGHTS_PER_DIRTY_PAGE = 64; // granularity of incremental light uploads
+const std::array<float, 3> LIGHT_UPLOAD_CHANGED_FRACTIONS = { 0.01f, 0.1f, 1.0f }; // tried by the light upload benchmark
+const size_t LIGHT_KERNEL_CHUNK_SIZE = 4096; // lights per worker thread task
+const size_t LIGHT_RAMP_MAX_COUNT = 200000; // point lights reached by the light ramp stress test
+const int LIGHT_RAMP_FRAMES_PER_STEP = 30; // the light count doubles over this many frames
+const int FRAME_PACING_BENCHMARK_FRAMES = 300; // drawn by the frame pacing benchmark
+const std::array<size_t, 4> LIGHT_KERNEL_BENCHMARK_COUNTS = { 1000, 10000, 100000, 1000000 }; // tried by the light kernel benchmark
+const size_t MESH_PARTS_PER_RECORDING_CHUNK = 64; // mesh parts recorded into one secondary command buffer
+const int RECORDING_BENCHMARK_FRAMES = 100; // drawn per thread count by the recording benchmark
+const std::array<vk::DeviceSize, 5> UPLOAD_STREAMING_SIZES = { 0, 256 * 1024, 4 * 1024 * 1024, 12 * 1024 * 1024, 32 * 1024 * 1024 }; // streamed per frame by the upload streaming benchmark
+const uint32_t MAX_BINDLESS_TEXTURES = 16384; // upper bound of the texture array of bindless materials, the device limits may lower it
+const uint32_t HIZ_WORKGROUP_SIZE = 8; // local_size_x and local_size_y of hiz_build.comp.glsl
+const uint32_t MESH_CULLING_WORKGROUP_SIZE = 64; // local_size_x of mesh_culling.comp.glsl
+const uint32_t MESH_CULLING_PHASE_COUNT = 2; // before the depth prepass, and against the pyramid of its depth
+const uint32_t MESH_CULLING_SHADING_LIST = 2; // the culled draw list of the parts drawn by both phases, in the order of the model
+// the shading list is compacted after phase 1: count per workgroup, scan the counts in one workgroup, write per workgroup
+const std::array<int, 3> MESH_CULLING_SHADING_LIST_PHASES = { 2, 3, 4 };
+const vk::DeviceSize CULLED_DRAW_COUNTS_SIZE = 4 * sizeof(uint32_t); // the draw count of each culling phase, padded to 16 bytes
+const float OCCLUDER_MIN_SCREEN_SIZE = 0.1f; // bounding sphere diameter over the viewport height above which a part is drawn first in the depth prepass
 
 
 // uniform buffer object for model transformation
@@ -67,16 +93,178 @@ struct CameraUbo
 	glm::vec3 cam_pos;
 };
 
+// sphere-vs-tile test used by light culling, must match LIGHT_CULLING_TEST_* in light_culling.comp.glsl
+enum LightCullingTest : int
+{
+	LIGHT_CULLING_TEST_FRUSTUM_PLANES = 0, // six frustum planes plus the 8 corner bbox rejection
+	LIGHT_CULLING_TEST_VIEW_AABB, // sphere vs the view space AABB of the tile
+	LIGHT_CULLING_TEST_TWO_PHASE, // view space AABB first, then the frustum planes
+	LIGHT_CULLING_TEST_COUNT
+};
+
+const char* const LIGHT_CULLING_TEST_NAMES[LIGHT_CULLING_TEST_COUNT] = { "frustum planes", "view space AABB", "AABB + planes" };
+
+// specialization constants of the light culling and forward+ shaders
+// member order must match the constant_id in the shaders,
+// ids 2 and 6 used to size the light arrays, which are runtime sized now
+struct SpecializationConstants
+{
+	int tile_size; // constant_id = 0
+	uint32_t max_point_light_per_tile; // constant_id = 1
+	uint32_t light_culling_workgroup_size; // constant_id = 3, local_size_x of light culling
+	int light_culling_test; // constant_id = 4, a LightCullingTest
+	VkBool32 light_culling_stats; // constant_id = 5, bool constants are 32 bits wide
+	uint32_t max_spot_light_per_tile; // constant_id = 7
+	VkBool32 hiz_depth_bounds; // constant_id = 8, light culling reads the tile depth bounds from the Hi-Z pyramid
+
+	static std::array<vk::SpecializationMapEntry, 7> getMapEntries()
+	{
+		return {
+			vk::SpecializationMapEntry(0, offsetof(SpecializationConstants, tile_size), sizeof(int)),
+			vk::SpecializationMapEntry(1, offsetof(SpecializationConstants, max_point_light_per_tile), sizeof(uint32_t)),
+			vk::SpecializationMapEntry(3, offsetof(SpecializationConstants, light_culling_workgroup_size), sizeof(uint32_t)),
+			vk::SpecializationMapEntry(4, offsetof(SpecializationConstants, light_culling_test), sizeof(int)),
+			vk::SpecializationMapEntry(5, offsetof(SpecializationConstants, light_culling_stats), sizeof(VkBool32)),
+			vk::SpecializationMapEntry(7, offsetof(SpecializationConstants, max_spot_light_per_tile), sizeof(uint32_t)),
+			vk::SpecializationMapEntry(8, offsetof(SpecializationConstants, hiz_depth_bounds), sizeof(VkBool32)),
+		};
+	}
+};
+
+// push constants of light_update.comp.glsl
+struct LightUpdatePushConstants
+{
+	glm::vec4 bounds_min;
+	glm::vec4 bounds_max;
+	float delta_time;
+	int spot_velocity_offset; // spot light velocities follow the point light ones
+};
+
+// push constants of hiz_build.comp.glsl
+struct HiZPushConstants
+{
+	int source_is_depth; // building level 0 from the depth image rather than a level from the one above it
+};
+
+// push constants of mesh_culling.comp.glsl
+struct MeshCullingPushConstants
+{
+	glm::mat4 model;
+	glm::ivec2 viewport_size;
+	uint32_t part_count;
+	int phase; // 0 before the depth prepass, 1 against the Hi-Z pyramid of its depth, 2 to 4 the shading list after 1
+};
+
+// counters written by GPU culling, see MeshCullingStats in mesh_culling.comp.glsl
+struct MeshCullingStats
+{
+	uint32_t phase0_draw_count = 0; // parts visible the last time, drawn before the pyramid is built
+	uint32_t phase1_draw_count = 0; // parts which became visible, drawn after the occlusion test
+	uint32_t frustum_culled_count = 0;
+	uint32_t occlusion_culled_count = 0;
+	uint32_t drawn_triangle_count = 0;
+};
+
+// a copy recorded into the next light update ahead of the light uploads, e.g. from light buffers which grew
+struct PendingBufferCopy
+{
+	vk::Buffer src;
+	vk::Buffer dst;
+	vk::BufferCopy region;
+};
+
+// the resources a frame's passes share in its frame graph
+struct FrameGraphResources
+{
+	VFrameGraph::ResourceId depth;
+	VFrameGraph::ResourceId hiz_pyramid; // only with use_hiz
+	VFrameGraph::ResourceId pointlight_snapshot;
+	VFrameGraph::ResourceId spotlight_snapshot;
+	VFrameGraph::ResourceId light_visibility;
+	VFrameGraph::ResourceId spot_light_visibility;
+	VFrameGraph::ResourceId light_culling_stats;
+	VFrameGraph::ResourceId culled_draws; // only with use_gpu_culling
+};
+
+// a frame to shade, whose depth prepass and light culling were submitted if they ran
+struct ShadingSubmission
+{
+	uint32_t frame = 0;
+	bool light_culling_ran = false;
+};
+
+// resources replaced while frames in flight may still use them, destroyed once the last of those frames is done
+struct RetiredResources
+{
+	uint64_t last_use_frame = 0; // frame_serial of the last frame which can use them
+	std::vector<VRaii<VkDeviceMemory>> memories;
+	std::vector<VRaii<VkBuffer>> buffers; // declared after the memory, so destroyed before it
+	VUploadRing upload_ring;
+};
+
+// counters written by light culling, see LightCullingStats in light_culling.comp.glsl
+struct LightCullingStats
+{
+	uint32_t accepted_light_count = 0; // only in stats mode
+	uint32_t zero_contribution_light_count = 0; // only in stats mode
+	uint32_t overflowed_tile_count = 0;
+	uint32_t dropped_light_count = 0;
+	uint32_t max_tile_light_count = 0;
+	uint32_t dropped_spot_light_count = 0; // spot lights dropped from tiles with more than max_spot_light_per_tile
+};
+
+// GPU time (in milliseconds) of each stage, measured with timestamp queries
+struct StageTimings
+{
+	float depth_prepass = 0.0f;
+	float hiz_build = 0.0f; // the Hi-Z pyramid, built from the depth right before light culling
+	float light_culling = 0.0f;
+	float shading = 0.0f;
+	float idle = 0.0f; // between the end of one pass and the start of the next, only when light culling ran
+	float shading_fragments = 0.0f; // fragment shader invocations of the shading pass, 0 without pipeline statistics
+
+	float cullingAndShading() const
+	{
+		return hiz_build + light_culling + shading;
+	}
+};
+
+// per frame averages of the frames drawn by measureFrames()
+struct FrameTimings
+{
+	StageTimings stages; // only when read, it costs the overlap between frames
+	double frame_ms = 0.0; // wall clock, up to the GPU finishing the last frame
+	double cpu_ms = 0.0; // updating, recording and submitting, without fence waits
+	double fence_wait_ms = 0.0;
+	double recording_ms = 0.0; // recording the mesh parts
+	double gpu_ms = 0.0; // 0 without timestamp queries
+	double gpu_idle_ms = 0.0;
+	double queue_submits = 0.0;
+	double submit_ms = 0.0;
+};
+
+// timestamp query slots, written once per frame
+enum TimestampQuery : uint32_t
+{
+	TIMESTAMP_DEPTH_PREPASS_BEGIN = 0,
+	TIMESTAMP_DEPTH_PREPASS_END,
+	TIMESTAMP_HIZ_BEGIN, // written back to back without the Hi-Z pyramid
+	TIMESTAMP_HIZ_END,
+	TIMESTAMP_LIGHT_CULLING_BEGIN,
+	TIMESTAMP_LIGHT_CULLING_END,
+	TIMESTAMP_SHADING_BEGIN,
+	TIMESTAMP_SHADING_END,
+	TIMESTAMP_QUERY_COUNT
+};
+
 struct PushConstantObject
 {
 	glm::ivec2 viewport_size;
 	glm::ivec2 tile_nums;
-	int debugview_index; // TODO: separate this and only have it in debug mode?
 
-	PushConstantObject(int viewport_size_x, int viewport_size_y, int tile_num_x, int tile_num_y, int debugview_index = 0)
+	PushConstantObject(int viewport_size_x, int viewport_size_y, int tile_num_x, int tile_num_y)
 		: viewport_size(viewport_size_x, viewport_size_y),
-		tile_nums(tile_num_x, tile_num_y),
-		debugview_index(debugview_index)
+		tile_nums(tile_num_x, tile_num_y)
 	{}
 };
 
@@ -101,18 +289,208 @@ public:
 
 	/**
 	*  0: render 1: heat map with render 2: heat map 3: depth 4: normal
+	*  Every view has its own pipeline built at startup, the next frame binds it when recording its commands
 	*/
 	void changeDebugViewIndex(int target_view)
 	{
-		debug_view_index = target_view % 5;
-		recreateSwapChain(); // TODO: change this to a state modification and handle the recreation before update
+		debug_view_index = target_view % DEBUG_VIEW_COUNT;
+		frame_dirty = true;
+	}
+
+	int getTileSize() const
+	{
+		return tile_size;
+	}
+
+	void changeTileSize(int target_tile_size)
+	{
+		if (target_tile_size <= 0 || target_tile_size == tile_size) return;
+
+		tile_size = target_tile_size;
+		recreateSpecializedPipelines();
+	}
+
+	int getLightCullingWorkgroupSize() const
+	{
+		return light_culling_workgroup_size;
+	}
+
+	void changeLightCullingWorkgroupSize(int target_workgroup_size)
+	{
+		if (target_workgroup_size <= 0 || target_workgroup_size == light_culling_workgroup_size) return;
+
+		light_culling_workgroup_size = target_workgroup_size;
+		recreateSpecializedPipelines();
+	}
+
+	void changeLightCullingTest(LightCullingTest target_test)
+	{
+		if (target_test == light_culling_test) return;
+
+		light_culling_test = target_test;
+		recreateSpecializedPipelines();
+	}
+
+	void changeMaxPointLightPerTile(int target_budget)
+	{
+		target_budget = std::min(target_budget, point_light_capacity);
+		if (target_budget <= 0 || target_budget == max_point_light_per_tile) return;
+
+		max_point_light_per_tile = target_budget;
+		recreateSpecializedPipelines();
+	}
+
+	/**
+	* Switch between the subgroup ballot light append and the plain atomicAdd one
+	*/
+	void setSubgroupLightAppendEnabled(bool enabled)
+	{
+		enabled = enabled && vulkan_context.supportsComputeSubgroupBallot();
+		if (enabled == use_subgroup_light_append) return;
+
+		use_subgroup_light_append = enabled;
+		recreateSpecializedPipelines();
+	}
+
+	void setLightCullingStatsEnabled(bool enabled)
+	{
+		if (enabled == light_culling_stats_enabled) return;
+
+		light_culling_stats_enabled = enabled;
+		recreateSpecializedPipelines();
+	}
+
+	/**
+	* Read the depth bounds of a tile from the Hi-Z pyramid, or from every depth sample of the tile.
+	* The pyramid is built either way when the device supports it
+	*/
+	void setHiZDepthBoundsEnabled(bool enabled)
+	{
+		if (enabled == hiz_depth_bounds_enabled) return;
+
+		hiz_depth_bounds_enabled = enabled;
+		recreateSpecializedPipelines();
+	}
+
+	/**
+	* Draw only the mesh parts in the view frustum, or every part. Only takes effect while GPU culling doesn't cull them
+	*/
+	void setCpuCullingEnabled(bool enabled)
+	{
+		if (enabled == cpu_culling_enabled) return;
+
+		// a frame waiting to be shaded would draw visible parts its depth prepass didn't cull
+		discardPendingShading();
+		vkDeviceWaitIdle(graphics_device);
+		cpu_culling_enabled = enabled;
+		invalidateFrameResults();
+	}
+
+	/**
+	* Draw the depth prepass occluders first and front to back, or every part in the order of the model
+	*/
+	void setDrawSortingEnabled(bool enabled)
+	{
+		draw_sorting_enabled = enabled;
+		invalidateFrameResults();
+	}
+
+	/**
+	* Draw only the mesh parts GPU culling found visible, or every part.
+	* The culling resources stay around either way when the device supports it
+	*/
+	void setGpuCullingEnabled(bool enabled)
+	{
+		if (enabled == gpu_culling_enabled) return;
+
+		// a frame waiting to be shaded would draw lists its depth prepass didn't write
+		discardPendingShading();
+		vkDeviceWaitIdle(graphics_device);
+		gpu_culling_enabled = enabled;
+		invalidateFrameResults();
+	}
+
+	/**
+	* Upload the spot lights as enclosing point lights instead, which is how scenes used to fake them
+	*/
+	void setSpotLightEmulation(bool enabled)
+	{
+		emulate_spot_lights = enabled;
+		resizeLightDirtyPages();
+		lights_changed = true;
+		lights_upload_pending = true;
+	}
+
+	bool isLightAnimationPaused() const
+	{
+		return light_animation_paused;
+	}
+
+	void setLightAnimationPaused(bool paused)
+	{
+		light_animation_paused = paused;
+	}
+
+	/**
+	* Animate the lights with the light update compute pass, or on the CPU with a full upload every frame
+	*/
+	void setGpuLightAnimationEnabled(bool enabled)
+	{
+		if (enabled == gpu_light_animation) return;
+
+		gpu_light_animation = enabled;
+		// the GPU and CPU copies of the positions diverged, restart from the CPU ones
+		lights_upload_pending = true;
+	}
+
+	FrameSkipCounters getFrameSkipCounters() const
+	{
+		return frame_skip_counters;
+	}
+
+	uint64_t getUploadedBytes() const
+	{
+		return uploaded_bytes;
+	}
+
+	FramePacingStats getFramePacingStats() const
+	{
+		auto stats = frame_pacing_stats;
+		stats.frames_in_flight = frames_in_flight;
+		stats.async_compute = pipelined_shading;
+		stats.frame_graph = use_frame_graph;
+		return stats;
 	}
 
+	void autoTuneTileSize();
+	void benchmarkLightCullingWorkgroupSizes();
+	void benchmarkLightCullingTests();
+	void benchmarkTileLightBudgets();
+	void benchmarkSpotLights();
+	void benchmarkSubgroupLightAppend();
+	void benchmarkLightAnimation();
+	void benchmarkLightUploads();
+	void benchmarkUploadStreaming();
+	void benchmarkLightKernels();
+	void benchmarkLightRamp();
+	void benchmarkFramePacing();
+	void benchmarkFrameGraph();
+	void benchmarkDebugViews();
+	void benchmarkRecordingThreads();
+	void benchmarkPipelineCache();
+	void benchmarkIndirectDraws();
+	void benchmarkHiZ();
+	void benchmarkMeshCulling();
+	void benchmarkDrawOrder();
+	void benchmarkChunkCulling();
+	void runBenchmark(const std::string& name);
+
 private:
 
 	VContext vulkan_context;
 
 	VUtility utility {vulkan_context};
+	VTransferQueue transfer_queue {vulkan_context}; // model uploads, they run while the rest of the renderer is set up
 
 	// TODO: remove those
 	QueueFamilyIndices queue_family_indices;
@@ -124,23 +502,32 @@ private:
 	vk::Queue compute_queue;
 	vk::CommandPool graphics_command_pool;
 	vk::CommandPool compute_command_pool;
+	bool queue_family_transfers = false; // the compute queue is in another family, which has to take ownership of exclusive resources
+	// the shading of a frame is submitted with the next frame, so its light culling on the compute queue overlaps this shading
+	bool pipelined_shading = false;
+	bool shading_pending = false;
+	ShadingSubmission pending_shading;
+	// without async compute every pass of a frame is recorded through the frame graph into one command buffer and submitted once
+	bool use_frame_graph = false;
+	VFrameGraph frame_graph;
 
 	VRaii<vk::SwapchainKHR> swap_chain;
 	std::vector<VkImage> swap_chain_images;
 	VkFormat swap_chain_image_format;
 	VkExtent2D swap_chain_extent;
 	std::vector<VRaii<vk::ImageView>> swap_chain_imageviews;
-	std::vector<VRaii<vk::Framebuffer>> swap_chain_framebuffers;
-	VRaii<vk::Framebuffer> depth_pre_pass_framebuffer;
+	std::vector<VRaii<vk::Framebuffer>> swap_chain_framebuffers; // one per swap chain image per frame in flight, for the frame's depth image
+	std::array<VRaii<vk::Framebuffer>, MAX_FRAMES_IN_FLIGHT> depth_pre_pass_framebuffers;
 
 	VRaii<vk::RenderPass> render_pass;
 	VRaii<vk::RenderPass> depth_pre_pass; // the depth prepass which happens before formal render pass
+	VRaii<vk::RenderPass> depth_pre_pass_load; // the same keeping the depth, for the parts the second culling phase adds
 
 	VRaii<vk::DescriptorSetLayout> object_descriptor_set_layout;
 	VRaii<vk::DescriptorSetLayout> camera_descriptor_set_layout;
 	VRaii<vk::DescriptorSetLayout> material_descriptor_set_layout;
 	VRaii<VkPipelineLayout> pipeline_layout;
-	VRaii<VkPipeline> graphics_pipeline;
+	std::array<VRaii<VkPipeline>, DEBUG_VIEW_COUNT> graphics_pipelines; // one per debug view, the debug ones derive from the render view
 	VRaii<vk::PipelineLayout> depth_pipeline_layout;
 	VRaii<vk::Pipeline> depth_pipeline;
 
@@ -148,22 +535,97 @@ private:
 	VRaii<vk::DescriptorSetLayout> intermediate_descriptor_set_layout; // which is exclusive to compute queue
 	VRaii<VkPipelineLayout> compute_pipeline_layout;
 	VRaii<VkPipeline> compute_pipeline;
-	vk::CommandBuffer light_culling_command_buffer = {};
+	// one per upload ring frame since they bind its region with dynamic offsets
+	std::array<vk::CommandBuffer, MAX_FRAMES_IN_FLIGHT> light_culling_command_buffers = {};
+	VRaii<VkPipelineLayout> light_update_pipeline_layout;
+	VRaii<VkPipeline> light_update_pipeline;
+	std::array<vk::CommandBuffer, MAX_FRAMES_IN_FLIGHT> light_update_command_buffers = {}; // rerecorded every frame for the new delta time and uploads
 	//VRaii<vk::PipelineLayout> compute_pipeline_layout;
 	//VRaii<vk::Pipeline> compute_pipeline;
 
-	std::vector<VkCommandBuffer> command_buffers; // buffers will be released when pool destroyed
-	vk::CommandBuffer depth_prepass_command_buffer;
-
-	VRaii<vk::Semaphore> image_available_semaphore;
-	VRaii<vk::Semaphore> render_finished_semaphore;
-	VRaii<vk::Semaphore> lightculling_completed_semaphore;
-	VRaii<vk::Semaphore> depth_prepass_finished_semaphore;
-
-	// for depth
-	VRaii<VkImage> depth_image;
-	VRaii<VkDeviceMemory> depth_image_memory;
-	VRaii<VkImageView> depth_image_view;
+	std::array<vk::CommandBuffer, MAX_FRAMES_IN_FLIGHT> depth_prepass_command_buffers = {}; // rerecorded every frame
+	// the graphics queue side of the ownership transfers at the end of light culling, only with a separate compute queue family
+	std::array<vk::CommandBuffer, MAX_FRAMES_IN_FLIGHT> queue_acquire_command_buffers = {};
+	// rerecorded every frame: the whole frame with the frame graph, otherwise the shading pass
+	std::array<vk::CommandBuffer, MAX_FRAMES_IN_FLIGHT> frame_command_buffers = {};
+
+	// one of each per frame in flight, so a frame never waits on or signals a semaphore an earlier frame still uses
+	std::array<VRaii<vk::Semaphore>, MAX_FRAMES_IN_FLIGHT> image_available_semaphores;
+	std::array<VRaii<vk::Semaphore>, MAX_FRAMES_IN_FLIGHT> render_finished_semaphores;
+	std::array<VRaii<vk::Semaphore>, MAX_FRAMES_IN_FLIGHT> lightculling_completed_semaphores;
+	std::array<VRaii<vk::Semaphore>, MAX_FRAMES_IN_FLIGHT> depth_prepass_finished_semaphores;
+	std::array<VRaii<vk::Fence>, MAX_FRAMES_IN_FLIGHT> frame_fences; // signaled when the GPU is done with the frame
+
+	VRaii<vk::QueryPool> timestamp_query_pool; // TIMESTAMP_QUERY_COUNT queries per frame in flight
+	bool timestamps_supported = false;
+	VRaii<vk::QueryPool> pipeline_statistics_query_pool; // the fragment shader invocations of the shading pass, one query per frame in flight
+	bool pipeline_statistics_supported = false;
+
+	// for depth, one per frame in flight so a frame's depth prepass doesn't overwrite the depth the previous frame is shading with
+	std::array<VRaii<VkImage>, MAX_FRAMES_IN_FLIGHT> depth_images;
+	std::array<VRaii<VkDeviceMemory>, MAX_FRAMES_IN_FLIGHT> depth_image_memories;
+	std::array<VRaii<VkImageView>, MAX_FRAMES_IN_FLIGHT> depth_image_views;
+
+	// Hi-Z pyramid of min and max depth, rebuilt from the frame's depth after the depth prepass.
+	// Level 0 is half the depth resolution, it's kept in the general layout and sampled by light culling through hiz_image_views
+	bool use_hiz = false;
+	uint32_t hiz_level_count = 0;
+	std::array<VRaii<VkImage>, MAX_FRAMES_IN_FLIGHT> hiz_images;
+	std::array<VRaii<VkDeviceMemory>, MAX_FRAMES_IN_FLIGHT> hiz_image_memories;
+	std::array<VRaii<VkImageView>, MAX_FRAMES_IN_FLIGHT> hiz_image_views; // every level
+	std::array<std::vector<VRaii<VkImageView>>, MAX_FRAMES_IN_FLIGHT> hiz_level_views; // one per level, for building it
+	VRaii<vk::DescriptorSetLayout> hiz_descriptor_set_layout;
+	VRaii<vk::PipelineLayout> hiz_pipeline_layout;
+	VRaii<vk::Pipeline> hiz_pipeline;
+	VRaii<vk::DescriptorPool> hiz_descriptor_pool; // recreated with the pyramid, its level count follows the resolution
+	std::array<std::vector<vk::DescriptorSet>, MAX_FRAMES_IN_FLIGHT> hiz_descriptor_sets; // one per level, from the level above it
+	VRaii<vk::Sampler> hiz_sampler; // nearest, the pyramid and the depth are only read with texelFetch
+
+	// GPU culling of the mesh parts against the frustum and the Hi-Z pyramid in two phases around the depth prepass,
+	// which draws the survivors of each phase. The shading pass draws them again from a third list in the order of the model,
+	// see recordDepthPrePass()
+	bool use_gpu_culling = false;
+	bool gpu_culling_enabled = true; // only takes effect with use_gpu_culling
+	VRaii<vk::DescriptorSetLayout> mesh_culling_descriptor_set_layout;
+	VRaii<vk::PipelineLayout> mesh_culling_pipeline_layout;
+	VRaii<vk::Pipeline> mesh_culling_pipeline;
+	VRaii<vk::DescriptorPool> mesh_culling_descriptor_pool;
+	std::array<vk::DescriptorSet, MAX_FRAMES_IN_FLIGHT> mesh_culling_descriptor_sets = {};
+	// the draw counts of the lists followed by room for the draw command of every part per list
+	std::array<VRaii<VkBuffer>, MAX_FRAMES_IN_FLIGHT> culled_draw_buffers;
+	std::array<VRaii<VkDeviceMemory>, MAX_FRAMES_IN_FLIGHT> culled_draw_buffer_memories;
+	vk::DeviceSize culled_draw_buffer_size = 0;
+	// flags per part, whether it was visible when last culled and whether the frame drew it. Shared by the frames in flight,
+	// their depth prepasses run one after another on the graphics queue
+	VRaii<VkBuffer> mesh_visibility_buffer;
+	VRaii<VkDeviceMemory> mesh_visibility_buffer_memory;
+	// an offset per culling workgroup for compacting the shading list, shared the same way
+	VRaii<VkBuffer> drawn_group_offsets_buffer;
+	VRaii<VkDeviceMemory> drawn_group_offsets_buffer_memory;
+	VRaii<VkBuffer> mesh_culling_stats_buffer; // host visible, like the light culling counters
+	VRaii<VkDeviceMemory> mesh_culling_stats_buffer_memory;
+
+	// CPU frustum culling of the mesh parts while GPU culling doesn't cull them, see cullMeshParts().
+	// The parts each frame in flight draws, in the order of the model, every part when nothing culls them
+	bool cpu_culling_enabled = true;
+	std::array<std::vector<uint32_t>, MAX_FRAMES_IN_FLIGHT> frame_visible_parts;
+	size_t visible_part_count = 0; // of the last cullMeshParts()
+	size_t visible_triangle_count = 0;
+
+	// the order the depth prepass draws the mesh parts in, rebuilt every frame it's recorded by sortPrepassDraws():
+	// the occluders front to back followed by the other parts front to back. The shading pass keeps the order of the model,
+	// which groups the parts by material
+	bool draw_sorting_enabled = true;
+	std::vector<uint32_t> prepass_draw_order;
+	size_t prepass_occluder_count = 0; // of the last sort
+	// per frame in flight, host visible and persistently mapped: the draw commands in prepass_draw_order for indirect draws,
+	// the draw commands of the visible parts for the shading pass at shading_draws_offset,
+	// and prepass_draw_order itself at prepass_order_offset for GPU culling
+	std::array<VRaii<VkBuffer>, MAX_FRAMES_IN_FLIGHT> prepass_draw_buffers;
+	std::array<VRaii<VkDeviceMemory>, MAX_FRAMES_IN_FLIGHT> prepass_draw_buffer_memories;
+	std::array<void*, MAX_FRAMES_IN_FLIGHT> prepass_draw_buffer_data = {};
+	vk::DeviceSize shading_draws_offset = 0;
+	vk::DeviceSize prepass_order_offset = 0;
 
 	// texture image
 	VRaii<VkImage> texture_image;
@@ -174,21 +636,29 @@ private:
 	VRaii<VkImageView> normalmap_image_view;
 	VRaii<VkSampler> texture_sampler;
 
-	// uniform buffers
-	VRaii<VkBuffer> object_staging_buffer;
-	VRaii<VkDeviceMemory> object_staging_buffer_memory;
-	VRaii<VkBuffer> object_uniform_buffer;
-	VRaii<VkDeviceMemory> object_uniform_buffer_memory;
-	VRaii<VkBuffer> camera_staging_buffer;
-	VRaii<VkDeviceMemory> camera_staging_buffer_memory;
-	VRaii<VkBuffer> camera_uniform_buffer;
-	VRaii<VkDeviceMemory> camera_uniform_buffer_memory;
+	// per frame data: camera and object uniforms are read from the ring directly
+	VUploadRing upload_ring;
+	// light uploads are copied from their own ring, which is replaced when the light buffers grow
+	VUploadRing light_upload_ring;
+	uint32_t frames_in_flight = 2; // frames the CPU can record ahead of the GPU, also the number of upload ring regions
+	uint32_t frame_index = 0; // frame being written by the CPU
+	uint64_t frame_serial = 0; // frames begun so far
+	vk::DeviceSize camera_ring_offset = 0; // from the start of a frame region, the camera is allocated first
+	vk::DeviceSize object_ring_offset = 0; // and the scene object right after
 
 	VRaii<VkDescriptorPool> descriptor_pool;
+	// bindless materials: one material descriptor set for the whole model instead of one per mesh part
+	bool use_bindless_materials = false;
+	uint32_t bindless_texture_capacity = 0; // of the texture array in material_descriptor_set_layout
+	VRaii<vk::DescriptorPool> bindless_material_descriptor_pool;
+	vk::DescriptorSet bindless_material_descriptor_set;
+	bool use_indirect_draws = false; // every mesh part from the draw commands of the model instead of a draw call each
 	VkDescriptorSet object_descriptor_set;
 	vk::DescriptorSet camera_descriptor_set;
-	VkDescriptorSet light_culling_descriptor_set;
-	vk::DescriptorSet intermediate_descriptor_set;
+	// one per frame in flight, so that a frame can switch to grown light buffers while the others still use the old ones
+	std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> light_culling_descriptor_sets = {};
+	std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> light_update_descriptor_sets = {}; // the same layout, pointing at the light buffers rather than the snapshots
+	std::array<vk::DescriptorSet, MAX_FRAMES_IN_FLIGHT> intermediate_descriptor_sets = {}; // the frame's depth image
 
 	// vertex buffer
 	VModel model;
@@ -199,110 +669,446 @@ private:
 
 	VRaii<VkBuffer> pointlight_buffer;
 	VRaii<VkDeviceMemory> pointlight_buffer_memory;
-	VRaii<VkBuffer> lights_staging_buffer;
-	VRaii<VkDeviceMemory> lights_staging_buffer_memory;
 	VkDeviceSize pointlight_buffer_size;
+	VRaii<VkBuffer> spotlight_buffer;
+	VRaii<VkDeviceMemory> spotlight_buffer_memory;
+	VkDeviceSize spotlight_buffer_size;
+	VRaii<VkBuffer> light_velocity_buffer;
+	VRaii<VkDeviceMemory> light_velocity_buffer_memory;
+	VkDeviceSize light_velocity_buffer_size;
+	// the light buffers are replaced by bigger ones when the lights don't fit,
+	// each frame's descriptor set and command buffers are switched over once the frame comes around again
+	uint32_t light_buffer_generation = 0;
+	std::array<uint32_t, MAX_FRAMES_IN_FLIGHT> frame_light_buffer_generations = {};
+	uint32_t light_buffer_growth_count = 0;
+	std::vector<PendingBufferCopy> pending_light_buffer_copies; // recorded into this frame's light update before the uploads
+	std::vector<RetiredResources> retired_resources;
+	// light culling and shading of a frame read its own copy of the light buffers, taken after the light update,
+	// so the next frame's light update can already run on the compute queue while this frame is shading
+	std::array<VRaii<VkBuffer>, MAX_FRAMES_IN_FLIGHT> pointlight_snapshot_buffers;
+	std::array<VRaii<VkDeviceMemory>, MAX_FRAMES_IN_FLIGHT> pointlight_snapshot_buffer_memories;
+	std::array<VRaii<VkBuffer>, MAX_FRAMES_IN_FLIGHT> spotlight_snapshot_buffers;
+	std::array<VRaii<VkDeviceMemory>, MAX_FRAMES_IN_FLIGHT> spotlight_snapshot_buffer_memories;
+	std::array<VkDeviceSize, MAX_FRAMES_IN_FLIGHT> pointlight_snapshot_buffer_sizes = {};
+	std::array<VkDeviceSize, MAX_FRAMES_IN_FLIGHT> spotlight_snapshot_buffer_sizes = {};
+	uint64_t light_data_version = 1; // bumped whenever the light buffers change on the GPU
+	std::array<uint64_t, MAX_FRAMES_IN_FLIGHT> frame_light_snapshot_versions = {}; // light_data_version copied into each snapshot, 0 for none
 
 	std::vector<util::Vertex> vertices;
 	std::vector<uint32_t> vertex_indices;
 
-	std::vector<PointLight> pointlights;
+	PointLightStore pointlights;
+	std::vector<SpotLight> spotlights;
+	ThreadPool thread_pool; // splits the CPU light kernels and the mesh part recording into chunks
+	VThreadCommandPools thread_command_pools {vulkan_context, MAX_FRAMES_IN_FLIGHT, thread_pool.getThreadCount()};
+	ThreadPool* recording_thread_pool = &thread_pool; // swapped by the recording benchmark
+	double recording_ms = 0.0; // CPU time spent recording mesh parts, including waiting for the other threads
+	ThreadPool* pipeline_thread_pool = &thread_pool; // swapped by the pipeline cache benchmark
+	vk::PipelineCache pipeline_cache = vulkan_context.getPipelineCache(); // swapped by the pipeline cache benchmark
+	double pipeline_creation_ms = 0.0; // of the last createPipelines()
+	bool emulate_spot_lights = false;
+	bool gpu_light_animation = true;
+	bool lights_upload_pending = true; // the light buffers need a CPU upload, e.g. after creating lights
+	float light_update_delta_time = 0.0f; // > 0 when the light update pass has to run this frame
+	uint64_t uploaded_bytes = 0; // host to device bytes copied for per frame data
+	uint64_t uploaded_copy_regions = 0; // copy regions recorded for light uploads
+	std::vector<vk::BufferCopy> pending_pointlight_copies; // from the upload ring, recorded into this frame's light update
+	std::vector<vk::BufferCopy> pending_spotlight_copies;
+	vk::Buffer pending_pointlight_copy_source; // the upload ring buffer the copies were staged in
+	vk::Buffer pending_spotlight_copy_source;
+	// lights changed since the last upload, in the index space of the GPU buffers (emulated spot lights follow the point lights)
+	DirtyPageTracker pointlight_dirty_pages{ LIGHTS_PER_DIRTY_PAGE };
+	DirtyPageTracker spotlight_dirty_pages{ LIGHTS_PER_DIRTY_PAGE };
+	int uploaded_pointlight_count = -1; // light_num in the GPU buffer headers, -1 if they need to be written
+	int uploaded_spotlight_count = -1;
 
 	// This storage buffer stores visible lights for each tile
 	// which is output from the light culling compute shader
-	// max MAX_POINT_LIGHT_PER_TILE point lights per tile
-	VRaii<VkBuffer> light_visibility_buffer;
-	VRaii<VkDeviceMemory> light_visibility_buffer_memory;
+	// max max_point_light_per_tile point lights per tile, one per frame in flight
+	std::array<VRaii<VkBuffer>, MAX_FRAMES_IN_FLIGHT> light_visibility_buffers;
+	std::array<VRaii<VkDeviceMemory>, MAX_FRAMES_IN_FLIGHT> light_visibility_buffer_memories;
 	VkDeviceSize light_visibility_buffer_size = 0;
+	// same for spot lights, max max_spot_light_per_tile spot lights per tile
+	std::array<VRaii<VkBuffer>, MAX_FRAMES_IN_FLIGHT> spot_light_visibility_buffers;
+	std::array<VRaii<VkDeviceMemory>, MAX_FRAMES_IN_FLIGHT> spot_light_visibility_buffer_memories;
+	VkDeviceSize spot_light_visibility_buffer_size = 0;
+
+	// host visible light culling counters: overflow accounting, plus the stats mode ones
+	VRaii<VkBuffer> light_culling_stats_buffer;
+	VRaii<VkDeviceMemory> light_culling_stats_buffer_memory;
 
 	int window_framebuffer_width;
 	int window_framebuffer_height;
 
 	glm::mat4 view_matrix;
 	glm::vec3 cam_pos;
+	// lights the light buffers have room for, they grow when there are more
+	int point_light_capacity = 0;
+	int spot_light_capacity = 0;
+	// baked into the shaders as specialization constants
+	int tile_size = DEFAULT_TILE_SIZE;
+	int max_point_light_per_tile = 0;
+	int max_spot_light_per_tile = 0;
+	int light_culling_workgroup_size = DEFAULT_LIGHT_CULLING_WORKGROUP_SIZE;
+	LightCullingTest light_culling_test = LIGHT_CULLING_TEST_TWO_PHASE;
+	bool light_culling_stats_enabled = false;
+	bool hiz_depth_bounds_enabled = true; // only takes effect with use_hiz
+	bool use_subgroup_light_append = false; // picks the light culling shader variant rather than a specialization constant
+
 	int tile_count_per_row;
 	int tile_count_per_col;
 	int debug_view_index = 0;
 
+	// change tracking, so static frames can reuse the light culling results or be skipped entirely
+	CameraUbo last_camera_ubo = {};
+	bool camera_changed = true;
+	bool lights_changed = true;
+	// the depth prepass and the light visibility buffers of a frame match the current inputs,
+	// every frame in flight has its own visibility buffers so each of them has to cull once after a change
+	std::array<bool, MAX_FRAMES_IN_FLIGHT> frame_light_culling_results_valid = {};
+	bool frame_dirty = true; // something the shading pass uses changed, e.g. the swap chain
+	bool temporal_reuse_enabled = true; // turned off while measuring so every frame does all the work
+	bool light_animation_paused = false;
+	FrameSkipCounters frame_skip_counters;
+
+	// where the time of drawn frames went, see recordFramePacing()
+	FramePacingStats frame_pacing_stats;
+	std::chrono::high_resolution_clock::time_point frame_cpu_start_time;
+	float frame_fence_wait_ms = 0.0f; // of the frame being written by the CPU
+	std::array<bool, MAX_FRAMES_IN_FLIGHT> frame_timestamps_pending = {}; // submitted, timestamps not read back yet
+	std::array<bool, MAX_FRAMES_IN_FLIGHT> frame_light_culling_ran = {}; // the prepass and culling queries belong to the last submission
+	uint64_t frame_graph_barriers = 0; // pipeline barriers recorded between the passes by the frame graph so far
+
+	/**
+	* Forget the reusable results after recreating anything they depend on
+	*/
+	void invalidateFrameResults()
+	{
+		frame_light_culling_results_valid = {};
+		frame_dirty = true;
+	}
+
 	void initialize()
 	{
+		frames_in_flight = static_cast<uint32_t>(glm::clamp(getGlobalTestSceneConfiguration().frames_in_flight, 1, static_cast<int>(MAX_FRAMES_IN_FLIGHT)));
+		queue_family_transfers = vulkan_context.hasSeparateComputeFamily();
+		// with a single frame in flight the next frame would wait on the fence of the frame still waiting to be shaded
+		pipelined_shading = vulkan_context.hasAsyncCompute() && frames_in_flight >= 2;
+		use_frame_graph = getGlobalTestSceneConfiguration().frame_graph && !vulkan_context.hasAsyncCompute();
+		use_bindless_materials = getGlobalTestSceneConfiguration().bindless_materials && vulkan_context.supportsDescriptorIndexing();
+		if (getGlobalTestSceneConfiguration().bindless_materials && !use_bindless_materials)
+		{
+			std::cout << "Descriptor indexing is not supported, binding the material of every mesh part instead" << std::endl;
+		}
+		// the textures of the model have to fit into the bindless texture array, so the model comes first
+		createModel();
+		if (use_bindless_materials && model.getTextures().size() > chooseBindlessTextureCapacity())
+		{
+			std::cout << "The model has more textures than the bindless texture array can hold, binding the material of every mesh part instead" << std::endl;
+			use_bindless_materials = false;
+		}
+		// the classic materials are bound between the draws, so indirect draws need the bindless ones
+		use_indirect_draws = getGlobalTestSceneConfiguration().indirect_draws && use_bindless_materials && vulkan_context.supportsMultiDrawIndirect();
+		use_hiz = vulkan_context.supportsStorageImageExtendedFormats();
+		if (!use_hiz)
+		{
+			std::cout << "rg32f storage images are not supported, light culling reads the tile depth bounds from every depth sample" << std::endl;
+		}
+		// the culled draw lists are only as long as the count the culling wrote
+		use_gpu_culling = getGlobalTestSceneConfiguration().gpu_culling && use_indirect_draws && use_hiz && vulkan_context.supportsDrawIndirectCount();
+		if (getGlobalTestSceneConfiguration().gpu_culling && !use_gpu_culling)
+		{
+			std::cout << "GPU culling needs indirect draws, the Hi-Z pyramid and VK_KHR_draw_indirect_count, drawing every mesh part instead" << std::endl;
+		}
+		draw_sorting_enabled = getGlobalTestSceneConfiguration().draw_sorting;
+		cpu_culling_enabled = getGlobalTestSceneConfiguration().cpu_culling;
+		chooseSpecializationConstants();
 		createSwapChain();
 		createSwapChainImageViews();
 		createRenderPasses();
 		createDescriptorSetLayouts();
-		createGraphicsPipelines();
-		createComputePipeline();
+		createPipelines(true);
+		std::cout << "Pipelines created in " << pipeline_creation_ms << " ms from a "
+			<< (vulkan_context.isPipelineCacheLoaded() ? "warm" : "cold") << " pipeline cache" << std::endl;
 		createDepthResources();
 		createFrameBuffers();
 		createTextureSampler();
-		createUniformBuffers();
+		createHiZResources();
+		createTimestampQueryPool();
+		createPipelineStatisticsQueryPool();
 		createLights();
+		createLightBuffers();
+		createUniformBuffers();
+		createLightCullingStatsBuffer();
 		createDescriptorPool();
-		model = VModel::loadModelFromFile(vulkan_context, getGlobalTestSceneConfiguration().model_file, texture_sampler.get(), descriptor_pool.get(), material_descriptor_set_layout.get());
+		if (use_bindless_materials)
+		{
+			createBindlessMaterialDescriptorSet();
+		}
+		else
+		{
+			model.createMaterialDescriptorSets(vulkan_context, texture_sampler.get(), descriptor_pool.get(), material_descriptor_set_layout.get(), transfer_queue);
+		}
+		createPrepassDrawBuffers();
+		createMeshCullingResources();
 		createSceneObjectDescriptorSet();
 		createCameraDescriptorSet();
 		createIntermediateDescriptorSet();
 		updateIntermediateDescriptorSet();
 		createLigutCullingDescriptorSet();
 		createLightVisibilityBuffer(); // create a light visiblity buffer and update descriptor sets, need to rerun after changing size
-		createGraphicsCommandBuffers();
 		createLightCullingCommandBuffer();
 		createDepthPrePassCommandBuffer();
+		createLightUpdateCommandBuffer();
+		createFrameCommandBuffers();
 		createSemaphores();
 	}
 
+	/**
+	* Rebuild the pipelines and the per-tile buffers after changing a specialization constant
+	*/
+	void recreateSpecializedPipelines()
+	{
+		discardPendingShading();
+		vkDeviceWaitIdle(graphics_device);
+
+		createPipelines(false);
+		createLightVisibilityBuffer();
+		createLightCullingCommandBuffer();
+		invalidateFrameResults();
+	}
+
 	void recreateSwapChain()
 	{
+		discardPendingShading();
 		vkDeviceWaitIdle(graphics_device);
 
 		createSwapChain();
 		createSwapChainImageViews();
 		createRenderPasses();
-		createGraphicsPipelines();
+		createPipelines(false);
 		createDepthResources();
+		createHiZResources();
 		createFrameBuffers();
 		createLightVisibilityBuffer(); // since it's size will scale with window;
 		updateIntermediateDescriptorSet();
-		createGraphicsCommandBuffers();
+		updateMeshCullingDescriptorSets(); // the pyramids were recreated
 		createLightCullingCommandBuffer(); // it needs light_visibility_buffer_size, which is changed on resize
-		createDepthPrePassCommandBuffer();
+		invalidateFrameResults();
+	}
+
+	/**
+	* Create the graphics and light culling pipelines, and the light update, Hi-Z and mesh culling pipelines too if with_unspecialized,
+	* those don't depend on the specialization constants.
+	* The compute pipelines are created on the worker threads alongside the ones deriving from the main graphics pipeline
+	*/
+	void createPipelines(bool with_unspecialized)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		std::vector<std::function<void()>> compute_tasks = { [this]() { createComputePipeline(); } };
+		if (with_unspecialized)
+		{
+			compute_tasks.push_back([this]() { createLightUpdatePipeline(); });
+			if (use_hiz)
+			{
+				compute_tasks.push_back([this]() { createHiZPipeline(); });
+			}
+			if (use_gpu_culling)
+			{
+				compute_tasks.push_back([this]() { createMeshCullingPipeline(); });
+			}
+		}
+		createGraphicsPipelines(compute_tasks);
+
+		pipeline_creation_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 	}
 
+	void chooseSpecializationConstants();
+	uint32_t chooseBindlessTextureCapacity();
 	void createSwapChain();
 	void createSwapChainImageViews();
 	void createRenderPasses();
 	void createDescriptorSetLayouts();
-	void createGraphicsPipelines();
+	void createGraphicsPipelines(const std::vector<std::function<void()>>& independent_tasks);
 	void createDepthResources();
+	void createHiZResources();
 	void createFrameBuffers();
 	void createTextureSampler();
+	void createTimestampQueryPool();
+	void createPipelineStatisticsQueryPool();
 	void createUniformBuffers();
 	void createLights();
+	void addPointLights(size_t count);
+	void createLightBuffers();
+	void createFrameLightSnapshot(uint32_t frame);
+	void ensureLightBufferCapacity();
+	void switchFrameToCurrentLightBuffers(uint32_t frame);
+	void releaseRetiredResources();
+	void uploadLights();
+	void resizeLightDirtyPages();
+	void markPointLightsDirty(size_t first, size_t count);
+	void markSpotLightsDirty(size_t first, size_t count);
+	void writePointLights(size_t first, size_t count, PointLight* dst);
+	void createLightUpdatePipeline();
+	void createLightUpdateCommandBuffer();
+	void recordLightUpdateCommandBuffer(float delta_time);
+	void createLightCullingStatsBuffer();
 	void createDescriptorPool();
+	void createModel();
+	void createBindlessMaterialDescriptorSet();
+	void createPrepassDrawBuffers();
+	void createMeshCullingResources();
+	void updateMeshCullingDescriptorSets();
 	void createSceneObjectDescriptorSet();
 	void createCameraDescriptorSet();
 	void createIntermediateDescriptorSet();
 	void updateIntermediateDescriptorSet();
-	void createGraphicsCommandBuffers();
 	void createSemaphores();
 
 	void createComputePipeline();
+	void createHiZPipeline();
+	void createMeshCullingPipeline();
 	void createLigutCullingDescriptorSet();
 	void createLightVisibilityBuffer();
+	void updateLightCullingDescriptorSet(uint32_t frame);
 	void createLightCullingCommandBuffer();
+	void recordLightCullingCommandBuffer(uint32_t frame);
+	void recordQueueAcquireCommandBuffer(uint32_t frame);
 
 	void createDepthPrePassCommandBuffer();
+	void recordDepthPrePassCommandBuffer(uint32_t frame);
+	void recordShadingCommandBuffer(uint32_t frame, size_t image);
+	void createFrameCommandBuffers();
+
+	// the passes of a frame, recorded into a command buffer per submission or through the frame graph
+	void recordDepthPrePass(vk::CommandBuffer command, uint32_t frame);
+	void cullMeshParts(uint32_t frame);
+	void sortPrepassDraws(uint32_t frame);
+	void recordPrepassDraws(vk::CommandBuffer command, uint32_t frame, size_t first, size_t count);
+	void recordMeshCulling(vk::CommandBuffer command, uint32_t frame, int phase);
+	void bindModelBuffers(vk::CommandBuffer command);
+	void recordMeshPartDraws(vk::CommandBuffer command, uint32_t frame, size_t first, size_t count);
+	void recordCulledMeshPartDraws(vk::CommandBuffer command, uint32_t frame, uint32_t first_phase, uint32_t phase_count);
+	void recordMeshParts(vk::CommandBuffer command, uint32_t frame, vk::RenderPass render_pass, vk::Framebuffer framebuffer
+		, const std::function<void(vk::CommandBuffer, size_t first, size_t count)>& record_chunk);
+	void recordLightUpdate(vk::CommandBuffer command, float delta_time);
+	void recordHiZBuild(vk::CommandBuffer command, uint32_t frame);
+	void recordHiZLevels(vk::CommandBuffer command, uint32_t frame);
+	void recordLightCulling(vk::CommandBuffer command, uint32_t frame);
+	void recordShading(VkCommandBuffer command, uint32_t frame, size_t image);
+	FrameGraphResources addFrameGraphResources(VFrameGraph& graph, uint32_t frame, vk::ImageLayout depth_layout) const;
+	void addDepthPrePass(VFrameGraph& graph, const FrameGraphResources& resources, uint32_t frame);
+	void addLightUpdatePass(VFrameGraph& graph, const FrameGraphResources& resources, float delta_time);
+	void addHiZBuildPass(VFrameGraph& graph, const FrameGraphResources& resources, uint32_t frame);
+	void addLightCullingPass(VFrameGraph& graph, const FrameGraphResources& resources, uint32_t frame);
+	void addShadingPass(VFrameGraph& graph, const FrameGraphResources& resources, uint32_t frame, size_t image);
 
 	void updateUniformBuffers(float deltatime);
 	void drawFrame();
+	bool prepareLightSnapshot();
+	void submitLightCulling();
+	void submitShading(const ShadingSubmission& shading);
+	void submitFrameGraph(const ShadingSubmission& shading);
+	void presentImage(uint32_t frame, uint32_t image_index);
+	void submitToQueue(vk::Queue queue, uint32_t submit_count, const vk::SubmitInfo* submits, vk::Fence fence);
+	void submitPendingShading();
+	void discardShading(const ShadingSubmission& shading);
+	void discardPendingShading();
+
+	FrameTimings measureFrames(int warmup_frames, int measured_frames, bool read_stage_timings
+		, float delta_time = 0.0f, const std::function<void()>& before_frame = nullptr);
+	StageTimings measureStageTimings(int warmup_frames, int measured_frames);
+	StageTimings readStageTimings(uint32_t frame, bool light_culling_ran);
+	void recordFramePacing(uint32_t frame);
+	LightCullingStats readLightCullingStats();
+	MeshCullingStats readMeshCullingStats();
 
 	VRaii<VkShaderModule> createShaderModule(const std::vector<char>& code);
+
+	SpecializationConstants getSpecializationConstants() const
+	{
+		return {
+			tile_size,
+			static_cast<uint32_t>(max_point_light_per_tile),
+			static_cast<uint32_t>(light_culling_workgroup_size),
+			light_culling_test,
+			light_culling_stats_enabled ? VK_TRUE : VK_FALSE,
+			static_cast<uint32_t>(max_spot_light_per_tile),
+			use_hiz && hiz_depth_bounds_enabled ? VK_TRUE : VK_FALSE
+		};
+	}
+
+	bool isGpuCullingActive() const
+	{
+		// the culled lists are drawn as a whole, so the parts must be recorded as one chunk
+		return use_gpu_culling && gpu_culling_enabled && use_indirect_draws;
+	}
+
+	bool isCpuCullingActive() const
+	{
+		return cpu_culling_enabled && !isGpuCullingActive();
+	}
+
+	static uint32_t getTimestampQuery(uint32_t frame, TimestampQuery query)
+	{
+		return frame * TIMESTAMP_QUERY_COUNT + query;
+	}
+
+	/**
+	* Barriers on a frame's light visibility buffers, a queue family ownership transfer if the families differ
+	*/
+	std::array<vk::BufferMemoryBarrier, 2> getLightVisibilityBarriers(uint32_t frame, vk::AccessFlags src_access, vk::AccessFlags dst_access
+		, uint32_t src_queue_family = VK_QUEUE_FAMILY_IGNORED, uint32_t dst_queue_family = VK_QUEUE_FAMILY_IGNORED) const
+	{
+		return {
+			vk::BufferMemoryBarrier(src_access, dst_access, src_queue_family, dst_queue_family
+				, static_cast<vk::Buffer>(light_visibility_buffers[frame].get()), 0, light_visibility_buffer_size),
+			vk::BufferMemoryBarrier(src_access, dst_access, src_queue_family, dst_queue_family
+				, static_cast<vk::Buffer>(spot_light_visibility_buffers[frame].get()), 0, spot_light_visibility_buffer_size)
+		};
+	}
+
+	/**
+	* Queue family ownership transfer of a frame's depth image, which stays read only while light culling and shading use it
+	*/
+	vk::ImageMemoryBarrier getDepthOwnershipBarrier(uint32_t frame, vk::AccessFlags src_access, vk::AccessFlags dst_access
+		, uint32_t src_queue_family, uint32_t dst_queue_family) const
+	{
+		return vk::ImageMemoryBarrier(
+			src_access,  // srcAccessMask
+			dst_access,  // dstAccessMask
+			vk::ImageLayout::eDepthStencilReadOnlyOptimal,  // oldLayout
+			vk::ImageLayout::eDepthStencilReadOnlyOptimal,  // newLayout
+			src_queue_family,  // srcQueueFamilyIndex
+			dst_queue_family,  // dstQueueFamilyIndex
+			static_cast<vk::Image>(depth_images[frame].get()),  // image
+			vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1)  // subresourceRange
+		);
+	}
+
+	/**
+	* Barrier on every level of a frame's Hi-Z pyramid into the general layout it's built and read in
+	*/
+	vk::ImageMemoryBarrier getHiZBarrier(uint32_t frame, vk::AccessFlags src_access, vk::AccessFlags dst_access, vk::ImageLayout old_layout) const
+	{
+		return vk::ImageMemoryBarrier(
+			src_access,  // srcAccessMask
+			dst_access,  // dstAccessMask
+			old_layout,  // oldLayout
+			vk::ImageLayout::eGeneral,  // newLayout
+			VK_QUEUE_FAMILY_IGNORED,  // srcQueueFamilyIndex
+			VK_QUEUE_FAMILY_IGNORED,  // dstQueueFamilyIndex
+			static_cast<vk::Image>(hiz_images[frame].get()),  // image
+			vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, hiz_level_count, 0, 1)  // subresourceRange
+		);
+	}
 };
 
 
 
 _VulkanRenderer_Impl::_VulkanRenderer_Impl(GLFWwindow* window)
-	:vulkan_context(window)
+	:vulkan_context(window, getGlobalTestSceneConfiguration().async_compute)
 {
 
 	queue_family_indices = vulkan_context.getQueueFamilyIndices();
@@ -331,12 +1137,13 @@ void _VulkanRenderer_Impl::resize(int width, int height)
 
 void _VulkanRenderer_Impl::requestDraw(float deltatime)
 {
-	updateUniformBuffers(deltatime); // TODO: there is graphics queue waiting in utility.copyBuffer() called by this so I don't need to sync CPU and GPU elsewhere... but someday I will make the copy command able to use multiple times and I need to sync on writing the staging buffer
+	updateUniformBuffers(deltatime); // waits for the frame's fence, the other frames in flight keep the GPU busy meanwhile
 	drawFrame();
 }
 
 void _VulkanRenderer_Impl::cleanUp()
 {
+	discardPendingShading();
 	vkDeviceWaitIdle(graphics_device);
 }
 
@@ -346,6 +1153,50 @@ void _VulkanRenderer_Impl::setCamera(const glm::mat4 & view, const glm::vec3 cam
 	this->cam_pos = campos;
 }
 
+/**
+* The size of the bindless texture array. It is update after bind when the device allows, whose limits are far higher on some devices
+*/
+uint32_t _VulkanRenderer_Impl::chooseBindlessTextureCapacity()
+{
+	// the depth sampler of the intermediate set counts against the same limits, its Hi-Z pyramid only against the pipeline layout one
+	if (vulkan_context.supportsSampledImageUpdateAfterBind())
+	{
+		const auto& properties = vulkan_context.getDescriptorIndexingProperties();
+		bindless_texture_capacity = std::min({ MAX_BINDLESS_TEXTURES, properties.maxPerStageDescriptorUpdateAfterBindSampledImages - 1
+			, properties.maxDescriptorSetUpdateAfterBindSampledImages - 2 });
+	}
+	else
+	{
+		const auto& limits = vulkan_context.getPhysicalDeviceProperties().limits;
+		bindless_texture_capacity = std::min({ MAX_BINDLESS_TEXTURES, limits.maxPerStageDescriptorSampledImages - 1, limits.maxDescriptorSetSampledImages - 2 });
+	}
+	return bindless_texture_capacity;
+}
+
+/**
+* Pick light capacities and the light culling workgroup shape for the current device and scene
+*/
+void _VulkanRenderer_Impl::chooseSpecializationConstants()
+{
+	const auto& scene = getGlobalTestSceneConfiguration();
+
+	// the light buffers start out with room for the lights of this scene and grow if more are added,
+	// spot lights also take point light slots when they are emulated with point lights
+	point_light_capacity = std::max(1, scene.light_num + scene.spot_light_num);
+	spot_light_capacity = std::max(1, scene.spot_light_num);
+	emulate_spot_lights = scene.emulate_spot_lights;
+
+	// a tile can never see more lights than the scene has
+	max_point_light_per_tile = std::max(1, std::min(scene.max_point_light_per_tile, point_light_capacity));
+	max_spot_light_per_tile = std::min(DEFAULT_MAX_SPOT_LIGHT_PER_TILE, spot_light_capacity);
+
+	const auto& limits = vulkan_context.getPhysicalDeviceProperties().limits;
+	auto max_workgroup_size = static_cast<int>(std::min(limits.maxComputeWorkGroupSize[0], limits.maxComputeWorkGroupInvocations));
+	light_culling_workgroup_size = std::min(light_culling_workgroup_size, max_workgroup_size);
+
+	use_subgroup_light_append = vulkan_context.supportsComputeSubgroupBallot();
+}
+
 void _VulkanRenderer_Impl::createSwapChain()
 {
 	auto support_details = SwapChainSupportDetails::querySwapChainSupport(physical_device, vulkan_context.getWindowSurface());
@@ -448,9 +1299,9 @@ void _VulkanRenderer_Impl::createRenderPasses()
 		depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE; //TODO?
 		depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		depth_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		// the frame graph transitions it into the attachment layout and on to read only for light culling and shading
 		depth_attachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-		//depth_attachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;  // to be read in compute shader?
-		depth_attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;  // to be read in compute shader?
+		depth_attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
 
 		VkAttachmentReference depth_attachment_ref = {};
@@ -462,15 +1313,6 @@ void _VulkanRenderer_Impl::createRenderPasses()
 		subpass.colorAttachmentCount = 0;
 		subpass.pDepthStencilAttachment = &depth_attachment_ref;
 
-		// overwrite subpass dependency to make it wait until VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
-		VkSubpassDependency dependency = {};
-		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-		dependency.dstSubpass = 0; // 0  refers to the subpass
-		dependency.srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-		dependency.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
 		std::array<VkAttachmentDescription, 1> attachments = {  depth_attachment };
 
 		VkRenderPassCreateInfo render_pass_info = {};
@@ -479,8 +1321,8 @@ void _VulkanRenderer_Impl::createRenderPasses()
 		render_pass_info.pAttachments = attachments.data();
 		render_pass_info.subpassCount = 1;
 		render_pass_info.pSubpasses = &subpass;
-		render_pass_info.dependencyCount = 1;
-		render_pass_info.pDependencies = &dependency;
+		render_pass_info.dependencyCount = 0; // the frame graph records the barriers around the pass
+		render_pass_info.pDependencies = nullptr;
 
 		VkRenderPass pass;
 		if (vkCreateRenderPass(graphics_device, &render_pass_info, nullptr, &pass) != VK_SUCCESS)
@@ -489,6 +1331,13 @@ void _VulkanRenderer_Impl::createRenderPasses()
 		}
 		depth_pre_pass = VRaii<vk::RenderPass>(pass,renderpass_deletef);
 
+		// the second culling phase adds its parts to the depth of the first, see recordDepthPrePass()
+		if (use_gpu_culling)
+		{
+			depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+			vulkan_util::checkResult(vkCreateRenderPass(graphics_device, &render_pass_info, nullptr, &pass), "failed to create depth pre-pass!");
+			depth_pre_pass_load = VRaii<vk::RenderPass>(pass, renderpass_deletef);
+		}
 	}
 	// the render pass
 	{
@@ -499,18 +1348,19 @@ void _VulkanRenderer_Impl::createRenderPasses()
 		color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE; // after rendering
 		color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE; // no stencil
 		color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; // to be directly used in swap chain
+		// the frame graph transitions the swap chain image from and back to presenting, see addShadingPass()
+		color_attachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		color_attachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
 		VkAttachmentDescription depth_attachment = {};
 		depth_attachment.format = utility.findDepthFormat();
 		depth_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
 		depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
-		depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE; // kept for the next frames reusing this frame's depth prepass
 		depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		depth_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 		depth_attachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
-		depth_attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		depth_attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
 
 		VkAttachmentReference color_attachment_ref = {};
 		color_attachment_ref.attachment = 0;
@@ -526,15 +1376,6 @@ void _VulkanRenderer_Impl::createRenderPasses()
 		subpass.pColorAttachments = &color_attachment_ref;
 		subpass.pDepthStencilAttachment = &depth_attachment_ref;
 
-		// overwrite subpass dependency to make it wait until VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
-		VkSubpassDependency dependency = {};
-		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-		dependency.dstSubpass = 0; // 0  refers to the subpass
-		dependency.srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-		dependency.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
 		std::array<VkAttachmentDescription, 2> attachments = { color_attachment, depth_attachment };
 
 		VkRenderPassCreateInfo render_pass_info = {};
@@ -543,8 +1384,8 @@ void _VulkanRenderer_Impl::createRenderPasses()
 		render_pass_info.pAttachments = attachments.data();
 		render_pass_info.subpassCount = 1;
 		render_pass_info.pSubpasses = &subpass;
-		render_pass_info.dependencyCount = 1;
-		render_pass_info.pDependencies = &dependency;
+		render_pass_info.dependencyCount = 0; // the frame graph records the barriers around the pass
+		render_pass_info.pDependencies = nullptr;
 
 		VkRenderPass tmp_render_pass;
 		if (vkCreateRenderPass(graphics_device, &render_pass_info, nullptr, &tmp_render_pass) != VK_SUCCESS)
@@ -569,7 +1410,7 @@ void _VulkanRenderer_Impl::createDescriptorSetLayouts()
 		// create descriptor for uniform buffer objects
 		VkDescriptorSetLayoutBinding ubo_layout_binding = {};
 		ubo_layout_binding.binding = 0;
-		ubo_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		ubo_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC; // lives in the upload ring
 		ubo_layout_binding.descriptorCount = 1;
 		ubo_layout_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT; // only referencing from vertex shader
 		// VK_SHADER_STAGE_ALL_GRAPHICS
@@ -594,7 +1435,7 @@ void _VulkanRenderer_Impl::createDescriptorSetLayouts()
 	{
 		vk::DescriptorSetLayoutBinding ubo_layout_binding = {
 			0,  // binding
-			vk::DescriptorType::eStorageBuffer,  // descriptorType // FIXME: change back to uniform
+			vk::DescriptorType::eStorageBufferDynamic,  // descriptorType, lives in the upload ring // FIXME: change back to uniform
 			1,  // descriptorCount
 			vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute, // stagFlags
 			nullptr, // pImmutableSamplers
@@ -638,16 +1479,60 @@ void _VulkanRenderer_Impl::createDescriptorSetLayouts()
 			set_layout_bindings.push_back(lb);
 		}
 
-		VkDescriptorSetLayoutCreateInfo layout_info = {};
-		layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-		layout_info.bindingCount = static_cast<uint32_t>(set_layout_bindings.size());
-		layout_info.pBindings = set_layout_bindings.data();
+		{
+			// storage buffer for light culling stats
+			VkDescriptorSetLayoutBinding lb = {};
+			lb.binding = 2;
+			lb.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			lb.descriptorCount = 1;
+			lb.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+			lb.pImmutableSamplers = nullptr;
+			set_layout_bindings.push_back(lb);
+		}
 
-		light_culling_descriptor_set_layout = VRaii<vk::DescriptorSetLayout>(
-			device.createDescriptorSetLayout(layout_info, nullptr),
-			raii_layout_deleter
-		);
-	}
+		{
+			// storage buffer for spot lights
+			VkDescriptorSetLayoutBinding lb = {};
+			lb.binding = 3;
+			lb.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			lb.descriptorCount = 1;
+			lb.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+			lb.pImmutableSamplers = nullptr;
+			set_layout_bindings.push_back(lb);
+		}
+
+		{
+			// storage buffer for spot light culling results
+			VkDescriptorSetLayoutBinding lb = {};
+			lb.binding = 4;
+			lb.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			lb.descriptorCount = 1;
+			lb.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+			lb.pImmutableSamplers = nullptr;
+			set_layout_bindings.push_back(lb);
+		}
+
+		{
+			// storage buffer for light velocities, read by the light update pass
+			VkDescriptorSetLayoutBinding lb = {};
+			lb.binding = 5;
+			lb.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			lb.descriptorCount = 1;
+			lb.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+			lb.pImmutableSamplers = nullptr;
+			set_layout_bindings.push_back(lb);
+		}
+
+		VkDescriptorSetLayoutCreateInfo layout_info = {};
+		layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layout_info.bindingCount = static_cast<uint32_t>(set_layout_bindings.size());
+		layout_info.pBindings = set_layout_bindings.data();
+
+		light_culling_descriptor_set_layout = VRaii<vk::DescriptorSetLayout>(
+			device.createDescriptorSetLayout(layout_info, nullptr),
+			raii_layout_deleter
+		);
+	}
 
 	// descriptor set layout for intermediate objects during render passes, such as z-buffer
 	{
@@ -661,10 +1546,20 @@ void _VulkanRenderer_Impl::createDescriptorSetLayouts()
 			nullptr, // pImmutableSamplers
 		};
 
+		// the Hi-Z pyramid for the tile depth bounds, the depth image again without it
+		vk::DescriptorSetLayoutBinding hiz_layout_binding = {
+			1, // binding
+			vk::DescriptorType::eCombinedImageSampler, // descriptorType
+			1, // descriptoCount
+			vk::ShaderStageFlagBits::eCompute,  //stageFlags
+			nullptr, // pImmutableSamplers
+		};
+
+		std::array<vk::DescriptorSetLayoutBinding, 2> bindings = { sampler_layout_binding, hiz_layout_binding };
 		vk::DescriptorSetLayoutCreateInfo create_info = {
 			vk::DescriptorSetLayoutCreateFlags(), // flags
-			1,
-			&sampler_layout_binding,
+			static_cast<uint32_t>(bindings.size()),
+			bindings.data(),
 		};
 
 		intermediate_descriptor_set_layout = VRaii<vk::DescriptorSetLayout>(
@@ -673,7 +1568,91 @@ void _VulkanRenderer_Impl::createDescriptorSetLayouts()
 		);
 	}
 
+	// Hi-Z build: the level above, or the depth image, and the level to write
+	if (use_hiz)
+	{
+		std::array<vk::DescriptorSetLayoutBinding, 2> bindings = {
+			vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eCompute, nullptr), // source
+			vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute, nullptr) // destination
+		};
+
+		vk::DescriptorSetLayoutCreateInfo create_info = {
+			vk::DescriptorSetLayoutCreateFlags(), // flags
+			static_cast<uint32_t>(bindings.size()),
+			bindings.data()
+		};
+
+		hiz_descriptor_set_layout = VRaii<vk::DescriptorSetLayout>(
+			device.createDescriptorSetLayout(create_info, nullptr),
+			raii_layout_deleter
+		);
+	}
+
+	// mesh culling: the bounds and draw commands of the parts, the culled draw lists, the visibility of the parts,
+	// the counters, the Hi-Z pyramid, the depth prepass order and the offsets of the shading list compaction,
+	// see mesh_culling.comp.glsl. The camera is bound with its own set
+	if (use_gpu_culling)
+	{
+		std::array<vk::DescriptorSetLayoutBinding, 8> bindings = {
+			vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute, nullptr), // part bounds
+			vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute, nullptr), // part draws
+			vk::DescriptorSetLayoutBinding(2, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute, nullptr), // culled draws
+			vk::DescriptorSetLayoutBinding(3, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute, nullptr), // part visibility
+			vk::DescriptorSetLayoutBinding(4, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute, nullptr), // stats
+			vk::DescriptorSetLayoutBinding(5, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eCompute, nullptr), // Hi-Z pyramid
+			vk::DescriptorSetLayoutBinding(6, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute, nullptr), // part order
+			vk::DescriptorSetLayoutBinding(7, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute, nullptr) // drawn group offsets
+		};
+
+		vk::DescriptorSetLayoutCreateInfo create_info = {
+			vk::DescriptorSetLayoutCreateFlags(), // flags
+			static_cast<uint32_t>(bindings.size()),
+			bindings.data()
+		};
+
+		mesh_culling_descriptor_set_layout = VRaii<vk::DescriptorSetLayout>(
+			device.createDescriptorSetLayout(create_info, nullptr),
+			raii_layout_deleter
+		);
+	}
+
+	// bindless material layout: every material in a storage buffer and every texture of the model in one array,
+	// the array is allocated with the texture count of the model and the textures are sampled with the one sampler
+	if (use_bindless_materials)
+	{
+		// bindless_texture_capacity was chosen before loading the model
+		VkDescriptorBindingFlagsEXT update_after_bind = vulkan_context.supportsSampledImageUpdateAfterBind() ? VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT : 0;
+
+		std::array<vk::DescriptorSetLayoutBinding, 3> bindings = {
+			vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eFragment, nullptr), // materials
+			vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eSampler, 1, vk::ShaderStageFlagBits::eFragment, nullptr), // texture sampler
+			vk::DescriptorSetLayoutBinding(2, vk::DescriptorType::eSampledImage, bindless_texture_capacity, vk::ShaderStageFlagBits::eFragment, nullptr) // textures
+		};
+		std::array<VkDescriptorBindingFlagsEXT, 3> binding_flags = {
+			0,
+			0,
+			VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT_EXT | update_after_bind
+		};
+
+		VkDescriptorSetLayoutBindingFlagsCreateInfoEXT binding_flags_info = {};
+		binding_flags_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+		binding_flags_info.bindingCount = static_cast<uint32_t>(binding_flags.size());
+		binding_flags_info.pBindingFlags = binding_flags.data();
+
+		vk::DescriptorSetLayoutCreateInfo create_info = {
+			update_after_bind ? vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPoolEXT : vk::DescriptorSetLayoutCreateFlags(), // flags
+			static_cast<uint32_t>(bindings.size()),
+			bindings.data()
+		};
+		create_info.pNext = &binding_flags_info;
+
+		material_descriptor_set_layout = VRaii<vk::DescriptorSetLayout>(
+			device.createDescriptorSetLayout(create_info, nullptr),
+			raii_layout_deleter
+		);
+	}
 	// material_descriptror_layout // TODO: maybe I still need to do for each instance
+	else
 	{
 		// reads from depth attachment of previous frame
 		// descriptor for texture sampler
@@ -718,7 +1697,10 @@ void _VulkanRenderer_Impl::createDescriptorSetLayouts()
 }
 
 
-void _VulkanRenderer_Impl::createGraphicsPipelines()
+/**
+* independent_tasks create pipelines which don't use the graphics ones, they run on the worker threads with the derived pipelines
+*/
+void _VulkanRenderer_Impl::createGraphicsPipelines(const std::vector<std::function<void()>>& independent_tasks)
 {
 
 	auto raii_pipeline_layout_deleter = [device = this->device](auto & obj)
@@ -733,7 +1715,7 @@ void _VulkanRenderer_Impl::createGraphicsPipelines()
 	// create main pipeline
 	{
 		auto vert_shader_code = util::readFile(util::getContentPath("forwardplus_vert.spv"));
-		auto frag_shader_code = util::readFile(util::getContentPath("forwardplus_frag.spv"));
+		auto frag_shader_code = util::readFile(util::getContentPath(use_bindless_materials ? "forwardplus_bindless_frag.spv" : "forwardplus_frag.spv"));
 		// auto light_culling_comp_shader_code = util::readFile(util::getContentPath("light_culling.comp.spv"));
 
 
@@ -754,6 +1736,16 @@ void _VulkanRenderer_Impl::createGraphicsPipelines()
 		frag_shader_stage_info.module = frag_shader_module.get();
 		frag_shader_stage_info.pName = "main";
 
+		auto specialization_data = getSpecializationConstants();
+		auto specialization_entries = SpecializationConstants::getMapEntries();
+		vk::SpecializationInfo specialization_info = {
+			static_cast<uint32_t>(specialization_entries.size()), // mapEntryCount
+			specialization_entries.data(), // pMapEntries
+			sizeof(specialization_data), // dataSize
+			&specialization_data // pData
+		};
+		frag_shader_stage_info.pSpecializationInfo = &static_cast<const VkSpecializationInfo&>(specialization_info);
+
 		VkPipelineShaderStageCreateInfo shaderStages[] = { vert_shader_stage_info, frag_shader_stage_info };
 
 		// vertex data info
@@ -901,72 +1893,109 @@ void _VulkanRenderer_Impl::createGraphicsPipelines()
 		pipelineInfo.flags = VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT;
 
 		VkPipeline temp_pipeline;
-		auto pipeline_result = vkCreateGraphicsPipelines(graphics_device, VK_NULL_HANDLE, 1
+		auto pipeline_result = vkCreateGraphicsPipelines(graphics_device, pipeline_cache, 1
 			, &pipelineInfo, nullptr, &temp_pipeline);
-		graphics_pipeline = VRaii<VkPipeline>(temp_pipeline, raii_pipeline_deleter);
+		graphics_pipelines[0] = VRaii<VkPipeline>(temp_pipeline, raii_pipeline_deleter);
 
 		if (pipeline_result != VK_SUCCESS)
 		{
 			throw std::runtime_error("failed to create graphics pipeline!");
 		}
 
-		//-------------------------------------depth prepass pipeline ------------------------------------------------
+		// the pipelines deriving from the main one are created in parallel, each task with its own create info
+		std::vector<std::function<void()>> tasks = independent_tasks;
 
+		// the debug views are compiled as separate variants so the render view has no branches for them
+		std::array<VRaii<VkShaderModule>, DEBUG_VIEW_COUNT> debug_frag_shader_modules;
+		for (int view = 1; view < DEBUG_VIEW_COUNT; view++)
 		{
+			auto debug_frag_shader_code = util::readFile(util::getContentPath(
+				std::string(use_bindless_materials ? "forwardplus_bindless_debug" : "forwardplus_debug") + std::to_string(view) + "_frag.spv"));
+			debug_frag_shader_modules[view] = createShaderModule(debug_frag_shader_code);
 
-			VkPipelineDepthStencilStateCreateInfo pre_pass_depth_stencil = { depth_stencil };
-			pre_pass_depth_stencil.depthCompareOp = VK_COMPARE_OP_LESS;
-			pre_pass_depth_stencil.depthWriteEnable = VK_TRUE;
+			tasks.push_back([&, view]()
+			{
+				VkPipelineShaderStageCreateInfo debug_shader_stages[] = { shaderStages[0], shaderStages[1] };
+				debug_shader_stages[1].module = debug_frag_shader_modules[view].get();
+
+				VkGraphicsPipelineCreateInfo debug_pipeline_info = pipelineInfo;
+				debug_pipeline_info.pStages = debug_shader_stages;
+				debug_pipeline_info.basePipelineHandle = graphics_pipelines[0].get();
+				debug_pipeline_info.flags = VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+
+				VkPipeline debug_pipeline;
+				vulkan_util::checkResult(vkCreateGraphicsPipelines(graphics_device, pipeline_cache, 1
+					, &debug_pipeline_info, nullptr, &debug_pipeline), "failed to create debug view pipeline!");
+				graphics_pipelines[view] = VRaii<VkPipeline>(debug_pipeline, raii_pipeline_deleter);
+			});
+		}
 
-			auto depth_vert_shader_code = util::readFile(util::getContentPath("depth_vert.spv"));
-			// auto light_culling_comp_shader_code = util::readFile(util::getContentPath("light_culling.comp.spv"));
-			auto depth_vert_shader_module = createShaderModule(depth_vert_shader_code);
-			VkPipelineShaderStageCreateInfo depth_vert_shader_stage_info = {};
-			depth_vert_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-			depth_vert_shader_stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
-			depth_vert_shader_stage_info.module = depth_vert_shader_module.get();
-			depth_vert_shader_stage_info.pName = "main";
-			VkPipelineShaderStageCreateInfo depth_shader_stages[] = { depth_vert_shader_stage_info };
+		//-------------------------------------depth prepass pipeline ------------------------------------------------
 
-			std::array<vk::DescriptorSetLayout, 2> depth_set_layouts = { object_descriptor_set_layout.get(), camera_descriptor_set_layout.get() };
+		VkPipelineDepthStencilStateCreateInfo pre_pass_depth_stencil = { depth_stencil };
+		pre_pass_depth_stencil.depthCompareOp = VK_COMPARE_OP_LESS;
+		pre_pass_depth_stencil.depthWriteEnable = VK_TRUE;
 
-			vk::PipelineLayoutCreateInfo depth_layout_info = {
-				vk::PipelineLayoutCreateFlags(),  // flags
-				static_cast<uint32_t>(depth_set_layouts.size()),  // setLayoutCount
-				depth_set_layouts.data(),  // setlayouts
-				0,  // pushConstantRangeCount
-				nullptr // pushConstantRanges
-			};
-			depth_pipeline_layout = VRaii<vk::PipelineLayout>(
-				device.createPipelineLayout(depth_layout_info, nullptr),
-				raii_pipeline_layout_deleter
-				);
-
-			VkGraphicsPipelineCreateInfo depth_pipeline_info = {};
-			depth_pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-			depth_pipeline_info.stageCount = 1;
-			depth_pipeline_info.pStages = depth_shader_stages;
-
-			depth_pipeline_info.pVertexInputState = &vertex_input_info;
-			depth_pipeline_info.pInputAssemblyState = &input_assembly_info;
-			depth_pipeline_info.pViewportState = &viewport_state_info;
-			depth_pipeline_info.pRasterizationState = &rasterizer;
-			depth_pipeline_info.pMultisampleState = &multisampling;
-			depth_pipeline_info.pDepthStencilState = &pre_pass_depth_stencil;
-			depth_pipeline_info.pColorBlendState = nullptr;
-			depth_pipeline_info.pDynamicState = nullptr; // Optional
-			depth_pipeline_info.layout = depth_pipeline_layout.get();
-			depth_pipeline_info.renderPass = depth_pre_pass.get();
-			depth_pipeline_info.subpass = 0;
-			depth_pipeline_info.basePipelineHandle = graphics_pipeline.get(); // not deriving from existing pipeline
-			depth_pipeline_info.basePipelineIndex = -1; // Optional
-			depth_pipeline_info.flags = VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+		auto depth_vert_shader_code = util::readFile(util::getContentPath("depth_vert.spv"));
+		// auto light_culling_comp_shader_code = util::readFile(util::getContentPath("light_culling.comp.spv"));
+		auto depth_vert_shader_module = createShaderModule(depth_vert_shader_code);
+		VkPipelineShaderStageCreateInfo depth_vert_shader_stage_info = {};
+		depth_vert_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		depth_vert_shader_stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
+		depth_vert_shader_stage_info.module = depth_vert_shader_module.get();
+		depth_vert_shader_stage_info.pName = "main";
+		VkPipelineShaderStageCreateInfo depth_shader_stages[] = { depth_vert_shader_stage_info };
+
+		std::array<vk::DescriptorSetLayout, 2> depth_set_layouts = { object_descriptor_set_layout.get(), camera_descriptor_set_layout.get() };
+
+		vk::PipelineLayoutCreateInfo depth_layout_info = {
+			vk::PipelineLayoutCreateFlags(),  // flags
+			static_cast<uint32_t>(depth_set_layouts.size()),  // setLayoutCount
+			depth_set_layouts.data(),  // setlayouts
+			0,  // pushConstantRangeCount
+			nullptr // pushConstantRanges
+		};
+		depth_pipeline_layout = VRaii<vk::PipelineLayout>(
+			device.createPipelineLayout(depth_layout_info, nullptr),
+			raii_pipeline_layout_deleter
+			);
 
+		VkGraphicsPipelineCreateInfo depth_pipeline_info = {};
+		depth_pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		depth_pipeline_info.stageCount = 1;
+		depth_pipeline_info.pStages = depth_shader_stages;
+
+		depth_pipeline_info.pVertexInputState = &vertex_input_info;
+		depth_pipeline_info.pInputAssemblyState = &input_assembly_info;
+		depth_pipeline_info.pViewportState = &viewport_state_info;
+		depth_pipeline_info.pRasterizationState = &rasterizer;
+		depth_pipeline_info.pMultisampleState = &multisampling;
+		depth_pipeline_info.pDepthStencilState = &pre_pass_depth_stencil;
+		depth_pipeline_info.pColorBlendState = nullptr;
+		depth_pipeline_info.pDynamicState = nullptr; // Optional
+		depth_pipeline_info.layout = depth_pipeline_layout.get();
+		depth_pipeline_info.renderPass = depth_pre_pass.get();
+		depth_pipeline_info.subpass = 0;
+		depth_pipeline_info.basePipelineHandle = graphics_pipelines[0].get(); // not deriving from existing pipeline
+		depth_pipeline_info.basePipelineIndex = -1; // Optional
+		depth_pipeline_info.flags = VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+
+		tasks.push_back([&]()
+		{
 			depth_pipeline = VRaii<vk::Pipeline>(
-				device.createGraphicsPipeline(vk::PipelineCache(), depth_pipeline_info, nullptr).value,
+				device.createGraphicsPipeline(pipeline_cache, depth_pipeline_info, nullptr).value,
 				raii_pipeline_deleter
 			);
-		}
+		});
+
+		// the pipeline cache is internally synchronized, so the tasks only share read only state
+		pipeline_thread_pool->parallelFor(tasks.size(), 1, [&](size_t first, size_t count)
+		{
+			for (size_t i = first; i < first + count; i++)
+			{
+				tasks[i]();
+			}
+		});
 	}
 }
 
@@ -977,14 +2006,15 @@ void _VulkanRenderer_Impl::createFrameBuffers()
 		device.destroyFramebuffer(obj);
 	};
 
-	// swap chain frame buffers
+	// swap chain frame buffers, frame by frame then image by image like the command buffers
 	{
 		swap_chain_framebuffers.clear(); // VDeleter will delete old objects
-		swap_chain_framebuffers.reserve(swap_chain_imageviews.size());
+		swap_chain_framebuffers.reserve(swap_chain_imageviews.size() * frames_in_flight);
 
-		for (size_t i = 0; i < swap_chain_imageviews.size(); i++)
+		for (size_t i = 0; i < swap_chain_imageviews.size() * frames_in_flight; i++)
 		{
-			std::array<VkImageView, 2> attachments = { swap_chain_imageviews[i].get(), depth_image_view.get() };
+			auto frame = i / swap_chain_imageviews.size();
+			std::array<VkImageView, 2> attachments = { swap_chain_imageviews[i % swap_chain_imageviews.size()].get(), depth_image_views[frame].get() };
 
 			VkFramebufferCreateInfo framebuffer_info = {};
 			framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
@@ -1002,9 +2032,10 @@ void _VulkanRenderer_Impl::createFrameBuffers()
 		}
 	}
 
-	// depth pass frame buffer
+	// depth pass frame buffers
+	for (uint32_t frame = 0; frame < frames_in_flight; frame++)
 	{
-		std::array<VkImageView, 1> attachments = { depth_image_view.get() };
+		std::array<VkImageView, 1> attachments = { depth_image_views[frame].get() };
 
 		VkFramebufferCreateInfo framebuffer_info = {};
 		framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
@@ -1015,7 +2046,7 @@ void _VulkanRenderer_Impl::createFrameBuffers()
 		framebuffer_info.height = swap_chain_extent.height;
 		framebuffer_info.layers = 1;
 
-		depth_pre_pass_framebuffer = VRaii<vk::Framebuffer>(
+		depth_pre_pass_framebuffers[frame] = VRaii<vk::Framebuffer>(
 			device.createFramebuffer(framebuffer_info, nullptr),
 			raii_framebuffer_deleter
 		);
@@ -1028,14 +2059,126 @@ void _VulkanRenderer_Impl::createDepthResources()
 	VkFormat depth_format = utility.findDepthFormat();
 
 	// for depth pre pass and output as texture
-	std::tie(depth_image, depth_image_memory) = utility.createImage(swap_chain_extent.width, swap_chain_extent.height
-		, depth_format
-		, VK_IMAGE_TILING_OPTIMAL
-		//, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT  // TODO: if creating another depth image for prepass use, use this only for rendering depth image
-		, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
-		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	depth_image_view = utility.createImageView(depth_image.get(), depth_format, VK_IMAGE_ASPECT_DEPTH_BIT);
-	utility.transitImageLayout(depth_image.get(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+	for (uint32_t frame = 0; frame < frames_in_flight; frame++)
+	{
+		std::tie(depth_images[frame], depth_image_memories[frame]) = utility.createImage(swap_chain_extent.width, swap_chain_extent.height
+			, depth_format
+			, VK_IMAGE_TILING_OPTIMAL
+			//, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT  // TODO: if creating another depth image for prepass use, use this only for rendering depth image
+			, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		depth_image_views[frame] = utility.createImageView(depth_images[frame].get(), depth_format, VK_IMAGE_ASPECT_DEPTH_BIT);
+		utility.transitImageLayout(depth_images[frame].get(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+	}
+}
+
+/**
+* Create or recreate the Hi-Z pyramid of every frame in flight for the swap chain extent, with the descriptor sets building it.
+* It's rebuilt from scratch every frame, so it's left in the undefined layout here. The GPU must be idle
+*/
+void _VulkanRenderer_Impl::createHiZResources()
+{
+	if (!use_hiz)
+	{
+		return;
+	}
+
+	// level 0 halves the extent, each level halves the one above rounding down, down to 1x1
+	uint32_t level0_width = std::max(swap_chain_extent.width / 2, 1u);
+	uint32_t level0_height = std::max(swap_chain_extent.height / 2, 1u);
+	hiz_level_count = 1;
+	while ((std::max(level0_width, level0_height) >> hiz_level_count) > 0)
+	{
+		hiz_level_count++;
+	}
+
+	uint32_t set_count = hiz_level_count * frames_in_flight;
+	std::array<vk::DescriptorPoolSize, 2> pool_sizes = {
+		vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, set_count),
+		vk::DescriptorPoolSize(vk::DescriptorType::eStorageImage, set_count)
+	};
+	vk::DescriptorPoolCreateInfo pool_info = {
+		vk::DescriptorPoolCreateFlags(), // flags
+		set_count, // maxSets
+		static_cast<uint32_t>(pool_sizes.size()), // poolSizeCount
+		pool_sizes.data() // pPoolSizes
+	};
+	// frees the sets of the old pyramid
+	hiz_descriptor_pool = VRaii<vk::DescriptorPool>(
+		device.createDescriptorPool(pool_info, nullptr),
+		[device = this->device](auto& obj)
+		{
+			device.destroyDescriptorPool(obj);
+		}
+	);
+
+	for (uint32_t frame = 0; frame < frames_in_flight; frame++)
+	{
+		hiz_level_views[frame].clear();
+		std::tie(hiz_images[frame], hiz_image_memories[frame]) = utility.createImage(level0_width, level0_height
+			, VK_FORMAT_R32G32_SFLOAT
+			, VK_IMAGE_TILING_OPTIMAL
+			, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+			, hiz_level_count);
+		hiz_image_views[frame] = utility.createImageView(hiz_images[frame].get(), VK_FORMAT_R32G32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT
+			, 0, hiz_level_count);
+		for (uint32_t level = 0; level < hiz_level_count; level++)
+		{
+			hiz_level_views[frame].push_back(utility.createImageView(hiz_images[frame].get(), VK_FORMAT_R32G32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT
+				, level, 1));
+		}
+
+		std::vector<vk::DescriptorSetLayout> layouts(hiz_level_count, hiz_descriptor_set_layout.get());
+		vk::DescriptorSetAllocateInfo alloc_info = {
+			hiz_descriptor_pool.get(),  // descriptorPool
+			hiz_level_count,  // descriptorSetCount
+			layouts.data(), // pSetLayouts
+		};
+		hiz_descriptor_sets[frame] = device.allocateDescriptorSets(alloc_info);
+
+		std::vector<vk::DescriptorImageInfo> source_infos;
+		std::vector<vk::DescriptorImageInfo> destination_infos;
+		source_infos.reserve(hiz_level_count);
+		destination_infos.reserve(hiz_level_count);
+		std::vector<vk::WriteDescriptorSet> descriptor_writes;
+		for (uint32_t level = 0; level < hiz_level_count; level++)
+		{
+			if (level == 0)
+			{
+				source_infos.emplace_back(hiz_sampler.get(), depth_image_views[frame].get(), vk::ImageLayout::eDepthStencilReadOnlyOptimal);
+			}
+			else
+			{
+				source_infos.emplace_back(hiz_sampler.get(), hiz_level_views[frame][level - 1].get(), vk::ImageLayout::eGeneral);
+			}
+			destination_infos.emplace_back(vk::Sampler(), hiz_level_views[frame][level].get(), vk::ImageLayout::eGeneral);
+
+			descriptor_writes.emplace_back(
+				hiz_descriptor_sets[frame][level], // dstSet
+				0, // dstBinding
+				0, // distArrayElement
+				1, // descriptorCount
+				vk::DescriptorType::eCombinedImageSampler, //descriptorType
+				&source_infos.back(), //pImageInfo
+				nullptr, //pBufferInfo
+				nullptr //pTexBufferView
+			);
+			descriptor_writes.emplace_back(
+				hiz_descriptor_sets[frame][level], // dstSet
+				1, // dstBinding
+				0, // distArrayElement
+				1, // descriptorCount
+				vk::DescriptorType::eStorageImage, //descriptorType
+				&destination_infos.back(), //pImageInfo
+				nullptr, //pBufferInfo
+				nullptr //pTexBufferView
+			);
+		}
+
+		std::array<vk::CopyDescriptorSet, 0> descriptor_copies;
+		device.updateDescriptorSets(descriptor_writes, descriptor_copies);
+	}
 }
 
 void _VulkanRenderer_Impl::createTextureSampler()
@@ -1076,138 +2219,746 @@ void _VulkanRenderer_Impl::createTextureSampler()
 			device.destroySampler(obj);
 		}
 	);
+
+	// the Hi-Z build and light culling fetch texels of a given level, so nothing is filtered
+	vk::SamplerCreateInfo hiz_sampler_info = {
+		vk::SamplerCreateFlags(), // flags
+		vk::Filter::eNearest, // magFilter
+		vk::Filter::eNearest, // minFilter
+		vk::SamplerMipmapMode::eNearest, // mipmapMode
+		vk::SamplerAddressMode::eClampToEdge, // addressModeU
+		vk::SamplerAddressMode::eClampToEdge, // addressModeV
+		vk::SamplerAddressMode::eClampToEdge, // addressModeW
+		0.0f, // mipLodBias
+		VK_FALSE, // anisotropyEnable
+		1.0f, // maxAnisotropy
+		VK_FALSE, // compareEnable
+		vk::CompareOp::eAlways, // compareOp
+		0.0f, // minLod
+		VK_LOD_CLAMP_NONE // maxLod
+	};
+	hiz_sampler = VRaii<vk::Sampler>(
+		device.createSampler(hiz_sampler_info, nullptr),
+		[device = this->device](auto& obj)
+		{
+			device.destroySampler(obj);
+		}
+	);
 }
 
-void _VulkanRenderer_Impl::createUniformBuffers()
+void _VulkanRenderer_Impl::createTimestampQueryPool()
 {
-	// create buffers for scene object
+	// timestampComputeAndGraphics guarantees timestamp support on every graphics and compute queue
+	timestamps_supported = vulkan_context.getPhysicalDeviceProperties().limits.timestampComputeAndGraphics == VK_TRUE;
+	if (!timestamps_supported)
 	{
-		VkDeviceSize bufferSize = sizeof(SceneObjectUbo);
-
-		std::tie(object_staging_buffer, object_staging_buffer_memory) = utility.createBuffer(bufferSize
-			, VK_BUFFER_USAGE_TRANSFER_SRC_BIT
-			, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-		std::tie(object_uniform_buffer, object_uniform_buffer_memory) = utility.createBuffer(bufferSize
-			, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
-			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		return;
 	}
 
-	// Adding data to scene object buffer
-	{
-		SceneObjectUbo ubo = {};
-		ubo.model = glm::scale(glm::mat4(1.0f), glm::vec3(getGlobalTestSceneConfiguration().scale));;
+	vk::QueryPoolCreateInfo create_info = {
+		vk::QueryPoolCreateFlags(), // flags
+		vk::QueryType::eTimestamp, // queryType
+		TIMESTAMP_QUERY_COUNT * MAX_FRAMES_IN_FLIGHT, // queryCount
+		vk::QueryPipelineStatisticFlags() // pipelineStatistics
+	};
 
-		void* data;
-		vkMapMemory(graphics_device, object_staging_buffer_memory.get(), 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(graphics_device, object_staging_buffer_memory.get());
-		utility.copyBuffer(object_staging_buffer.get(), object_uniform_buffer.get(), sizeof(ubo));
-	}
+	timestamp_query_pool = VRaii<vk::QueryPool>(
+		device.createQueryPool(create_info, nullptr),
+		[device = this->device](auto & obj)
+		{
+			device.destroyQueryPool(obj);
+		}
+	);
+}
 
-	// create buffers for camera
+/**
+* One query per frame in flight counting the fragment shader invocations of the shading pass, if the device can count them
+* around a render pass drawn from secondary command buffers
+*/
+void _VulkanRenderer_Impl::createPipelineStatisticsQueryPool()
+{
+	pipeline_statistics_supported = vulkan_context.supportsPipelineStatistics();
+	if (!pipeline_statistics_supported)
 	{
-		VkDeviceSize bufferSize = sizeof(CameraUbo);
-
-		std::tie(camera_staging_buffer, camera_staging_buffer_memory) = utility.createBuffer(bufferSize
-			, VK_BUFFER_USAGE_TRANSFER_SRC_BIT
-			, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-		std::tie(camera_uniform_buffer, camera_uniform_buffer_memory) = utility.createBuffer(bufferSize
-			, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT  // FIXME: change back to uniform
-			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-			, queue_family_indices.graphics_family
-			, 0);//		, queue_family_indices.compute_family);
+		return;
 	}
+
+	vk::QueryPoolCreateInfo create_info = {
+		vk::QueryPoolCreateFlags(), // flags
+		vk::QueryType::ePipelineStatistics, // queryType
+		MAX_FRAMES_IN_FLIGHT, // queryCount
+		vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations // pipelineStatistics
+	};
+
+	pipeline_statistics_query_pool = VRaii<vk::QueryPool>(
+		device.createQueryPool(create_info, nullptr),
+		[device = this->device](auto & obj)
+		{
+			device.destroyQueryPool(obj);
+		}
+	);
+}
+
+/**
+* Create the upload ring for the camera and the scene object
+*/
+void _VulkanRenderer_Impl::createUniformBuffers()
+{
+	auto alignment = VUploadRing::getAlignment(vulkan_context);
+	camera_ring_offset = 0;
+	object_ring_offset = VUploadRing::align(sizeof(CameraUbo), alignment);
+	auto frame_region_size = object_ring_offset + VUploadRing::align(sizeof(SceneObjectUbo), alignment);
+
+	upload_ring = VUploadRing(vulkan_context, frame_region_size, frames_in_flight
+		, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT); // FIXME: camera is a storage buffer, change back to uniform
 }
 
 void _VulkanRenderer_Impl::createLights()
 {
-	for (int i = 0; i < getGlobalTestSceneConfiguration().light_num; i++) {
+	addPointLights(getGlobalTestSceneConfiguration().light_num);
+
+	// spot lights point roughly downwards
+	for (int i = 0; i < getGlobalTestSceneConfiguration().spot_light_num; i++) {
+		// rejects dim colors, vec3::length() would be the component count
 		glm::vec3 color;
 		do { color = { glm::linearRand(glm::vec3(0, 0, 0), glm::vec3(1, 1, 1)) }; }
-		while (color.length() < 0.8f);
-		pointlights.emplace_back(glm::linearRand(getGlobalTestSceneConfiguration().min_light_pos, getGlobalTestSceneConfiguration().max_light_pos), getGlobalTestSceneConfiguration().light_radius, color);
+		while (glm::length(color) < 0.8f);
+		auto tilt = glm::diskRand(0.5f);
+		auto direction = glm::vec3(tilt.x, -1.0f, tilt.y);
+		spotlights.emplace_back(glm::linearRand(getGlobalTestSceneConfiguration().min_light_pos, getGlobalTestSceneConfiguration().max_light_pos)
+			, direction, glm::radians(getGlobalTestSceneConfiguration().spot_light_angle), getGlobalTestSceneConfiguration().spot_light_range, color);
 	}
-	// TODO: choose between memory mapping and staging buffer
-	//  (given that the lights are moving)
-	auto light_num = static_cast<int>(pointlights.size());
-
-	pointlight_buffer_size = sizeof(PointLight) * MAX_POINT_LIGHT_COUNT + sizeof(glm::vec4); // vec4 rather than int for padding
-
-	std::tie(lights_staging_buffer, lights_staging_buffer_memory) = utility.createBuffer(pointlight_buffer_size
-		, VK_BUFFER_USAGE_TRANSFER_SRC_BIT // to be transfered from
-		, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-	std::tie(pointlight_buffer, pointlight_buffer_memory) = utility.createBuffer(pointlight_buffer_size
-		, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT  // FIXME: change back to uniform
-		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT); // using barrier to sync
+	resizeLightDirtyPages();
 }
 
-void _VulkanRenderer_Impl::createDescriptorPool()
+/**
+* Add random point lights at runtime, the light buffers grow at the start of the next frame if they don't fit
+*/
+void _VulkanRenderer_Impl::addPointLights(size_t count)
 {
-	// Create descriptor pool for uniform buffer
-	std::array<VkDescriptorPoolSize, 3> pool_sizes = {};
-	//std::array<VkDescriptorPoolSize, 2> pool_sizes = {};
-	pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	pool_sizes[0].descriptorCount = 100; // transform buffer & light buffer & camera buffer & light buffer in compute pipeline
-	pool_sizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	pool_sizes[1].descriptorCount = 100; // sampler for color map and normal map and depth map from depth prepass... and so many from scene materials
-	pool_sizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	pool_sizes[2].descriptorCount = 3; // light visiblity buffer in graphics pipeline and compute pipeline
-
-	VkDescriptorPoolCreateInfo pool_info = {};
-	pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	pool_info.poolSizeCount = (uint32_t)pool_sizes.size();
-	pool_info.pPoolSizes = pool_sizes.data();
-	pool_info.maxSets = 200;
-	pool_info.flags = 0;
-	//poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
-	// TODO: use VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT so I can create a VKGemoetryClass
+	const auto& scene = getGlobalTestSceneConfiguration();
+	auto first = pointlights.size();
+	pointlights.reserve(first + count);
+	for (size_t i = 0; i < count; i++) {
+		// rejects dim colors, vec3::length() would be the component count
+		glm::vec3 color;
+		do { color = { glm::linearRand(glm::vec3(0, 0, 0), glm::vec3(1, 1, 1)) }; }
+		while (glm::length(color) < 0.8f);
+		pointlights.push_back(PointLight(glm::linearRand(scene.min_light_pos, scene.max_light_pos), scene.light_radius, color));
+	}
 
-	VkDescriptorPool pool;
-	if (vkCreateDescriptorPool(graphics_device, &pool_info, nullptr, &pool) != VK_SUCCESS)
+	// emulated spot lights follow the point lights in the GPU buffer, so they moved too
+	resizeLightDirtyPages();
+	markPointLightsDirty(first, count);
+	if (emulate_spot_lights)
 	{
-		throw std::runtime_error("Failed to create descriptor pool!");
+		markSpotLightsDirty(0, spotlights.size());
 	}
-
-	descriptor_pool = VRaii<VkDescriptorPool>(
-		pool,
-		[device = this->device](auto& obj)
-		{
-			device.destroyDescriptorPool(obj);
-		}
-	);
+	lights_changed = true;
 }
 
-void _VulkanRenderer_Impl::createSceneObjectDescriptorSet()
+/**
+* Create the light buffers with point_light_capacity and spot_light_capacity lights, the velocity buffer
+* and the ring their uploads are copied from. Nothing is waited for: the velocities are staged and copied
+* by the next light update, the staging buffer is retired with the frame that copies from it
+*/
+void _VulkanRenderer_Impl::createLightBuffers()
 {
+	pointlight_buffer_size = sizeof(PointLight) * point_light_capacity + sizeof(glm::vec4); // vec4 rather than int for padding
+	spotlight_buffer_size = sizeof(SpotLight) * spot_light_capacity + sizeof(glm::vec4);
 
-	VkDescriptorSetLayout layouts[] = { object_descriptor_set_layout.get() };
-	VkDescriptorSetAllocateInfo alloc_info = {};
-	alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	alloc_info.descriptorPool = descriptor_pool.get();
-	alloc_info.descriptorSetCount = 1;
-	alloc_info.pSetLayouts = layouts;
+	std::tie(pointlight_buffer, pointlight_buffer_memory) = utility.createBuffer(pointlight_buffer_size
+		, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT  // FIXME: change back to uniform
+		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT); // using barrier to sync
 
-	if (vkAllocateDescriptorSets(graphics_device, &alloc_info, &object_descriptor_set) != VK_SUCCESS)
+	std::tie(spotlight_buffer, spotlight_buffer_memory) = utility.createBuffer(spotlight_buffer_size
+		, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT // source of the copy when they grow
+		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	// velocities read by the light update pass, they never change so they are only uploaded here
+	// point lights (and spot lights emulated as point lights) first, spot lights after point_light_capacity
 	{
-		throw std::runtime_error("Failed to allocate descriptor set!");
+		std::vector<glm::vec4> velocities(point_light_capacity + spot_light_capacity, glm::vec4(LIGHT_VELOCITY, 0.0f));
+		light_velocity_buffer_size = sizeof(glm::vec4) * velocities.size();
+
+		RetiredResources staging;
+		staging.last_use_frame = frame_serial + 1; // copied by this frame when growing, by the first frame at startup
+		VRaii<VkBuffer> staging_buffer;
+		VRaii<VkDeviceMemory> staging_buffer_memory;
+		std::tie(staging_buffer, staging_buffer_memory) = utility.createBuffer(light_velocity_buffer_size
+			, VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+			, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+		void* data;
+		vkMapMemory(graphics_device, staging_buffer_memory.get(), 0, light_velocity_buffer_size, 0, &data);
+		memcpy(data, velocities.data(), light_velocity_buffer_size);
+		vkUnmapMemory(graphics_device, staging_buffer_memory.get());
+
+		std::tie(light_velocity_buffer, light_velocity_buffer_memory) = utility.createBuffer(light_velocity_buffer_size
+			, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+		pending_light_buffer_copies.push_back({ static_cast<vk::Buffer>(staging_buffer.get()), static_cast<vk::Buffer>(light_velocity_buffer.get())
+			, vk::BufferCopy(0, 0, light_velocity_buffer_size) });
+		staging.memories.push_back(std::move(staging_buffer_memory));
+		staging.buffers.push_back(std::move(staging_buffer));
+		retired_resources.push_back(std::move(staging));
 	}
 
-	// refer to the uniform object buffer
-	VkDescriptorBufferInfo buffer_info = {};
-	buffer_info.buffer = object_uniform_buffer.get();
-	buffer_info.offset = 0;
-	buffer_info.range = sizeof(SceneObjectUbo);
+	// big enough for uploading every light in one frame
+	auto alignment = VUploadRing::getAlignment(vulkan_context);
+	auto frame_region_size = VUploadRing::align(pointlight_buffer_size, alignment) + VUploadRing::align(spotlight_buffer_size, alignment);
+	light_upload_ring = VUploadRing(vulkan_context, frame_region_size, frames_in_flight, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+	light_upload_ring.beginFrame(frame_index);
 
-	//std::array<VkWriteDescriptorSet, 4> descriptor_writes = {};
-	std::array<VkWriteDescriptorSet, 1> descriptor_writes = {};
+	light_buffer_generation++;
+}
 
-	// ubo
+/**
+* Grow the light buffers geometrically once the lights don't fit anymore, called at the start of a frame.
+* The old contents are copied on the GPU by this frame's light update, so lights moved by the light update pass keep their positions.
+* The old buffers stay alive until the frames in flight which use them are done, so there is no vkDeviceWaitIdle
+*/
+void _VulkanRenderer_Impl::ensureLightBufferCapacity()
+{
+	auto required_point_capacity = static_cast<int>(pointlights.size() + (emulate_spot_lights ? spotlights.size() : 0));
+	auto required_spot_capacity = static_cast<int>(spotlights.size());
+	if (required_point_capacity <= point_light_capacity && required_spot_capacity <= spot_light_capacity)
+	{
+		return;
+	}
+
+	RetiredResources old;
+	old.last_use_frame = frame_serial; // read by the previous frames, and copied from by this one
+	auto old_pointlight_buffer = static_cast<vk::Buffer>(pointlight_buffer.get());
+	auto old_spotlight_buffer = static_cast<vk::Buffer>(spotlight_buffer.get());
+	auto old_pointlight_buffer_size = pointlight_buffer_size;
+	auto old_spotlight_buffer_size = spotlight_buffer_size;
+	old.memories.push_back(std::move(pointlight_buffer_memory));
+	old.memories.push_back(std::move(spotlight_buffer_memory));
+	old.memories.push_back(std::move(light_velocity_buffer_memory));
+	old.buffers.push_back(std::move(pointlight_buffer));
+	old.buffers.push_back(std::move(spotlight_buffer));
+	old.buffers.push_back(std::move(light_velocity_buffer));
+	old.upload_ring = std::move(light_upload_ring);
+
+	if (required_point_capacity > point_light_capacity)
+	{
+		point_light_capacity = std::max(required_point_capacity, point_light_capacity * 2);
+	}
+	if (required_spot_capacity > spot_light_capacity)
+	{
+		spot_light_capacity = std::max(required_spot_capacity, spot_light_capacity * 2);
+	}
+
+	if (!pending_pointlight_copies.empty() || !pending_spotlight_copies.empty())
+	{
+		// staged in the old ring, start over with a full upload
+		pending_pointlight_copies.clear();
+		pending_spotlight_copies.clear();
+		lights_upload_pending = true;
+	}
+	createLightBuffers();
+	pending_light_buffer_copies.push_back({ old_pointlight_buffer, static_cast<vk::Buffer>(pointlight_buffer.get()), vk::BufferCopy(0, 0, old_pointlight_buffer_size) });
+	pending_light_buffer_copies.push_back({ old_spotlight_buffer, static_cast<vk::Buffer>(spotlight_buffer.get()), vk::BufferCopy(0, 0, old_spotlight_buffer_size) });
+	retired_resources.push_back(std::move(old));
+	light_buffer_growth_count++;
+
+	// the other frames switch over when they come around, see updateUniformBuffers()
+	switchFrameToCurrentLightBuffers(frame_index);
+	lights_changed = true;
+}
+
+/**
+* Point the descriptor set and the command buffers of a frame at the current light buffers,
+* the frame's fence must have been waited for
+*/
+void _VulkanRenderer_Impl::switchFrameToCurrentLightBuffers(uint32_t frame)
+{
+	createFrameLightSnapshot(frame);
+	updateLightCullingDescriptorSet(frame);
+	recordLightCullingCommandBuffer(frame);
+	frame_light_buffer_generations[frame] = light_buffer_generation;
+}
+
+/**
+* Create the light snapshot buffers of a frame at the size of the current light buffers,
+* they are filled by the frame's next light update. The frame's fence must have been waited for
+*/
+void _VulkanRenderer_Impl::createFrameLightSnapshot(uint32_t frame)
+{
+	// written on the compute queue, read by light culling there and by shading on the graphics queue
+	std::tie(pointlight_snapshot_buffers[frame], pointlight_snapshot_buffer_memories[frame]) = utility.createBuffer(pointlight_buffer_size
+		, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+		, queue_family_indices.graphics_family, queue_family_indices.compute_family);
+	std::tie(spotlight_snapshot_buffers[frame], spotlight_snapshot_buffer_memories[frame]) = utility.createBuffer(spotlight_buffer_size
+		, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+		, queue_family_indices.graphics_family, queue_family_indices.compute_family);
+	pointlight_snapshot_buffer_sizes[frame] = pointlight_buffer_size;
+	spotlight_snapshot_buffer_sizes[frame] = spotlight_buffer_size;
+	frame_light_snapshot_versions[frame] = 0;
+}
+
+/**
+* Destroy the retired resources no frame in flight can use anymore,
+* called right after waiting for the fence of the frame being started
+*/
+void _VulkanRenderer_Impl::releaseRetiredResources()
+{
+	// frames are submitted in order, so every frame up to frame_serial - frames_in_flight is done
+	retired_resources.erase(std::remove_if(retired_resources.begin(), retired_resources.end(), [this](const RetiredResources& retired)
+	{
+		return retired.last_use_frame + frames_in_flight <= frame_serial;
+	}), retired_resources.end());
+}
+
+namespace
+{
+	/**
+	* Pack the light count and the dirty ranges of one light buffer into a single upload ring allocation,
+	* adding a copy region for each of them from copy_source. write_lights(first, count, dst) writes a range of lights in the GPU layout.
+	* Returns the number of bytes written
+	*/
+	template <typename Light, typename WriteLights>
+	VkDeviceSize stageDirtyLights(VUploadRing& upload_ring, DirtyPageTracker& dirty_pages, int& uploaded_count
+		, WriteLights write_lights, std::vector<vk::BufferCopy>& copies, vk::Buffer& copy_source)
+	{
+		auto light_num = static_cast<int>(dirty_pages.size());
+		bool header_dirty = light_num != uploaded_count;
+		auto ranges = dirty_pages.takeDirtyRanges();
+		if (!header_dirty && ranges.empty())
+		{
+			return 0;
+		}
+
+		VkDeviceSize upload_size = header_dirty ? sizeof(glm::vec4) : 0; // vec4 rather than int for padding
+		for (const auto& range : ranges)
+		{
+			upload_size += sizeof(Light) * range.second;
+		}
+
+		// the ring may have grown into a new buffer, the copies are staged once per frame so they all come from this one
+		auto allocation = upload_ring.allocate(upload_size);
+		copy_source = allocation.buffer;
+		auto data = static_cast<char*>(allocation.data);
+		auto src_offset = allocation.offset;
+		if (header_dirty)
+		{
+			memcpy(data, &light_num, sizeof(int));
+			copies.emplace_back(src_offset, 0, sizeof(glm::vec4));
+			data += sizeof(glm::vec4);
+			src_offset += sizeof(glm::vec4);
+			uploaded_count = light_num;
+		}
+
+		for (const auto& range : ranges)
+		{
+			write_lights(range.first, range.second, reinterpret_cast<Light*>(data));
+
+			VkDeviceSize size = sizeof(Light) * range.second;
+			copies.emplace_back(src_offset, sizeof(glm::vec4) + sizeof(Light) * range.first, size);
+			data += size;
+			src_offset += size;
+		}
+		return upload_size;
+	}
+}
+
+/**
+* Write the lights which changed since the last upload into the upload ring,
+* they are copied to their GPU buffers by this frame's light update
+*/
+void _VulkanRenderer_Impl::uploadLights()
+{
+	if (lights_upload_pending)
+	{
+		// everything, e.g. after creating the lights or switching the spot light emulation
+		resizeLightDirtyPages();
+		pointlight_dirty_pages.markAllDirty();
+		spotlight_dirty_pages.markAllDirty();
+		uploaded_pointlight_count = -1;
+		uploaded_spotlight_count = -1;
+		lights_upload_pending = false;
+	}
+
+	auto copy_region_count = pending_pointlight_copies.size() + pending_spotlight_copies.size();
+
+	// the point light buffer holds the point lights, followed by the spot lights when they are emulated
+	VkDeviceSize upload_size = stageDirtyLights<PointLight>(light_upload_ring, pointlight_dirty_pages, uploaded_pointlight_count
+		, [this](size_t first, size_t count, PointLight* dst) { writePointLights(first, count, dst); }
+		, pending_pointlight_copies, pending_pointlight_copy_source);
+	upload_size += stageDirtyLights<SpotLight>(light_upload_ring, spotlight_dirty_pages, uploaded_spotlight_count
+		, [this](size_t first, size_t count, SpotLight* dst) { std::copy_n(spotlights.begin() + first, count, dst); }
+		, pending_spotlight_copies, pending_spotlight_copy_source);
+
+	if (upload_size > 0)
+	{
+		uploaded_bytes += upload_size;
+		uploaded_copy_regions += pending_pointlight_copies.size() + pending_spotlight_copies.size() - copy_region_count;
+		// light culling has to run to pick up the copies
+		lights_changed = true;
+	}
+}
+
+/**
+* Write a range of the point light buffer, the point lights are packed in chunks by the worker threads
+*/
+void _VulkanRenderer_Impl::writePointLights(size_t first, size_t count, PointLight* dst)
+{
+	auto point_end = std::min(first + count, pointlights.size());
+	if (first < point_end)
+	{
+		thread_pool.parallelFor(point_end - first, LIGHT_KERNEL_CHUNK_SIZE, [&](size_t chunk_first, size_t chunk_count)
+		{
+			pointlights.pack(first + chunk_first, chunk_count, dst + chunk_first);
+		});
+	}
+
+	// emulated spot lights follow the point lights
+	for (auto i = std::max(first, pointlights.size()); i < first + count; i++)
+	{
+		dst[i - first] = spotlights[i - pointlights.size()].toEnclosingPointLight();
+	}
+}
+
+/**
+* Track as many lights as the GPU buffers hold with the current spot light emulation
+*/
+void _VulkanRenderer_Impl::resizeLightDirtyPages()
+{
+	pointlight_dirty_pages.resize(pointlights.size() + (emulate_spot_lights ? spotlights.size() : 0));
+	spotlight_dirty_pages.resize(emulate_spot_lights ? 0 : spotlights.size());
+}
+
+void _VulkanRenderer_Impl::markPointLightsDirty(size_t first, size_t count)
+{
+	pointlight_dirty_pages.markDirty(first, count);
+}
+
+void _VulkanRenderer_Impl::markSpotLightsDirty(size_t first, size_t count)
+{
+	if (emulate_spot_lights)
+	{
+		pointlight_dirty_pages.markDirty(pointlights.size() + first, count);
+	}
+	else
+	{
+		spotlight_dirty_pages.markDirty(first, count);
+	}
+}
+
+void _VulkanRenderer_Impl::createLightCullingStatsBuffer()
+{
+	std::tie(light_culling_stats_buffer, light_culling_stats_buffer_memory) = utility.createBuffer(sizeof(LightCullingStats)
+		, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT // cleared with vkCmdFillBuffer
+		, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+}
+
+void _VulkanRenderer_Impl::createDescriptorPool()
+{
+	// the classic materials take a set each with a uniform buffer and up to two maps, a model falling back from bindless may have many
+	uint32_t material_set_count = 0;
+	if (!use_bindless_materials)
+	{
+		for (const auto& part : model.getMeshParts())
+		{
+			material_set_count = std::max(material_set_count, part.material_index + 1);
+		}
+	}
+
+	// Create descriptor pool for uniform buffer
+	std::array<VkDescriptorPoolSize, 5> pool_sizes = {};
+	//std::array<VkDescriptorPoolSize, 2> pool_sizes = {};
+	pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	pool_sizes[0].descriptorCount = 100 + material_set_count; // transform buffer & light buffer & camera buffer & light buffer in compute pipeline
+	pool_sizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	pool_sizes[1].descriptorCount = 100 + MAX_FRAMES_IN_FLIGHT + 2 * material_set_count; // sampler for color map and normal map and depth map from depth prepass... and so many from scene materials, and the Hi-Z pyramids
+	pool_sizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	pool_sizes[2].descriptorCount = 9 * MAX_FRAMES_IN_FLIGHT; // per frame in flight: light visiblity buffers and light snapshots shared by graphics pipeline and compute pipeline, light culling stats, light buffers and velocities for the light update
+	pool_sizes[3].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	pool_sizes[3].descriptorCount = 1; // scene object in the upload ring
+	pool_sizes[4].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+	pool_sizes[4].descriptorCount = 1; // camera in the upload ring
+
+	VkDescriptorPoolCreateInfo pool_info = {};
+	pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	pool_info.poolSizeCount = (uint32_t)pool_sizes.size();
+	pool_info.pPoolSizes = pool_sizes.data();
+	pool_info.maxSets = 200 + material_set_count;
+	pool_info.flags = 0;
+	//poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+	// TODO: use VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT so I can create a VKGemoetryClass
+
+	VkDescriptorPool pool;
+	if (vkCreateDescriptorPool(graphics_device, &pool_info, nullptr, &pool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create descriptor pool!");
+	}
+
+	descriptor_pool = VRaii<VkDescriptorPool>(
+		pool,
+		[device = this->device](auto& obj)
+		{
+			device.destroyDescriptorPool(obj);
+		}
+	);
+}
+
+/**
+* Load the scene model, or generate the synthetic one over the light bounds of the scene
+*/
+void _VulkanRenderer_Impl::createModel()
+{
+	const auto& config = getGlobalTestSceneConfiguration();
+	if (config.synthetic_mesh_parts > 0)
+	{
+		// the light bounds are in world space, the model is scaled on the way there
+		model = VModel::createSyntheticModel(vulkan_context, static_cast<size_t>(config.synthetic_mesh_parts)
+			, config.min_light_pos / config.scale, config.max_light_pos / config.scale, transfer_queue);
+	}
+	else
+	{
+		model = VModel::loadModelFromFile(vulkan_context, config.model_file, transfer_queue);
+	}
+}
+
+/**
+* The one material descriptor set of the bindless path, from a pool of its own sized for the textures of the model
+*/
+void _VulkanRenderer_Impl::createBindlessMaterialDescriptorSet()
+{
+	// initialize() falls back to the per-part materials when the textures don't fit into bindless_texture_capacity
+	auto textures = model.getTextures();
+	auto texture_count = static_cast<uint32_t>(textures.size());
+
+	std::array<vk::DescriptorPoolSize, 3> pool_sizes = {
+		vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, 1),
+		vk::DescriptorPoolSize(vk::DescriptorType::eSampler, 1),
+		vk::DescriptorPoolSize(vk::DescriptorType::eSampledImage, std::max(texture_count, 1u))
+	};
+	vk::DescriptorPoolCreateInfo pool_info = {
+		vulkan_context.supportsSampledImageUpdateAfterBind() ? vk::DescriptorPoolCreateFlagBits::eUpdateAfterBindEXT : vk::DescriptorPoolCreateFlags(), // flags
+		1, // maxSets
+		static_cast<uint32_t>(pool_sizes.size()), // poolSizeCount
+		pool_sizes.data() // pPoolSizes
+	};
+	bindless_material_descriptor_pool = VRaii<vk::DescriptorPool>(
+		device.createDescriptorPool(pool_info, nullptr),
+		[device = this->device](auto& obj)
+		{
+			device.destroyDescriptorPool(obj);
+		}
+	);
+
+	VkDescriptorSetVariableDescriptorCountAllocateInfoEXT variable_count_info = {};
+	variable_count_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO_EXT;
+	variable_count_info.descriptorSetCount = 1;
+	variable_count_info.pDescriptorCounts = &texture_count;
+
+	VkDescriptorSetLayout layouts[] = { material_descriptor_set_layout.get() };
+	VkDescriptorSetAllocateInfo alloc_info = {};
+	alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	alloc_info.pNext = &variable_count_info;
+	alloc_info.descriptorPool = bindless_material_descriptor_pool.get();
+	alloc_info.descriptorSetCount = 1;
+	alloc_info.pSetLayouts = layouts;
+	VkDescriptorSet temp_set;
+	vulkan_util::checkResult(vkAllocateDescriptorSets(graphics_device, &alloc_info, &temp_set), "Failed to allocate bindless material descriptor set!");
+	bindless_material_descriptor_set = temp_set;
+
+	auto material_buffer_section = model.getMaterialBufferSection();
+	vk::DescriptorBufferInfo material_buffer_info = { material_buffer_section.buffer, material_buffer_section.offset, material_buffer_section.size };
+	vk::DescriptorImageInfo sampler_info = { texture_sampler.get(), vk::ImageView(), vk::ImageLayout::eUndefined };
+	std::vector<vk::DescriptorImageInfo> texture_infos;
+	texture_infos.reserve(textures.size());
+	for (auto texture : textures)
+	{
+		texture_infos.emplace_back(vk::Sampler(), texture, vk::ImageLayout::eShaderReadOnlyOptimal);
+	}
+
+	std::vector<vk::WriteDescriptorSet> descriptor_writes = {
+		vk::WriteDescriptorSet(bindless_material_descriptor_set, 0, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &material_buffer_info, nullptr),
+		vk::WriteDescriptorSet(bindless_material_descriptor_set, 1, 0, 1, vk::DescriptorType::eSampler, &sampler_info, nullptr, nullptr)
+	};
+	if (!texture_infos.empty())
+	{
+		descriptor_writes.emplace_back(bindless_material_descriptor_set, 2, 0, texture_count, vk::DescriptorType::eSampledImage, texture_infos.data(), nullptr, nullptr);
+	}
+	device.updateDescriptorSets(descriptor_writes, std::array<vk::CopyDescriptorSet, 0>());
+}
+
+/**
+* The buffers sortPrepassDraws() writes the depth prepass order of each frame in flight into,
+* and cullMeshParts() the shading draws of the visible parts
+*/
+void _VulkanRenderer_Impl::createPrepassDrawBuffers()
+{
+	auto part_count = std::max<vk::DeviceSize>(model.getMeshParts().size(), 1);
+	auto alignment = vulkan_context.getPhysicalDeviceProperties().limits.minStorageBufferOffsetAlignment;
+	shading_draws_offset = part_count * sizeof(VkDrawIndexedIndirectCommand);
+	prepass_order_offset = VUploadRing::align(2 * shading_draws_offset, alignment);
+	auto buffer_size = prepass_order_offset + part_count * sizeof(uint32_t);
+
+	prepass_draw_order.clear();
+	for (uint32_t frame = 0; frame < frames_in_flight; frame++)
+	{
+		frame_visible_parts[frame].clear();
+		std::tie(prepass_draw_buffers[frame], prepass_draw_buffer_memories[frame]) = utility.createBuffer(buffer_size
+			, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+			, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		// unmapped when the memory is freed
+		vulkan_util::checkResult(vkMapMemory(graphics_device, prepass_draw_buffer_memories[frame].get(), 0, buffer_size, 0, &prepass_draw_buffer_data[frame])
+			, "Failed to map the depth prepass draw buffer!");
+	}
+}
+
+/**
+* The culled draw lists of every frame in flight, the visibility of the parts and the culling counters,
+* with a descriptor set per frame. Every part starts out visible, so the first frame draws them all before the pyramid exists
+*/
+void _VulkanRenderer_Impl::createMeshCullingResources()
+{
+	if (!use_gpu_culling)
+	{
+		return;
+	}
+
+	auto part_count = static_cast<uint32_t>(model.getMeshParts().size());
+	if (part_count > vulkan_context.getPhysicalDeviceProperties().limits.maxDrawIndirectCount)
+	{
+		std::cout << "The model has more mesh parts than a single indirect draw can draw, drawing every mesh part instead" << std::endl;
+		use_gpu_culling = false;
+		return;
+	}
+
+	culled_draw_buffer_size = CULLED_DRAW_COUNTS_SIZE + (MESH_CULLING_SHADING_LIST + 1) * std::max(part_count, 1u) * sizeof(VkDrawIndexedIndirectCommand);
+	for (uint32_t frame = 0; frame < frames_in_flight; frame++)
+	{
+		std::tie(culled_draw_buffers[frame], culled_draw_buffer_memories[frame]) = utility.createBuffer(culled_draw_buffer_size
+			, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT // the counts are cleared with vkCmdFillBuffer
+			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	}
+
+	VkDeviceSize visibility_size = std::max(part_count, 1u) * sizeof(uint32_t);
+	std::tie(mesh_visibility_buffer, mesh_visibility_buffer_memory) = utility.createBuffer(visibility_size
+		, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	VkDeviceSize group_offsets_size = std::max((part_count + MESH_CULLING_WORKGROUP_SIZE - 1) / MESH_CULLING_WORKGROUP_SIZE, 1u) * sizeof(uint32_t);
+	std::tie(drawn_group_offsets_buffer, drawn_group_offsets_buffer_memory) = utility.createBuffer(group_offsets_size
+		, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	std::tie(mesh_culling_stats_buffer, mesh_culling_stats_buffer_memory) = utility.createBuffer(sizeof(MeshCullingStats)
+		, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT // cleared with vkCmdFillBuffer
+		, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	{
+		auto command = utility.beginSingleTimeCommands();
+		vkCmdFillBuffer(command, mesh_visibility_buffer.get(), 0, VK_WHOLE_SIZE, 1u);
+		utility.endSingleTimeCommands(command);
+	}
+
+	std::array<vk::DescriptorPoolSize, 2> pool_sizes = {
+		vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, 7 * frames_in_flight),
+		vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, frames_in_flight)
+	};
+	vk::DescriptorPoolCreateInfo pool_info = {
+		vk::DescriptorPoolCreateFlags(), // flags
+		frames_in_flight, // maxSets
+		static_cast<uint32_t>(pool_sizes.size()), // poolSizeCount
+		pool_sizes.data() // pPoolSizes
+	};
+	mesh_culling_descriptor_pool = VRaii<vk::DescriptorPool>(
+		device.createDescriptorPool(pool_info, nullptr),
+		[device = this->device](auto& obj)
+		{
+			device.destroyDescriptorPool(obj);
+		}
+	);
+
+	std::vector<vk::DescriptorSetLayout> layouts(frames_in_flight, mesh_culling_descriptor_set_layout.get());
+	vk::DescriptorSetAllocateInfo alloc_info = {
+		mesh_culling_descriptor_pool.get(),  // descriptorPool
+		frames_in_flight,  // descriptorSetCount
+		layouts.data(), // pSetLayouts
+	};
+	auto allocated = device.allocateDescriptorSets(alloc_info);
+	std::copy(allocated.begin(), allocated.end(), mesh_culling_descriptor_sets.begin());
+
+	updateMeshCullingDescriptorSets();
+}
+
+/**
+* Point the mesh culling descriptor sets at the buffers and the current Hi-Z pyramids, again whenever the pyramids are recreated
+*/
+void _VulkanRenderer_Impl::updateMeshCullingDescriptorSets()
+{
+	if (!use_gpu_culling)
+	{
+		return;
+	}
+
+	auto bounds_section = model.getBoundsBufferSection();
+	auto draw_command_section = model.getDrawCommandBufferSection();
+	vk::DescriptorBufferInfo bounds_info = { bounds_section.buffer, bounds_section.offset, bounds_section.size };
+	vk::DescriptorBufferInfo draw_command_info = { draw_command_section.buffer, draw_command_section.offset, draw_command_section.size };
+	vk::DescriptorBufferInfo visibility_info = { static_cast<vk::Buffer>(mesh_visibility_buffer.get()), 0, VK_WHOLE_SIZE };
+	vk::DescriptorBufferInfo stats_info = { static_cast<vk::Buffer>(mesh_culling_stats_buffer.get()), 0, sizeof(MeshCullingStats) };
+	vk::DescriptorBufferInfo group_offsets_info = { static_cast<vk::Buffer>(drawn_group_offsets_buffer.get()), 0, VK_WHOLE_SIZE };
+
+	for (uint32_t frame = 0; frame < frames_in_flight; frame++)
+	{
+		auto set = mesh_culling_descriptor_sets[frame];
+		vk::DescriptorBufferInfo culled_draws_info = { static_cast<vk::Buffer>(culled_draw_buffers[frame].get()), 0, culled_draw_buffer_size };
+		vk::DescriptorImageInfo hiz_info = { hiz_sampler.get(), hiz_image_views[frame].get(), vk::ImageLayout::eGeneral };
+		vk::DescriptorBufferInfo order_info = { static_cast<vk::Buffer>(prepass_draw_buffers[frame].get()), prepass_order_offset
+			, std::max<vk::DeviceSize>(model.getMeshParts().size(), 1) * sizeof(uint32_t) };
+
+		std::array<vk::WriteDescriptorSet, 8> descriptor_writes = {
+			vk::WriteDescriptorSet(set, 0, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &bounds_info, nullptr),
+			vk::WriteDescriptorSet(set, 1, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &draw_command_info, nullptr),
+			vk::WriteDescriptorSet(set, 2, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &culled_draws_info, nullptr),
+			vk::WriteDescriptorSet(set, 3, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &visibility_info, nullptr),
+			vk::WriteDescriptorSet(set, 4, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &stats_info, nullptr),
+			vk::WriteDescriptorSet(set, 5, 0, 1, vk::DescriptorType::eCombinedImageSampler, &hiz_info, nullptr, nullptr),
+			vk::WriteDescriptorSet(set, 6, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &order_info, nullptr),
+			vk::WriteDescriptorSet(set, 7, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &group_offsets_info, nullptr)
+		};
+		device.updateDescriptorSets(descriptor_writes, std::array<vk::CopyDescriptorSet, 0>());
+	}
+}
+
+void _VulkanRenderer_Impl::createSceneObjectDescriptorSet()
+{
+
+	VkDescriptorSetLayout layouts[] = { object_descriptor_set_layout.get() };
+	VkDescriptorSetAllocateInfo alloc_info = {};
+	alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	alloc_info.descriptorPool = descriptor_pool.get();
+	alloc_info.descriptorSetCount = 1;
+	alloc_info.pSetLayouts = layouts;
+
+	if (vkAllocateDescriptorSets(graphics_device, &alloc_info, &object_descriptor_set) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate descriptor set!");
+	}
+
+	// refer to the uniform object buffer
+	VkDescriptorBufferInfo buffer_info = {};
+	buffer_info.buffer = static_cast<VkBuffer>(upload_ring.getBuffer());
+	buffer_info.offset = 0; // the frame and object_ring_offset are added as dynamic offset
+	buffer_info.range = sizeof(SceneObjectUbo);
+
+	//std::array<VkWriteDescriptorSet, 4> descriptor_writes = {};
+	std::array<VkWriteDescriptorSet, 1> descriptor_writes = {};
+
+	// ubo
 	descriptor_writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 	descriptor_writes[0].dstSet = object_descriptor_set;
 	descriptor_writes[0].dstBinding = 0;
 	descriptor_writes[0].dstArrayElement = 0;
-	descriptor_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	descriptor_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	descriptor_writes[0].descriptorCount = 1;
 	descriptor_writes[0].pBufferInfo = &buffer_info;
 	descriptor_writes[0].pImageInfo = nullptr; // Optional
@@ -1235,8 +2986,8 @@ void _VulkanRenderer_Impl::createCameraDescriptorSet()
 	{
 		// refer to the uniform object buffer
 		vk::DescriptorBufferInfo camera_uniform_buffer_info{
-			camera_uniform_buffer.get(), // buffer_
-			0, //offset_
+			upload_ring.getBuffer(), // buffer_
+			0, //offset_, the frame and camera_ring_offset are added as dynamic offset
 			sizeof(CameraUbo) // range_
 		};
 
@@ -1247,7 +2998,7 @@ void _VulkanRenderer_Impl::createCameraDescriptorSet()
 			0, // dstBinding
 			0, // distArrayElement
 			1, // descriptorCount
-			vk::DescriptorType::eStorageBuffer, //descriptorType // FIXME: change back to uniform
+			vk::DescriptorType::eStorageBufferDynamic, //descriptorType // FIXME: change back to uniform
 			nullptr, //pImageInfo
 			&camera_uniform_buffer_info, //pBufferInfo
 			nullptr //pTexBufferView
@@ -1260,15 +3011,18 @@ void _VulkanRenderer_Impl::createCameraDescriptorSet()
 
 void _VulkanRenderer_Impl::createIntermediateDescriptorSet()
 {
-	// Create descriptor set
+	// Create descriptor sets, one per frame in flight for its depth image
 	{
+		std::array<vk::DescriptorSetLayout, MAX_FRAMES_IN_FLIGHT> layouts;
+		layouts.fill(intermediate_descriptor_set_layout.get());
 		vk::DescriptorSetAllocateInfo alloc_info = {
 			descriptor_pool.get(),  // descriptorPool
-			1,  // descriptorSetCount
-			intermediate_descriptor_set_layout.data(), // pSetLayouts
+			frames_in_flight,  // descriptorSetCount
+			layouts.data(), // pSetLayouts
 		};
 
-		intermediate_descriptor_set = device.allocateDescriptorSets(alloc_info)[0];
+		auto allocated = device.allocateDescriptorSets(alloc_info);
+		std::copy(allocated.begin(), allocated.end(), intermediate_descriptor_sets.begin());
 	}
 
 }
@@ -1276,17 +3030,22 @@ void _VulkanRenderer_Impl::createIntermediateDescriptorSet()
 void _VulkanRenderer_Impl::updateIntermediateDescriptorSet()
 {
 	// Write desciptor set
-
+	for (uint32_t frame = 0; frame < frames_in_flight; frame++)
+	{
 		vk::DescriptorImageInfo depth_image_info = {
 			texture_sampler.get(),
-			depth_image_view.get(),
-			vk::ImageLayout::eShaderReadOnlyOptimal
+			depth_image_views[frame].get(),
+			vk::ImageLayout::eDepthStencilReadOnlyOptimal // left by the depth prepass
 		};
+		// without the pyramid the binding only has to be valid, light culling is specialized not to read it
+		vk::DescriptorImageInfo hiz_image_info = use_hiz
+			? vk::DescriptorImageInfo(hiz_sampler.get(), hiz_image_views[frame].get(), vk::ImageLayout::eGeneral)
+			: vk::DescriptorImageInfo(hiz_sampler.get(), depth_image_views[frame].get(), vk::ImageLayout::eDepthStencilReadOnlyOptimal);
 
 		std::vector<vk::WriteDescriptorSet> descriptor_writes = {};
 
 		descriptor_writes.emplace_back(
-			intermediate_descriptor_set, // dstSet
+			intermediate_descriptor_sets[frame], // dstSet
 			0, // dstBinding
 			0, // distArrayElement
 			1, // descriptorCount
@@ -1295,617 +3054,3528 @@ void _VulkanRenderer_Impl::updateIntermediateDescriptorSet()
 			nullptr, //pBufferInfo
 			nullptr //pTexBufferView
 		);
+		descriptor_writes.emplace_back(
+			intermediate_descriptor_sets[frame], // dstSet
+			1, // dstBinding
+			0, // distArrayElement
+			1, // descriptorCount
+			vk::DescriptorType::eCombinedImageSampler, //descriptorType
+			&hiz_image_info, //pImageInfo
+			nullptr, //pBufferInfo
+			nullptr //pTexBufferView
+		);
 
 		std::array<vk::CopyDescriptorSet, 0> descriptor_copies;
 		device.updateDescriptorSets(descriptor_writes, descriptor_copies);
-
+	}
 }
 
 void _VulkanRenderer_Impl::createDepthPrePassCommandBuffer()
 {
-	if (depth_prepass_command_buffer)
+	if (depth_prepass_command_buffers[0])
 	{
-		device.freeCommandBuffers(graphics_command_pool, 1, &depth_prepass_command_buffer);
-		depth_prepass_command_buffer = nullptr;
+		device.freeCommandBuffers(graphics_command_pool, static_cast<uint32_t>(depth_prepass_command_buffers.size()), depth_prepass_command_buffers.data());
+		depth_prepass_command_buffers = {};
 	}
 
-	// Create depth pre-pass command buffer
+	// Create depth pre-pass command buffers, one per upload ring frame
 	{
 		vk::CommandBufferAllocateInfo alloc_info = {
 			graphics_command_pool, // command pool
 			vk::CommandBufferLevel::ePrimary, // level
-			1 // commandBufferCount
+			static_cast<uint32_t>(depth_prepass_command_buffers.size()) // commandBufferCount
 		};
 
-		depth_prepass_command_buffer = device.allocateCommandBuffers(alloc_info)[0];
+		auto allocated = device.allocateCommandBuffers(alloc_info);
+		std::copy(allocated.begin(), allocated.end(), depth_prepass_command_buffers.begin());
 	}
+}
 
-	// Begin command
+/**
+* Record the depth prepass command buffer of a frame for submitLightCulling(), the frame's fence must have been waited for
+*/
+void _VulkanRenderer_Impl::recordDepthPrePassCommandBuffer(uint32_t frame)
+{
+	auto command = depth_prepass_command_buffers[frame];
+	command.reset(vk::CommandBufferResetFlags());
+	command.begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit, nullptr });
+
+	// the depth is cleared, so its old content is dropped with the transition into the attachment layout
+	VFrameGraph graph;
+	auto resources = addFrameGraphResources(graph, frame, vk::ImageLayout::eUndefined);
+	addDepthPrePass(graph, resources, frame);
+	// light culling waits for a semaphore, with a separate compute family the release below comes first
+	graph.setFinalState(resources.depth
+		, queue_family_transfers ? vk::PipelineStageFlagBits::eLateFragmentTests : vk::PipelineStageFlagBits::eBottomOfPipe
+		, vk::AccessFlags(), vk::ImageLayout::eDepthStencilReadOnlyOptimal);
+	graph.compile();
+	graph.execute(command);
+
+	if (queue_family_transfers)
 	{
-		vk::CommandBufferBeginInfo begin_info =
-		{
-			vk::CommandBufferUsageFlagBits::eSimultaneousUse,
-			nullptr
-		};
+		// light culling reads the depth on the compute queue, which takes it over in recordLightCullingCommandBuffer()
+		auto depth_release = getDepthOwnershipBarrier(frame, vk::AccessFlagBits::eDepthStencilAttachmentWrite, vk::AccessFlags()
+			, static_cast<uint32_t>(queue_family_indices.graphics_family), static_cast<uint32_t>(queue_family_indices.compute_family));
+		command.pipelineBarrier(
+			vk::PipelineStageFlagBits::eLateFragmentTests,
+			vk::PipelineStageFlagBits::eBottomOfPipe,
+			vk::DependencyFlags(),
+			0, nullptr,
+			0, nullptr,
+			1, &depth_release
+		);
+	}
+
+	command.end();
+}
+
+/**
+* Record the depth prepass of a frame with its timestamps, it resets the depth prepass and light culling queries
+*/
+void _VulkanRenderer_Impl::recordDepthPrePass(vk::CommandBuffer command, uint32_t frame)
+{
+	cullMeshParts(frame);
+	sortPrepassDraws(frame);
 
-		auto command = depth_prepass_command_buffer;
+	if (timestamps_supported)
+	{
+		// reset the prepass and culling queries, the shading pass resets its own since it can run alone
+		command.resetQueryPool(timestamp_query_pool.get(), getTimestampQuery(frame, TIMESTAMP_DEPTH_PREPASS_BEGIN), TIMESTAMP_SHADING_BEGIN);
+		command.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, timestamp_query_pool.get(), getTimestampQuery(frame, TIMESTAMP_DEPTH_PREPASS_BEGIN));
+	}
 
-		command.begin(begin_info);
+	// with GPU culling the parts which were visible the last time are drawn first, the pyramid of their depth
+	// culls the rest and the ones which became visible are drawn on top, see mesh_culling.comp.glsl
+	bool gpu_culling = isGpuCullingActive();
+	uint32_t phase_count = gpu_culling ? MESH_CULLING_PHASE_COUNT : 1;
+	for (uint32_t phase = 0; phase < phase_count; phase++)
+	{
+		if (gpu_culling)
+		{
+			recordMeshCulling(command, frame, static_cast<int>(phase));
+		}
 
+		auto pass = phase == 0 ? depth_pre_pass.get() : depth_pre_pass_load.get();
 		std::array<vk::ClearValue, 1> clear_values = {};
 		clear_values[0].depthStencil = vk::ClearDepthStencilValue( 1.0f, 0 ); // 1.0 is far view plane
 		vk::RenderPassBeginInfo depth_pass_info = {
-			depth_pre_pass.get(),
-			depth_pre_pass_framebuffer.get(),
+			pass,
+			depth_pre_pass_framebuffers[frame].get(),
 			vk::Rect2D({ 0,0 }, swap_chain_extent),
 			static_cast<uint32_t>(clear_values.size()),
 			clear_values.data()
 		};
-		command.beginRenderPass(&depth_pass_info, vk::SubpassContents::eInline);
+		command.beginRenderPass(&depth_pass_info, vk::SubpassContents::eSecondaryCommandBuffers);
 
-		for (const auto& part: model.getMeshParts() )
+		recordMeshParts(command, frame, pass, depth_pre_pass_framebuffers[frame].get()
+			, [this, frame, gpu_culling, phase](vk::CommandBuffer secondary, size_t first, size_t count)
 		{
-			command.bindPipeline(vk::PipelineBindPoint::eGraphics, depth_pipeline.get());
+			// nothing is inherited from the primary, every secondary binds its own state
+			secondary.bindPipeline(vk::PipelineBindPoint::eGraphics, depth_pipeline.get());
 
 			std::array<vk::DescriptorSet, 2> depth_descriptor_sets = { object_descriptor_set, camera_descriptor_set };
-			std::array<uint32_t, 0> depth_dynamic_offsets;
-			command.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, depth_pipeline_layout.get(), 0, depth_descriptor_sets, depth_dynamic_offsets);
-
-			std::array<vk::Buffer, 1> depth_vertex_buffers = { part.vertex_buffer_section.buffer };
-			std::array<vk::DeviceSize, 1> depth_offsets = { part.vertex_buffer_section.offset };
-			command.bindVertexBuffers(0, depth_vertex_buffers, depth_offsets);
-			command.bindIndexBuffer(part.index_buffer_section.buffer, part.index_buffer_section.offset, vk::IndexType::eUint32);
+			std::array<uint32_t, 2> depth_dynamic_offsets = {
+				static_cast<uint32_t>(upload_ring.getFrameOffset(frame) + object_ring_offset),
+				static_cast<uint32_t>(upload_ring.getFrameOffset(frame) + camera_ring_offset)
+			};
+			secondary.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, depth_pipeline_layout.get(), 0, depth_descriptor_sets, depth_dynamic_offsets);
 
-			command.drawIndexed(static_cast<uint32_t>(part.index_count), 1, 0, 0, 0);
-		}
+			if (gpu_culling)
+			{
+				recordCulledMeshPartDraws(secondary, frame, phase, 1);
+			}
+			else
+			{
+				recordPrepassDraws(secondary, frame, first, count);
+			}
+		});
 		command.endRenderPass();
 
-		command.end();
+		if (gpu_culling && phase == 0)
+		{
+			// the pyramid of the first phase's depth for the occlusion test of the second,
+			// the depth stays in the attachment layout for the render pass of the second phase afterwards
+			auto depth_barrier = vk::ImageMemoryBarrier(
+				vk::AccessFlagBits::eDepthStencilAttachmentWrite,  // srcAccessMask
+				vk::AccessFlagBits::eShaderRead,  // dstAccessMask
+				vk::ImageLayout::eDepthStencilAttachmentOptimal,  // oldLayout
+				vk::ImageLayout::eDepthStencilReadOnlyOptimal,  // newLayout
+				VK_QUEUE_FAMILY_IGNORED,  // srcQueueFamilyIndex
+				VK_QUEUE_FAMILY_IGNORED,  // dstQueueFamilyIndex
+				static_cast<vk::Image>(depth_images[frame].get()),  // image
+				vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1)  // subresourceRange
+			);
+			command.pipelineBarrier(
+				vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests,
+				vk::PipelineStageFlagBits::eComputeShader,
+				vk::DependencyFlags(),
+				0, nullptr,
+				0, nullptr,
+				1, &depth_barrier
+			);
 
+			recordHiZLevels(command, frame);
+
+			std::array<vk::ImageMemoryBarrier, 2> image_barriers = {
+				getHiZBarrier(frame, vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eGeneral),
+				vk::ImageMemoryBarrier(
+					vk::AccessFlags(),  // srcAccessMask, only read since the last barrier
+					vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite,  // dstAccessMask
+					vk::ImageLayout::eDepthStencilReadOnlyOptimal,  // oldLayout
+					vk::ImageLayout::eDepthStencilAttachmentOptimal,  // newLayout
+					VK_QUEUE_FAMILY_IGNORED,  // srcQueueFamilyIndex
+					VK_QUEUE_FAMILY_IGNORED,  // dstQueueFamilyIndex
+					static_cast<vk::Image>(depth_images[frame].get()),  // image
+					vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1)  // subresourceRange
+				)
+			};
+			command.pipelineBarrier(
+				vk::PipelineStageFlagBits::eComputeShader,
+				vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests,
+				vk::DependencyFlags(),
+				0, nullptr,
+				0, nullptr,
+				static_cast<uint32_t>(image_barriers.size()), image_barriers.data()
+			);
+		}
 	}
 
+	if (timestamps_supported)
+	{
+		command.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, timestamp_query_pool.get(), getTimestampQuery(frame, TIMESTAMP_DEPTH_PREPASS_END));
+	}
 }
 
-void _VulkanRenderer_Impl::createGraphicsCommandBuffers()
+/**
+* One command buffer per frame in flight for the frame graph or the shading pass, the graphics pool lets them be reset one by one
+*/
+void _VulkanRenderer_Impl::createFrameCommandBuffers()
 {
-	// Free old command buffers, if any
-	if (command_buffers.size() > 0)
-	{
-		vkFreeCommandBuffers(graphics_device, graphics_command_pool, (uint32_t)command_buffers.size(), command_buffers.data());
-	}
-	command_buffers.clear();
+	vk::CommandBufferAllocateInfo alloc_info = {
+		graphics_command_pool, // command pool
+		vk::CommandBufferLevel::ePrimary, // level
+		static_cast<uint32_t>(frame_command_buffers.size()) // commandBufferCount
+	};
+	auto allocated = device.allocateCommandBuffers(alloc_info);
+	std::copy(allocated.begin(), allocated.end(), frame_command_buffers.begin());
+}
 
-	command_buffers.resize(swap_chain_framebuffers.size());
+/**
+* Record the shading command buffer of a frame into a swap chain image for submitShading(),
+* the frame's fence must have been waited for
+*/
+void _VulkanRenderer_Impl::recordShadingCommandBuffer(uint32_t frame, size_t image)
+{
+	auto command = frame_command_buffers[frame];
+	command.reset(vk::CommandBufferResetFlags());
+	command.begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit, nullptr });
+
+	// the render pass keeps the swap chain image in the attachment layout, the graph transitions it before and for presenting
+	VFrameGraph graph;
+	auto resources = addFrameGraphResources(graph, frame, vk::ImageLayout::eDepthStencilReadOnlyOptimal);
+	addShadingPass(graph, resources, frame, image);
+	graph.compile();
+	graph.execute(command);
+
+	command.end();
+}
 
-	VkCommandBufferAllocateInfo alloc_info = {};
-	alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	alloc_info.commandPool = graphics_command_pool;
-	alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	// primary: can be submitted to a queue but cannot be called from other command buffers
-	// secondary: can be called by others but cannot be submitted to a queue
-	alloc_info.commandBufferCount = (uint32_t)command_buffers.size();
+/**
+* Pick the mesh parts a frame draws: with CPU culling the ones whose bounding sphere and bounds intersect the view frustum,
+* otherwise every part. Writes the draw commands of the visible parts, in the order of the model,
+* into the shading region of the frame's prepass draw buffer
+*/
+void _VulkanRenderer_Impl::cullMeshParts(uint32_t frame)
+{
+	const auto& parts = model.getMeshParts();
+	auto& visible = frame_visible_parts[frame];
+	visible.clear();
+	visible_triangle_count = 0;
 
-	auto alloc_result = vkAllocateCommandBuffers(graphics_device, &alloc_info, command_buffers.data());
-	if (alloc_result != VK_SUCCESS)
+	if (!isCpuCullingActive())
 	{
-		throw std::runtime_error("failed to allocate command buffers!");
+		visible.resize(parts.size());
+		std::iota(visible.begin(), visible.end(), 0);
+		for (const auto& part : parts)
+		{
+			visible_triangle_count += part.index_count / 3;
+		}
+		visible_part_count = visible.size();
+		return;
 	}
 
-	// record command buffers
-	for (size_t i = 0; i < command_buffers.size(); i++)
+	// the planes of the frustum from the rows of the view projection, Vulkan depth goes from 0 to 1,
+	// the model is uniformly scaled into world space, see updateUniformBuffers()
+	glm::mat4 m = glm::transpose(last_camera_ubo.projview);
+	std::array<glm::vec4, 6> planes = {
+		m[3] + m[0], m[3] - m[0],
+		m[3] + m[1], m[3] - m[1],
+		m[2], m[3] - m[2]
+	};
+	for (auto& plane : planes)
 	{
-		VkCommandBufferBeginInfo begin_info = {};
-		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-		begin_info.pInheritanceInfo = nullptr; // Optional
-
-		vkBeginCommandBuffer(command_buffers[i], &begin_info);
+		plane /= glm::length(glm::vec3(plane));
+	}
+	float scale = getGlobalTestSceneConfiguration().scale;
 
-		// render pass
+	for (uint32_t i = 0; i < static_cast<uint32_t>(parts.size()); i++)
+	{
+		const auto& part = parts[i];
+		auto center = part.bounding_sphere_center * scale;
+		float radius = part.bounding_sphere_radius * scale;
+		auto bounds_min = part.bounds_min * scale;
+		auto bounds_max = part.bounds_max * scale;
+
+		// the sphere rejects most parts cheaply, the corner of the bounds farthest along each plane the rest
+		bool inside = true;
+		for (const auto& plane : planes)
 		{
-			VkRenderPassBeginInfo render_pass_info = {};
-			render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-			render_pass_info.renderPass = render_pass.get();
-			render_pass_info.framebuffer = swap_chain_framebuffers[i].get();
-			render_pass_info.renderArea.offset = { 0, 0 };
-			render_pass_info.renderArea.extent = swap_chain_extent;
-
-			std::array<VkClearValue, 1> clear_values = {};
-			clear_values[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
-			//clear_values[1].depthStencil = { 1.0f, 0 }; // don't clear with depth prepass
-			render_pass_info.clearValueCount = (uint32_t)clear_values.size();
-			render_pass_info.pClearValues = clear_values.data();
-
-			vkCmdBeginRenderPass(command_buffers[i], &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
-
-			PushConstantObject pco = {
-				static_cast<int>(swap_chain_extent.width),
-				static_cast<int>(swap_chain_extent.height),
-				tile_count_per_row, tile_count_per_col,
-				debug_view_index
-			};
-			vkCmdPushConstants(command_buffers[i], pipeline_layout.get(), VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pco), &pco);
-
-
-			vkCmdBindPipeline(command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_pipeline.get());
-
-			std::array<VkDescriptorSet, 4> descriptor_sets = { object_descriptor_set, camera_descriptor_set, light_culling_descriptor_set, intermediate_descriptor_set };
-			vkCmdBindDescriptorSets(command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS
-				, pipeline_layout.get(), 0, static_cast<uint32_t>(descriptor_sets.size()), descriptor_sets.data(), 0, nullptr);
-
-			for (const auto& part : model.getMeshParts())
+			glm::vec3 normal(plane);
+			glm::vec3 farthest_corner = glm::mix(bounds_min, bounds_max, glm::vec3(glm::greaterThanEqual(normal, glm::vec3(0.0f))));
+			if (glm::dot(normal, center) + plane.w < -radius || glm::dot(normal, farthest_corner) + plane.w < 0.0f)
 			{
+				inside = false;
+				break;
+			}
+		}
+		if (inside)
+		{
+			visible.push_back(i);
+			visible_triangle_count += part.index_count / 3;
+		}
+	}
+	visible_part_count = visible.size();
 
-				// bind vertex buffer
-				VkBuffer vertex_buffers[] = { part.vertex_buffer_section.buffer };
-				VkDeviceSize offsets[] = { part.vertex_buffer_section.offset };
-				vkCmdBindVertexBuffers(command_buffers[i], 0, 1, vertex_buffers, offsets);
-				//vkCmdBindIndexBuffer(command_buffers[i], index_buffer, 0, VK_INDEX_TYPE_UINT16);
-				vkCmdBindIndexBuffer(command_buffers[i], part.index_buffer_section.buffer, part.index_buffer_section.offset, VK_INDEX_TYPE_UINT32);
+	// the frame's fence was waited for, so the GPU is done with the buffer
+	auto commands = reinterpret_cast<VkDrawIndexedIndirectCommand*>(static_cast<char*>(prepass_draw_buffer_data[frame]) + shading_draws_offset);
+	for (size_t i = 0; i < visible.size(); i++)
+	{
+		const auto& part = parts[visible[i]];
+		commands[i] = { static_cast<uint32_t>(part.index_count), 1, part.first_index, part.vertex_offset, part.material_index };
+	}
+}
 
-				std::array<VkDescriptorSet, 1> mesh_descriptor_sets = { part.material_descriptor_set };
-				vkCmdBindDescriptorSets(command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS
-					, pipeline_layout.get(), static_cast<uint32_t>(descriptor_sets.size()), static_cast<uint32_t>(mesh_descriptor_sets.size()), mesh_descriptor_sets.data(), 0, nullptr);
+/**
+* Order the mesh parts for the depth prepass of a frame, so early depth tests reject as much as they can:
+* the occluders, parts covering a large share of the screen, front to back, then the other parts front to back.
+* Parts are compared by the distance from the camera to their bounds. Only the parts cullMeshParts() kept are drawn.
+* Writes the order and its draw commands into the frame's prepass draw buffer, the order of the model when draw sorting is off
+*/
+void _VulkanRenderer_Impl::sortPrepassDraws(uint32_t frame)
+{
+	const auto& parts = model.getMeshParts();
+	prepass_draw_order = frame_visible_parts[frame];
+	prepass_occluder_count = 0;
 
-				//vkCmdDraw(command_buffers[i], VERTICES.size(), 1, 0, 0);
-				vkCmdDrawIndexed(command_buffers[i], static_cast<uint32_t>(part.index_count), 1, 0, 0, 0);
+	if (draw_sorting_enabled)
+	{
+		// the model is uniformly scaled into world space, see updateUniformBuffers()
+		float scale = getGlobalTestSceneConfiguration().scale;
+		float projection_scale = std::abs(last_camera_ubo.proj[1][1]); // half the viewport height over the distance, per unit
+		auto camera_position = last_camera_ubo.cam_pos;
+		std::vector<float> distances(parts.size());
+		std::vector<bool> occluders(parts.size());
+		for (auto i : prepass_draw_order)
+		{
+			auto bounds_min = parts[i].bounds_min * scale;
+			auto bounds_max = parts[i].bounds_max * scale;
+			// 0 from inside the bounds
+			distances[i] = glm::distance(camera_position, glm::clamp(camera_position, bounds_min, bounds_max));
+
+			float radius = 0.5f * glm::distance(bounds_min, bounds_max);
+			float center_distance = glm::distance(camera_position, 0.5f * (bounds_min + bounds_max));
+			occluders[i] = center_distance <= radius || radius * projection_scale >= OCCLUDER_MIN_SCREEN_SIZE * center_distance;
+			if (occluders[i])
+			{
+				prepass_occluder_count++;
 			}
-			vkCmdEndRenderPass(command_buffers[i]);
-			//utility.recordTransitImageLayout(command_buffers[i], pre_pass_depth_image.get(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
-		
 		}
 
-		auto record_result = vkEndCommandBuffer(command_buffers[i]);
-		if (record_result != VK_SUCCESS)
+		std::sort(prepass_draw_order.begin(), prepass_draw_order.end(), [&distances, &occluders](uint32_t a, uint32_t b)
 		{
-			throw std::runtime_error("Failed to record command buffer!");
-		}
+			if (occluders[a] != occluders[b])
+			{
+				return static_cast<bool>(occluders[a]);
+			}
+			return distances[a] < distances[b];
+		});
+	}
+
+	// the frame's fence was waited for, so the GPU is done with the buffer
+	auto commands = static_cast<VkDrawIndexedIndirectCommand*>(prepass_draw_buffer_data[frame]);
+	for (size_t i = 0; i < prepass_draw_order.size(); i++)
+	{
+		const auto& part = parts[prepass_draw_order[i]];
+		commands[i] = { static_cast<uint32_t>(part.index_count), 1, part.first_index, part.vertex_offset, part.material_index };
 	}
+	memcpy(static_cast<char*>(prepass_draw_buffer_data[frame]) + prepass_order_offset, prepass_draw_order.data()
+		, prepass_draw_order.size() * sizeof(uint32_t));
 }
 
-void _VulkanRenderer_Impl::createSemaphores()
+/**
+* Like recordMeshPartDraws(), but the parts from first on in the depth prepass order of the frame, see sortPrepassDraws().
+* Indirect draws draw every visible part from the frame's prepass draw buffer
+*/
+void _VulkanRenderer_Impl::recordPrepassDraws(vk::CommandBuffer command, uint32_t frame, size_t first, size_t count)
 {
-	vk::SemaphoreCreateInfo semaphore_info = { vk::SemaphoreCreateFlags() };
+	if (!draw_sorting_enabled)
+	{
+		recordMeshPartDraws(command, frame, first, count);
+		return;
+	}
 
-	auto destroy_func = [&device = this->device](auto & obj)
+	bindModelBuffers(command);
+
+	const auto& parts = model.getMeshParts();
+	if (!use_indirect_draws)
 	{
-		device.destroySemaphore(obj);
-	};
+		for (size_t i = first; i < first + count; i++)
+		{
+			const auto& part = parts[prepass_draw_order[i]];
+			command.drawIndexed(static_cast<uint32_t>(part.index_count), 1, part.first_index, part.vertex_offset, part.material_index);
+		}
+		return;
+	}
 
-	render_finished_semaphore = VRaii<vk::Semaphore>(
-		device.createSemaphore(semaphore_info, nullptr),
-		destroy_func
-	);
-	image_available_semaphore = VRaii<vk::Semaphore>(
-		device.createSemaphore(semaphore_info, nullptr),
-		destroy_func
-	);
-	lightculling_completed_semaphore = VRaii<vk::Semaphore>(
-		device.createSemaphore(semaphore_info, nullptr),
-		destroy_func
-	);
-	depth_prepass_finished_semaphore = VRaii<vk::Semaphore>(
-		device.createSemaphore(semaphore_info, nullptr),
-		destroy_func
-	);
+	auto buffer = static_cast<vk::Buffer>(prepass_draw_buffers[frame].get());
+	auto draw_count = static_cast<uint32_t>(prepass_draw_order.size());
+	auto max_draw_count = vulkan_context.getPhysicalDeviceProperties().limits.maxDrawIndirectCount;
+	const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	for (uint32_t first_draw = 0; first_draw < draw_count; first_draw += max_draw_count)
+	{
+		command.drawIndexedIndirect(buffer, first_draw * stride, std::min(max_draw_count, draw_count - first_draw), stride);
+	}
 }
 
-
 /**
-* Create compute pipeline for light culling
+* Record a phase of GPU culling of a frame into its culled draw lists, phase 0 clears the draw counts and the counters first.
+* Phase 1 needs the pyramid of phase 0's depth, readable by compute shaders, and lists the drawn parts for the shading pass after it.
+* The lists are ready for the indirect draws and the visibility for the next phase afterwards
 */
-void _VulkanRenderer_Impl::createComputePipeline()
+void _VulkanRenderer_Impl::recordMeshCulling(vk::CommandBuffer command, uint32_t frame, int phase)
 {
-	// Step 1: Create Pipeline
+	if (phase == 0)
 	{
-		auto raii_pipeline_layout_deleter = [device = this->device](auto & obj)
-		{
-			device.destroyPipelineLayout(obj);
+		// the counters are shared by the frames in flight, the last frame's culling may still be counting into them
+		vk::MemoryBarrier counters_barrier = {
+			vk::AccessFlagBits::eShaderWrite, // srcAccessMask
+			vk::AccessFlagBits::eTransferWrite // dstAccessMask
 		};
-		auto raii_pipeline_deleter = [device = this->device](auto & obj)
-		{
-			device.destroyPipeline(obj);
+		command.pipelineBarrier(
+			vk::PipelineStageFlagBits::eComputeShader,
+			vk::PipelineStageFlagBits::eTransfer,
+			vk::DependencyFlags(),
+			1, &counters_barrier,
+			0, nullptr,
+			0, nullptr
+		);
+
+		command.fillBuffer(static_cast<vk::Buffer>(culled_draw_buffers[frame].get()), 0, CULLED_DRAW_COUNTS_SIZE, 0);
+		command.fillBuffer(static_cast<vk::Buffer>(mesh_culling_stats_buffer.get()), 0, sizeof(MeshCullingStats), 0);
+
+		// also orders this phase after the visibility written by the last phase 1, and the draw list reads of the last frame
+		vk::MemoryBarrier clear_barrier = {
+			vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eShaderWrite, // srcAccessMask
+			vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite // dstAccessMask
 		};
+		command.pipelineBarrier(
+			vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader,
+			vk::PipelineStageFlagBits::eComputeShader,
+			vk::DependencyFlags(),
+			1, &clear_barrier,
+			0, nullptr,
+			0, nullptr
+		);
+	}
 
-		VkPushConstantRange push_constant_range = {};
-		push_constant_range.offset = 0;
-		push_constant_range.size = sizeof(PushConstantObject);
-		push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	command.bindPipeline(vk::PipelineBindPoint::eCompute, mesh_culling_pipeline.get());
+	std::array<vk::DescriptorSet, 2> descriptor_sets = { camera_descriptor_set, mesh_culling_descriptor_sets[frame] };
+	std::array<uint32_t, 1> dynamic_offsets = { static_cast<uint32_t>(upload_ring.getFrameOffset(frame) + camera_ring_offset) };
+	command.bindDescriptorSets(vk::PipelineBindPoint::eCompute, mesh_culling_pipeline_layout.get(), 0, descriptor_sets, dynamic_offsets);
+
+	auto part_count = static_cast<uint32_t>(model.getMeshParts().size());
+	MeshCullingPushConstants push_constants = {
+		glm::scale(glm::mat4(1.0f), glm::vec3(getGlobalTestSceneConfiguration().scale)), // see updateUniformBuffers()
+		glm::ivec2(static_cast<int>(swap_chain_extent.width), static_cast<int>(swap_chain_extent.height)),
+		part_count,
+		phase
+	};
 
-		VkPipelineLayoutCreateInfo pipeline_layout_info = {};
-		pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-		std::array<VkDescriptorSetLayout, 3> set_layouts = { light_culling_descriptor_set_layout.get(), camera_descriptor_set_layout.get(), intermediate_descriptor_set_layout.get()};
-		pipeline_layout_info.setLayoutCount = static_cast<int>(set_layouts.size());
-		pipeline_layout_info.pSetLayouts = set_layouts.data();
-		pipeline_layout_info.pushConstantRangeCount = 1;
-		pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+	// phase 1 is followed by the phases compacting the drawn flags it wrote into the shading list,
+	// only the scan over the workgroup counts runs as a single workgroup
+	std::vector<int> dispatch_phases = { phase };
+	if (phase == 1)
+	{
+		dispatch_phases.insert(dispatch_phases.end(), MESH_CULLING_SHADING_LIST_PHASES.begin(), MESH_CULLING_SHADING_LIST_PHASES.end());
+	}
+	for (auto dispatch_phase : dispatch_phases)
+	{
+		push_constants.phase = dispatch_phase;
+		command.pushConstants(mesh_culling_pipeline_layout.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(push_constants), &push_constants);
+		command.dispatch(dispatch_phase == MESH_CULLING_SHADING_LIST_PHASES[1] ? 1
+			: (part_count + MESH_CULLING_WORKGROUP_SIZE - 1) / MESH_CULLING_WORKGROUP_SIZE, 1, 1);
+
+		// the counters are read back on the host, see readMeshCullingStats()
+		vk::MemoryBarrier culling_barrier = {
+			vk::AccessFlagBits::eShaderWrite, // srcAccessMask
+			vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eHostRead // dstAccessMask
+		};
+		command.pipelineBarrier(
+			vk::PipelineStageFlagBits::eComputeShader,
+			vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eHost,
+			vk::DependencyFlags(),
+			1, &culling_barrier,
+			0, nullptr,
+			0, nullptr
+		);
+	}
+}
 
-		VkPipelineLayout temp_layout;
-		vulkan_util::checkResult(vkCreatePipelineLayout(graphics_device, &pipeline_layout_info, nullptr, &temp_layout));
-		compute_pipeline_layout = VRaii<VkPipelineLayout>(temp_layout, raii_pipeline_layout_deleter);
+/**
+* Record the mesh parts a frame draws inside a render pass begun with secondary command buffer contents,
+* first and count of the chunks index into frame_visible_parts. The parts are split into chunks which the recording threads record into secondary command buffers
+* from their own command pools, the primary executes them in order
+*/
+void _VulkanRenderer_Impl::recordMeshParts(vk::CommandBuffer command, uint32_t frame, vk::RenderPass render_pass, vk::Framebuffer framebuffer
+	, const std::function<void(vk::CommandBuffer, size_t first, size_t count)>& record_chunk)
+{
+	auto start_time = std::chrono::high_resolution_clock::now();
 
-		auto light_culling_comp_shader_code = util::readFile(util::getContentPath("light_culling_comp.spv"));
+	// indirect draws take the same few commands for any number of parts, so they are recorded as one chunk
+	auto part_count = frame_visible_parts[frame].size();
+	auto chunk_size = use_indirect_draws ? std::max<size_t>(part_count, 1) : MESH_PARTS_PER_RECORDING_CHUNK;
+	std::vector<vk::CommandBuffer> secondaries((part_count + chunk_size - 1) / chunk_size);
+	recording_thread_pool->parallelFor(part_count, chunk_size, [&](size_t first, size_t count)
+	{
+		auto secondary = thread_command_pools.allocateSecondary(frame, ThreadPool::getCurrentThreadIndex());
+		vk::CommandBufferInheritanceInfo inheritance_info = {
+			render_pass, // renderPass
+			0, // subpass
+			framebuffer, // framebuffer
+			VK_FALSE, // occlusionQueryEnable
+			vk::QueryControlFlags(), // queryFlags
+			// the shading pass counts its fragments around the secondaries
+			pipeline_statistics_supported ? vk::QueryPipelineStatisticFlags(vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations)
+				: vk::QueryPipelineStatisticFlags() // pipelineStatistics
+		};
+		secondary.begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit | vk::CommandBufferUsageFlagBits::eRenderPassContinue, &inheritance_info });
+		record_chunk(secondary, first, count);
+		secondary.end();
+		secondaries[first / chunk_size] = secondary;
+	});
 
-		auto comp_shader_module = createShaderModule(light_culling_comp_shader_code);
-		VkPipelineShaderStageCreateInfo comp_shader_stage_info = {};
-		comp_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		comp_shader_stage_info.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-		comp_shader_stage_info.module = comp_shader_module.get();
-		comp_shader_stage_info.pName = "main";
+	if (!secondaries.empty())
+	{
+		command.executeCommands(static_cast<uint32_t>(secondaries.size()), secondaries.data());
+	}
 
-		VkComputePipelineCreateInfo pipeline_create_info;
-		pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-		pipeline_create_info.stage = comp_shader_stage_info;
-		pipeline_create_info.layout = compute_pipeline_layout.get();
-		pipeline_create_info.pNext = nullptr;
-		pipeline_create_info.flags = 0;
-		pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE; // not deriving from existing pipeline
-		pipeline_create_info.basePipelineIndex = -1; // Optional
+	recording_ms += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start_time).count();
+}
 
-		VkPipeline temp_pipeline;
-		vulkan_util::checkResult(vkCreateComputePipelines(graphics_device, VK_NULL_HANDLE, 1, &pipeline_create_info, nullptr, &temp_pipeline));
-		compute_pipeline = VRaii<VkPipeline>(temp_pipeline, raii_pipeline_deleter);
-	};
+void _VulkanRenderer_Impl::bindModelBuffers(vk::CommandBuffer command)
+{
+	auto vertex_buffer_section = model.getVertexBufferSection();
+	auto index_buffer_section = model.getIndexBufferSection();
+	std::array<vk::Buffer, 1> vertex_buffers = { vertex_buffer_section.buffer };
+	std::array<vk::DeviceSize, 1> vertex_offsets = { vertex_buffer_section.offset };
+	command.bindVertexBuffers(0, vertex_buffers, vertex_offsets);
+	command.bindIndexBuffer(index_buffer_section.buffer, index_buffer_section.offset, vk::IndexType::eUint32);
 }
 
 /**
-* creating light visiblity descriptor sets for both passes
+* Bind the vertex and index buffers of the model and draw the visible mesh parts of a frame from first on,
+* with the pipeline and descriptor sets bound. Indirect draws always draw every visible part: from the frame's prepass draw buffer
+* with CPU culling, otherwise from the draw commands of the model, a single call when the count buffer is supported
 */
-void _VulkanRenderer_Impl::createLigutCullingDescriptorSet()
+void _VulkanRenderer_Impl::recordMeshPartDraws(vk::CommandBuffer command, uint32_t frame, size_t first, size_t count)
 {
-	// create shared dercriptor set between compute pipeline and rendering pipeline
+	bindModelBuffers(command);
+
+	const auto& parts = model.getMeshParts();
+	const auto& visible = frame_visible_parts[frame];
+	if (!use_indirect_draws)
 	{
-		// todo: reduce code duplication with createDescriptorSet()
-		VkDescriptorSetLayout layouts[] = { light_culling_descriptor_set_layout.get() };
-		VkDescriptorSetAllocateInfo alloc_info = {};
-		alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		alloc_info.descriptorPool = descriptor_pool.get();
-		alloc_info.descriptorSetCount = 1;
-		alloc_info.pSetLayouts = layouts;
+		for (size_t i = first; i < first + count; i++)
+		{
+			const auto& part = parts[visible[i]];
+			command.drawIndexed(static_cast<uint32_t>(part.index_count), 1, part.first_index, part.vertex_offset, part.material_index);
+		}
+		return;
+	}
 
-		light_culling_descriptor_set = device.allocateDescriptorSets(alloc_info)[0];
+	auto max_draw_count = vulkan_context.getPhysicalDeviceProperties().limits.maxDrawIndirectCount; // at least 65535 with multiDrawIndirect
+	const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	if (isCpuCullingActive())
+	{
+		auto buffer = static_cast<vk::Buffer>(prepass_draw_buffers[frame].get());
+		auto draw_count = static_cast<uint32_t>(visible.size());
+		for (uint32_t first_draw = 0; first_draw < draw_count; first_draw += max_draw_count)
+		{
+			command.drawIndexedIndirect(buffer, shading_draws_offset + first_draw * stride, std::min(max_draw_count, draw_count - first_draw), stride);
+		}
+		return;
 	}
 
+	auto draw_commands = model.getDrawCommandBufferSection();
+	auto part_count = static_cast<uint32_t>(parts.size());
+	if (vulkan_context.supportsDrawIndirectCount() && part_count <= max_draw_count)
+	{
+		auto draw_count = model.getDrawCountBufferSection();
+		vulkan_context.cmdDrawIndexedIndirectCount(command, draw_commands.buffer, draw_commands.offset
+			, draw_count.buffer, draw_count.offset, part_count, stride);
+	}
+	else
+	{
+		for (uint32_t first_draw = 0; first_draw < part_count; first_draw += max_draw_count)
+		{
+			command.drawIndexedIndirect(draw_commands.buffer, draw_commands.offset + first_draw * stride
+				, std::min(max_draw_count, part_count - first_draw), stride);
+		}
+	}
 }
 
-// just for sizing information
-struct _Dummy_VisibleLightsForTile
+/**
+* Bind the vertex and index buffers of the model and draw the culled draw lists of a frame's phases from first_phase on,
+* with the pipeline and descriptor sets bound. Each list is drawn with the count GPU culling wrote for it
+*/
+void _VulkanRenderer_Impl::recordCulledMeshPartDraws(vk::CommandBuffer command, uint32_t frame, uint32_t first_phase, uint32_t phase_count)
 {
-	uint32_t count;
-	std::array<uint32_t, MAX_POINT_LIGHT_PER_TILE> lightindices;
-};
+	bindModelBuffers(command);
+
+	auto buffer = static_cast<vk::Buffer>(culled_draw_buffers[frame].get());
+	auto part_count = static_cast<uint32_t>(model.getMeshParts().size());
+	const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	for (uint32_t phase = first_phase; phase < first_phase + phase_count; phase++)
+	{
+		vulkan_context.cmdDrawIndexedIndirectCount(command, buffer, CULLED_DRAW_COUNTS_SIZE + phase * part_count * stride
+			, buffer, phase * sizeof(uint32_t), part_count, stride);
+	}
+}
 
 /**
-* Create or recreate light visibility buffer and its descriptor
+* Record the shading pass of a frame into a swap chain image with its timestamps
 */
-void _VulkanRenderer_Impl::createLightVisibilityBuffer()
+void _VulkanRenderer_Impl::recordShading(VkCommandBuffer command, uint32_t frame, size_t image)
 {
-	assert(sizeof(_Dummy_VisibleLightsForTile) == sizeof(int) * (MAX_POINT_LIGHT_PER_TILE + 1));
+	auto light_culling_descriptor_set = light_culling_descriptor_sets[frame];
 
-	tile_count_per_row = (swap_chain_extent.width - 1) / TILE_SIZE + 1;
-	tile_count_per_col = (swap_chain_extent.height - 1) / TILE_SIZE + 1;
+	if (timestamps_supported)
+	{
+		vkCmdResetQueryPool(command, timestamp_query_pool.get(), getTimestampQuery(frame, TIMESTAMP_SHADING_BEGIN), TIMESTAMP_QUERY_COUNT - TIMESTAMP_SHADING_BEGIN);
+		vkCmdWriteTimestamp(command, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestamp_query_pool.get(), getTimestampQuery(frame, TIMESTAMP_SHADING_BEGIN));
+	}
+	if (pipeline_statistics_supported)
+	{
+		vkCmdResetQueryPool(command, pipeline_statistics_query_pool.get(), frame, 1);
+		vkCmdBeginQuery(command, pipeline_statistics_query_pool.get(), frame, 0);
+	}
 
-	light_visibility_buffer_size = sizeof(_Dummy_VisibleLightsForTile) * tile_count_per_row * tile_count_per_col;
+	// render pass
+	{
+		VkRenderPassBeginInfo render_pass_info = {};
+		render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		render_pass_info.renderPass = render_pass.get();
+		render_pass_info.framebuffer = swap_chain_framebuffers[frame * swap_chain_imageviews.size() + image].get();
+		render_pass_info.renderArea.offset = { 0, 0 };
+		render_pass_info.renderArea.extent = swap_chain_extent;
+
+		std::array<VkClearValue, 1> clear_values = {};
+		clear_values[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
+		//clear_values[1].depthStencil = { 1.0f, 0 }; // don't clear with depth prepass
+		render_pass_info.clearValueCount = (uint32_t)clear_values.size();
+		render_pass_info.pClearValues = clear_values.data();
+
+		vkCmdBeginRenderPass(command, &render_pass_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+		recordMeshParts(static_cast<vk::CommandBuffer>(command), frame, render_pass.get(), swap_chain_framebuffers[frame * swap_chain_imageviews.size() + image].get()
+			, [this, frame, light_culling_descriptor_set](vk::CommandBuffer secondary_command, size_t first, size_t count)
+		{
+			auto secondary = static_cast<VkCommandBuffer>(secondary_command);
 
-	std::tie(light_visibility_buffer, light_visibility_buffer_memory) = utility.createBuffer(
-		light_visibility_buffer_size
-		, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
-		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-	); // using barrier to sync
+			// nothing is inherited from the primary, every secondary binds its own state
+			PushConstantObject pco = {
+				static_cast<int>(swap_chain_extent.width),
+				static_cast<int>(swap_chain_extent.height),
+				tile_count_per_row, tile_count_per_col
+			};
+			vkCmdPushConstants(secondary, pipeline_layout.get(), VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pco), &pco);
 
-	// Write desciptor set in compute shader
-	{
-		// refer to the uniform object buffer
-		vk::DescriptorBufferInfo light_visibility_buffer_info{
-			light_visibility_buffer.get(), // buffer_
-			0, //offset_
-			light_visibility_buffer_size // range_
-		};
+			vkCmdBindPipeline(secondary, VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_pipelines[debug_view_index].get());
 
-		// refer to the uniform object buffer
-		vk::DescriptorBufferInfo pointlight_buffer_info = {
-			pointlight_buffer.get(), // buffer_
-			0, //offset_
-			pointlight_buffer_size // range_
-		};
+			// the bindless material set is bound once along with the others, the classic ones per mesh part
+			std::array<VkDescriptorSet, 5> descriptor_sets = { object_descriptor_set, camera_descriptor_set, light_culling_descriptor_set, intermediate_descriptor_sets[frame]
+				, bindless_material_descriptor_set };
+			uint32_t descriptor_set_count = use_bindless_materials ? 5 : 4;
+			std::array<uint32_t, 2> dynamic_offsets = {
+				static_cast<uint32_t>(upload_ring.getFrameOffset(frame) + object_ring_offset),
+				static_cast<uint32_t>(upload_ring.getFrameOffset(frame) + camera_ring_offset)
+			};
+			vkCmdBindDescriptorSets(secondary, VK_PIPELINE_BIND_POINT_GRAPHICS
+				, pipeline_layout.get(), 0, descriptor_set_count, descriptor_sets.data()
+				, static_cast<uint32_t>(dynamic_offsets.size()), dynamic_offsets.data());
 
-		std::vector<vk::WriteDescriptorSet> descriptor_writes = {};
+			if (isGpuCullingActive())
+			{
+				// the shading list keeps the order of the model, the prepass lists are ordered for early depth tests
+				recordCulledMeshPartDraws(secondary_command, frame, MESH_CULLING_SHADING_LIST, 1);
+				return;
+			}
+			if (use_bindless_materials)
+			{
+				recordMeshPartDraws(secondary_command, frame, first, count);
+				return;
+			}
 
-		descriptor_writes.emplace_back(
-			light_culling_descriptor_set, // dstSet
-			0, // dstBinding
-			0, // distArrayElement
-			1, // descriptorCount
-			vk::DescriptorType::eStorageBuffer, //descriptorType
-			nullptr, //pImageInfo
-			&light_visibility_buffer_info, //pBufferInfo
-			nullptr //pTexBufferView
-		);
+			auto vertex_buffer_section = model.getVertexBufferSection();
+			auto index_buffer_section = model.getIndexBufferSection();
+			VkBuffer vertex_buffers[] = { vertex_buffer_section.buffer };
+			VkDeviceSize offsets[] = { vertex_buffer_section.offset };
+			vkCmdBindVertexBuffers(secondary, 0, 1, vertex_buffers, offsets);
+			vkCmdBindIndexBuffer(secondary, index_buffer_section.buffer, index_buffer_section.offset, VK_INDEX_TYPE_UINT32);
+
+			const auto& parts = model.getMeshParts();
+			const auto& visible = frame_visible_parts[frame];
+			for (size_t i = first; i < first + count; i++)
+			{
+				const auto& part = parts[visible[i]];
+
+				std::array<VkDescriptorSet, 1> mesh_descriptor_sets = { part.material_descriptor_set };
+				vkCmdBindDescriptorSets(secondary, VK_PIPELINE_BIND_POINT_GRAPHICS
+					, pipeline_layout.get(), descriptor_set_count, static_cast<uint32_t>(mesh_descriptor_sets.size()), mesh_descriptor_sets.data(), 0, nullptr);
+
+				// the first instance carries the material index to the shaders
+				vkCmdDrawIndexed(secondary, static_cast<uint32_t>(part.index_count), 1, part.first_index, part.vertex_offset, part.material_index);
+			}
+		});
+		vkCmdEndRenderPass(command);
+		if (pipeline_statistics_supported)
+		{
+			vkCmdEndQuery(command, pipeline_statistics_query_pool.get(), frame);
+		}
+		//utility.recordTransitImageLayout(command, pre_pass_depth_image.get(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+	
+	}
+
+	if (timestamps_supported)
+	{
+		vkCmdWriteTimestamp(command, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestamp_query_pool.get(), getTimestampQuery(frame, TIMESTAMP_SHADING_END));
+	}
+}
+
+/**
+* Add the resources of a frame which its passes share to a frame graph, depth_layout is the layout the depth image is in
+*/
+FrameGraphResources _VulkanRenderer_Impl::addFrameGraphResources(VFrameGraph& graph, uint32_t frame, vk::ImageLayout depth_layout) const
+{
+	FrameGraphResources resources;
+	resources.depth = graph.addImage(static_cast<vk::Image>(depth_images[frame].get()), vk::ImageAspectFlagBits::eDepth, depth_layout);
+	if (use_hiz)
+	{
+		// rebuilt from scratch whenever it's written, so its old content is never kept
+		resources.hiz_pyramid = graph.addImage(static_cast<vk::Image>(hiz_images[frame].get()), vk::ImageAspectFlagBits::eColor, vk::ImageLayout::eUndefined);
+	}
+	resources.pointlight_snapshot = graph.addBuffer(static_cast<vk::Buffer>(pointlight_snapshot_buffers[frame].get()), 0, pointlight_snapshot_buffer_sizes[frame]);
+	resources.spotlight_snapshot = graph.addBuffer(static_cast<vk::Buffer>(spotlight_snapshot_buffers[frame].get()), 0, spotlight_snapshot_buffer_sizes[frame]);
+	resources.light_visibility = graph.addBuffer(static_cast<vk::Buffer>(light_visibility_buffers[frame].get()), 0, light_visibility_buffer_size);
+	resources.spot_light_visibility = graph.addBuffer(static_cast<vk::Buffer>(spot_light_visibility_buffers[frame].get()), 0, spot_light_visibility_buffer_size);
+	resources.light_culling_stats = graph.addBuffer(static_cast<vk::Buffer>(light_culling_stats_buffer.get()), 0, sizeof(LightCullingStats));
+	if (use_gpu_culling)
+	{
+		resources.culled_draws = graph.addBuffer(static_cast<vk::Buffer>(culled_draw_buffers[frame].get()), 0, culled_draw_buffer_size);
+	}
+	return resources;
+}
+
+/**
+* With GPU culling the pass also writes the culled draw lists and builds the pyramid in between its phases,
+* only their writes are declared, the barriers inside the pass are recorded by recordDepthPrePass()
+*/
+void _VulkanRenderer_Impl::addDepthPrePass(VFrameGraph& graph, const FrameGraphResources& resources, uint32_t frame)
+{
+	std::vector<VFrameGraph::Access> accesses = {
+		{ resources.depth, vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests
+			, vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite, vk::ImageLayout::eDepthStencilAttachmentOptimal }
+	};
+	if (isGpuCullingActive())
+	{
+		accesses.push_back({ resources.culled_draws, vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader
+			, vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eShaderWrite });
+		accesses.push_back({ resources.hiz_pyramid, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite, vk::ImageLayout::eGeneral });
+	}
+	graph.addPass("depth prepass", std::move(accesses), [this, frame](vk::CommandBuffer command)
+	{
+		recordDepthPrePass(command, frame);
+	});
+}
+
+/**
+* The light buffers themselves are only used by this pass, it records the barriers on them, only the snapshot is shared
+*/
+void _VulkanRenderer_Impl::addLightUpdatePass(VFrameGraph& graph, const FrameGraphResources& resources, float delta_time)
+{
+	graph.addPass("light update", {
+		{ resources.pointlight_snapshot, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite },
+		{ resources.spotlight_snapshot, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite }
+	}, [this, delta_time](vk::CommandBuffer command)
+	{
+		recordLightUpdate(command, delta_time);
+	});
+}
+
+/**
+* Only the writes of the pyramid are declared, the barriers between the levels are recorded by the pass itself, see recordHiZBuild()
+*/
+void _VulkanRenderer_Impl::addHiZBuildPass(VFrameGraph& graph, const FrameGraphResources& resources, uint32_t frame)
+{
+	std::vector<VFrameGraph::Access> accesses = {
+		{ resources.depth, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eDepthStencilReadOnlyOptimal }
+	};
+	if (use_hiz)
+	{
+		accesses.push_back({ resources.hiz_pyramid, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite, vk::ImageLayout::eGeneral });
+	}
+	// added without the pyramid too, it still writes the timestamps
+	graph.addPass("hi-z build", std::move(accesses), [this, frame](vk::CommandBuffer command)
+	{
+		recordHiZBuild(command, frame);
+	});
+}
+
+void _VulkanRenderer_Impl::addLightCullingPass(VFrameGraph& graph, const FrameGraphResources& resources, uint32_t frame)
+{
+	std::vector<VFrameGraph::Access> accesses = {
+		{ resources.depth, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eDepthStencilReadOnlyOptimal },
+		{ resources.pointlight_snapshot, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead },
+		{ resources.spotlight_snapshot, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead },
+		{ resources.light_visibility, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite },
+		{ resources.spot_light_visibility, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite },
+		// cleared first, see recordLightCulling()
+		{ resources.light_culling_stats, vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader
+			, vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite }
+	};
+	if (use_hiz)
+	{
+		accesses.push_back({ resources.hiz_pyramid, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eGeneral });
+	}
+	graph.addPass("light culling", std::move(accesses), [this, frame](vk::CommandBuffer command)
+	{
+		recordLightCulling(command, frame);
+	});
+}
+
+/**
+* Shade into a swap chain image, which is transitioned from whatever it was presented with and back to presenting.
+* The image available semaphore is waited for at the color attachment output stage
+*/
+void _VulkanRenderer_Impl::addShadingPass(VFrameGraph& graph, const FrameGraphResources& resources, uint32_t frame, size_t image)
+{
+	auto color = graph.addImage(static_cast<vk::Image>(swap_chain_images[image]), vk::ImageAspectFlagBits::eColor
+		, vk::ImageLayout::eUndefined, vk::PipelineStageFlagBits::eColorAttachmentOutput);
+
+	// the depth is tested against and sampled by the debug views
+	std::vector<VFrameGraph::Access> accesses = {
+		{ color, vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::AccessFlagBits::eColorAttachmentWrite, vk::ImageLayout::eColorAttachmentOptimal },
+		{ resources.depth, vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests | vk::PipelineStageFlagBits::eFragmentShader
+			, vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eDepthStencilReadOnlyOptimal },
+		{ resources.pointlight_snapshot, vk::PipelineStageFlagBits::eFragmentShader, vk::AccessFlagBits::eShaderRead },
+		{ resources.spotlight_snapshot, vk::PipelineStageFlagBits::eFragmentShader, vk::AccessFlagBits::eShaderRead },
+		{ resources.light_visibility, vk::PipelineStageFlagBits::eFragmentShader, vk::AccessFlagBits::eShaderRead },
+		{ resources.spot_light_visibility, vk::PipelineStageFlagBits::eFragmentShader, vk::AccessFlagBits::eShaderRead }
+	};
+	if (isGpuCullingActive())
+	{
+		accesses.push_back({ resources.culled_draws, vk::PipelineStageFlagBits::eDrawIndirect, vk::AccessFlagBits::eIndirectCommandRead });
+	}
+	graph.addPass("shading", std::move(accesses), [this, frame, image](vk::CommandBuffer command)
+	{
+		recordShading(static_cast<VkCommandBuffer>(command), frame, image);
+	});
+	graph.setFinalState(color, vk::PipelineStageFlagBits::eBottomOfPipe, vk::AccessFlags(), vk::ImageLayout::ePresentSrcKHR);
+}
+
+void _VulkanRenderer_Impl::createSemaphores()
+{
+	vk::SemaphoreCreateInfo semaphore_info = { vk::SemaphoreCreateFlags() };
+
+	auto destroy_func = [&device = this->device](auto & obj)
+	{
+		device.destroySemaphore(obj);
+	};
+
+	for (uint32_t frame = 0; frame < frames_in_flight; frame++)
+	{
+		render_finished_semaphores[frame] = VRaii<vk::Semaphore>(
+			device.createSemaphore(semaphore_info, nullptr),
+			destroy_func
+		);
+		image_available_semaphores[frame] = VRaii<vk::Semaphore>(
+			device.createSemaphore(semaphore_info, nullptr),
+			destroy_func
+		);
+		lightculling_completed_semaphores[frame] = VRaii<vk::Semaphore>(
+			device.createSemaphore(semaphore_info, nullptr),
+			destroy_func
+		);
+		depth_prepass_finished_semaphores[frame] = VRaii<vk::Semaphore>(
+			device.createSemaphore(semaphore_info, nullptr),
+			destroy_func
+		);
+
+		// signaled so that the first frames don't wait
+		frame_fences[frame] = VRaii<vk::Fence>(
+			device.createFence({ vk::FenceCreateFlagBits::eSignaled }, nullptr),
+			[device = this->device](auto & obj)
+			{
+				device.destroyFence(obj);
+			}
+		);
+	}
+}
+
+
+/**
+* Create compute pipeline for light culling
+*/
+void _VulkanRenderer_Impl::createComputePipeline()
+{
+	// Step 1: Create Pipeline
+	{
+		auto raii_pipeline_layout_deleter = [device = this->device](auto & obj)
+		{
+			device.destroyPipelineLayout(obj);
+		};
+		auto raii_pipeline_deleter = [device = this->device](auto & obj)
+		{
+			device.destroyPipeline(obj);
+		};
+
+		VkPushConstantRange push_constant_range = {};
+		push_constant_range.offset = 0;
+		push_constant_range.size = sizeof(PushConstantObject);
+		push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+		VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+		pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		std::array<VkDescriptorSetLayout, 3> set_layouts = { light_culling_descriptor_set_layout.get(), camera_descriptor_set_layout.get(), intermediate_descriptor_set_layout.get()};
+		pipeline_layout_info.setLayoutCount = static_cast<int>(set_layouts.size());
+		pipeline_layout_info.pSetLayouts = set_layouts.data();
+		pipeline_layout_info.pushConstantRangeCount = 1;
+		pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+
+		VkPipelineLayout temp_layout;
+		vulkan_util::checkResult(vkCreatePipelineLayout(graphics_device, &pipeline_layout_info, nullptr, &temp_layout));
+		compute_pipeline_layout = VRaii<VkPipelineLayout>(temp_layout, raii_pipeline_layout_deleter);
+
+		// the subgroup variant is compiled separately since it needs SPIR-V 1.3
+		auto light_culling_comp_shader_code = util::readFile(util::getContentPath(
+			use_subgroup_light_append ? "light_culling_subgroup_comp.spv" : "light_culling_comp.spv"));
+
+		auto comp_shader_module = createShaderModule(light_culling_comp_shader_code);
+		VkPipelineShaderStageCreateInfo comp_shader_stage_info = {};
+		comp_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		comp_shader_stage_info.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		comp_shader_stage_info.module = comp_shader_module.get();
+		comp_shader_stage_info.pName = "main";
+
+		auto specialization_data = getSpecializationConstants();
+		auto specialization_entries = SpecializationConstants::getMapEntries();
+		vk::SpecializationInfo specialization_info = {
+			static_cast<uint32_t>(specialization_entries.size()), // mapEntryCount
+			specialization_entries.data(), // pMapEntries
+			sizeof(specialization_data), // dataSize
+			&specialization_data // pData
+		};
+		comp_shader_stage_info.pSpecializationInfo = &static_cast<const VkSpecializationInfo&>(specialization_info);
+
+		VkComputePipelineCreateInfo pipeline_create_info;
+		pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipeline_create_info.stage = comp_shader_stage_info;
+		pipeline_create_info.layout = compute_pipeline_layout.get();
+		pipeline_create_info.pNext = nullptr;
+		pipeline_create_info.flags = 0;
+		pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE; // not deriving from existing pipeline
+		pipeline_create_info.basePipelineIndex = -1; // Optional
+
+		VkPipeline temp_pipeline;
+		vulkan_util::checkResult(vkCreateComputePipelines(graphics_device, pipeline_cache, 1, &pipeline_create_info, nullptr, &temp_pipeline));
+		compute_pipeline = VRaii<VkPipeline>(temp_pipeline, raii_pipeline_deleter);
+	};
+}
+
+/**
+* Create the compute pipeline building a level of the Hi-Z pyramid
+*/
+void _VulkanRenderer_Impl::createHiZPipeline()
+{
+	vk::PushConstantRange push_constant_range = {
+		vk::ShaderStageFlagBits::eCompute, // stageFlags
+		0, // offset
+		sizeof(HiZPushConstants) // size
+	};
+	vk::DescriptorSetLayout set_layout = hiz_descriptor_set_layout.get();
+	vk::PipelineLayoutCreateInfo pipeline_layout_info = {
+		vk::PipelineLayoutCreateFlags(), // flags
+		1, // setLayoutCount
+		&set_layout, // pSetLayouts
+		1, // pushConstantRangeCount
+		&push_constant_range // pPushConstantRanges
+	};
+	hiz_pipeline_layout = VRaii<vk::PipelineLayout>(
+		device.createPipelineLayout(pipeline_layout_info, nullptr),
+		[device = this->device](auto & obj)
+		{
+			device.destroyPipelineLayout(obj);
+		}
+	);
+
+	auto hiz_comp_shader_code = util::readFile(util::getContentPath("hiz_build_comp.spv"));
+	auto comp_shader_module = createShaderModule(hiz_comp_shader_code);
+
+	vk::ComputePipelineCreateInfo pipeline_create_info = {
+		vk::PipelineCreateFlags(), // flags
+		vk::PipelineShaderStageCreateInfo(vk::PipelineShaderStageCreateFlags(), vk::ShaderStageFlagBits::eCompute, comp_shader_module.get(), "main"), // stage
+		hiz_pipeline_layout.get() // layout
+	};
+	hiz_pipeline = VRaii<vk::Pipeline>(
+		device.createComputePipeline(pipeline_cache, pipeline_create_info, nullptr).value,
+		[device = this->device](auto & obj)
+		{
+			device.destroyPipeline(obj);
+		}
+	);
+}
+
+void _VulkanRenderer_Impl::createMeshCullingPipeline()
+{
+	vk::PushConstantRange push_constant_range = {
+		vk::ShaderStageFlagBits::eCompute, // stageFlags
+		0, // offset
+		sizeof(MeshCullingPushConstants) // size
+	};
+	std::array<vk::DescriptorSetLayout, 2> set_layouts = { camera_descriptor_set_layout.get(), mesh_culling_descriptor_set_layout.get() };
+	vk::PipelineLayoutCreateInfo pipeline_layout_info = {
+		vk::PipelineLayoutCreateFlags(), // flags
+		static_cast<uint32_t>(set_layouts.size()), // setLayoutCount
+		set_layouts.data(), // pSetLayouts
+		1, // pushConstantRangeCount
+		&push_constant_range // pPushConstantRanges
+	};
+	mesh_culling_pipeline_layout = VRaii<vk::PipelineLayout>(
+		device.createPipelineLayout(pipeline_layout_info, nullptr),
+		[device = this->device](auto & obj)
+		{
+			device.destroyPipelineLayout(obj);
+		}
+	);
+
+	auto mesh_culling_comp_shader_code = util::readFile(util::getContentPath("mesh_culling_comp.spv"));
+	auto comp_shader_module = createShaderModule(mesh_culling_comp_shader_code);
+
+	vk::ComputePipelineCreateInfo pipeline_create_info = {
+		vk::PipelineCreateFlags(), // flags
+		vk::PipelineShaderStageCreateInfo(vk::PipelineShaderStageCreateFlags(), vk::ShaderStageFlagBits::eCompute, comp_shader_module.get(), "main"), // stage
+		mesh_culling_pipeline_layout.get() // layout
+	};
+	mesh_culling_pipeline = VRaii<vk::Pipeline>(
+		device.createComputePipeline(pipeline_cache, pipeline_create_info, nullptr).value,
+		[device = this->device](auto & obj)
+		{
+			device.destroyPipeline(obj);
+		}
+	);
+}
+
+/**
+* creating light visiblity descriptor sets for both passes
+*/
+void _VulkanRenderer_Impl::createLigutCullingDescriptorSet()
+{
+	// create shared dercriptor set between compute pipeline and rendering pipeline
+	{
+		// todo: reduce code duplication with createDescriptorSet()
+		std::array<VkDescriptorSetLayout, MAX_FRAMES_IN_FLIGHT> layouts;
+		layouts.fill(light_culling_descriptor_set_layout.get());
+		VkDescriptorSetAllocateInfo alloc_info = {};
+		alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		alloc_info.descriptorPool = descriptor_pool.get();
+		alloc_info.descriptorSetCount = frames_in_flight;
+		alloc_info.pSetLayouts = layouts.data();
+
+		vulkan_util::checkResult(vkAllocateDescriptorSets(graphics_device, &alloc_info, light_culling_descriptor_sets.data()));
+		vulkan_util::checkResult(vkAllocateDescriptorSets(graphics_device, &alloc_info, light_update_descriptor_sets.data()));
+	}
+
+}
+
+/**
+* Create or recreate light visibility buffer and its descriptors, the GPU must be idle
+*/
+void _VulkanRenderer_Impl::createLightVisibilityBuffer()
+{
+	tile_count_per_row = (swap_chain_extent.width - 1) / tile_size + 1;
+	tile_count_per_col = (swap_chain_extent.height - 1) / tile_size + 1;
+
+	// a light count followed by max_point_light_per_tile light indices per tile
+	light_visibility_buffer_size = sizeof(uint32_t) * (max_point_light_per_tile + 1) * tile_count_per_row * tile_count_per_col;
+	spot_light_visibility_buffer_size = sizeof(uint32_t) * (max_spot_light_per_tile + 1) * tile_count_per_row * tile_count_per_col;
+
+	// one set per frame, so a frame never shades from visibility buffers another frame in flight is culling into
+	for (uint32_t frame = 0; frame < frames_in_flight; frame++)
+	{
+		std::tie(light_visibility_buffers[frame], light_visibility_buffer_memories[frame]) = utility.createBuffer(
+			light_visibility_buffer_size
+			, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+		); // using barrier to sync
+
+		std::tie(spot_light_visibility_buffers[frame], spot_light_visibility_buffer_memories[frame]) = utility.createBuffer(
+			spot_light_visibility_buffer_size
+			, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+		);
+
+		if (frame_light_buffer_generations[frame] != light_buffer_generation)
+		{
+			createFrameLightSnapshot(frame);
+		}
+		updateLightCullingDescriptorSet(frame);
+		frame_light_buffer_generations[frame] = light_buffer_generation;
+	}
+}
+
+/**
+* Write the descriptor set of a frame, it must not be in use by the GPU
+*/
+void _VulkanRenderer_Impl::updateLightCullingDescriptorSet(uint32_t frame)
+{
+	auto light_culling_descriptor_set = light_culling_descriptor_sets[frame];
+
+	// Write desciptor set in compute shader
+	{
+		// refer to the uniform object buffer
+		vk::DescriptorBufferInfo light_visibility_buffer_info{
+			light_visibility_buffers[frame].get(), // buffer_
+			0, //offset_
+			light_visibility_buffer_size // range_
+		};
+
+		// refer to the uniform object buffer
+		vk::DescriptorBufferInfo pointlight_buffer_info = {
+			pointlight_snapshot_buffers[frame].get(), // buffer_
+			0, //offset_
+			pointlight_snapshot_buffer_sizes[frame] // range_
+		};
+
+		vk::DescriptorBufferInfo light_culling_stats_buffer_info = {
+			light_culling_stats_buffer.get(), // buffer_
+			0, //offset_
+			sizeof(LightCullingStats) // range_
+		};
+
+		vk::DescriptorBufferInfo spotlight_buffer_info = {
+			spotlight_snapshot_buffers[frame].get(), // buffer_
+			0, //offset_
+			spotlight_snapshot_buffer_sizes[frame] // range_
+		};
+
+		vk::DescriptorBufferInfo spot_light_visibility_buffer_info = {
+			spot_light_visibility_buffers[frame].get(), // buffer_
+			0, //offset_
+			spot_light_visibility_buffer_size // range_
+		};
+
+		std::vector<vk::WriteDescriptorSet> descriptor_writes = {};
+
+		descriptor_writes.emplace_back(
+			light_culling_descriptor_set, // dstSet
+			0, // dstBinding
+			0, // distArrayElement
+			1, // descriptorCount
+			vk::DescriptorType::eStorageBuffer, //descriptorType
+			nullptr, //pImageInfo
+			&light_visibility_buffer_info, //pBufferInfo
+			nullptr //pTexBufferView
+		);
+
+		descriptor_writes.emplace_back(
+			light_culling_descriptor_set, // dstSet
+			1, // dstBinding
+			0, // distArrayElement
+			1, // descriptorCount
+			vk::DescriptorType::eStorageBuffer, //descriptorType // FIXME: change back to uniform
+			nullptr, //pImageInfo
+			&pointlight_buffer_info, //pBufferInfo
+			nullptr //pTexBufferView
+		);
+
+		descriptor_writes.emplace_back(
+			light_culling_descriptor_set, // dstSet
+			2, // dstBinding
+			0, // distArrayElement
+			1, // descriptorCount
+			vk::DescriptorType::eStorageBuffer, //descriptorType
+			nullptr, //pImageInfo
+			&light_culling_stats_buffer_info, //pBufferInfo
+			nullptr //pTexBufferView
+		);
+
+		descriptor_writes.emplace_back(
+			light_culling_descriptor_set, // dstSet
+			3, // dstBinding
+			0, // distArrayElement
+			1, // descriptorCount
+			vk::DescriptorType::eStorageBuffer, //descriptorType
+			nullptr, //pImageInfo
+			&spotlight_buffer_info, //pBufferInfo
+			nullptr //pTexBufferView
+		);
+
+		descriptor_writes.emplace_back(
+			light_culling_descriptor_set, // dstSet
+			4, // dstBinding
+			0, // distArrayElement
+			1, // descriptorCount
+			vk::DescriptorType::eStorageBuffer, //descriptorType
+			nullptr, //pImageInfo
+			&spot_light_visibility_buffer_info, //pBufferInfo
+			nullptr //pTexBufferView
+		);
+
+		std::array<vk::CopyDescriptorSet, 0> descriptor_copies;
+		device.updateDescriptorSets(descriptor_writes, descriptor_copies);
+	}
+
+	// Write the light update descriptor set, which moves the lights in the light buffers themselves
+	{
+		vk::DescriptorBufferInfo pointlight_buffer_info = {
+			pointlight_buffer.get(), // buffer_
+			0, //offset_
+			pointlight_buffer_size // range_
+		};
+
+		vk::DescriptorBufferInfo spotlight_buffer_info = {
+			spotlight_buffer.get(), // buffer_
+			0, //offset_
+			spotlight_buffer_size // range_
+		};
+
+		vk::DescriptorBufferInfo light_velocity_buffer_info = {
+			light_velocity_buffer.get(), // buffer_
+			0, //offset_
+			light_velocity_buffer_size // range_
+		};
+
+		std::vector<vk::WriteDescriptorSet> descriptor_writes = {};
+		descriptor_writes.emplace_back(light_update_descriptor_sets[frame], 1, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &pointlight_buffer_info, nullptr);
+		descriptor_writes.emplace_back(light_update_descriptor_sets[frame], 3, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &spotlight_buffer_info, nullptr);
+		descriptor_writes.emplace_back(light_update_descriptor_sets[frame], 5, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &light_velocity_buffer_info, nullptr);
+
+		std::array<vk::CopyDescriptorSet, 0> descriptor_copies;
+		device.updateDescriptorSets(descriptor_writes, descriptor_copies);
+	}
+}
+
+void _VulkanRenderer_Impl::createLightCullingCommandBuffer()
+{
+
+	if (light_culling_command_buffers[0])
+	{
+		device.freeCommandBuffers(compute_command_pool, static_cast<uint32_t>(light_culling_command_buffers.size()), light_culling_command_buffers.data());
+		light_culling_command_buffers = {};
+	}
+
+	// Create light culling command buffers, one per upload ring frame
+	{
+		vk::CommandBufferAllocateInfo alloc_info = {
+			compute_command_pool, // command pool
+			vk::CommandBufferLevel::ePrimary, // level
+			static_cast<uint32_t>(light_culling_command_buffers.size()) // commandBufferCount
+		};
+
+		auto allocated = device.allocateCommandBuffers(alloc_info);
+		std::copy(allocated.begin(), allocated.end(), light_culling_command_buffers.begin());
+	}
+
+	if (queue_family_transfers)
+	{
+		if (queue_acquire_command_buffers[0])
+		{
+			device.freeCommandBuffers(graphics_command_pool, static_cast<uint32_t>(queue_acquire_command_buffers.size()), queue_acquire_command_buffers.data());
+			queue_acquire_command_buffers = {};
+		}
+
+		vk::CommandBufferAllocateInfo alloc_info = {
+			graphics_command_pool, // command pool
+			vk::CommandBufferLevel::ePrimary, // level
+			static_cast<uint32_t>(queue_acquire_command_buffers.size()) // commandBufferCount
+		};
+
+		auto allocated = device.allocateCommandBuffers(alloc_info);
+		std::copy(allocated.begin(), allocated.end(), queue_acquire_command_buffers.begin());
+	}
+
+	for (uint32_t frame = 0; frame < frames_in_flight; frame++)
+	{
+		recordLightCullingCommandBuffer(frame);
+		if (queue_family_transfers)
+		{
+			recordQueueAcquireCommandBuffer(frame);
+		}
+	}
+}
+
+/**
+* Record the light culling command buffer of a frame, it must not be in use by the GPU
+*/
+void _VulkanRenderer_Impl::recordLightCullingCommandBuffer(uint32_t frame)
+{
+	vk::CommandBufferBeginInfo begin_info =
+	{
+		vk::CommandBufferUsageFlagBits::eSimultaneousUse,
+		nullptr
+	};
+
+	vk::CommandBuffer command(light_culling_command_buffers[frame]);
+
+	command.begin(begin_info);
+
+	// the visibility buffers are rewritten, so they don't need to be handed over from the graphics queue.
+	// The CPU waited for the fence of the frame which read them last
+	auto barriers_before = getLightVisibilityBarriers(frame, vk::AccessFlagBits::eShaderRead, vk::AccessFlagBits::eShaderWrite);
+	// the depth prepass hands the depth image over when the compute queue is in another family
+	std::vector<vk::ImageMemoryBarrier> image_barriers_before;
+	if (queue_family_transfers)
+	{
+		image_barriers_before.push_back(getDepthOwnershipBarrier(frame, vk::AccessFlags(), vk::AccessFlagBits::eShaderRead
+			, static_cast<uint32_t>(queue_family_indices.graphics_family), static_cast<uint32_t>(queue_family_indices.compute_family)));
+	}
+	if (use_hiz)
+	{
+		// the pyramid is rebuilt from scratch, dropping the old content also leaves it to whichever queue builds it
+		image_barriers_before.push_back(getHiZBarrier(frame, vk::AccessFlags(), vk::AccessFlagBits::eShaderWrite, vk::ImageLayout::eUndefined));
+	}
+
+	command.pipelineBarrier(
+		queue_family_transfers ? vk::PipelineStageFlagBits::eComputeShader : vk::PipelineStageFlagBits::eFragmentShader,  // srcStageMask, a compute only queue has no fragment stage
+		vk::PipelineStageFlagBits::eComputeShader,  // dstStageMask
+		vk::DependencyFlags(),  // dependencyFlags
+		0,  // memoryBarrierCount
+		nullptr,  // pBUfferMemoryBarriers
+		static_cast<uint32_t>(barriers_before.size()),  // bufferMemoryBarrierCount
+		barriers_before.data(),  // pBUfferMemoryBarriers
+		static_cast<uint32_t>(image_barriers_before.size()),  // imageMemoryBarrierCount
+		image_barriers_before.data() // pImageMemoryBarriers
+	);
+
+	recordHiZBuild(command, frame);
+	if (use_hiz)
+	{
+		auto hiz_barrier = getHiZBarrier(frame, vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eGeneral);
+		command.pipelineBarrier(
+			vk::PipelineStageFlagBits::eComputeShader,
+			vk::PipelineStageFlagBits::eComputeShader,
+			vk::DependencyFlags(),
+			0, nullptr,
+			0, nullptr,
+			1, &hiz_barrier
+		);
+	}
+
+	recordLightCulling(command, frame);
+
+	if (queue_family_transfers)
+	{
+		// hand the results and the depth image back to the graphics queue, which acquires them in recordQueueAcquireCommandBuffer()
+		auto barriers_after = getLightVisibilityBarriers(frame, vk::AccessFlagBits::eShaderWrite, vk::AccessFlags()
+			, static_cast<uint32_t>(queue_family_indices.compute_family), static_cast<uint32_t>(queue_family_indices.graphics_family));
+		auto depth_release = getDepthOwnershipBarrier(frame, vk::AccessFlags(), vk::AccessFlags()
+			, static_cast<uint32_t>(queue_family_indices.compute_family), static_cast<uint32_t>(queue_family_indices.graphics_family));
+		command.pipelineBarrier(
+			vk::PipelineStageFlagBits::eComputeShader,
+			vk::PipelineStageFlagBits::eBottomOfPipe,
+			vk::DependencyFlags(),
+			0, nullptr,
+			static_cast<uint32_t>(barriers_after.size()), barriers_after.data(),
+			1, &depth_release
+		);
+	}
+	else
+	{
+		auto barriers_after = getLightVisibilityBarriers(frame, vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead);
+		command.pipelineBarrier(
+			vk::PipelineStageFlagBits::eComputeShader,
+			vk::PipelineStageFlagBits::eFragmentShader,
+			vk::DependencyFlags(),
+			0, nullptr,
+			static_cast<uint32_t>(barriers_after.size()), barriers_after.data(),
+			0, nullptr
+		);
+	}
+
+	{
+		// make the counters visible to readLightCullingStats()
+		vk::BufferMemoryBarrier readback_barrier = {
+			vk::AccessFlagBits::eShaderWrite,  // srcAccessMask
+			vk::AccessFlagBits::eHostRead,  // dstAccessMask
+			VK_QUEUE_FAMILY_IGNORED,  // srcQueueFamilyIndex
+			VK_QUEUE_FAMILY_IGNORED,  // dstQueueFamilyIndex
+			static_cast<vk::Buffer>(light_culling_stats_buffer.get()),  // buffer
+			0,  // offset
+			sizeof(LightCullingStats)  // size
+		};
+		command.pipelineBarrier(
+			vk::PipelineStageFlagBits::eComputeShader,
+			vk::PipelineStageFlagBits::eHost,
+			vk::DependencyFlags(),
+			0, nullptr,
+			1, &readback_barrier,
+			0, nullptr
+		);
+	}
+
+	command.end();
+}
+
+/**
+* Record the Hi-Z build of a frame with its timestamps, one dispatch per level reading the level above it.
+* The pyramid must be in the general layout and the depth readable by compute shaders,
+* making the last level visible to the passes reading the pyramid is up to the caller
+*/
+void _VulkanRenderer_Impl::recordHiZBuild(vk::CommandBuffer command, uint32_t frame)
+{
+	if (timestamps_supported)
+	{
+		command.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, timestamp_query_pool.get(), getTimestampQuery(frame, TIMESTAMP_HIZ_BEGIN));
+	}
+
+	if (use_hiz)
+	{
+		recordHiZLevels(command, frame);
+	}
+
+	if (timestamps_supported)
+	{
+		command.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, timestamp_query_pool.get(), getTimestampQuery(frame, TIMESTAMP_HIZ_END));
+	}
+}
+
+/**
+* The dispatches of recordHiZBuild() without the timestamps, the depth prepass also builds the pyramid for GPU culling
+*/
+void _VulkanRenderer_Impl::recordHiZLevels(vk::CommandBuffer command, uint32_t frame)
+{
+	command.bindPipeline(vk::PipelineBindPoint::eCompute, hiz_pipeline.get());
+
+	uint32_t level0_width = std::max(swap_chain_extent.width / 2, 1u);
+	uint32_t level0_height = std::max(swap_chain_extent.height / 2, 1u);
+	for (uint32_t level = 0; level < hiz_level_count; level++)
+	{
+		if (level > 0)
+		{
+			// the level above is complete before this one reads it
+			vk::ImageMemoryBarrier level_barrier = {
+				vk::AccessFlagBits::eShaderWrite,  // srcAccessMask
+				vk::AccessFlagBits::eShaderRead,  // dstAccessMask
+				vk::ImageLayout::eGeneral,  // oldLayout
+				vk::ImageLayout::eGeneral,  // newLayout
+				VK_QUEUE_FAMILY_IGNORED,  // srcQueueFamilyIndex
+				VK_QUEUE_FAMILY_IGNORED,  // dstQueueFamilyIndex
+				static_cast<vk::Image>(hiz_images[frame].get()),  // image
+				vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, level - 1, 1, 0, 1)  // subresourceRange
+			};
+			command.pipelineBarrier(
+				vk::PipelineStageFlagBits::eComputeShader,
+				vk::PipelineStageFlagBits::eComputeShader,
+				vk::DependencyFlags(),
+				0, nullptr,
+				0, nullptr,
+				1, &level_barrier
+			);
+		}
+
+		command.bindDescriptorSets(vk::PipelineBindPoint::eCompute, hiz_pipeline_layout.get(), 0
+			, std::array<vk::DescriptorSet, 1>{ hiz_descriptor_sets[frame][level] }, std::array<uint32_t, 0>());
+
+		HiZPushConstants push_constants = { level == 0 ? 1 : 0 };
+		command.pushConstants(hiz_pipeline_layout.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(push_constants), &push_constants);
+
+		uint32_t level_width = std::max(level0_width >> level, 1u);
+		uint32_t level_height = std::max(level0_height >> level, 1u);
+		command.dispatch((level_width - 1) / HIZ_WORKGROUP_SIZE + 1, (level_height - 1) / HIZ_WORKGROUP_SIZE + 1, 1);
+	}
+}
+
+/**
+* Record the light culling dispatch of a frame with its timestamps, after clearing the counters
+*/
+void _VulkanRenderer_Impl::recordLightCulling(vk::CommandBuffer command, uint32_t frame)
+{
+	auto light_culling_descriptor_set = light_culling_descriptor_sets[frame];
+
+	{
+		// the counters are shared by the frames in flight, the last frame's light culling may still be counting into them,
+		// its dispatches are all on this queue
+		vk::BufferMemoryBarrier counters_barrier = {
+			vk::AccessFlagBits::eShaderWrite,  // srcAccessMask
+			vk::AccessFlagBits::eTransferWrite,  // dstAccessMask
+			VK_QUEUE_FAMILY_IGNORED,  // srcQueueFamilyIndex
+			VK_QUEUE_FAMILY_IGNORED,  // dstQueueFamilyIndex
+			static_cast<vk::Buffer>(light_culling_stats_buffer.get()),  // buffer
+			0,  // offset
+			sizeof(LightCullingStats)  // size
+		};
+		command.pipelineBarrier(
+			vk::PipelineStageFlagBits::eComputeShader,
+			vk::PipelineStageFlagBits::eTransfer,
+			vk::DependencyFlags(),
+			0, nullptr,
+			1, &counters_barrier,
+			0, nullptr
+		);
+
+		// the shader accumulates into the counters, so zero them first
+		command.fillBuffer(light_culling_stats_buffer.get(), 0, sizeof(LightCullingStats), 0);
+
+		vk::BufferMemoryBarrier clear_barrier = {
+			vk::AccessFlagBits::eTransferWrite,  // srcAccessMask
+			vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,  // dstAccessMask
+			VK_QUEUE_FAMILY_IGNORED,  // srcQueueFamilyIndex
+			VK_QUEUE_FAMILY_IGNORED,  // dstQueueFamilyIndex
+			static_cast<vk::Buffer>(light_culling_stats_buffer.get()),  // buffer
+			0,  // offset
+			sizeof(LightCullingStats)  // size
+		};
+		command.pipelineBarrier(
+			vk::PipelineStageFlagBits::eTransfer,
+			vk::PipelineStageFlagBits::eComputeShader,
+			vk::DependencyFlags(),
+			0, nullptr,
+			1, &clear_barrier,
+			0, nullptr
+		);
+	}
+
+
+	// barrier
+	command.bindDescriptorSets(
+		vk::PipelineBindPoint::eCompute, // pipelineBindPoint
+		compute_pipeline_layout.get(), // layout
+		0, // firstSet
+		std::array<vk::DescriptorSet, 3>{light_culling_descriptor_set, camera_descriptor_set, intermediate_descriptor_sets[frame]}, // descriptorSets
+		std::array<uint32_t, 1>{ static_cast<uint32_t>(upload_ring.getFrameOffset(frame) + camera_ring_offset) } // pDynamicOffsets
+	);
+
+	PushConstantObject pco = { static_cast<int>(swap_chain_extent.width), static_cast<int>(swap_chain_extent.height), tile_count_per_row, tile_count_per_col };
+	command.pushConstants(compute_pipeline_layout.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pco), &pco);
+
+	command.bindPipeline(vk::PipelineBindPoint::eCompute, static_cast<VkPipeline>(compute_pipeline.get()));
+
+	if (timestamps_supported)
+	{
+		command.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, timestamp_query_pool.get(), getTimestampQuery(frame, TIMESTAMP_LIGHT_CULLING_BEGIN));
+	}
+
+	command.dispatch(tile_count_per_row, tile_count_per_col, 1);
+
+	if (timestamps_supported)
+	{
+		command.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, timestamp_query_pool.get(), getTimestampQuery(frame, TIMESTAMP_LIGHT_CULLING_END));
+	}
+}
+
+/**
+* Record the graphics queue side of the ownership transfers at the end of a frame's light culling,
+* submitted right before the frame's shading whenever light culling ran
+*/
+void _VulkanRenderer_Impl::recordQueueAcquireCommandBuffer(uint32_t frame)
+{
+	vk::CommandBuffer command(queue_acquire_command_buffers[frame]);
+	command.begin({ vk::CommandBufferUsageFlagBits::eSimultaneousUse, nullptr });
+
+	auto barriers = getLightVisibilityBarriers(frame, vk::AccessFlags(), vk::AccessFlagBits::eShaderRead
+		, static_cast<uint32_t>(queue_family_indices.compute_family), static_cast<uint32_t>(queue_family_indices.graphics_family));
+	auto depth_acquire = getDepthOwnershipBarrier(frame, vk::AccessFlags(), vk::AccessFlagBits::eDepthStencilAttachmentRead
+		, static_cast<uint32_t>(queue_family_indices.compute_family), static_cast<uint32_t>(queue_family_indices.graphics_family));
+	command.pipelineBarrier(
+		vk::PipelineStageFlagBits::eTopOfPipe,
+		vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests | vk::PipelineStageFlagBits::eFragmentShader,
+		vk::DependencyFlags(),
+		0, nullptr,
+		static_cast<uint32_t>(barriers.size()), barriers.data(),
+		1, &depth_acquire
+	);
+
+	command.end();
+}
+
+/**
+* Create compute pipeline for moving the lights, it shares the light culling descriptor set layout
+*/
+void _VulkanRenderer_Impl::createLightUpdatePipeline()
+{
+	auto raii_pipeline_layout_deleter = [device = this->device](auto & obj)
+	{
+		device.destroyPipelineLayout(obj);
+	};
+	auto raii_pipeline_deleter = [device = this->device](auto & obj)
+	{
+		device.destroyPipeline(obj);
+	};
+
+	VkPushConstantRange push_constant_range = {};
+	push_constant_range.offset = 0;
+	push_constant_range.size = sizeof(LightUpdatePushConstants);
+	push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+	pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	VkDescriptorSetLayout set_layouts[] = { light_culling_descriptor_set_layout.get() };
+	pipeline_layout_info.setLayoutCount = 1;
+	pipeline_layout_info.pSetLayouts = set_layouts;
+	pipeline_layout_info.pushConstantRangeCount = 1;
+	pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+
+	VkPipelineLayout temp_layout;
+	vulkan_util::checkResult(vkCreatePipelineLayout(graphics_device, &pipeline_layout_info, nullptr, &temp_layout));
+	light_update_pipeline_layout = VRaii<VkPipelineLayout>(temp_layout, raii_pipeline_layout_deleter);
+
+	auto light_update_comp_shader_code = util::readFile(util::getContentPath("light_update_comp.spv"));
+
+	auto comp_shader_module = createShaderModule(light_update_comp_shader_code);
+	VkPipelineShaderStageCreateInfo comp_shader_stage_info = {};
+	comp_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	comp_shader_stage_info.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	comp_shader_stage_info.module = comp_shader_module.get();
+	comp_shader_stage_info.pName = "main";
+
+	// the workgroup size the dispatch is computed with
+	vk::SpecializationMapEntry specialization_entry(0, 0, sizeof(uint32_t));
+	vk::SpecializationInfo specialization_info = {
+		1, // mapEntryCount
+		&specialization_entry, // pMapEntries
+		sizeof(LIGHT_UPDATE_WORKGROUP_SIZE), // dataSize
+		&LIGHT_UPDATE_WORKGROUP_SIZE // pData
+	};
+	comp_shader_stage_info.pSpecializationInfo = &static_cast<const VkSpecializationInfo&>(specialization_info);
+
+	VkComputePipelineCreateInfo pipeline_create_info = {};
+	pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipeline_create_info.stage = comp_shader_stage_info;
+	pipeline_create_info.layout = light_update_pipeline_layout.get();
+	pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
+	pipeline_create_info.basePipelineIndex = -1;
+
+	VkPipeline temp_pipeline;
+	vulkan_util::checkResult(vkCreateComputePipelines(graphics_device, pipeline_cache, 1, &pipeline_create_info, nullptr, &temp_pipeline));
+	light_update_pipeline = VRaii<VkPipeline>(temp_pipeline, raii_pipeline_deleter);
+}
+
+void _VulkanRenderer_Impl::createLightUpdateCommandBuffer()
+{
+	vk::CommandBufferAllocateInfo alloc_info = {
+		compute_command_pool, // command pool
+		vk::CommandBufferLevel::ePrimary, // level
+		static_cast<uint32_t>(light_update_command_buffers.size()) // commandBufferCount
+	};
+	auto allocated = device.allocateCommandBuffers(alloc_info);
+	std::copy(allocated.begin(), allocated.end(), light_update_command_buffers.begin());
+}
+
+/**
+* Record the light update pass of the current frame into its light update command buffer.
+* The delta time is a push constant so it's rerecorded every frame
+*/
+void _VulkanRenderer_Impl::recordLightUpdateCommandBuffer(float delta_time)
+{
+	// frame_fences[frame_index] was waited for in updateUniformBuffers(), so the command buffer isn't in use
+	vk::CommandBuffer command(light_update_command_buffers[frame_index]);
+	command.reset(vk::CommandBufferResetFlags());
+	command.begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit, nullptr });
+
+	recordLightUpdate(command, delta_time);
+
+	// light culling runs right after this on the same queue, shading waits for light culling
+	vk::MemoryBarrier snapshot_barrier = { vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead };
+	command.pipelineBarrier(
+		vk::PipelineStageFlagBits::eTransfer,
+		vk::PipelineStageFlagBits::eComputeShader,
+		vk::DependencyFlags(),
+		1, &snapshot_barrier,
+		0, nullptr,
+		0, nullptr
+	);
+
+	command.end();
+}
+
+/**
+* Record the copies into grown light buffers, the light uploads staged in the light upload ring,
+* the light update dispatch and the copy into the frame's light snapshot for the current frame.
+* The barriers after the snapshot copy are left to the caller
+*/
+void _VulkanRenderer_Impl::recordLightUpdate(vk::CommandBuffer command, float delta_time)
+{
+	// the light buffers are only used on the compute queue, the earlier frames read their own snapshots
+	auto light_buffer_barriers = [this](vk::AccessFlags src_access, vk::AccessFlags dst_access)
+	{
+		return std::array<vk::BufferMemoryBarrier, 2>{
+			vk::BufferMemoryBarrier(
+				src_access,  // srcAccessMask
+				dst_access,  // dstAccessMask
+				VK_QUEUE_FAMILY_IGNORED,  // srcQueueFamilyIndex
+				VK_QUEUE_FAMILY_IGNORED,  // dstQueueFamilyIndex
+				static_cast<vk::Buffer>(pointlight_buffer.get()),  // buffer
+				0,  // offset
+				pointlight_buffer_size  // size
+			),
+			vk::BufferMemoryBarrier(
+				src_access,  // srcAccessMask
+				dst_access,  // dstAccessMask
+				VK_QUEUE_FAMILY_IGNORED,  // srcQueueFamilyIndex
+				VK_QUEUE_FAMILY_IGNORED,  // dstQueueFamilyIndex
+				static_cast<vk::Buffer>(spotlight_buffer.get()),  // buffer
+				0,  // offset
+				spotlight_buffer_size  // size
+			)
+		};
+	};
+
+	// after the previous light update and snapshot copy
+	auto barriers_before = light_buffer_barriers(vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite
+		, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite);
+	// the buffers replaced by grown ones were last written by the light update pass of an earlier frame
+	vk::MemoryBarrier grown_barrier_before = { vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferRead };
+	command.pipelineBarrier(
+		vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer,
+		vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer,
+		vk::DependencyFlags(),
+		pending_light_buffer_copies.empty() ? 0 : 1, &grown_barrier_before,
+		static_cast<uint32_t>(barriers_before.size()), barriers_before.data(),
+		0, nullptr
+	);
+
+	if (!pending_light_buffer_copies.empty())
+	{
+		for (const auto& copy : pending_light_buffer_copies)
+		{
+			command.copyBuffer(copy.src, copy.dst, 1, &copy.region);
+		}
+		pending_light_buffer_copies.clear();
+
+		// the uploads below may overwrite parts of what was just copied
+		vk::MemoryBarrier grown_barrier_after = {
+			vk::AccessFlagBits::eTransferWrite,
+			vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite
+		};
+		command.pipelineBarrier(
+			vk::PipelineStageFlagBits::eTransfer,
+			vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader,
+			vk::DependencyFlags(),
+			1, &grown_barrier_after,
+			0, nullptr,
+			0, nullptr
+		);
+	}
+
+	if (!pending_pointlight_copies.empty() || !pending_spotlight_copies.empty())
+	{
+		if (!pending_pointlight_copies.empty())
+		{
+			command.copyBuffer(pending_pointlight_copy_source, static_cast<vk::Buffer>(pointlight_buffer.get()), pending_pointlight_copies);
+		}
+		if (!pending_spotlight_copies.empty())
+		{
+			command.copyBuffer(pending_spotlight_copy_source, static_cast<vk::Buffer>(spotlight_buffer.get()), pending_spotlight_copies);
+		}
+		pending_pointlight_copies.clear();
+		pending_spotlight_copies.clear();
+
+		auto barriers_copied = light_buffer_barriers(vk::AccessFlagBits::eTransferWrite
+			, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferRead);
+		command.pipelineBarrier(
+			vk::PipelineStageFlagBits::eTransfer,
+			vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer,
+			vk::DependencyFlags(),
+			0, nullptr,
+			static_cast<uint32_t>(barriers_copied.size()), barriers_copied.data(),
+			0, nullptr
+		);
+	}
+
+	if (delta_time > 0.0f)
+	{
+		command.bindDescriptorSets(
+			vk::PipelineBindPoint::eCompute, // pipelineBindPoint
+			light_update_pipeline_layout.get(), // layout
+			0, // firstSet
+			std::array<vk::DescriptorSet, 1>{light_update_descriptor_sets[frame_index]}, // descriptorSets
+			std::array<uint32_t, 0>() // pDynamicOffsets
+		);
+
+		const auto& scene = getGlobalTestSceneConfiguration();
+		LightUpdatePushConstants pco = { glm::vec4(scene.min_light_pos, 0.0f), glm::vec4(scene.max_light_pos, 0.0f), delta_time, point_light_capacity };
+		command.pushConstants(light_update_pipeline_layout.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pco), &pco);
+
+		command.bindPipeline(vk::PipelineBindPoint::eCompute, static_cast<VkPipeline>(light_update_pipeline.get()));
+
+		// one invocation moves one point light and one spot light
+		auto light_count = static_cast<uint32_t>(std::max(point_light_capacity, spot_light_capacity));
+		command.dispatch((light_count + LIGHT_UPDATE_WORKGROUP_SIZE - 1) / LIGHT_UPDATE_WORKGROUP_SIZE, 1, 1);
+
+		auto barriers_after = light_buffer_barriers(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferRead);
+		command.pipelineBarrier(
+			vk::PipelineStageFlagBits::eComputeShader,
+			vk::PipelineStageFlagBits::eTransfer,
+			vk::DependencyFlags(),
+			0, nullptr,
+			static_cast<uint32_t>(barriers_after.size()), barriers_after.data(),
+			0, nullptr
+		);
+	}
+
+	// the frame's light culling and shading read the snapshot, so the next frame's light update doesn't have to wait for them.
+	// Only the lights in use are copied, not the spare capacity
+	{
+		auto pointlight_copy_size = std::min<VkDeviceSize>(pointlight_snapshot_buffer_sizes[frame_index]
+			, sizeof(glm::vec4) + sizeof(PointLight) * static_cast<VkDeviceSize>(std::max(uploaded_pointlight_count, 0)));
+		auto spotlight_copy_size = std::min<VkDeviceSize>(spotlight_snapshot_buffer_sizes[frame_index]
+			, sizeof(glm::vec4) + sizeof(SpotLight) * static_cast<VkDeviceSize>(std::max(uploaded_spotlight_count, 0)));
+		command.copyBuffer(static_cast<vk::Buffer>(pointlight_buffer.get()), static_cast<vk::Buffer>(pointlight_snapshot_buffers[frame_index].get())
+			, vk::BufferCopy(0, 0, pointlight_copy_size));
+		command.copyBuffer(static_cast<vk::Buffer>(spotlight_buffer.get()), static_cast<vk::Buffer>(spotlight_snapshot_buffers[frame_index].get())
+			, vk::BufferCopy(0, 0, spotlight_copy_size));
+	}
+}
+
+void _VulkanRenderer_Impl::updateUniformBuffers(float deltatime)
+{
+	static auto start_time = std::chrono::high_resolution_clock::now();
+
+	auto current_time = std::chrono::high_resolution_clock::now();
+	float time = std::chrono::duration_cast<std::chrono::milliseconds>(current_time - start_time).count() / 1000.0f;
+
+	// move on to the next frame once the GPU is done with it, the frames in between can still be running
+	{
+		frame_cpu_start_time = current_time;
+		frame_index = (frame_index + 1) % frames_in_flight;
+		frame_serial++;
+		vk::Fence fence = frame_fences[frame_index].get();
+		device.waitForFences(1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+		frame_fence_wait_ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - current_time).count();
+		recordFramePacing(frame_index);
+		upload_ring.beginFrame(frame_index);
+		light_upload_ring.beginFrame(frame_index);
+		thread_command_pools.beginFrame(frame_index);
+		releaseRetiredResources();
+
+		// the model uploads have to land before it is drawn, only the first frame ever waits here
+		transfer_queue.wait(model.getUploadValue());
+		transfer_queue.acquireCompleted();
+
+		ensureLightBufferCapacity();
+		if (frame_light_buffer_generations[frame_index] != light_buffer_generation)
+		{
+			// the light buffers grew while this frame was in flight
+			switchFrameToCurrentLightBuffers(frame_index);
+		}
+	}
+
+	// update camera ubo, every frame region needs its own copy even if it didn't change
+	{
+		CameraUbo ubo = {};
+		ubo.view = view_matrix;
+		ubo.proj = glm::perspective(glm::radians(45.0f), swap_chain_extent.width / (float)swap_chain_extent.height, 0.5f, 100.0f);
+		ubo.proj[1][1] *= -1; //since the Y axis of Vulkan NDC points down
+		ubo.projview = ubo.proj * ubo.view;
+		ubo.cam_pos = cam_pos;
+
+		camera_changed = camera_changed || ubo.view != last_camera_ubo.view || ubo.proj != last_camera_ubo.proj || ubo.cam_pos != last_camera_ubo.cam_pos;
+		last_camera_ubo = ubo;
+
+		// allocated first, at camera_ring_offset which the command buffers bind
+		auto allocation = upload_ring.allocate(sizeof(ubo));
+		memcpy(allocation.data, &ubo, sizeof(ubo));
+		uploaded_bytes += sizeof(ubo);
+	}
+
+	// update scene object ubo, at object_ring_offset
+	{
+		SceneObjectUbo ubo = {};
+		ubo.model = glm::scale(glm::mat4(1.0f), glm::vec3(getGlobalTestSceneConfiguration().scale));
+
+		auto allocation = upload_ring.allocate(sizeof(ubo));
+		memcpy(allocation.data, &ubo, sizeof(ubo));
+		uploaded_bytes += sizeof(ubo);
+	}
+
+	// update light ubo
+	light_update_delta_time = 0.0f;
+	if (!light_animation_paused && deltatime > 0.0f && gpu_light_animation)
+	{
+		// moved in place by the light update pass in drawFrame()
+		light_update_delta_time = deltatime;
+		lights_changed = true;
+	}
+	else if (!light_animation_paused && deltatime > 0.0f)
+	{
+		thread_pool.parallelFor(pointlights.size(), LIGHT_KERNEL_CHUNK_SIZE, [&](size_t first, size_t count)
+		{
+			pointlights.animate(first, count, LIGHT_VELOCITY, deltatime
+				, getGlobalTestSceneConfiguration().min_light_pos, getGlobalTestSceneConfiguration().max_light_pos);
+		});
+
+		for (auto& spotlight : spotlights) {
+			spotlight.pos += LIGHT_VELOCITY * deltatime;
+			if (spotlight.pos.y > getGlobalTestSceneConfiguration().max_light_pos.y) {
+				spotlight.pos.y -= (getGlobalTestSceneConfiguration().max_light_pos.y - getGlobalTestSceneConfiguration().min_light_pos.y);
+			}
+		}
+
+		markPointLightsDirty(0, pointlights.size());
+		markSpotLightsDirty(0, spotlights.size());
+	}
+
+	uploadLights();
+}
+
+const uint64_t ACQUIRE_NEXT_IMAGE_TIMEOUT{ std::numeric_limits<uint64_t>::max() };
+
+void _VulkanRenderer_Impl::drawFrame()
+{
+	// the depth prepass and light culling only depend on the camera, the lights and the swap chain extent
+	if (camera_changed || lights_changed)
+	{
+		frame_light_culling_results_valid = {};
+	}
+	bool culling_inputs_changed = !temporal_reuse_enabled || !frame_light_culling_results_valid[frame_index];
+	if (!culling_inputs_changed && !frame_dirty)
+	{
+		// the presented image is still up to date, only the previous frame still has to be shown
+		submitPendingShading();
+		frame_skip_counters.skipped_frames++;
+		return;
+	}
+
+	if (culling_inputs_changed && !use_frame_graph)
+	{
+		submitLightCulling();
+	}
+
+	frame_skip_counters.drawn_frames++;
+	if (!culling_inputs_changed)
+	{
+		frame_skip_counters.skipped_light_culling_frames++;
+	}
+	camera_changed = false;
+	lights_changed = false;
+	frame_light_culling_results_valid[frame_index] = true;
+	frame_dirty = false;
+
+	ShadingSubmission shading = { frame_index, culling_inputs_changed };
+	if (use_frame_graph)
+	{
+		submitFrameGraph(shading);
+	}
+	else if (pipelined_shading)
+	{
+		// this frame's depth prepass and light culling are queued now, so the previous frame's shading overlaps them
+		auto previous = pending_shading;
+		auto previous_pending = shading_pending;
+		pending_shading = shading;
+		shading_pending = true;
+		if (previous_pending)
+		{
+			submitShading(previous);
+		}
+	}
+	else
+	{
+		submitShading(shading);
+	}
+
+	// CPU time of the frame from the start of updateUniformBuffers(), without waiting for the frame's fence
+	auto frame_ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - frame_cpu_start_time).count();
+	frame_pacing_stats.cpu_frames++;
+	frame_pacing_stats.cpu_ms += frame_ms - frame_fence_wait_ms;
+	frame_pacing_stats.fence_wait_ms += frame_fence_wait_ms;
+}
+
+/**
+* Whether the light update pass has to run for the current frame, because the light buffers change this frame
+* or the frame's light snapshot is older than them. The snapshot is up to date once the pass ran
+*/
+bool _VulkanRenderer_Impl::prepareLightSnapshot()
+{
+	// light uploads and the light update pass, followed by the copy into this frame's light snapshot
+	bool lights_updated = light_update_delta_time > 0.0f || !pending_light_buffer_copies.empty()
+		|| !pending_pointlight_copies.empty() || !pending_spotlight_copies.empty();
+	if (lights_updated)
+	{
+		light_data_version++;
+	}
+	bool snapshot_outdated = frame_light_snapshot_versions[frame_index] != light_data_version;
+	frame_light_snapshot_versions[frame_index] = light_data_version;
+	return snapshot_outdated;
+}
+
+/**
+* Submit the depth prepass of the current frame on the graphics queue,
+* then its light update and light culling on the compute queue
+*/
+void _VulkanRenderer_Impl::submitLightCulling()
+{
+	// submit depth pre-pass command buffer
+	{
+		recordDepthPrePassCommandBuffer(frame_index);
+		vk::SubmitInfo submit_info = {
+			0, // waitSemaphoreCount
+			nullptr, // pWaitSemaphores
+			nullptr, // pwaitDstStageMask
+			1, // commandBufferCount
+			&depth_prepass_command_buffers[frame_index], // pCommandBuffers
+			1, // singalSemaphoreCount
+			depth_prepass_finished_semaphores[frame_index].data() // pSingalSemaphores
+		};
+		submitToQueue(graphics_queue, 1, &submit_info, nullptr);
+	}
+
+	// submit light update and light culling command buffers
+	{
+		bool snapshot_outdated = prepareLightSnapshot();
+		if (snapshot_outdated)
+		{
+			recordLightUpdateCommandBuffer(light_update_delta_time);
+		}
+
+		// the light update doesn't need the depth, so only light culling waits for the depth prepass
+		vk::Semaphore wait_semaphores[] = { depth_prepass_finished_semaphores[frame_index].get() }; // which semaphore to wait
+		vk::PipelineStageFlags wait_stages[] = { vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer }; // which stage to execute
+		std::array<vk::SubmitInfo, 2> submit_infos = {
+			vk::SubmitInfo(
+				0, // waitSemaphoreCount
+				nullptr, // pWaitSemaphores
+				nullptr, // pwaitDstStageMask
+				1, // commandBufferCount
+				&light_update_command_buffers[frame_index], // pCommandBuffers
+				0, // singalSemaphoreCount
+				nullptr // pSingalSemaphores
+			),
+			vk::SubmitInfo(
+				1, // waitSemaphoreCount
+				wait_semaphores, // pWaitSemaphores
+				wait_stages, // pwaitDstStageMask
+				1, // commandBufferCount
+				&light_culling_command_buffers[frame_index], // pCommandBuffers
+				1, // singalSemaphoreCount
+				lightculling_completed_semaphores[frame_index].data() // pSingalSemaphores
+			)
+		};
+		submitToQueue(compute_queue, snapshot_outdated ? 2 : 1, snapshot_outdated ? submit_infos.data() : submit_infos.data() + 1, nullptr);
+	}
+}
+
+/**
+* Acquire a swap chain image, submit the shading of a frame and present it
+*/
+void _VulkanRenderer_Impl::submitShading(const ShadingSubmission& shading)
+{
+	auto frame = shading.frame;
+
+	// 1. Acquiring an image from the swap chain
+	uint32_t image_index;
+	{
+		auto aquiring_result = vkAcquireNextImageKHR(graphics_device, swap_chain.get()
+			, ACQUIRE_NEXT_IMAGE_TIMEOUT, image_available_semaphores[frame].get(), VK_NULL_HANDLE, &image_index);
+
+		if (aquiring_result == VK_ERROR_OUT_OF_DATE_KHR)
+		{
+			// when swap chain needs recreation, the frame is dropped
+			discardShading(shading);
+			recreateSwapChain();
+			return;
+		}
+		else if (aquiring_result != VK_SUCCESS && aquiring_result != VK_SUBOPTIMAL_KHR)
+		{
+			throw std::runtime_error("Failed to acquire swap chain image!");
+		}
+	}
+
+	// 2. Submitting the command buffer
+	{
+		recordShadingCommandBuffer(frame, image_index);
+
+		VkSubmitInfo submit_info = {};
+		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		VkSemaphore wait_semaphores[] = { image_available_semaphores[frame].get() , lightculling_completed_semaphores[frame].get() }; // which semaphore to wait
+		// the light culling results are read by the fragment shader, the depth by the depth test
+		VkPipelineStageFlags wait_stages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+			, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT }; // which stage to execute
+		// reused culling results were already waited for by an earlier frame
+		submit_info.waitSemaphoreCount = shading.light_culling_ran ? 2 : 1;
+		submit_info.pWaitSemaphores = wait_semaphores;
+		submit_info.pWaitDstStageMask = wait_stages;
+		// the results of light culling change queue family first
+		VkCommandBuffer submitted_command_buffers[] = { queue_acquire_command_buffers[frame], frame_command_buffers[frame] };
+		bool acquire = queue_family_transfers && shading.light_culling_ran;
+		submit_info.commandBufferCount = acquire ? 2 : 1;
+		submit_info.pCommandBuffers = acquire ? submitted_command_buffers : submitted_command_buffers + 1;
+		VkSemaphore signal_semaphores[] = { render_finished_semaphores[frame].get() };
+		submit_info.signalSemaphoreCount = 1;
+		submit_info.pSignalSemaphores = signal_semaphores;
+
+		// the frame's upload ring region and command buffers are free again once this is done
+		vk::Fence fence = frame_fences[frame].get();
+		device.resetFences(1, &fence);
+		submitToQueue(graphics_queue, 1, reinterpret_cast<const vk::SubmitInfo*>(&submit_info), fence); // the same layout as VkSubmitInfo
+	}
+
+	frame_timestamps_pending[frame] = timestamps_supported;
+	frame_light_culling_ran[frame] = shading.light_culling_ran;
+
+	// 3. Submitting the result back to the swap chain to show it on screen
+	presentImage(frame, image_index);
+}
+
+/**
+* Present a swap chain image once the render finished semaphore of the frame is signaled
+*/
+void _VulkanRenderer_Impl::presentImage(uint32_t frame, uint32_t image_index)
+{
+	VkPresentInfoKHR present_info = {};
+	present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+	present_info.waitSemaphoreCount = 1;
+	VkSemaphore present_wait_semaphores[] = { render_finished_semaphores[frame].get() };
+	present_info.pWaitSemaphores = present_wait_semaphores;
+	VkSwapchainKHR swapChains[] = { swap_chain.get() };
+	present_info.swapchainCount = 1;
+	present_info.pSwapchains = swapChains;
+	present_info.pImageIndices = &image_index;
+	present_info.pResults = nullptr; // Optional, check for if every single chains is successful
+
+	VkResult present_result = vkQueuePresentKHR(present_queue, &present_info);
+
+	if (present_result == VK_ERROR_OUT_OF_DATE_KHR || present_result == VK_SUBOPTIMAL_KHR)
+	{
+		recreateSwapChain();
+	}
+	else if (present_result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to present swap chain image!");
+	}
+}
+
+/**
+* Record every pass of a frame through the frame graph into the frame's command buffer, submit it once and present.
+* The depth prepass, light update and light culling only run if light culling does
+*/
+void _VulkanRenderer_Impl::submitFrameGraph(const ShadingSubmission& shading)
+{
+	auto frame = shading.frame;
+
+	uint32_t image_index = 0;
+	auto aquiring_result = vkAcquireNextImageKHR(graphics_device, swap_chain.get()
+		, ACQUIRE_NEXT_IMAGE_TIMEOUT, image_available_semaphores[frame].get(), VK_NULL_HANDLE, &image_index);
+	if (aquiring_result != VK_SUCCESS && aquiring_result != VK_SUBOPTIMAL_KHR && aquiring_result != VK_ERROR_OUT_OF_DATE_KHR)
+	{
+		throw std::runtime_error("Failed to acquire swap chain image!");
+	}
+	// when the swap chain needs recreation the frame isn't shaded, the other passes still run so the staged light uploads land
+	bool shaded = aquiring_result != VK_ERROR_OUT_OF_DATE_KHR;
+
+	frame_graph.reset();
+	auto resources = addFrameGraphResources(frame_graph, frame
+		, shading.light_culling_ran ? vk::ImageLayout::eUndefined : vk::ImageLayout::eDepthStencilReadOnlyOptimal);
+	if (shading.light_culling_ran)
+	{
+		addDepthPrePass(frame_graph, resources, frame);
+		if (prepareLightSnapshot())
+		{
+			addLightUpdatePass(frame_graph, resources, light_update_delta_time);
+		}
+		addHiZBuildPass(frame_graph, resources, frame);
+		addLightCullingPass(frame_graph, resources, frame);
+		frame_graph.setFinalState(resources.light_culling_stats, vk::PipelineStageFlagBits::eHost, vk::AccessFlagBits::eHostRead); // see readLightCullingStats()
+	}
+	if (shaded)
+	{
+		addShadingPass(frame_graph, resources, frame, image_index);
+	}
+	frame_graph.compile();
+
+	// frame_fences[frame] was waited for in updateUniformBuffers(), so the command buffer isn't in use
+	auto command = frame_command_buffers[frame];
+	command.reset(vk::CommandBufferResetFlags());
+	command.begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit, nullptr });
+	frame_graph.execute(command);
+	command.end();
+	frame_graph_barriers += frame_graph.getBarrierCount();
+
+	vk::Semaphore wait_semaphores[] = { image_available_semaphores[frame].get() };
+	vk::PipelineStageFlags wait_stages[] = { vk::PipelineStageFlagBits::eColorAttachmentOutput }; // where the graph transitions the image
+	vk::Semaphore signal_semaphores[] = { render_finished_semaphores[frame].get() };
+	vk::SubmitInfo submit_info = {
+		shaded ? 1u : 0u, // waitSemaphoreCount
+		wait_semaphores, // pWaitSemaphores
+		wait_stages, // pwaitDstStageMask
+		1, // commandBufferCount
+		&command, // pCommandBuffers
+		shaded ? 1u : 0u, // singalSemaphoreCount
+		signal_semaphores // pSingalSemaphores
+	};
+	vk::Fence fence = frame_fences[frame].get();
+	device.resetFences(1, &fence);
+	submitToQueue(graphics_queue, 1, &submit_info, fence);
+
+	if (!shaded)
+	{
+		recreateSwapChain();
+		return;
+	}
+
+	frame_timestamps_pending[frame] = timestamps_supported;
+	frame_light_culling_ran[frame] = shading.light_culling_ran;
+	presentImage(frame, image_index);
+}
+
+/**
+* vkQueueSubmit, counting the calls and the CPU time spent in them for the frame pacing stats
+*/
+void _VulkanRenderer_Impl::submitToQueue(vk::Queue queue, uint32_t submit_count, const vk::SubmitInfo* submits, vk::Fence fence)
+{
+	auto start_time = std::chrono::high_resolution_clock::now();
+	auto result = queue.submit(submit_count, submits, fence);
+	frame_pacing_stats.submit_ms += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start_time).count();
+	frame_pacing_stats.queue_submits++;
+	vulkan_util::checkResult(static_cast<VkResult>(result), "Failed to submit command buffers!");
+}
+
+/**
+* Submit the shading of the frame waiting for the next frame, if there is one
+*/
+void _VulkanRenderer_Impl::submitPendingShading()
+{
+	if (shading_pending)
+	{
+		shading_pending = false;
+		submitShading(pending_shading);
+	}
+}
+
+/**
+* Drop a frame without shading it. Its light culling semaphore still has to be waited for,
+* and with a separate compute family the graphics queue takes back what light culling released
+*/
+void _VulkanRenderer_Impl::discardShading(const ShadingSubmission& shading)
+{
+	if (!shading.light_culling_ran)
+	{
+		return; // nothing was submitted, the frame's fence is still signaled
+	}
+
+	vk::Semaphore wait_semaphores[] = { lightculling_completed_semaphores[shading.frame].get() };
+	vk::PipelineStageFlags wait_stages[] = { vk::PipelineStageFlagBits::eAllCommands };
+	vk::SubmitInfo submit_info = {
+		1, // waitSemaphoreCount
+		wait_semaphores, // pWaitSemaphores
+		wait_stages, // pwaitDstStageMask
+		queue_family_transfers ? 1u : 0u, // commandBufferCount
+		&queue_acquire_command_buffers[shading.frame], // pCommandBuffers
+		0, // singalSemaphoreCount
+		nullptr // pSingalSemaphores
+	};
+
+	vk::Fence fence = frame_fences[shading.frame].get();
+	device.resetFences(1, &fence);
+	submitToQueue(graphics_queue, 1, &submit_info, fence);
+}
+
+/**
+* Drop the frame waiting for the next frame, before recreating what its command buffers use
+*/
+void _VulkanRenderer_Impl::discardPendingShading()
+{
+	if (shading_pending)
+	{
+		shading_pending = false;
+		discardShading(pending_shading);
+	}
+}
+
+/**
+* Wait for a submitted frame and read back its stage timings.
+* Without light culling only the shading time is read, the other queries still hold an earlier frame's results
+*/
+StageTimings _VulkanRenderer_Impl::readStageTimings(uint32_t frame, bool light_culling_ran)
+{
+	std::array<uint64_t, TIMESTAMP_QUERY_COUNT> timestamps = {};
+	TimestampQuery first_query = light_culling_ran ? TIMESTAMP_DEPTH_PREPASS_BEGIN : TIMESTAMP_SHADING_BEGIN;
+	uint32_t query_count = TIMESTAMP_QUERY_COUNT - first_query;
+	vulkan_util::checkResult(vkGetQueryPoolResults(graphics_device, timestamp_query_pool.get(), getTimestampQuery(frame, first_query), query_count
+		, sizeof(uint64_t) * query_count, timestamps.data() + first_query, sizeof(uint64_t)
+		, VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT), "Failed to read timestamp queries!");
+
+	// timestampPeriod is nanoseconds per tick
+	float ms_per_tick = vulkan_context.getPhysicalDeviceProperties().limits.timestampPeriod / 1000000.0f;
+	auto elapsed = [&timestamps, ms_per_tick](TimestampQuery begin, TimestampQuery end)
+	{
+		return static_cast<float>(timestamps[end] - timestamps[begin]) * ms_per_tick;
+	};
+
+	StageTimings timings;
+	if (light_culling_ran)
+	{
+		timings.depth_prepass = elapsed(TIMESTAMP_DEPTH_PREPASS_BEGIN, TIMESTAMP_DEPTH_PREPASS_END);
+		timings.hiz_build = elapsed(TIMESTAMP_HIZ_BEGIN, TIMESTAMP_HIZ_END);
+		timings.light_culling = elapsed(TIMESTAMP_LIGHT_CULLING_BEGIN, TIMESTAMP_LIGHT_CULLING_END);
+		// the passes run back to back unless a semaphore or barrier holds the next one, they may also overlap
+		auto gap = [&timestamps, ms_per_tick](TimestampQuery end, TimestampQuery begin)
+		{
+			return timestamps[begin] > timestamps[end] ? static_cast<float>(timestamps[begin] - timestamps[end]) * ms_per_tick : 0.0f;
+		};
+		timings.idle = gap(TIMESTAMP_DEPTH_PREPASS_END, TIMESTAMP_HIZ_BEGIN) + gap(TIMESTAMP_HIZ_END, TIMESTAMP_LIGHT_CULLING_BEGIN)
+			+ gap(TIMESTAMP_LIGHT_CULLING_END, TIMESTAMP_SHADING_BEGIN);
+	}
+	timings.shading = elapsed(TIMESTAMP_SHADING_BEGIN, TIMESTAMP_SHADING_END);
+
+	if (pipeline_statistics_supported)
+	{
+		uint64_t fragments = 0;
+		vulkan_util::checkResult(vkGetQueryPoolResults(graphics_device, pipeline_statistics_query_pool.get(), frame, 1
+			, sizeof(fragments), &fragments, sizeof(fragments), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT)
+			, "Failed to read pipeline statistics queries!");
+		timings.shading_fragments = static_cast<float>(fragments);
+	}
+	return timings;
+}
+
+/**
+* Called once the fence of a frame was waited for: add the GPU time of the frame that used it last
+*/
+void _VulkanRenderer_Impl::recordFramePacing(uint32_t frame)
+{
+	if (!frame_timestamps_pending[frame])
+	{
+		return;
+	}
+	frame_timestamps_pending[frame] = false;
+
+	// the fence is signaled, so this doesn't wait
+	auto timings = readStageTimings(frame, frame_light_culling_ran[frame]);
+	frame_pacing_stats.gpu_frames++;
+	frame_pacing_stats.gpu_ms += timings.depth_prepass + timings.hiz_build + timings.light_culling + timings.shading;
+	frame_pacing_stats.gpu_idle_ms += timings.idle;
+}
+
+/**
+* Wait for the device and read back the counters written by the last light culling dispatch
+*/
+LightCullingStats _VulkanRenderer_Impl::readLightCullingStats()
+{
+	vkDeviceWaitIdle(graphics_device);
+
+	LightCullingStats stats;
+	void* data;
+	vkMapMemory(graphics_device, light_culling_stats_buffer_memory.get(), 0, sizeof(stats), 0, &data);
+	memcpy(&stats, data, sizeof(stats));
+	vkUnmapMemory(graphics_device, light_culling_stats_buffer_memory.get());
+	return stats;
+}
+
+/**
+* The counters of the last GPU culling, waits for the device to be idle
+*/
+MeshCullingStats _VulkanRenderer_Impl::readMeshCullingStats()
+{
+	vkDeviceWaitIdle(graphics_device);
+
+	MeshCullingStats stats;
+	void* data;
+	vkMapMemory(graphics_device, mesh_culling_stats_buffer_memory.get(), 0, sizeof(stats), 0, &data);
+	memcpy(&stats, data, sizeof(stats));
+	vkUnmapMemory(graphics_device, mesh_culling_stats_buffer_memory.get());
+	return stats;
+}
+
+/**
+* Draw warmup_frames, then measured_frames whose times are averaged, every pass runs in each of them.
+* The frames are drawn with delta_time, after calling before_frame if there is one. Reading the stage timings
+* submits each frame's shading right away, so leave it off where the overlap between frames is measured
+*/
+FrameTimings _VulkanRenderer_Impl::measureFrames(int warmup_frames, int measured_frames, bool read_stage_timings
+	, float delta_time, const std::function<void()>& before_frame)
+{
+	auto previous_temporal_reuse = temporal_reuse_enabled;
+	temporal_reuse_enabled = false; // every measured frame has to run every pass
+
+	auto drawMeasuredFrame = [&]()
+	{
+		if (before_frame)
+		{
+			before_frame();
+		}
+		updateUniformBuffers(delta_time);
+		drawFrame();
+	};
+	auto finishFrames = [&]()
+	{
+		submitPendingShading();
+		vkDeviceWaitIdle(graphics_device);
+		for (uint32_t frame = 0; frame < frames_in_flight; frame++)
+		{
+			recordFramePacing(frame);
+		}
+	};
+
+	for (int i = 0; i < warmup_frames; i++)
+	{
+		drawMeasuredFrame();
+	}
+	finishFrames(); // the frames drawn so far belong to none of the measured ones
+
+	FrameTimings average;
+	auto stats_before = frame_pacing_stats;
+	auto recording_before = recording_ms;
+	auto start_time = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < measured_frames; i++)
+	{
+		drawMeasuredFrame();
+
+		if (read_stage_timings)
+		{
+			submitPendingShading(); // the timestamps of a frame are complete once it's shaded
+			auto timings = readStageTimings(frame_index, true);
+			average.stages.depth_prepass += timings.depth_prepass / measured_frames;
+			average.stages.hiz_build += timings.hiz_build / measured_frames;
+			average.stages.light_culling += timings.light_culling / measured_frames;
+			average.stages.shading += timings.shading / measured_frames;
+			average.stages.shading_fragments += timings.shading_fragments / measured_frames;
+		}
+	}
+	finishFrames();
+	auto total_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start_time).count();
+
+	auto cpu_frames = static_cast<double>(std::max<uint64_t>(frame_pacing_stats.cpu_frames - stats_before.cpu_frames, 1));
+	average.frame_ms = total_ms / std::max(measured_frames, 1);
+	average.cpu_ms = (frame_pacing_stats.cpu_ms - stats_before.cpu_ms) / cpu_frames;
+	average.fence_wait_ms = (frame_pacing_stats.fence_wait_ms - stats_before.fence_wait_ms) / cpu_frames;
+	average.recording_ms = (recording_ms - recording_before) / cpu_frames;
+	average.queue_submits = (frame_pacing_stats.queue_submits - stats_before.queue_submits) / cpu_frames;
+	average.submit_ms = (frame_pacing_stats.submit_ms - stats_before.submit_ms) / cpu_frames;
+	if (frame_pacing_stats.gpu_frames > stats_before.gpu_frames)
+	{
+		auto gpu_frames = static_cast<double>(frame_pacing_stats.gpu_frames - stats_before.gpu_frames);
+		average.gpu_ms = (frame_pacing_stats.gpu_ms - stats_before.gpu_ms) / gpu_frames;
+		average.gpu_idle_ms = (frame_pacing_stats.gpu_idle_ms - stats_before.gpu_idle_ms) / gpu_frames;
+	}
+
+	temporal_reuse_enabled = previous_temporal_reuse;
+	return average;
+}
+
+/**
+* Render frames with the current camera and lights frozen and return the average stage timings
+*/
+StageTimings _VulkanRenderer_Impl::measureStageTimings(int warmup_frames, int measured_frames)
+{
+	return measureFrames(warmup_frames, measured_frames, true).stages;
+}
+
+/**
+* Try every candidate tile size on the current scene and resolution,
+* then lock in the one with the fastest light culling plus shading
+*/
+void _VulkanRenderer_Impl::autoTuneTileSize()
+{
+	if (!timestamps_supported)
+	{
+		std::cout << "Tile size auto-tuning needs timestamp queries, which this device doesn't support." << std::endl;
+		return;
+	}
+
+	std::cout << "Auto-tuning tile size at " << swap_chain_extent.width << "x" << swap_chain_extent.height << std::endl;
+
+	int best_tile_size = tile_size;
+	float best_time = std::numeric_limits<float>::max();
+	for (int candidate : TILE_SIZE_CANDIDATES)
+	{
+		changeTileSize(candidate);
+		auto timings = measureStageTimings(TUNING_WARMUP_FRAMES, TUNING_MEASURED_FRAMES);
+
+		std::cout << "\ttile size " << candidate
+			<< ": light culling " << timings.light_culling << " ms"
+			<< ", shading " << timings.shading << " ms"
+			<< ", total " << timings.cullingAndShading() << " ms" << std::endl;
+
+		if (timings.cullingAndShading() < best_time)
+		{
+			best_time = timings.cullingAndShading();
+			best_tile_size = candidate;
+		}
+	}
+
+	changeTileSize(best_tile_size);
+	std::cout << "Tile size locked to " << best_tile_size << std::endl;
+}
+
+/**
+* Time light culling with every candidate workgroup size the device supports and keep the fastest one
+*/
+void _VulkanRenderer_Impl::benchmarkLightCullingWorkgroupSizes()
+{
+	if (!timestamps_supported)
+	{
+		std::cout << "Workgroup size benchmark needs timestamp queries, which this device doesn't support." << std::endl;
+		return;
+	}
+
+	const auto& limits = vulkan_context.getPhysicalDeviceProperties().limits;
+	auto max_workgroup_size = static_cast<int>(std::min(limits.maxComputeWorkGroupSize[0], limits.maxComputeWorkGroupInvocations));
+
+	std::cout << "Light culling workgroup size benchmark at " << swap_chain_extent.width << "x" << swap_chain_extent.height
+		<< ", tile size " << tile_size << std::endl;
+
+	int best_workgroup_size = light_culling_workgroup_size;
+	float best_time = std::numeric_limits<float>::max();
+	for (int candidate : WORKGROUP_SIZE_CANDIDATES)
+	{
+		if (candidate > max_workgroup_size)
+		{
+			continue;
+		}
+
+		changeLightCullingWorkgroupSize(candidate);
+		auto timings = measureStageTimings(TUNING_WARMUP_FRAMES, TUNING_MEASURED_FRAMES);
+
+		std::cout << "\tworkgroup size " << candidate
+			<< ": light culling " << timings.light_culling << " ms"
+			<< ", shading " << timings.shading << " ms" << std::endl;
+
+		if (timings.light_culling < best_time)
+		{
+			best_time = timings.light_culling;
+			best_workgroup_size = candidate;
+		}
+	}
+
+	changeLightCullingWorkgroupSize(best_workgroup_size);
+	std::cout << "Light culling workgroup size locked to " << best_workgroup_size << std::endl;
+}
+
+/**
+* Compare the sphere-vs-tile tests: time each one, then rerun a frame in stats mode
+* to count lights per tile and accepted lights which light nothing in their tile
+*/
+void _VulkanRenderer_Impl::benchmarkLightCullingTests()
+{
+	if (!timestamps_supported)
+	{
+		std::cout << "Light culling test benchmark needs timestamp queries, which this device doesn't support." << std::endl;
+		return;
+	}
+
+	std::cout << "Light culling test benchmark at " << swap_chain_extent.width << "x" << swap_chain_extent.height
+		<< ", tile size " << tile_size << std::endl;
+
+	auto previous_test = light_culling_test;
+	auto tile_count = tile_count_per_row * tile_count_per_col;
+	for (int test = 0; test < LIGHT_CULLING_TEST_COUNT; test++)
+	{
+		changeLightCullingTest(static_cast<LightCullingTest>(test));
+		auto timings = measureStageTimings(TUNING_WARMUP_FRAMES, TUNING_MEASURED_FRAMES);
+
+		// the stats mode is much slower, so it's kept out of the timed frames
+		setLightCullingStatsEnabled(true);
+		measureStageTimings(0, 1);
+		auto stats = readLightCullingStats();
+		setLightCullingStatsEnabled(false);
+
+		auto zero_contribution_percent = stats.accepted_light_count > 0
+			? 100.0f * stats.zero_contribution_light_count / stats.accepted_light_count : 0.0f;
+
+		std::cout << "\t" << LIGHT_CULLING_TEST_NAMES[test]
+			<< ": light culling " << timings.light_culling << " ms"
+			<< ", shading " << timings.shading << " ms"
+			<< ", " << static_cast<float>(stats.accepted_light_count) / tile_count << " lights per tile"
+			<< ", " << zero_contribution_percent << "% of them light nothing" << std::endl;
+	}
+
+	changeLightCullingTest(previous_test);
+}
+
+/**
+* Time shading with different per-tile light budgets and report how many tiles had to be truncated
+*/
+void _VulkanRenderer_Impl::benchmarkTileLightBudgets()
+{
+	if (!timestamps_supported)
+	{
+		std::cout << "Tile light budget benchmark needs timestamp queries, which this device doesn't support." << std::endl;
+		return;
+	}
+
+	std::cout << "Tile light budget benchmark at " << swap_chain_extent.width << "x" << swap_chain_extent.height
+		<< ", tile size " << tile_size << std::endl;
+
+	auto previous_budget = max_point_light_per_tile;
+	for (int candidate : TILE_BUDGET_CANDIDATES)
+	{
+		if (candidate > point_light_capacity)
+		{
+			continue;
+		}
+
+		changeMaxPointLightPerTile(candidate);
+		auto timings = measureStageTimings(TUNING_WARMUP_FRAMES, TUNING_MEASURED_FRAMES);
+		auto stats = readLightCullingStats(); // counters of the last measured frame
+
+		std::cout << "\tbudget " << candidate
+			<< ": light culling " << timings.light_culling << " ms"
+			<< ", shading " << timings.shading << " ms"
+			<< ", " << stats.overflowed_tile_count << " of " << tile_count_per_row * tile_count_per_col << " tiles overflowed"
+			<< ", " << stats.dropped_light_count << " lights dropped"
+			<< ", busiest tile saw " << stats.max_tile_light_count << " lights" << std::endl;
+	}
+
+	changeMaxPointLightPerTile(previous_budget);
+}
+
+/**
+* Compare real spot lights against the same lights emulated with enclosing point lights
+*/
+void _VulkanRenderer_Impl::benchmarkSpotLights()
+{
+	if (!timestamps_supported)
+	{
+		std::cout << "Spot light benchmark needs timestamp queries, which this device doesn't support." << std::endl;
+		return;
+	}
+	if (spotlights.empty())
+	{
+		std::cout << "Spot light benchmark needs a scene with spot lights." << std::endl;
+		return;
+	}
+
+	std::cout << "Spot light benchmark at " << swap_chain_extent.width << "x" << swap_chain_extent.height
+		<< " with " << pointlights.size() << " point lights and " << spotlights.size() << " spot lights" << std::endl;
+
+	auto previous_emulation = emulate_spot_lights;
+	for (bool emulated : { true, false })
+	{
+		setSpotLightEmulation(emulated);
+		auto timings = measureStageTimings(TUNING_WARMUP_FRAMES, TUNING_MEASURED_FRAMES);
+
+		setLightCullingStatsEnabled(true);
+		measureStageTimings(0, 1);
+		auto stats = readLightCullingStats();
+		setLightCullingStatsEnabled(false);
+
+		std::cout << "\t" << (emulated ? "emulated with point lights" : "spot lights")
+			<< ": light culling " << timings.light_culling << " ms"
+			<< ", shading " << timings.shading << " ms"
+			<< ", " << static_cast<float>(stats.accepted_light_count) / (tile_count_per_row * tile_count_per_col) << " lights per tile" << std::endl;
+	}
+
+	setSpotLightEmulation(previous_emulation);
+}
+
+/**
+* Time light culling with the atomicAdd light append and, when the device supports it, the subgroup ballot one
+*/
+void _VulkanRenderer_Impl::benchmarkSubgroupLightAppend()
+{
+	if (!timestamps_supported)
+	{
+		std::cout << "Subgroup append benchmark needs timestamp queries, which this device doesn't support." << std::endl;
+		return;
+	}
+
+	std::cout << "Light append benchmark at " << swap_chain_extent.width << "x" << swap_chain_extent.height
+		<< ", tile size " << tile_size << ", workgroup size " << light_culling_workgroup_size
+		<< ", subgroup size " << vulkan_context.getSubgroupProperties().subgroupSize
+		<< (vulkan_context.supportsComputeSubgroupBallot() ? ", ballot supported in compute" : ", no ballot in compute") << std::endl;
+
+	auto previous = use_subgroup_light_append;
+	for (bool subgroup : { false, true })
+	{
+		if (subgroup && !vulkan_context.supportsComputeSubgroupBallot())
+		{
+			std::cout << "\tsubgroup ballot: not supported by this device" << std::endl;
+			continue;
+		}
+
+		setSubgroupLightAppendEnabled(subgroup);
+		auto timings = measureStageTimings(TUNING_WARMUP_FRAMES, TUNING_MEASURED_FRAMES);
+
+		std::cout << "\t" << (subgroup ? "subgroup ballot" : "atomicAdd per light")
+			<< ": light culling " << timings.light_culling << " ms" << std::endl;
+	}
+
+	setSubgroupLightAppendEnabled(previous);
+}
+
+/**
+* Compare moving the lights on the CPU with a full upload every frame against the light update pass
+*/
+void _VulkanRenderer_Impl::benchmarkLightAnimation()
+{
+	const float delta_time = 1.0f / 60.0f;
+
+	std::cout << "Light animation benchmark with " << pointlights.size() << " point lights and "
+		<< spotlights.size() << " spot lights" << std::endl;
+
+	auto previous_gpu_animation = gpu_light_animation;
+	auto previous_paused = light_animation_paused;
+	light_animation_paused = false;
+	for (bool gpu : { false, true })
+	{
+		setGpuLightAnimationEnabled(gpu);
+
+		for (int i = 0; i < TUNING_WARMUP_FRAMES; i++)
+		{
+			updateUniformBuffers(delta_time);
+			drawFrame();
+		}
+		vkDeviceWaitIdle(graphics_device);
+
+		uploaded_bytes = 0;
+		auto start_time = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < TUNING_MEASURED_FRAMES; i++)
+		{
+			updateUniformBuffers(delta_time);
+			drawFrame();
+		}
+		auto end_time = std::chrono::high_resolution_clock::now();
+		vkDeviceWaitIdle(graphics_device);
+
+		// CPU time includes waiting on the single time copies, which is part of the cost of uploading
+		float cpu_ms = std::chrono::duration<float, std::milli>(end_time - start_time).count() / TUNING_MEASURED_FRAMES;
+		std::cout << "\t" << (gpu ? "light update pass" : "CPU loop + upload")
+			<< ": CPU frame time " << cpu_ms << " ms, uploaded " << uploaded_bytes / TUNING_MEASURED_FRAMES << " bytes/frame" << std::endl;
+	}
+
+	light_animation_paused = previous_paused;
+	setGpuLightAnimationEnabled(previous_gpu_animation);
+}
+
+/**
+* Change a fraction of the point lights every frame and report how much the incremental uploads copy
+*/
+void _VulkanRenderer_Impl::benchmarkLightUploads()
+{
+	if (pointlights.empty())
+	{
+		std::cout << "Light upload benchmark needs a scene with point lights." << std::endl;
+		return;
+	}
+
+	auto full_upload_size = sizeof(glm::vec4) + sizeof(PointLight) * pointlights.size();
+	std::cout << "Light upload benchmark with " << pointlights.size() << " point lights, "
+		<< LIGHTS_PER_DIRTY_PAGE << " lights per page, a full upload is " << full_upload_size << " bytes" << std::endl;
+
+	// only the changes made here should be uploaded
+	auto previous_paused = light_animation_paused;
+	light_animation_paused = true;
+	std::mt19937 random_engine(42);
+	std::uniform_int_distribution<size_t> light_index(0, pointlights.size() - 1);
+
+	for (float fraction : LIGHT_UPLOAD_CHANGED_FRACTIONS)
+	{
+		auto changed_count = std::max<size_t>(1, static_cast<size_t>(pointlights.size() * fraction));
+		auto changeLights = [&]()
+		{
+			if (changed_count == pointlights.size())
+			{
+				markPointLightsDirty(0, pointlights.size());
+				return;
+			}
+			for (size_t i = 0; i < changed_count; i++)
+			{
+				auto index = light_index(random_engine);
+				auto light = pointlights.get(index);
+				light.intensity = glm::vec3(1.0f) - light.intensity * 0.5f;
+				pointlights.set(index, light);
+				markPointLightsDirty(index, 1);
+			}
+		};
+
+		for (int i = 0; i < TUNING_WARMUP_FRAMES; i++)
+		{
+			changeLights();
+			updateUniformBuffers(0.0f);
+			drawFrame();
+		}
+		vkDeviceWaitIdle(graphics_device);
+
+		uploaded_bytes = 0;
+		uploaded_copy_regions = 0;
+		float update_ms = 0.0f;
+		for (int i = 0; i < TUNING_MEASURED_FRAMES; i++)
+		{
+			changeLights();
+			auto start_time = std::chrono::high_resolution_clock::now();
+			updateUniformBuffers(0.0f);
+			update_ms += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start_time).count();
+			drawFrame();
+		}
+		vkDeviceWaitIdle(graphics_device);
+
+		// the camera and object uniforms are written every frame too
+		auto light_bytes = (uploaded_bytes - (sizeof(CameraUbo) + sizeof(SceneObjectUbo)) * TUNING_MEASURED_FRAMES) / TUNING_MEASURED_FRAMES;
+		std::cout << "\t" << fraction * 100.0f << "% of lights changing: uploaded " << light_bytes << " bytes/frame ("
+			<< 100.0f * light_bytes / full_upload_size << "% of a full upload) in "
+			<< static_cast<float>(uploaded_copy_regions) / TUNING_MEASURED_FRAMES << " copy regions/frame, CPU update "
+			<< update_ms / TUNING_MEASURED_FRAMES << " ms/frame" << std::endl;
+	}
+
+	// the last light with a range running past the end of the buffer, only the last page should be uploaded
+	{
+		auto last = pointlights.size() - 1;
+		auto page_first = last / LIGHTS_PER_DIRTY_PAGE * LIGHTS_PER_DIRTY_PAGE;
+		auto page_end = std::min(page_first + LIGHTS_PER_DIRTY_PAGE, pointlight_dirty_pages.size());
+		auto expected_bytes = sizeof(PointLight) * (page_end - page_first);
+		auto changeLastLight = [&]()
+		{
+			auto light = pointlights.get(last);
+			light.intensity = glm::vec3(1.0f) - light.intensity * 0.5f;
+			pointlights.set(last, light);
+			markPointLightsDirty(last, 2 * LIGHTS_PER_DIRTY_PAGE);
+		};
+
+		for (int i = 0; i < TUNING_WARMUP_FRAMES; i++)
+		{
+			changeLastLight();
+			updateUniformBuffers(0.0f);
+			drawFrame();
+		}
+		vkDeviceWaitIdle(graphics_device);
+
+		uploaded_bytes = 0;
+		for (int i = 0; i < TUNING_MEASURED_FRAMES; i++)
+		{
+			changeLastLight();
+			updateUniformBuffers(0.0f);
+			drawFrame();
+		}
+		vkDeviceWaitIdle(graphics_device);
+
+		auto light_bytes = (uploaded_bytes - (sizeof(CameraUbo) + sizeof(SceneObjectUbo)) * TUNING_MEASURED_FRAMES) / TUNING_MEASURED_FRAMES;
+		std::cout << "\tlast light, range past the end: uploaded " << light_bytes << " bytes/frame, the last page is "
+			<< expected_bytes << " bytes" << std::endl;
+	}
+
+	light_animation_paused = previous_paused;
+}
+
+/**
+* Stream a buffer upload through the transfer queue every frame while drawing, as streaming in meshes or textures would,
+* and report the frame time, the upload throughput and how many staging blocks had to be allocated for each upload size
+*/
+void _VulkanRenderer_Impl::benchmarkUploadStreaming()
+{
+	std::cout << "Upload streaming benchmark, " << TUNING_MEASURED_FRAMES << " frames per upload size, uploads on ";
+	if (vulkan_context.hasSeparateTransferFamily())
+	{
+		std::cout << "transfer queue family " << vulkan_context.getQueueFamilyIndices().transfer_family << std::endl;
+	}
+	else
+	{
+		std::cout << "the graphics queue" << std::endl;
+	}
+
+	// one destination region per frame in flight, an upload waits for the last one into its region,
+	// so the transfers can fall behind by that many frames before they stall the CPU
+	auto max_size = *std::max_element(UPLOAD_STREAMING_SIZES.begin(), UPLOAD_STREAMING_SIZES.end());
+	VRaii<VkBuffer> destination_buffer;
+	VRaii<VkDeviceMemory> destination_buffer_memory;
+	std::tie(destination_buffer, destination_buffer_memory) = utility.createBuffer(max_size * frames_in_flight
+		, VK_BUFFER_USAGE_TRANSFER_DST_BIT
+		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	std::vector<char> source_data(static_cast<size_t>(max_size), 1);
+	std::vector<uint64_t> region_upload_values(frames_in_flight, 0);
+
+	for (auto size : UPLOAD_STREAMING_SIZES)
+	{
+		// the warmup frames fill the staging block pool, the counts start with the first measured frame
+		int frames_drawn = 0;
+		int stalls = 0;
+		uint64_t allocations_before = 0;
+		auto timings = measureFrames(TUNING_WARMUP_FRAMES, TUNING_MEASURED_FRAMES, false, 0.0f, [&]()
+		{
+			if (frames_drawn++ == TUNING_WARMUP_FRAMES)
+			{
+				stalls = 0;
+				allocations_before = transfer_queue.getStagingBlockAllocations();
+			}
+			if (size == 0)
+			{
+				return;
+			}
+
+			auto region = frame_serial % frames_in_flight;
+			if (!transfer_queue.isComplete(region_upload_values[region]))
+			{
+				stalls++;
+				transfer_queue.wait(region_upload_values[region]);
+			}
+			// every upload rewrites its whole region, which takes it over from the graphics family without an acquire,
+			// the frame drawn next acquires it
+			transfer_queue.uploadBuffer(destination_buffer.get(), max_size * region, source_data.data(), size
+				, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferRead);
+			region_upload_values[region] = transfer_queue.submit();
+		});
+		transfer_queue.wait(transfer_queue.submit());
+
+		std::cout << "\t" << size / 1024 << " KiB/frame: " << timings.frame_ms << " ms/frame";
+		if (size > 0)
+		{
+			std::cout << ", " << size / (timings.frame_ms * 1000.0) << " MB/s streamed, "
+				<< stalls << " frames waited for an upload, "
+				<< transfer_queue.getStagingBlockAllocations() - allocations_before << " staging blocks allocated";
+		}
+		std::cout << std::endl;
+	}
+
+	// the last uploads still have to be acquired before the buffer goes away
+	transfer_queue.acquireCompleted();
+	vkDeviceWaitIdle(graphics_device);
+}
+
+/**
+* Time the CPU light kernels on 1k to 1M lights, scalar against SIMD and one thread against all of them.
+* Runs on its own lights, the frustum is the one of the current camera
+*/
+void _VulkanRenderer_Impl::benchmarkLightKernels()
+{
+	// planes of the clip space frustum (Vulkan depth range 0 to 1) in world space, normalized so they give distances
+	const auto& projview = last_camera_ubo.projview;
+	auto row = [&projview](int i) { return glm::vec4(projview[0][i], projview[1][i], projview[2][i], projview[3][i]); };
+	std::array<glm::vec4, 6> planes = { row(3) + row(0), row(3) - row(0), row(3) + row(1), row(3) - row(1), row(2), row(3) - row(2) };
+	for (auto& plane : planes)
+	{
+		plane /= glm::length(glm::vec3(plane));
+	}
+
+	const auto& scene = getGlobalTestSceneConfiguration();
+	const float delta_time = 1.0f / 60.0f;
+	ThreadPool single_thread(1);
+
+	std::cout << "Light kernel benchmark, best instruction set " << getLightKernelIsaName(PointLightStore::getBestSupportedIsa())
+		<< ", " << thread_pool.getThreadCount() << " threads, " << LIGHT_KERNEL_CHUNK_SIZE << " lights per task" << std::endl;
+
+	std::mt19937 random_engine(42);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	for (auto light_count : LIGHT_KERNEL_BENCHMARK_COUNTS)
+	{
+		PointLightStore lights;
+		lights.reserve(light_count);
+		for (size_t i = 0; i < light_count; i++)
+		{
+			glm::vec3 t = { unit(random_engine), unit(random_engine), unit(random_engine) };
+			lights.push_back(PointLight(glm::mix(scene.min_light_pos, scene.max_light_pos, t), scene.light_radius, t));
+		}
+		std::vector<uint8_t> visible(light_count);
+		std::vector<PointLight> packed(light_count);
+
+		struct Variant
+		{
+			const char* name;
+			LightKernelIsa isa;
+			ThreadPool* pool;
+		};
+		const std::array<Variant, 3> variants = { {
+			{ "scalar, 1 thread", LightKernelIsa::SCALAR, &single_thread },
+			{ "SIMD, 1 thread", PointLightStore::getBestSupportedIsa(), &single_thread },
+			{ "SIMD, all threads", PointLightStore::getBestSupportedIsa(), &thread_pool },
+		} };
+
+		for (const auto& variant : variants)
+		{
+			lights.setKernelIsa(variant.isa);
+			auto& pool = *variant.pool;
+
+			auto measure = [&](const std::function<void(size_t first, size_t count)>& kernel)
+			{
+				pool.parallelFor(light_count, LIGHT_KERNEL_CHUNK_SIZE, kernel); // warm up
+				auto start_time = std::chrono::high_resolution_clock::now();
+				for (int i = 0; i < TUNING_MEASURED_FRAMES; i++)
+				{
+					pool.parallelFor(light_count, LIGHT_KERNEL_CHUNK_SIZE, kernel);
+				}
+				auto end_time = std::chrono::high_resolution_clock::now();
+				return std::chrono::duration<float, std::milli>(end_time - start_time).count() / TUNING_MEASURED_FRAMES;
+			};
+
+			std::atomic<size_t> visible_count(0);
+			auto animate_ms = measure([&](size_t first, size_t count)
+			{
+				lights.animate(first, count, LIGHT_VELOCITY, delta_time, scene.min_light_pos, scene.max_light_pos);
+			});
+			auto cull_ms = measure([&](size_t first, size_t count)
+			{
+				visible_count += lights.cullSpheres(first, count, planes, visible.data() + first);
+			});
+			auto pack_ms = measure([&](size_t first, size_t count)
+			{
+				lights.pack(first, count, packed.data() + first);
+			});
+
+			std::cout << "\t" << light_count << " lights, " << variant.name
+				<< ": animate " << animate_ms << " ms, frustum cull " << cull_ms << " ms ("
+				<< visible_count / (TUNING_MEASURED_FRAMES + 1) << " visible), pack " << pack_ms << " ms" << std::endl;
+		}
+	}
+}
+
+/**
+* Stress test for the growable light buffers: keep adding point lights while rendering, doubling the count every step.
+* The slowest frame of a step includes the growth, which should cost about as much as a full upload rather than a GPU stall.
+* The added lights stay in the scene
+*/
+void _VulkanRenderer_Impl::benchmarkLightRamp()
+{
+	const float delta_time = 1.0f / 60.0f;
+
+	std::cout << "Light ramp stress test from " << pointlights.size() << " to " << LIGHT_RAMP_MAX_COUNT << " point lights, "
+		<< LIGHT_RAMP_FRAMES_PER_STEP << " frames per step" << std::endl;
+
+	auto previous_temporal_reuse = temporal_reuse_enabled;
+	temporal_reuse_enabled = false; // every measured frame has to run every pass
+	while (pointlights.size() < LIGHT_RAMP_MAX_COUNT)
+	{
+		auto target_count = std::min(LIGHT_RAMP_MAX_COUNT, std::max<size_t>(pointlights.size() * 2, 1000));
+		auto growth_count = light_buffer_growth_count;
+
+		// a few lights every frame, so the buffers grow in the middle of rendering
+		float total_ms = 0.0f;
+		float slowest_ms = 0.0f;
+		for (int i = 0; i < LIGHT_RAMP_FRAMES_PER_STEP; i++)
+		{
+			auto start_time = std::chrono::high_resolution_clock::now();
+			addPointLights((target_count - pointlights.size()) / (LIGHT_RAMP_FRAMES_PER_STEP - i));
+			updateUniformBuffers(delta_time);
+			drawFrame();
+			auto frame_ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start_time).count();
+			total_ms += frame_ms;
+			slowest_ms = std::max(slowest_ms, frame_ms);
+		}
+
+		std::cout << "\t" << pointlights.size() << " lights: capacity " << point_light_capacity
+			<< " (" << pointlight_buffer_size / (1024 * 1024) << " MiB), grew " << light_buffer_growth_count - growth_count << " times"
+			<< ", CPU frame time " << total_ms / LIGHT_RAMP_FRAMES_PER_STEP << " ms, slowest frame " << slowest_ms << " ms" << std::endl;
+	}
+	vkDeviceWaitIdle(graphics_device);
+	temporal_reuse_enabled = previous_temporal_reuse;
+}
+
+/**
+* Draw animated frames as fast as possible and report where the frame time went with the configured frames in flight.
+* Run it again with --frames-in-flight 1 to see the frame time without any CPU/GPU overlap
+*/
+void _VulkanRenderer_Impl::benchmarkFramePacing()
+{
+	const float delta_time = 1.0f / 60.0f;
+
+	auto timings = measureFrames(0, FRAME_PACING_BENCHMARK_FRAMES, false, delta_time);
+
+	std::cout << "Light culling queue: ";
+	if (vulkan_context.hasSeparateComputeFamily())
+	{
+		std::cout << "compute queue family " << vulkan_context.getQueueFamilyIndices().compute_family << std::endl;
+	}
+	else if (vulkan_context.hasAsyncCompute())
+	{
+		std::cout << "second queue of the graphics queue family" << std::endl;
+	}
+	else
+	{
+		std::cout << "the graphics queue" << std::endl;
+	}
+	std::cout << FRAME_PACING_BENCHMARK_FRAMES << " frames with " << frames_in_flight << " frames in flight"
+		<< (pipelined_shading ? " and async compute" : "") << ": "
+		<< timings.frame_ms << " ms/frame, CPU " << timings.cpu_ms << " ms, waiting for the GPU " << timings.fence_wait_ms << " ms";
+	if (timings.gpu_ms > 0.0)
+	{
+		// the part of the GPU time the CPU didn't have to wait through
+		auto overlap = glm::clamp(1.0 - timings.fence_wait_ms / timings.gpu_ms, 0.0, 1.0);
+		std::cout << ", GPU " << timings.gpu_ms << " ms, overlap " << overlap * 100.0 << "%";
+	}
+	std::cout << std::endl;
+}
+
+/**
+* Draw the same frames with the depth prepass, light culling and shading submitted separately and chained by semaphores,
+* then as one submission through the frame graph, and compare the submission cost and the GPU idle time between the passes.
+* The frame graph needs light culling on the graphics queue, so run it with --async-compute 0
+*/
+void _VulkanRenderer_Impl::benchmarkFrameGraph()
+{
+	if (vulkan_context.hasAsyncCompute())
+	{
+		std::cout << "Light culling runs on its own queue, run the frame graph benchmark with --async-compute 0." << std::endl;
+		return;
+	}
 
-		descriptor_writes.emplace_back(
-			light_culling_descriptor_set, // dstSet
-			1, // dstBinding
-			0, // distArrayElement
-			1, // descriptorCount
-			vk::DescriptorType::eStorageBuffer, //descriptorType // FIXME: change back to uniform
-			nullptr, //pImageInfo
-			&pointlight_buffer_info, //pBufferInfo
-			nullptr //pTexBufferView
-		);
+	std::cout << "Frame submission at " << swap_chain_extent.width << "x" << swap_chain_extent.height
+		<< ", " << FRAME_PACING_BENCHMARK_FRAMES << " frames each" << std::endl;
 
-		std::array<vk::CopyDescriptorSet, 0> descriptor_copies;
-		device.updateDescriptorSets(descriptor_writes, descriptor_copies);
+	auto previous_use_frame_graph = use_frame_graph;
+	for (bool graph : { false, true })
+	{
+		use_frame_graph = graph;
+
+		// lights stay put, so no light update pass sits between the depth prepass and light culling
+		auto barriers_before = frame_graph_barriers;
+		auto timings = measureFrames(0, FRAME_PACING_BENCHMARK_FRAMES, false);
+
+		std::cout << "\t" << (graph ? "frame graph" : "separate submissions") << ": "
+			<< timings.queue_submits << " vkQueueSubmit/frame, "
+			<< timings.submit_ms << " ms submitting";
+		if (graph)
+		{
+			std::cout << ", " << static_cast<double>(frame_graph_barriers - barriers_before) / FRAME_PACING_BENCHMARK_FRAMES << " barriers/frame";
+		}
+		if (timings.gpu_ms > 0.0)
+		{
+			std::cout << ", GPU " << timings.gpu_ms << " ms"
+				<< ", idle between passes " << timings.gpu_idle_ms << " ms";
+		}
+		std::cout << std::endl;
 	}
 
+	use_frame_graph = previous_use_frame_graph;
 }
 
-void _VulkanRenderer_Impl::createLightCullingCommandBuffer()
+/**
+* Time switching to each debug view until its first frame is submitted, against the swap chain recreation
+* switching used to take, and the shading time of each shader variant
+*/
+void _VulkanRenderer_Impl::benchmarkDebugViews()
 {
+	const char* view_names[DEBUG_VIEW_COUNT] = { "render", "heat map with render", "heat map", "depth", "normal" };
 
-	if (light_culling_command_buffer)
+	std::cout << "Debug view benchmark at " << swap_chain_extent.width << "x" << swap_chain_extent.height << std::endl;
+
+	auto previous_view = debug_view_index;
 	{
-		device.freeCommandBuffers(compute_command_pool, 1, &light_culling_command_buffer);
-		light_culling_command_buffer = nullptr;
+		auto start = std::chrono::high_resolution_clock::now();
+		recreateSwapChain();
+		updateUniformBuffers(0.0f);
+		drawFrame();
+		std::cout << "	swap chain recreation: "
+			<< std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count() << " ms" << std::endl;
 	}
 
-	// Create light culling command buffer
+	for (int view = 0; view < DEBUG_VIEW_COUNT; view++)
 	{
-		vk::CommandBufferAllocateInfo alloc_info = {
-			compute_command_pool, // command pool
-			vk::CommandBufferLevel::ePrimary, // level
-			1 // commandBufferCount
-		};
-
-		light_culling_command_buffer = device.allocateCommandBuffers(alloc_info)[0];
+		auto start = std::chrono::high_resolution_clock::now();
+		changeDebugViewIndex(view);
+		updateUniformBuffers(0.0f);
+		drawFrame();
+		auto switch_ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		std::cout << "	" << view_names[view] << ": switch " << switch_ms << " ms";
+		if (timestamps_supported)
+		{
+			auto timings = measureStageTimings(TUNING_WARMUP_FRAMES, TUNING_MEASURED_FRAMES);
+			std::cout << ", shading " << timings.shading << " ms";
+		}
+		std::cout << std::endl;
 	}
 
-	// Record command buffer
+	changeDebugViewIndex(previous_view);
+}
+
+/**
+* Time recording the mesh parts of the depth prepass and the shading pass with 1 thread up to all of them
+*/
+void _VulkanRenderer_Impl::benchmarkRecordingThreads()
+{
+	auto part_count = model.getMeshParts().size();
+	std::cout << "Recording benchmark with " << part_count << " mesh parts, " << MESH_PARTS_PER_RECORDING_CHUNK << " parts per secondary command buffer, "
+		<< RECORDING_BENCHMARK_FRAMES << " frames each" << std::endl;
+	if (part_count <= MESH_PARTS_PER_RECORDING_CHUNK)
 	{
-		vk::CommandBufferBeginInfo begin_info =
-		{
-			vk::CommandBufferUsageFlagBits::eSimultaneousUse,
-			nullptr
-		};
+		std::cout << "	the scene fits in one chunk, run with --synthetic-parts 4096 to have something to split" << std::endl;
+	}
 
-		vk::CommandBuffer command(light_culling_command_buffer);
+	auto previous_use_indirect_draws = use_indirect_draws;
+	use_indirect_draws = false; // they would be recorded as one chunk
 
-		command.begin(begin_info);
+	std::vector<size_t> thread_counts;
+	for (size_t count = 1; count < thread_pool.getThreadCount(); count *= 2)
+	{
+		thread_counts.push_back(count);
+	}
+	thread_counts.push_back(thread_pool.getThreadCount());
 
-		// using barrier since the sharing mode when allocating memory is exclusive
-		// begin after fragment shader finished reading from storage buffer
+	double single_thread_ms = 0.0;
+	for (auto thread_count : thread_counts)
+	{
+		// the command pools are per thread of the renderer's pool, so a smaller pool uses the first of them
+		ThreadPool pool(thread_count);
+		recording_thread_pool = thread_count == thread_pool.getThreadCount() ? &thread_pool : &pool;
 
-		std::vector<vk::BufferMemoryBarrier> barriers_before;
-		barriers_before.emplace_back
-		(
-			vk::AccessFlagBits::eShaderRead,  // srcAccessMask
-			vk::AccessFlagBits::eShaderWrite,  // dstAccessMask
-			0, //static_cast<uint32_t>(queue_family_indices.graphics_family),  // srcQueueFamilyIndex
-			0, //static_cast<uint32_t>(queue_family_indices.compute_family),  // dstQueueFamilyIndex
-			static_cast<vk::Buffer>(light_visibility_buffer.get()),  // buffer
-			0,  // offset
-			light_visibility_buffer_size  // size
-		);
-		barriers_before.emplace_back
-		(
-			vk::AccessFlagBits::eShaderRead,  // srcAccessMask // FIXME: change back to uniform
-			vk::AccessFlagBits::eShaderWrite,  // dstAccessMask
-			0, //static_cast<uint32_t>(queue_family_indices.graphics_family),  // srcQueueFamilyIndex
-			0, //static_cast<uint32_t>(queue_family_indices.compute_family),  // dstQueueFamilyIndex
-			static_cast<vk::Buffer>(pointlight_buffer.get()),  // buffer
-			0,  // offset
-			pointlight_buffer_size  // size
-		);
+		// every frame is shaded before this returns, so nothing is recorded after the pool is gone
+		auto timings = measureFrames(TUNING_WARMUP_FRAMES, RECORDING_BENCHMARK_FRAMES, false);
+		if (thread_count == 1)
+		{
+			single_thread_ms = timings.recording_ms;
+		}
 
-		command.pipelineBarrier(
-			vk::PipelineStageFlagBits::eFragmentShader,  // srcStageMask
-			vk::PipelineStageFlagBits::eComputeShader,  // dstStageMask
-			vk::DependencyFlags(),  // dependencyFlags
-			0,  // memoryBarrierCount
-			nullptr,  // pBUfferMemoryBarriers
-			static_cast<uint32_t>(barriers_before.size()),  // bufferMemoryBarrierCount
-			barriers_before.data(),  // pBUfferMemoryBarriers
-			0,  // imageMemoryBarrierCount
-			nullptr // pImageMemoryBarriers
-		);
+		std::cout << "	" << thread_count << (thread_count == 1 ? " thread: " : " threads: ")
+			<< timings.recording_ms << " ms recording/frame (" << single_thread_ms / timings.recording_ms << "x), "
+			<< timings.cpu_ms << " ms CPU/frame" << std::endl;
+	}
 
+	recording_thread_pool = &thread_pool;
+	use_indirect_draws = previous_use_indirect_draws;
+}
 
-		// barrier
-		command.bindDescriptorSets(
-			vk::PipelineBindPoint::eCompute, // pipelineBindPoint
-			compute_pipeline_layout.get(), // layout
-			0, // firstSet
-			std::array<vk::DescriptorSet, 3>{light_culling_descriptor_set, camera_descriptor_set, intermediate_descriptor_set}, // descriptorSets
-			std::array<uint32_t, 0>() // pDynamicOffsets
-		);
+/**
+* Time creating every pipeline without a pipeline cache, from an empty one and again from the same one once it's warm,
+* on one thread and on all of them. Drivers may keep a cache of their own, which makes the cold numbers optimistic
+*/
+void _VulkanRenderer_Impl::benchmarkPipelineCache()
+{
+	std::cout << "Pipeline creation benchmark, " << DEBUG_VIEW_COUNT + 3 << " pipelines, the cache ";
+	if (vulkan_context.getPipelineCacheRejection())
+	{
+		std::cout << "started empty at startup, " << vulkan_context.getPipelineCacheRejection() << std::endl;
+	}
+	else
+	{
+		std::cout << "loaded " << vulkan_context.getPipelineCacheLoadedSize() << " bytes from disk at startup" << std::endl;
+	}
 
-		PushConstantObject pco = { static_cast<int>(swap_chain_extent.width), static_cast<int>(swap_chain_extent.height), tile_count_per_row, tile_count_per_col };
-		command.pushConstants(compute_pipeline_layout.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(pco), &pco);
+	discardPendingShading();
+	vkDeviceWaitIdle(graphics_device);
 
-		command.bindPipeline(vk::PipelineBindPoint::eCompute, static_cast<VkPipeline>(compute_pipeline.get()));
-		command.dispatch(tile_count_per_row, tile_count_per_col, 1);
+	ThreadPool single_thread_pool(1);
+	for (auto pool : { &single_thread_pool, &thread_pool })
+	{
+		pipeline_thread_pool = pool;
 
+		pipeline_cache = vk::PipelineCache();
+		createPipelines(true);
+		auto no_cache_ms = pipeline_creation_ms;
 
-		std::vector<vk::BufferMemoryBarrier> barriers_after;
-		barriers_after.emplace_back
-		(
-			vk::AccessFlagBits::eShaderWrite,  // srcAccessMask
-			vk::AccessFlagBits::eShaderRead,  // dstAccessMask
-			0,//static_cast<uint32_t>(queue_family_indices.compute_family), // srcQueueFamilyIndex
-			0,//static_cast<uint32_t>(queue_family_indices.graphics_family),  // dstQueueFamilyIndex
-			static_cast<vk::Buffer>(light_visibility_buffer.get()),  // buffer
-			0,  // offset
-			light_visibility_buffer_size  // size
-		);
-		barriers_after.emplace_back
-		(
-			vk::AccessFlagBits::eShaderWrite,  // srcAccessMask // TODO: change back to uniform
-			vk::AccessFlagBits::eShaderRead,  // dstAccessMask
-			0, //static_cast<uint32_t>(queue_family_indices.compute_family), // srcQueueFamilyIndex
-			0, //static_cast<uint32_t>(queue_family_indices.graphics_family),  // dstQueueFamilyIndex
-			static_cast<vk::Buffer>(pointlight_buffer.get()),  // buffer
-			0,  // offset
-			pointlight_buffer_size  // size
+		VRaii<vk::PipelineCache> benchmark_cache(
+			device.createPipelineCache(vk::PipelineCacheCreateInfo(), nullptr),
+			[device = this->device](auto& cache) { device.destroyPipelineCache(cache); }
 		);
+		pipeline_cache = benchmark_cache.get();
+		createPipelines(true);
+		auto cold_ms = pipeline_creation_ms;
+		createPipelines(true);
+		auto warm_ms = pipeline_creation_ms;
+
+		std::cout << "	" << pool->getThreadCount() << (pool->getThreadCount() == 1 ? " thread: " : " threads: ")
+			<< "no cache " << no_cache_ms << " ms, cold cache " << cold_ms << " ms, warm cache " << warm_ms << " ms ("
+			<< cold_ms / warm_ms << "x)" << std::endl;
+	}
 
-		command.pipelineBarrier(
-			vk::PipelineStageFlagBits::eComputeShader,
-			vk::PipelineStageFlagBits::eFragmentShader,
-			vk::DependencyFlags(),
-			0, nullptr,
-			static_cast<uint32_t>(barriers_after.size()), barriers_after.data(), // TODO
-			0, nullptr
-		);
+	pipeline_thread_pool = &thread_pool;
+	pipeline_cache = vulkan_context.getPipelineCache();
+	createLightCullingCommandBuffer(); // recorded with the light culling pipeline just destroyed
+	invalidateFrameResults();
+}
 
-		command.end();
+/**
+* Compare recording a draw call per mesh part on the recording threads against the indirect draws
+*/
+void _VulkanRenderer_Impl::benchmarkIndirectDraws()
+{
+	if (!use_bindless_materials || !vulkan_context.supportsMultiDrawIndirect())
+	{
+		std::cout << "Indirect draws need bindless materials and multiDrawIndirect, which this device or configuration lacks." << std::endl;
+		return;
 	}
-}
 
+	auto part_count = model.getMeshParts().size();
+	std::cout << "Indirect draw benchmark with " << part_count << " mesh parts"
+		<< (vulkan_context.supportsDrawIndirectCount() ? ", draw count from a buffer" : "") << ", "
+		<< RECORDING_BENCHMARK_FRAMES << " frames each" << std::endl;
+	if (part_count < 10000)
+	{
+		std::cout << "	run with --synthetic-parts 16384 to see the draw submission cost" << std::endl;
+	}
 
+	auto previous_use_indirect_draws = use_indirect_draws;
+	for (bool indirect : { false, true })
+	{
+		use_indirect_draws = indirect;
+		auto timings = measureFrames(TUNING_WARMUP_FRAMES, RECORDING_BENCHMARK_FRAMES, false);
 
-void _VulkanRenderer_Impl::updateUniformBuffers(float deltatime)
+		std::cout << "	" << (indirect ? "indirect draws: " : "draw per part: ")
+			<< timings.recording_ms << " ms recording/frame, "
+			<< timings.cpu_ms << " ms CPU/frame";
+		if (timings.gpu_ms > 0.0)
+		{
+			std::cout << ", GPU " << timings.gpu_ms << " ms";
+		}
+		std::cout << std::endl;
+	}
+
+	use_indirect_draws = previous_use_indirect_draws;
+}
+
+/**
+* Time the Hi-Z build, and light culling reading the tile depth bounds from the pyramid against reading every depth sample,
+* for every candidate tile size at the current resolution
+*/
+void _VulkanRenderer_Impl::benchmarkHiZ()
 {
-	static auto start_time = std::chrono::high_resolution_clock::now();
+	if (!timestamps_supported || !use_hiz)
+	{
+		std::cout << "Hi-Z benchmark needs timestamp queries and rg32f storage images, which this device lacks." << std::endl;
+		return;
+	}
 
-	auto current_time = std::chrono::high_resolution_clock::now();
-	float time = std::chrono::duration_cast<std::chrono::milliseconds>(current_time - start_time).count() / 1000.0f;
+	std::cout << "Hi-Z benchmark at " << swap_chain_extent.width << "x" << swap_chain_extent.height
+		<< ", " << hiz_level_count << " pyramid levels" << std::endl;
 
-	// update camera ubo
+	auto previous_tile_size = tile_size;
+	auto previous_hiz_depth_bounds = hiz_depth_bounds_enabled;
+	for (int candidate : TILE_SIZE_CANDIDATES)
 	{
-		CameraUbo ubo = {};
-		ubo.view = view_matrix;
-		ubo.proj = glm::perspective(glm::radians(45.0f), swap_chain_extent.width / (float)swap_chain_extent.height, 0.5f, 100.0f);
-		ubo.proj[1][1] *= -1; //since the Y axis of Vulkan NDC points down
-		ubo.projview = ubo.proj * ubo.view;
-		ubo.cam_pos = cam_pos;
+		changeTileSize(candidate);
+
+		setHiZDepthBoundsEnabled(false);
+		auto sampled = measureStageTimings(TUNING_WARMUP_FRAMES, TUNING_MEASURED_FRAMES);
+		setHiZDepthBoundsEnabled(true);
+		auto pyramid = measureStageTimings(TUNING_WARMUP_FRAMES, TUNING_MEASURED_FRAMES);
+
+		// the pyramid is built either way, the speedup still charges its build to the culling reading it
+		auto speedup = pyramid.hiz_build + pyramid.light_culling > 0.0f
+			? sampled.light_culling / (pyramid.hiz_build + pyramid.light_culling) : 0.0f;
+		std::cout << "\ttile size " << candidate
+			<< ": Hi-Z build " << pyramid.hiz_build << " ms"
+			<< ", light culling " << sampled.light_culling << " ms from the depth samples, "
+			<< pyramid.light_culling << " ms from the pyramid"
+			<< ", " << speedup << "x with the build" << std::endl;
+	}
 
-		void* data;
-		vkMapMemory(graphics_device, camera_staging_buffer_memory.get(), 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(graphics_device, camera_staging_buffer_memory.get());
+	changeTileSize(previous_tile_size);
+	setHiZDepthBoundsEnabled(previous_hiz_depth_bounds);
+}
 
-		// TODO: maybe I shouldn't use single time buffer
-		utility.copyBuffer(camera_staging_buffer.get(), camera_uniform_buffer.get(), sizeof(ubo));
+/**
+* Time the depth prepass and the shading pass drawing every mesh part against drawing the parts GPU culling kept,
+* and report how many parts and triangles each culling phase kept for the current camera
+*/
+void _VulkanRenderer_Impl::benchmarkMeshCulling()
+{
+	if (!timestamps_supported || !use_gpu_culling)
+	{
+		std::cout << "Mesh culling benchmark needs timestamp queries, indirect draws, the Hi-Z pyramid and VK_KHR_draw_indirect_count, which this device or configuration lacks." << std::endl;
+		return;
 	}
 
-	// update light ubo
+	const auto& parts = model.getMeshParts();
+	size_t total_triangles = 0;
+	for (const auto& part : parts)
+	{
+		total_triangles += part.index_count / 3;
+	}
+	std::cout << "Mesh culling benchmark with " << parts.size() << " mesh parts, " << total_triangles << " triangles" << std::endl;
+	if (parts.size() < 100)
 	{
-		auto light_num = static_cast<int>(pointlights.size());
-		VkDeviceSize bufferSize = sizeof(PointLight) * MAX_POINT_LIGHT_COUNT + sizeof(glm::vec4);
+		std::cout << "	run with --scene rungholt_1000_lights to cull a large scene" << std::endl;
+	}
 
-		for (int i = 0; i < light_num; i++) {
-			pointlights[i].pos += glm::vec3(0, 3.0f, 0) * deltatime;
-			if (pointlights[i].pos.y > getGlobalTestSceneConfiguration().max_light_pos.y) {
-				pointlights[i].pos.y -= (getGlobalTestSceneConfiguration().max_light_pos.y - getGlobalTestSceneConfiguration().min_light_pos.y);
-			}
+	auto previous_gpu_culling = gpu_culling_enabled;
+	for (bool culling : { false, true })
+	{
+		setGpuCullingEnabled(culling);
+		auto timings = measureStageTimings(TUNING_WARMUP_FRAMES, TUNING_MEASURED_FRAMES);
+		std::cout << "	" << (culling ? "GPU culling: " : "every part: ")
+			<< "depth prepass " << timings.depth_prepass << " ms"
+			<< ", shading " << timings.shading << " ms"
+			<< ", total " << timings.depth_prepass + timings.cullingAndShading() << " ms" << std::endl;
+		if (!culling || parts.empty())
+		{
+			continue;
 		}
 
-		auto pointlights_size = sizeof(PointLight) * pointlights.size();
-		void* data;
-		vkMapMemory(graphics_device, lights_staging_buffer_memory.get(), 0, pointlight_buffer_size, 0, &data);
-		memcpy(data, &light_num, sizeof(int));
-		memcpy((char*)data + sizeof(glm::vec4), pointlights.data(), pointlights_size);
-		vkUnmapMemory(graphics_device, lights_staging_buffer_memory.get());
-		utility.copyBuffer(lights_staging_buffer.get(), pointlight_buffer.get(), pointlight_buffer_size);
+		// the counters belong to the last frame measured
+		auto stats = readMeshCullingStats();
+		auto part_count = static_cast<float>(parts.size());
+		std::cout << "		" << stats.phase0_draw_count << " parts drawn before the pyramid, " << stats.phase1_draw_count << " after"
+			<< ", " << 100.0f * stats.frustum_culled_count / part_count << "% frustum culled"
+			<< ", " << 100.0f * stats.occlusion_culled_count / part_count << "% occlusion culled"
+			<< ", " << stats.drawn_triangle_count << " triangles drawn ("
+			<< (total_triangles > 0 ? 100.0f * stats.drawn_triangle_count / total_triangles : 0.0f) << "%)" << std::endl;
 	}
-}
 
-const uint64_t ACQUIRE_NEXT_IMAGE_TIMEOUT{ std::numeric_limits<uint64_t>::max() };
+	setGpuCullingEnabled(previous_gpu_culling);
+}
 
-void _VulkanRenderer_Impl::drawFrame()
+/**
+* Time the depth prepass with the parts in the order of the model against occluders first and front to back,
+* along with the fragments the shading pass still shades
+*/
+void _VulkanRenderer_Impl::benchmarkDrawOrder()
 {
-	// 1. Acquiring an image from the swap chain
-	uint32_t image_index;
+	if (!timestamps_supported)
 	{
-		auto aquiring_result = vkAcquireNextImageKHR(graphics_device, swap_chain.get()
-			, ACQUIRE_NEXT_IMAGE_TIMEOUT, image_available_semaphore.get(), VK_NULL_HANDLE, &image_index);
+		std::cout << "Draw order benchmark needs timestamp queries, which this device lacks." << std::endl;
+		return;
+	}
 
-		if (aquiring_result == VK_ERROR_OUT_OF_DATE_KHR)
+	std::cout << "Draw order benchmark with " << model.getMeshParts().size() << " mesh parts"
+		<< (pipeline_statistics_supported ? "" : ", no pipeline statistics to count the shaded fragments") << std::endl;
+
+	auto previous_draw_sorting = draw_sorting_enabled;
+	for (bool sorted : { false, true })
+	{
+		setDrawSortingEnabled(sorted);
+		auto timings = measureStageTimings(TUNING_WARMUP_FRAMES, TUNING_MEASURED_FRAMES);
+		std::cout << "	" << (sorted ? "occluders first, front to back: " : "model order: ")
+			<< "depth prepass " << timings.depth_prepass << " ms"
+			<< ", shading " << timings.shading << " ms";
+		if (pipeline_statistics_supported)
 		{
-			// when swap chain needs recreation
-			recreateSwapChain();
-			return;
+			std::cout << ", " << static_cast<uint64_t>(timings.shading_fragments) << " fragments shaded";
 		}
-		else if (aquiring_result != VK_SUCCESS && aquiring_result != VK_SUBOPTIMAL_KHR)
+		if (sorted)
 		{
-			throw std::runtime_error("Failed to acquire swap chain image!");
+			std::cout << ", " << prepass_occluder_count << " occluders";
 		}
+		std::cout << std::endl;
 	}
 
-	// submit depth pre-pass command buffer
-	{
-		vk::SubmitInfo submit_info = {
-			0, // waitSemaphoreCount
-			nullptr, // pWaitSemaphores
-			nullptr, // pwaitDstStageMask
-			1, // commandBufferCount
-			&depth_prepass_command_buffer, // pCommandBuffers
-			1, // singalSemaphoreCount
-			depth_prepass_finished_semaphore.data() // pSingalSemaphores
-		};
-		graphics_queue.submit(1, &submit_info, nullptr);
-	}
+	setDrawSortingEnabled(previous_draw_sorting);
+}
 
-	// submit light culling command buffer
+/**
+* Time the depth prepass and the shading pass drawing every mesh part against the parts CPU frustum culling kept,
+* along with the parts and triangles kept for the camera of the scene. GPU culling is off meanwhile
+*/
+void _VulkanRenderer_Impl::benchmarkChunkCulling()
+{
+	if (!timestamps_supported)
 	{
-		vk::Semaphore wait_semaphores[] = { depth_prepass_finished_semaphore.get() }; // which semaphore to wait
-		vk::PipelineStageFlags wait_stages[] = { vk::PipelineStageFlagBits::eComputeShader }; // which stage to execute
-		vk::SubmitInfo submit_info = {
-			1, // waitSemaphoreCount
-			wait_semaphores, // pWaitSemaphores
-			wait_stages, // pwaitDstStageMask
-			1, // commandBufferCount
-			&light_culling_command_buffer, // pCommandBuffers
-			1, // singalSemaphoreCount
-			lightculling_completed_semaphore.data() // pSingalSemaphores
-		};
-		compute_queue.submit(1, &submit_info, nullptr);
+		std::cout << "Chunk culling benchmark needs timestamp queries, which this device lacks." << std::endl;
+		return;
 	}
 
-	// 2. Submitting the command buffer
+	const auto& parts = model.getMeshParts();
+	size_t total_triangles = 0;
+	for (const auto& part : parts)
 	{
-		VkSubmitInfo submit_info = {};
-		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		VkSemaphore wait_semaphores[] = { image_available_semaphore.get() , lightculling_completed_semaphore.get() }; // which semaphore to wait
-		VkPipelineStageFlags wait_stages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT }; // which stage to execute
-		submit_info.waitSemaphoreCount = 2;
-		submit_info.pWaitSemaphores = wait_semaphores;
-		submit_info.pWaitDstStageMask = wait_stages;
-		submit_info.commandBufferCount = 1;
-		submit_info.pCommandBuffers = &command_buffers[image_index];
-		VkSemaphore signal_semaphores[] = { render_finished_semaphore.get() };
-		submit_info.signalSemaphoreCount = 1;
-		submit_info.pSignalSemaphores = signal_semaphores;
-
-		auto submit_result = vkQueueSubmit(graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
-		if (submit_result != VK_SUCCESS) {
-			throw std::runtime_error("Failed to submit draw command buffer!");
-		}
+		total_triangles += part.index_count / 3;
 	}
-	// TODO: use Fence and we can have cpu start working at a earlier time
+	std::cout << "Chunk culling benchmark with " << parts.size() << " mesh parts, " << total_triangles << " triangles" << std::endl;
 
-	// 3. Submitting the result back to the swap chain to show it on screen
+	auto previous_gpu_culling = gpu_culling_enabled;
+	auto previous_cpu_culling = cpu_culling_enabled;
+	setGpuCullingEnabled(false);
+	for (bool culling : { false, true })
 	{
-		VkPresentInfoKHR present_info = {};
-		present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-		present_info.waitSemaphoreCount = 1;
-		VkSemaphore present_wait_semaphores[] = { render_finished_semaphore.get() };
-		present_info.pWaitSemaphores = present_wait_semaphores;
-		VkSwapchainKHR swapChains[] = { swap_chain.get() };
-		present_info.swapchainCount = 1;
-		present_info.pSwapchains = swapChains;
-		present_info.pImageIndices = &image_index;
-		present_info.pResults = nullptr; // Optional, check for if every single chains is successful
+		setCpuCullingEnabled(culling);
+		auto timings = measureFrames(TUNING_WARMUP_FRAMES, TUNING_MEASURED_FRAMES, true);
+		// the counts belong to the last frame measured
+		std::cout << "	" << (culling ? "CPU culling: " : "every part: ")
+			<< "depth prepass " << timings.stages.depth_prepass << " ms"
+			<< ", shading " << timings.stages.shading << " ms"
+			<< ", CPU " << timings.cpu_ms << " ms/frame"
+			<< ", " << visible_part_count << " parts, " << visible_triangle_count << " triangles ("
+			<< (total_triangles > 0 ? 100.0f * visible_triangle_count / total_triangles : 0.0f) << "%)" << std::endl;
+	}
 
-		VkResult present_result = vkQueuePresentKHR(present_queue, &present_info);
+	setCpuCullingEnabled(previous_cpu_culling);
+	setGpuCullingEnabled(previous_gpu_culling);
+}
 
-		if (present_result == VK_ERROR_OUT_OF_DATE_KHR || present_result == VK_SUBOPTIMAL_KHR)
-		{
-			recreateSwapChain();
-		}
-		else if (present_result != VK_SUCCESS)
-		{
-			throw std::runtime_error("Failed to present swap chain image!");
-		}
+void _VulkanRenderer_Impl::runBenchmark(const std::string& name)
+{
+	if (name == "tile_size")
+	{
+		autoTuneTileSize();
+	}
+	else if (name == "workgroup_size")
+	{
+		benchmarkLightCullingWorkgroupSizes();
+	}
+	else if (name == "culling_test")
+	{
+		benchmarkLightCullingTests();
+	}
+	else if (name == "tile_budget")
+	{
+		benchmarkTileLightBudgets();
+	}
+	else if (name == "spot_lights")
+	{
+		benchmarkSpotLights();
+	}
+	else if (name == "subgroup_append")
+	{
+		benchmarkSubgroupLightAppend();
+	}
+	else if (name == "light_animation")
+	{
+		benchmarkLightAnimation();
+	}
+	else if (name == "light_upload")
+	{
+		benchmarkLightUploads();
+	}
+	else if (name == "upload_streaming")
+	{
+		benchmarkUploadStreaming();
+	}
+	else if (name == "light_kernels")
+	{
+		benchmarkLightKernels();
+	}
+	else if (name == "light_ramp")
+	{
+		benchmarkLightRamp();
+	}
+	else if (name == "frame_pacing")
+	{
+		benchmarkFramePacing();
+	}
+	else if (name == "frame_graph")
+	{
+		benchmarkFrameGraph();
+	}
+	else if (name == "debug_view")
+	{
+		benchmarkDebugViews();
+	}
+	else if (name == "recording_threads")
+	{
+		benchmarkRecordingThreads();
+	}
+	else if (name == "pipeline_cache")
+	{
+		benchmarkPipelineCache();
+	}
+	else if (name == "indirect_draws")
+	{
+		benchmarkIndirectDraws();
+	}
+	else if (name == "hiz")
+	{
+		benchmarkHiZ();
+	}
+	else if (name == "mesh_culling")
+	{
+		benchmarkMeshCulling();
+	}
+	else if (name == "draw_order")
+	{
+		benchmarkDrawOrder();
+	}
+	else if (name == "chunk_culling")
+	{
+		benchmarkChunkCulling();
+	}
+	else
+	{
+		std::cout << "Unknown benchmark \"" << name << "\", available: tile_size, workgroup_size, culling_test, tile_budget, spot_lights, subgroup_append, light_animation, light_upload, light_kernels, light_ramp, frame_pacing, frame_graph, debug_view, recording_threads, pipeline_cache, indirect_draws, hiz, mesh_culling, draw_order, chunk_culling" << std::endl;
 	}
 }
 
@@ -1953,6 +6623,61 @@ void VulkanRenderer::changeDebugViewIndex(int target_view)
 	p_impl->changeDebugViewIndex(target_view);
 }
 
+int VulkanRenderer::getTileSize() const
+{
+	return p_impl->getTileSize();
+}
+
+void VulkanRenderer::changeTileSize(int target_tile_size)
+{
+	p_impl->changeTileSize(target_tile_size);
+}
+
+bool VulkanRenderer::isLightAnimationPaused() const
+{
+	return p_impl->isLightAnimationPaused();
+}
+
+void VulkanRenderer::setLightAnimationPaused(bool paused)
+{
+	p_impl->setLightAnimationPaused(paused);
+}
+
+FrameSkipCounters VulkanRenderer::getFrameSkipCounters() const
+{
+	return p_impl->getFrameSkipCounters();
+}
+
+FramePacingStats VulkanRenderer::getFramePacingStats() const
+{
+	return p_impl->getFramePacingStats();
+}
+
+uint64_t VulkanRenderer::getUploadedBytes() const
+{
+	return p_impl->getUploadedBytes();
+}
+
+void VulkanRenderer::autoTuneTileSize()
+{
+	p_impl->autoTuneTileSize();
+}
+
+int VulkanRenderer::getLightCullingWorkgroupSize() const
+{
+	return p_impl->getLightCullingWorkgroupSize();
+}
+
+void VulkanRenderer::changeLightCullingWorkgroupSize(int target_workgroup_size)
+{
+	p_impl->changeLightCullingWorkgroupSize(target_workgroup_size);
+}
+
+void VulkanRenderer::runBenchmark(const std::string& name)
+{
+	p_impl->runBenchmark(name);
+}
+
 void VulkanRenderer::requestDraw(float deltatime)
 {
 	p_impl->requestDraw(deltatime);
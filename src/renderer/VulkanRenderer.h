@@ -6,10 +6,40 @@
 #include <glm/glm.hpp>
 
 #include <memory>
+#include <string>
+#include <cstdint>
 
 struct GLFWwindow;
 class _VulkanRenderer_Impl;
 
+/**
+* How much work requestDraw() saved by reusing the results of earlier frames
+*/
+struct FrameSkipCounters
+{
+	uint64_t drawn_frames = 0; // frames which were submitted and presented
+	uint64_t skipped_frames = 0; // nothing changed, the presented image was kept
+	uint64_t skipped_light_culling_frames = 0; // drawn, but the depth prepass and light culling results were reused
+};
+
+/**
+* Where the time of drawn frames went, to see how much of the GPU work the CPU overlaps with its own
+*/
+struct FramePacingStats
+{
+	uint32_t frames_in_flight = 0;
+	bool async_compute = false; // light culling of a frame overlaps the shading of the previous one
+	bool frame_graph = false; // every pass of a frame is recorded into one command buffer and submitted at once
+	uint64_t cpu_frames = 0; // drawn frames whose CPU time was measured
+	double cpu_ms = 0.0; // updating, recording and submitting them, without fence waits
+	double fence_wait_ms = 0.0; // blocked until the GPU was done with an earlier frame
+	uint64_t gpu_frames = 0; // drawn frames whose timestamps were read back
+	double gpu_ms = 0.0; // their depth prepass, light culling and shading time
+	double gpu_idle_ms = 0.0; // their gaps between the end of one pass and the start of the next
+	uint64_t queue_submits = 0; // vkQueueSubmit calls
+	double submit_ms = 0.0; // CPU time spent in them
+};
+
 class VulkanRenderer
 {
 public:
@@ -17,9 +47,20 @@ public:
 	~VulkanRenderer();
 
 	int getDebugViewIndex() const;
+	int getTileSize() const;
+	int getLightCullingWorkgroupSize() const;
+	bool isLightAnimationPaused() const;
+	FrameSkipCounters getFrameSkipCounters() const;
+	FramePacingStats getFramePacingStats() const;
+	uint64_t getUploadedBytes() const; // host to device bytes written for camera, object and light data so far
 
 	void resize(int width, int height);
 	void changeDebugViewIndex(int target_view);
+	void changeTileSize(int target_tile_size);
+	void changeLightCullingWorkgroupSize(int target_workgroup_size);
+	void setLightAnimationPaused(bool paused);
+	void autoTuneTileSize();
+	void runBenchmark(const std::string& name);
 	void requestDraw(float deltatime);
 	void cleanUp();
 
@@ -2,12 +2,17 @@
 // MIT License.
 
 #include "context.h"
+#include "vulkan_util.h"
 
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
+#include <array>
 #include <unordered_set>
 #include <iostream>
 #include <cstring>
+#include <fstream>
+#include <limits>
 #include <set>
 
 #ifdef NDEBUG
@@ -17,8 +22,6 @@ const bool ENABLE_VALIDATION_LAYERS = false;
 const bool ENABLE_VALIDATION_LAYERS = true;
 #endif
 
-#define ONE_QUEUE // Force one queue for everything
-
 const std::vector<const char*> VALIDATION_LAYERS = {
 	"VK_LAYER_KHRONOS_validation"
 };
@@ -27,7 +30,20 @@ const std::vector<const char*> DEVICE_EXTENSIONS = {
 	VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
-VContext::VContext(GLFWwindow* window)
+const std::string PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+
+// the header vkGetPipelineCacheData writes for VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+struct PipelineCacheHeader
+{
+	uint32_t header_size;
+	uint32_t header_version;
+	uint32_t vendor_id;
+	uint32_t device_id;
+	uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+};
+
+VContext::VContext(GLFWwindow* window, bool async_compute)
+	: allow_async_compute(async_compute)
 {
 	if (!window)
 	{
@@ -39,7 +55,20 @@ VContext::VContext(GLFWwindow* window)
 	initVulkan();
 }
 
-VContext::~VContext() = default;
+VContext::~VContext()
+{
+	if (pipeline_cache.get())
+	{
+		try
+		{
+			savePipelineCache();
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << "Failed to save pipeline cache: " << e.what() << std::endl;
+		}
+	}
+}
 
 std::pair<int, int> VContext::getWindowFrameBufferSize() const
 {
@@ -76,55 +105,21 @@ QueueFamilyIndices QueueFamilyIndices::findQueueFamilies(VkPhysicalDevice device
 	std::vector<VkQueueFamilyProperties> queuefamilies(queuefamily_count);
 	vkGetPhysicalDeviceQueueFamilyProperties(device, &queuefamily_count, queuefamilies.data());
 
+	// graphics, presenting and the fallback for compute all happen in one family
 	int i = 0;
 	for (const auto& queuefamily : queuefamilies)
 	{
-#ifdef ONE_QUEUE //TODO: refactor...
 		if (queuefamily.queueCount > 0 && (queuefamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && (queuefamily.queueFlags & VK_QUEUE_COMPUTE_BIT))
 		{
 			VkBool32 presentSupport = false;
 			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-			if (queuefamily.queueCount > 0 && presentSupport)
+			if (presentSupport)
 			{
 				indices.graphics_family = i;
 				indices.present_family = i;
+				indices.compute_family = i;
 			}
 		}
-#else
-		if (queuefamily.queueCount > 0 && (queuefamily.queueFlags & VK_QUEUE_GRAPHICS_BIT))
-		{
-			auto support_compute = static_cast<bool>(queuefamily.queueFlags & VK_QUEUE_COMPUTE_BIT);
-			auto enough_size = (queuefamily.queueCount >= 2);
-
-			if (!support_compute)
-			{
-				std::cout << "Found a graphics queue family, but it doesn't support compute." << std::endl;
-			}
-			if (!enough_size) // using a second queue to do light culling
-			{
-				std::cout << "Found a graphics queue family, but it doesn't enough queue count" << std::endl;
-			}
-
-			if (support_compute && enough_size)
-			{
-				indices.graphics_family = i;
-			}
-		}
-
-		//if (queuefamily.queueCount > 0 && queuefamily.queueFlags & VK_QUEUE_COMPUTE_BIT)
-		//{
-		//	indices.compute_family = i;
-		//}
-
-		VkBool32 presentSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-		if (queuefamily.queueCount > 0 && presentSupport)
-		{
-			indices.present_family = i;
-		}
-#endif // ONE_QUEUE
-
-
 
 		if (indices.isComplete()) {
 			break;
@@ -222,7 +217,7 @@ void VContext::createInstance()
 	app_info.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
 	app_info.pEngineName = "No Engine";
 	app_info.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-	app_info.apiVersion = VK_API_VERSION_1_0;
+	app_info.apiVersion = VK_API_VERSION_1_1; // for subgroup operations, 1.0 devices still work without them
 
 	VkInstanceCreateInfo instance_info = {}; // not optional
 	instance_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -322,6 +317,20 @@ bool checkDeviceExtensionSupport(VkPhysicalDevice device)
 	return required_extensions.empty();
 }
 
+bool isDeviceExtensionSupported(VkPhysicalDevice device, const char* extension_name)
+{
+	uint32_t extension_count;
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count, nullptr);
+
+	std::vector<VkExtensionProperties> available_extensions(extension_count);
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count, available_extensions.data());
+
+	return std::any_of(available_extensions.begin(), available_extensions.end(), [extension_name](const VkExtensionProperties& extension)
+	{
+		return std::strcmp(extension.extensionName, extension_name) == 0;
+	});
+}
+
 
 bool isDeviceSuitable(VkPhysicalDevice device, VkSurfaceKHR window_surface)
 {
@@ -388,6 +397,67 @@ void VContext::pickPhysicalDevice()
 
 
 	this->physical_device_properties = static_cast<vk::PhysicalDevice>(physical_device).getProperties();
+
+	// subgroup properties are core in Vulkan 1.1
+	if (physical_device_properties.apiVersion >= VK_API_VERSION_1_1)
+	{
+		subgroup_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+		subgroup_properties.pNext = nullptr;
+
+		VkPhysicalDeviceProperties2 properties2 = {};
+		properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+		properties2.pNext = &subgroup_properties;
+		vkGetPhysicalDeviceProperties2(physical_device, &properties2);
+	}
+
+	// timeline semaphores track the uploads on the transfer queue, core in Vulkan 1.2 but used through the extension here
+	if (physical_device_properties.apiVersion >= VK_API_VERSION_1_1 && isDeviceExtensionSupported(physical_device, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME))
+	{
+		VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features = {};
+		timeline_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+
+		VkPhysicalDeviceFeatures2 features2 = {};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = &timeline_features;
+		vkGetPhysicalDeviceFeatures2(physical_device, &features2);
+		timeline_semaphores_supported = timeline_features.timelineSemaphore == VK_TRUE;
+	}
+
+	// bindless materials index a runtime sized texture array by material, core in Vulkan 1.2 but used through the extension here
+	if (physical_device_properties.apiVersion >= VK_API_VERSION_1_1 && isDeviceExtensionSupported(physical_device, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME))
+	{
+		VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing_features = {};
+		indexing_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+		VkPhysicalDeviceFeatures2 features2 = {};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = &indexing_features;
+		vkGetPhysicalDeviceFeatures2(physical_device, &features2);
+		descriptor_indexing_supported = indexing_features.shaderSampledImageArrayNonUniformIndexing
+			&& indexing_features.runtimeDescriptorArray
+			&& indexing_features.descriptorBindingPartiallyBound
+			&& indexing_features.descriptorBindingVariableDescriptorCount;
+		// update after bind texture arrays have their own limits, which are far higher on some devices
+		sampled_image_update_after_bind_supported = descriptor_indexing_supported && indexing_features.descriptorBindingSampledImageUpdateAfterBind;
+
+		descriptor_indexing_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+		descriptor_indexing_properties.pNext = nullptr;
+
+		VkPhysicalDeviceProperties2 properties2 = {};
+		properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+		properties2.pNext = &descriptor_indexing_properties;
+		vkGetPhysicalDeviceProperties2(physical_device, &properties2);
+	}
+
+	// indirect draws of every mesh part in one call, the first instance carries the material index
+	VkPhysicalDeviceFeatures supported_features;
+	vkGetPhysicalDeviceFeatures(physical_device, &supported_features);
+	multi_draw_indirect_supported = supported_features.multiDrawIndirect && supported_features.drawIndirectFirstInstance;
+	draw_indirect_count_supported = multi_draw_indirect_supported && isDeviceExtensionSupported(physical_device, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	// the Hi-Z pyramid stores min and max depth in a two channel float image, which needs the extended storage formats
+	storage_image_extended_formats_supported = supported_features.shaderStorageImageExtendedFormats == VK_TRUE;
+	// counted around a render pass whose draws are recorded into secondary command buffers, which inherit the query
+	pipeline_statistics_supported = supported_features.pipelineStatisticsQuery && supported_features.inheritedQueries;
 }
 
 void VContext::findQueueFamilyIndices()
@@ -398,6 +468,45 @@ void VContext::findQueueFamilyIndices()
 	{
 		throw std::runtime_error("Queue family indices not complete!");
 	}
+
+	uint32_t queuefamily_count = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queuefamily_count, nullptr);
+	std::vector<VkQueueFamilyProperties> queuefamilies(queuefamily_count);
+	vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queuefamily_count, queuefamilies.data());
+
+	// a transfer only family is usually backed by the copy engines. Its uploads are handed over to the graphics family
+	// once a timeline semaphore says they are done, so without timeline semaphores uploads stay on the graphics queue
+	queue_family_indices.transfer_family = queue_family_indices.graphics_family;
+	for (uint32_t i = 0; i < queuefamily_count && timeline_semaphores_supported; i++)
+	{
+		if (queuefamilies[i].queueCount > 0 && (queuefamilies[i].queueFlags & VK_QUEUE_TRANSFER_BIT)
+			&& !(queuefamilies[i].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+		{
+			queue_family_indices.transfer_family = static_cast<int>(i);
+			break;
+		}
+	}
+	if (!allow_async_compute)
+	{
+		return;
+	}
+
+	// a compute only family is usually backed by the async compute engines,
+	// failing that a second queue of the graphics family can still overlap with the first one
+	auto& indices = queue_family_indices;
+	for (uint32_t i = 0; i < queuefamily_count; i++)
+	{
+		if (queuefamilies[i].queueCount > 0 && (queuefamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queuefamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT))
+		{
+			indices.compute_family = static_cast<int>(i);
+			indices.compute_queue_index = 0;
+			break;
+		}
+	}
+	if (indices.compute_family == indices.graphics_family && queuefamilies[indices.graphics_family].queueCount >= 2)
+	{
+		indices.compute_queue_index = 1;
+	}
 }
 
 // Needs to be called right after instance creation because it may influence device selection
@@ -422,47 +531,47 @@ void VContext::createWindowSurface()
 
 void VContext::createLogicalDevice()
 {
-	QueueFamilyIndices indices = QueueFamilyIndices::findQueueFamilies(physical_device, static_cast<VkSurfaceKHR>(window_surface.get()));
+	const auto& indices = queue_family_indices;
 
 	std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
 
-	std::vector<int> queue_families;// = { indices.graphics_family, indices.present_family };
-	std::vector<std::vector<float>> queue_priorties;// = { { 1.0f, 1.0f },{ 1.0f } }; // 2 queues in graphics family, 1 used for light cullingf
-
-#ifdef ONE_QUEUE
-	queue_families = { indices.graphics_family};
-	queue_priorties = { { 1.0f } }; // 2 queues in graphics family, 1 used for light cullingf
-#else
-	if (indices.graphics_family != indices.present_family)
+	// the graphics family also presents, and holds the compute queue too unless there is a compute only family
+	std::vector<int> queue_families = { indices.graphics_family };
+	std::vector<uint32_t> queue_counts = { 1 };
+	if (indices.compute_family != indices.graphics_family)
 	{
-		//TODO: refactor this part of code, use some structs to help queue creatrion
-		queue_families = { indices.graphics_family, indices.present_family };
-		queue_priorties = { { 1.0f, 1.0f },{ 1.0f } }; // 2 queues in graphics family, 1 used for light cullingf
+		queue_families.push_back(indices.compute_family);
+		queue_counts.push_back(1);
 	}
 	else
 	{
-		queue_families = { indices.graphics_family };
-		queue_priorties = { { 1.0f, 1.0f, 1.0f } };
+		queue_counts[0] += indices.compute_queue_index;
 	}
-#endif // ONE_QUEUE
-
-	float queue_priority = 1.0f;
-	for (int i = 0; i < queue_families.size(); i++)
+	if (indices.transfer_family != indices.graphics_family)
 	{
-		auto family = queue_families[i];
+		queue_families.push_back(indices.transfer_family); // never the compute family, a transfer only family can't compute
+		queue_counts.push_back(1);
+	}
+	const std::array<float, 2> queue_priorities = { 1.0f, 1.0f };
 
-		// Create a graphics queue
+	for (size_t i = 0; i < queue_families.size(); i++)
+	{
 		VkDeviceQueueCreateInfo queue_create_info = {};
 		queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-		queue_create_info.queueFamilyIndex = indices.graphics_family;
-		queue_create_info.queueCount = static_cast<uint32_t>(queue_priorties[i].size());
+		queue_create_info.queueFamilyIndex = queue_families[i];
+		queue_create_info.queueCount = queue_counts[i];
 
-		queue_create_info.pQueuePriorities = queue_priorties[i].data();
+		queue_create_info.pQueuePriorities = queue_priorities.data();
 		queue_create_infos.push_back(queue_create_info);
 	}
 	
 	// Specify used device features
 	VkPhysicalDeviceFeatures device_features = {}; // Everything is by default VK_FALSE
+	device_features.multiDrawIndirect = multi_draw_indirect_supported;
+	device_features.drawIndirectFirstInstance = multi_draw_indirect_supported;
+	device_features.shaderStorageImageExtendedFormats = storage_image_extended_formats_supported;
+	device_features.pipelineStatisticsQuery = pipeline_statistics_supported;
+	device_features.inheritedQueries = pipeline_statistics_supported;
 
 												   // Create the logical device
 	VkDeviceCreateInfo device_create_info = {};
@@ -472,6 +581,36 @@ void VContext::createLogicalDevice()
 
 	device_create_info.pEnabledFeatures = &device_features;
 
+	std::vector<const char*> device_extensions = DEVICE_EXTENSIONS;
+	void* feature_chain = nullptr;
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features = {};
+	timeline_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+	if (timeline_semaphores_supported)
+	{
+		device_extensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+		timeline_features.timelineSemaphore = VK_TRUE;
+		timeline_features.pNext = feature_chain;
+		feature_chain = &timeline_features;
+	}
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing_features = {};
+	indexing_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+	if (descriptor_indexing_supported)
+	{
+		device_extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME); // VK_KHR_maintenance3 it needs is core in Vulkan 1.1
+		indexing_features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+		indexing_features.runtimeDescriptorArray = VK_TRUE;
+		indexing_features.descriptorBindingPartiallyBound = VK_TRUE;
+		indexing_features.descriptorBindingVariableDescriptorCount = VK_TRUE;
+		indexing_features.descriptorBindingSampledImageUpdateAfterBind = sampled_image_update_after_bind_supported ? VK_TRUE : VK_FALSE;
+		indexing_features.pNext = feature_chain;
+		feature_chain = &indexing_features;
+	}
+	if (draw_indirect_count_supported)
+	{
+		device_extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	}
+	device_create_info.pNext = feature_chain;
+
 	if (ENABLE_VALIDATION_LAYERS)
 	{
 		device_create_info.enabledLayerCount = static_cast<uint32_t>(VALIDATION_LAYERS.size());
@@ -482,8 +621,8 @@ void VContext::createLogicalDevice()
 		device_create_info.enabledLayerCount = 0;
 	}
 
-	device_create_info.enabledExtensionCount = static_cast<uint32_t>(DEVICE_EXTENSIONS.size());
-	device_create_info.ppEnabledExtensionNames = DEVICE_EXTENSIONS.data();
+	device_create_info.enabledExtensionCount = static_cast<uint32_t>(device_extensions.size());
+	device_create_info.ppEnabledExtensionNames = device_extensions.data();
 
 	VkDevice temp_device;
 	auto result = vkCreateDevice(physical_device, &device_create_info, nullptr, &temp_device);
@@ -501,25 +640,44 @@ void VContext::createLogicalDevice()
 	};
 	auto device = graphics_device.get();
 
-#ifdef ONE_QUEUE
 	graphics_queue = device.getQueue(indices.graphics_family, 0);
-	compute_queue = device.getQueue(indices.graphics_family, 0);
-	present_queue = device.getQueue(indices.graphics_family, 0);
-#else
-	graphics_queue = device.getQueue(indices.graphics_family, 0);
-	compute_queue = device.getQueue(indices.graphics_family, 1);
+	present_queue = device.getQueue(indices.present_family, 0);
+	compute_queue = device.getQueue(indices.compute_family, indices.compute_queue_index);
+	transfer_queue = device.getQueue(indices.transfer_family, 0);
 
-	if (indices.graphics_family != indices.present_family)
+	if (timeline_semaphores_supported)
 	{
-		// TODO: refactor this part of code, use some structs to help queue creatrion
-		present_queue = device.getQueue(indices.present_family, 0);
+		get_semaphore_counter_value = reinterpret_cast<PFN_vkGetSemaphoreCounterValueKHR>(vkGetDeviceProcAddr(temp_device, "vkGetSemaphoreCounterValueKHR"));
+		wait_semaphores = reinterpret_cast<PFN_vkWaitSemaphoresKHR>(vkGetDeviceProcAddr(temp_device, "vkWaitSemaphoresKHR"));
 	}
-	else
+	if (draw_indirect_count_supported)
 	{
-		present_queue = device.getQueue(indices.graphics_family, 2);
+		draw_indexed_indirect_count = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(vkGetDeviceProcAddr(temp_device, "vkCmdDrawIndexedIndirectCountKHR"));
 	}
-#endif // ONE_QUEUE
+}
 
+uint64_t VContext::getSemaphoreCounterValue(vk::Semaphore semaphore) const
+{
+	uint64_t value = 0;
+	vulkan_util::checkResult(get_semaphore_counter_value(graphics_device.get(), semaphore, &value), "Failed to read timeline semaphore!");
+	return value;
+}
+
+void VContext::cmdDrawIndexedIndirectCount(vk::CommandBuffer command, vk::Buffer buffer, vk::DeviceSize offset
+	, vk::Buffer count_buffer, vk::DeviceSize count_buffer_offset, uint32_t max_draw_count, uint32_t stride) const
+{
+	draw_indexed_indirect_count(command, buffer, offset, count_buffer, count_buffer_offset, max_draw_count, stride);
+}
+
+void VContext::waitSemaphore(vk::Semaphore semaphore, uint64_t value) const
+{
+	VkSemaphore semaphores[] = { semaphore };
+	VkSemaphoreWaitInfoKHR wait_info = {};
+	wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+	wait_info.semaphoreCount = 1;
+	wait_info.pSemaphores = semaphores;
+	wait_info.pValues = &value;
+	vulkan_util::checkResult(wait_semaphores(graphics_device.get(), &wait_info, std::numeric_limits<uint64_t>::max()), "Failed to wait for timeline semaphore!");
 }
 
 void VContext::createCommandPools()
@@ -537,9 +695,8 @@ void VContext::createCommandPools()
 		VkCommandPoolCreateInfo pool_info = {};
 		pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 		pool_info.queueFamilyIndex = indices.graphics_family;
-		pool_info.flags = 0; // Optional
+		pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // the command buffers of a frame are rerecorded when the light buffers grow
 								// hint the command pool will rerecord buffers by VK_COMMAND_POOL_CREATE_TRANSIENT_BIT
-								// allow buffers to be rerecorded individually by VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT
 
 
 
@@ -553,7 +710,7 @@ void VContext::createCommandPools()
 	{
 		VkCommandPoolCreateInfo cmd_pool_info = {};
 		cmd_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-		cmd_pool_info.queueFamilyIndex = indices.graphics_family;
+		cmd_pool_info.queueFamilyIndex = indices.compute_family;
 		cmd_pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
 
@@ -563,6 +720,97 @@ void VContext::createCommandPools()
 		);
 	}
 
+	// transfer_queue_command_pool, even when uploads go to the graphics queue so they don't share a pool with rendering
+	{
+		VkCommandPoolCreateInfo cmd_pool_info = {};
+		cmd_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		cmd_pool_info.queueFamilyIndex = indices.transfer_family;
+		cmd_pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+		transfer_queue_command_pool = VRaii<vk::CommandPool>(
+			device.createCommandPool(cmd_pool_info, nullptr),
+			raii_commandpool_deleter
+		);
+	}
+
+}
+
+/**
+* Start from the cache a previous run saved, unless it was written by another driver or device
+*/
+void VContext::createPipelineCache()
+{
+	std::vector<char> cache_data;
+	std::ifstream file_stream(PIPELINE_CACHE_PATH, std::ios::ate | std::ios::binary);
+	if (file_stream.is_open())
+	{
+		cache_data.resize(static_cast<size_t>(file_stream.tellg()));
+		file_stream.seekg(0);
+		file_stream.read(cache_data.data(), cache_data.size());
+	}
+
+	const char* rejection = nullptr;
+	if (cache_data.empty())
+	{
+		rejection = "no cache on disk";
+	}
+	else if (cache_data.size() < sizeof(PipelineCacheHeader))
+	{
+		rejection = "truncated header";
+	}
+	else
+	{
+		PipelineCacheHeader header;
+		std::memcpy(&header, cache_data.data(), sizeof(header));
+		if (header.header_size < sizeof(header) || header.header_size > cache_data.size()
+			|| header.header_version != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+		{
+			rejection = "unknown header";
+		}
+		else if (header.vendor_id != physical_device_properties.vendorID || header.device_id != physical_device_properties.deviceID)
+		{
+			rejection = "written for another device";
+		}
+		else if (std::memcmp(header.pipeline_cache_uuid, physical_device_properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+		{
+			rejection = "written by another driver version";
+		}
+	}
+
+	if (rejection)
+	{
+		cache_data.clear();
+	}
+	pipeline_cache_rejection = rejection;
+	pipeline_cache_loaded_size = cache_data.size();
+
+	auto device = graphics_device.get();
+	vk::PipelineCacheCreateInfo cache_info = {
+		vk::PipelineCacheCreateFlags(), // flags
+		cache_data.size(), // initialDataSize
+		cache_data.data() // pInitialData
+	};
+	pipeline_cache = VRaii<vk::PipelineCache>(
+		device.createPipelineCache(cache_info, nullptr),
+		[device = device](auto& cache) { device.destroyPipelineCache(cache); }
+	);
+	pipeline_cache_loaded = !cache_data.empty();
+}
+
+void VContext::savePipelineCache() const
+{
+	auto device = graphics_device.get();
+	size_t data_size = 0;
+	vulkan_util::checkResult(vkGetPipelineCacheData(device, pipeline_cache.get(), &data_size, nullptr), "Failed to get pipeline cache size!");
+	std::vector<char> cache_data(data_size);
+	vulkan_util::checkResult(vkGetPipelineCacheData(device, pipeline_cache.get(), &data_size, cache_data.data()), "Failed to get pipeline cache data!");
+
+	std::ofstream file_stream(PIPELINE_CACHE_PATH, std::ios::binary | std::ios::trunc);
+	if (!file_stream.is_open())
+	{
+		throw std::runtime_error("failed to open " + PIPELINE_CACHE_PATH);
+	}
+	file_stream.write(cache_data.data(), data_size);
 }
 
 SwapChainSupportDetails SwapChainSupportDetails::querySwapChainSupport(VkPhysicalDevice device, VkSurfaceKHR surface)
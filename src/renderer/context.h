@@ -16,12 +16,16 @@ struct QueueFamilyIndices
 {
 	int graphics_family = -1;
 	int present_family = -1;
-	//int compute_family = -1;
+	// light culling runs here, the graphics family itself (and the graphics queue) when there is no other compute queue
+	int compute_family = -1;
+	uint32_t compute_queue_index = 0;
+	// uploads run here, the graphics family (and the graphics queue) when there is no transfer only family
+	int transfer_family = -1;
 
 
 	bool isComplete()
 	{
-		return graphics_family >= 0 && present_family >= 0; //&& compute_family >= 0;
+		return graphics_family >= 0 && present_family >= 0;
 	}
 
 	static QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface);
@@ -43,7 +47,11 @@ struct SwapChainSupportDetails
 class VContext
 {
 public:
-	VContext(GLFWwindow* window);
+	/**
+	* async_compute picks a compute queue of its own for light culling if the device has one,
+	* otherwise everything goes to the graphics queue
+	*/
+	VContext(GLFWwindow* window, bool async_compute = true);
 	~VContext();
 
 	VContext(VContext&&) = delete;
@@ -68,6 +76,20 @@ public:
 		return physical_device_properties;
 	}
 
+	const VkPhysicalDeviceSubgroupProperties& getSubgroupProperties() const
+	{
+		return subgroup_properties;
+	}
+
+	/**
+	* Whether compute shaders can use GL_KHR_shader_subgroup_ballot
+	*/
+	bool supportsComputeSubgroupBallot() const
+	{
+		return (subgroup_properties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT)
+			&& (subgroup_properties.supportedOperations & VK_SUBGROUP_FEATURE_BALLOT_BIT);
+	}
+
 	vk::Device getDevice() const
 	{
 		return graphics_device.get();
@@ -88,6 +110,112 @@ public:
 		return compute_queue;
 	}
 
+	/**
+	* Whether the compute queue is not the graphics queue, so their work can overlap
+	*/
+	bool hasAsyncCompute() const
+	{
+		return compute_queue != graphics_queue;
+	}
+
+	/**
+	* Whether the compute queue is in another queue family, which has to take ownership of exclusive resources
+	*/
+	bool hasSeparateComputeFamily() const
+	{
+		return queue_family_indices.compute_family != queue_family_indices.graphics_family;
+	}
+
+	/**
+	* The queue for uploads, the graphics queue itself unless the device has a transfer only queue family
+	*/
+	vk::Queue getTransferQueue() const
+	{
+		return transfer_queue;
+	}
+
+	bool hasSeparateTransferFamily() const
+	{
+		return queue_family_indices.transfer_family != queue_family_indices.graphics_family;
+	}
+
+	/**
+	* Whether VK_KHR_timeline_semaphore is enabled, see getSemaphoreCounterValue() and waitSemaphore()
+	*/
+	bool supportsTimelineSemaphores() const
+	{
+		return timeline_semaphores_supported;
+	}
+
+	/**
+	* Whether VK_EXT_descriptor_indexing is enabled with the features bindless materials need:
+	* non-uniform indexing of sampled image arrays, runtime sized arrays, partially bound and variable count bindings
+	*/
+	bool supportsDescriptorIndexing() const
+	{
+		return descriptor_indexing_supported;
+	}
+
+	/**
+	* Whether sampled image bindings can be created with VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT,
+	* their limits are the UpdateAfterBind ones of getDescriptorIndexingProperties()
+	*/
+	bool supportsSampledImageUpdateAfterBind() const
+	{
+		return sampled_image_update_after_bind_supported;
+	}
+
+	// all zero without descriptor indexing
+	const VkPhysicalDeviceDescriptorIndexingPropertiesEXT& getDescriptorIndexingProperties() const
+	{
+		return descriptor_indexing_properties;
+	}
+
+	/**
+	* Whether one vkCmdDrawIndexedIndirect can draw many commands with a first instance other than 0
+	*/
+	bool supportsMultiDrawIndirect() const
+	{
+		return multi_draw_indirect_supported;
+	}
+
+	/**
+	* Whether VK_KHR_draw_indirect_count is enabled, see cmdDrawIndexedIndirectCount()
+	*/
+	bool supportsDrawIndirectCount() const
+	{
+		return draw_indirect_count_supported;
+	}
+
+	/**
+	* Whether compute shaders can write two channel storage images like rg32f, which the Hi-Z pyramid is built into
+	*/
+	bool supportsStorageImageExtendedFormats() const
+	{
+		return storage_image_extended_formats_supported;
+	}
+
+	/**
+	* Whether pipeline statistics can be queried, also while executing secondary command buffers
+	*/
+	bool supportsPipelineStatistics() const
+	{
+		return pipeline_statistics_supported;
+	}
+
+	/**
+	* vkCmdDrawIndexedIndirectCountKHR, drawing as many of the commands as the count buffer says, at most max_draw_count
+	*/
+	void cmdDrawIndexedIndirectCount(vk::CommandBuffer command, vk::Buffer buffer, vk::DeviceSize offset
+		, vk::Buffer count_buffer, vk::DeviceSize count_buffer_offset, uint32_t max_draw_count, uint32_t stride) const;
+
+	uint64_t getSemaphoreCounterValue(vk::Semaphore semaphore) const;
+
+	/**
+	* Block until a timeline semaphore reaches the value
+	*/
+	void waitSemaphore(vk::Semaphore semaphore, uint64_t value) const;
+
 	vk::SurfaceKHR getWindowSurface() const
 	{
 		return window_surface.get();
@@ -103,9 +231,52 @@ public:
 		return compute_queue_command_pool.get();
 	}
 
+	vk::CommandPool getTransferCommandPool() const
+	{
+		return transfer_queue_command_pool.get();
+	}
+
+	/**
+	* The pipeline cache every pipeline is created with, loaded from disk at startup and written back when the context is destructed
+	*/
+	vk::PipelineCache getPipelineCache() const
+	{
+		return pipeline_cache.get();
+	}
+
+	/**
+	* Whether the pipeline cache started with data from an earlier run, i.e. pipeline creation is warm
+	*/
+	bool isPipelineCacheLoaded() const
+	{
+		return pipeline_cache_loaded;
+	}
+
+	/**
+	* Bytes of pipeline cache data loaded from disk at startup
+	*/
+	size_t getPipelineCacheLoadedSize() const
+	{
+		return pipeline_cache_loaded_size;
+	}
+
+	/**
+	* Why the data on disk wasn't used and the pipeline cache started empty, nullptr if it was loaded
+	*/
+	const char* getPipelineCacheRejection() const
+	{
+		return pipeline_cache_rejection;
+	}
+
+	/**
+	* Write the content of the pipeline cache to disk, the destructor does it too
+	*/
+	void savePipelineCache() const;
+
 private:
 
 	GLFWwindow* window;
+	bool allow_async_compute;
 
 	VRaii<vk::Instance> instance;
 	VRaii<vk::DebugReportCallbackEXT> callback;
@@ -118,10 +289,28 @@ private:
 	vk::Queue graphics_queue;
 	vk::Queue present_queue;
 	vk::Queue compute_queue;
+	vk::Queue transfer_queue;
 
 	VRaii<vk::CommandPool> graphics_queue_command_pool;
 	VRaii<vk::CommandPool> compute_queue_command_pool;
+	VRaii<vk::CommandPool> transfer_queue_command_pool;
+	VRaii<vk::PipelineCache> pipeline_cache;
+	bool pipeline_cache_loaded = false;
+	size_t pipeline_cache_loaded_size = 0;
+	const char* pipeline_cache_rejection = nullptr;
 	vk::PhysicalDeviceProperties physical_device_properties;
+	VkPhysicalDeviceSubgroupProperties subgroup_properties = {}; // all zero when the device is Vulkan 1.0
+	bool timeline_semaphores_supported = false;
+	bool descriptor_indexing_supported = false;
+	bool sampled_image_update_after_bind_supported = false;
+	VkPhysicalDeviceDescriptorIndexingPropertiesEXT descriptor_indexing_properties = {};
+	bool multi_draw_indirect_supported = false;
+	bool draw_indirect_count_supported = false;
+	bool storage_image_extended_formats_supported = false;
+	bool pipeline_statistics_supported = false;
+	PFN_vkGetSemaphoreCounterValueKHR get_semaphore_counter_value = nullptr; // extension functions aren't exported by the loader
+	PFN_vkWaitSemaphoresKHR wait_semaphores = nullptr;
+	PFN_vkCmdDrawIndexedIndirectCountKHR draw_indexed_indirect_count = nullptr;
 
 	static void DestroyDebugReportCallbackEXT(VkInstance instance
 		, VkDebugReportCallbackEXT callback
@@ -139,6 +328,7 @@ private:
 	void findQueueFamilyIndices();
 	void createLogicalDevice();
 	void createCommandPools();
+	void createPipelineCache();
 
 	void initVulkan()
 	{
@@ -149,6 +339,7 @@ private:
 		findQueueFamilyIndices();
 		createLogicalDevice();
 		createCommandPools();
+		createPipelineCache();
 	}
 };
 
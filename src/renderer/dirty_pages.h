@@ -0,0 +1,133 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+* Tracks which pages of an array changed since the last upload, one bit per page of elements.
+* Dirty pages next to each other are merged, so the upload needs as few copy regions as possible
+*/
+class DirtyPageTracker
+{
+public:
+	explicit DirtyPageTracker(size_t elements_per_page = 64)
+		: elements_per_page(elements_per_page)
+	{}
+
+	/**
+	* Track element_count elements, pages beyond the old count start out dirty
+	*/
+	void resize(size_t element_count)
+	{
+		auto old_page_count = getPageCount();
+		this->element_count = element_count;
+		dirty_words.resize((getPageCount() + 63) / 64, 0);
+		markPagesDirty(old_page_count, getPageCount());
+	}
+
+	size_t size() const
+	{
+		return element_count;
+	}
+
+	/**
+	* Indices past the tracked elements are ignored
+	*/
+	void markDirty(size_t index)
+	{
+		if (index >= element_count) return;
+		auto page = index / elements_per_page;
+		dirty_words[page / 64] |= uint64_t(1) << (page % 64);
+	}
+
+	/**
+	* The range is clamped to the tracked elements
+	*/
+	void markDirty(size_t first, size_t count)
+	{
+		if (first >= element_count) return;
+		count = std::min(count, element_count - first);
+		if (count == 0) return;
+		markPagesDirty(first / elements_per_page, (first + count - 1) / elements_per_page + 1);
+	}
+
+	void markAllDirty()
+	{
+		markPagesDirty(0, getPageCount());
+	}
+
+	bool isClean() const
+	{
+		for (auto word : dirty_words)
+		{
+			if (word != 0) return false;
+		}
+		return true;
+	}
+
+	/**
+	* Returns the dirty elements as (first, count) ranges in increasing order and marks everything clean
+	*/
+	std::vector<std::pair<size_t, size_t>> takeDirtyRanges()
+	{
+		std::vector<std::pair<size_t, size_t>> ranges;
+		auto page_count = getPageCount();
+		size_t page = 0;
+		while (page < page_count)
+		{
+			// skip clean words quickly, most of them are clean when few elements change
+			if (dirty_words[page / 64] == 0)
+			{
+				page = (page / 64 + 1) * 64;
+				continue;
+			}
+			if (!isPageDirty(page))
+			{
+				page++;
+				continue;
+			}
+
+			auto first_page = page;
+			while (page < page_count && isPageDirty(page))
+			{
+				page++;
+			}
+
+			auto first = first_page * elements_per_page;
+			auto last = std::min(page * elements_per_page, element_count);
+			ranges.emplace_back(first, last - first);
+		}
+
+		std::fill(dirty_words.begin(), dirty_words.end(), 0);
+		return ranges;
+	}
+
+private:
+	size_t getPageCount() const
+	{
+		return (element_count + elements_per_page - 1) / elements_per_page;
+	}
+
+	bool isPageDirty(size_t page) const
+	{
+		return (dirty_words[page / 64] >> (page % 64)) & 1;
+	}
+
+	void markPagesDirty(size_t first_page, size_t end_page)
+	{
+		for (auto page = first_page; page < end_page; page++)
+		{
+			dirty_words[page / 64] |= uint64_t(1) << (page % 64);
+		}
+	}
+
+	size_t elements_per_page;
+	size_t element_count = 0;
+	std::vector<uint64_t> dirty_words; // bit i of word w is page w * 64 + i
+};
@@ -0,0 +1,219 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "frame_graph.h"
+
+#include <utility>
+
+namespace
+{
+	const vk::AccessFlags WRITE_ACCESS = vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eColorAttachmentWrite
+		| vk::AccessFlagBits::eDepthStencilAttachmentWrite | vk::AccessFlagBits::eTransferWrite
+		| vk::AccessFlagBits::eHostWrite | vk::AccessFlagBits::eMemoryWrite;
+}
+
+void VFrameGraph::reset()
+{
+	resources.clear();
+	passes.clear();
+	barrier_batches.clear();
+}
+
+VFrameGraph::ResourceId VFrameGraph::addImage(vk::Image image, vk::ImageAspectFlags aspect, vk::ImageLayout initial_layout
+	, vk::PipelineStageFlags initial_stages)
+{
+	Resource resource;
+	resource.image = image;
+	resource.aspect = aspect;
+	resource.initial_layout = initial_layout;
+	resource.initial_stages = initial_stages;
+	resources.push_back(resource);
+	return static_cast<ResourceId>(resources.size() - 1);
+}
+
+VFrameGraph::ResourceId VFrameGraph::addBuffer(vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize size)
+{
+	Resource resource;
+	resource.buffer = buffer;
+	resource.offset = offset;
+	resource.size = size;
+	resource.initial_stages = vk::PipelineStageFlagBits::eTopOfPipe;
+	resources.push_back(resource);
+	return static_cast<ResourceId>(resources.size() - 1);
+}
+
+/**
+* A pass accesses each resource once, with the stages and access flags of all its uses combined
+*/
+void VFrameGraph::addPass(const std::string& name, std::vector<Access> accesses, std::function<void(vk::CommandBuffer)> record)
+{
+	passes.push_back({ name, std::move(accesses), std::move(record) });
+}
+
+void VFrameGraph::setFinalState(ResourceId resource, vk::PipelineStageFlags stages, vk::AccessFlags access, vk::ImageLayout layout)
+{
+	resources[resource].has_final_state = true;
+	resources[resource].final_state = { resource, stages, access, layout };
+}
+
+/**
+* Walk the passes in order and collect the barriers each access needs:
+* writes and layout transitions wait for every earlier access, a read only waits for a write it can't see yet
+*/
+void VFrameGraph::compile()
+{
+	std::vector<ResourceState> states(resources.size());
+	for (size_t i = 0; i < resources.size(); i++)
+	{
+		states[i].layout = resources[i].initial_layout;
+	}
+
+	barrier_batches.assign(passes.size() + 1, BarrierBatch());
+	for (size_t pass = 0; pass < passes.size(); pass++)
+	{
+		for (const auto& access : passes[pass].accesses)
+		{
+			addDependency(barrier_batches[pass], resources[access.resource], states[access.resource], access);
+		}
+	}
+
+	for (size_t i = 0; i < resources.size(); i++)
+	{
+		if (resources[i].has_final_state)
+		{
+			auto final_state = resources[i].final_state;
+			if (final_state.layout == vk::ImageLayout::eUndefined)
+			{
+				final_state.layout = states[i].layout; // stays in the layout of the last pass
+			}
+			addDependency(barrier_batches.back(), resources[i], states[i], final_state);
+		}
+	}
+}
+
+void VFrameGraph::addDependency(BarrierBatch& batch, const Resource& resource, ResourceState& state, const Access& access) const
+{
+	bool is_image = static_cast<bool>(resource.image);
+	bool transition = is_image && access.layout != state.layout;
+	bool write = (access.access & WRITE_ACCESS) != vk::AccessFlags();
+	bool written = state.write_stages != vk::PipelineStageFlags();
+	bool visible = (access.stages & state.visible_stages) == access.stages && (access.access & state.visible_access) == access.access;
+
+	bool needs_barrier = false;
+	vk::PipelineStageFlags src_stages;
+	vk::AccessFlags src_access;
+	if (write || transition)
+	{
+		if (state.accessed)
+		{
+			// a write after reads only has to wait for them, the last write has to be made available too
+			src_stages = state.write_stages | state.read_stages;
+			src_access = state.write_access;
+			needs_barrier = true;
+		}
+		else if (transition)
+		{
+			src_stages = resource.initial_stages;
+			needs_barrier = true;
+		}
+		// the first write without a transition has nothing to wait for inside the graph
+	}
+	else if (written && !visible)
+	{
+		src_stages = state.write_stages;
+		src_access = state.write_access;
+		needs_barrier = true;
+	}
+
+	if (needs_barrier)
+	{
+		batch.src_stages |= src_stages;
+		batch.dst_stages |= access.stages;
+		if (is_image)
+		{
+			batch.image_barriers.emplace_back(
+				src_access,  // srcAccessMask
+				access.access,  // dstAccessMask
+				state.layout,  // oldLayout
+				access.layout,  // newLayout
+				VK_QUEUE_FAMILY_IGNORED,  // srcQueueFamilyIndex
+				VK_QUEUE_FAMILY_IGNORED,  // dstQueueFamilyIndex
+				resource.image,  // image
+				vk::ImageSubresourceRange(resource.aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS)  // subresourceRange
+			);
+		}
+		else
+		{
+			batch.buffer_barriers.emplace_back(
+				src_access,  // srcAccessMask
+				access.access,  // dstAccessMask
+				VK_QUEUE_FAMILY_IGNORED,  // srcQueueFamilyIndex
+				VK_QUEUE_FAMILY_IGNORED,  // dstQueueFamilyIndex
+				resource.buffer,  // buffer
+				resource.offset,  // offset
+				resource.size  // size
+			);
+		}
+	}
+
+	if (write || transition)
+	{
+		// a transition counts as a write which the barrier already made available
+		state.write_stages = access.stages;
+		state.write_access = access.access & WRITE_ACCESS;
+		state.read_stages = vk::PipelineStageFlags();
+		state.visible_stages = access.stages;
+		state.visible_access = access.access;
+		if (is_image)
+		{
+			state.layout = access.layout;
+		}
+	}
+	else
+	{
+		if (needs_barrier)
+		{
+			state.visible_stages |= access.stages;
+			state.visible_access |= access.access;
+		}
+		state.read_stages |= access.stages;
+	}
+	state.accessed = true;
+}
+
+void VFrameGraph::execute(vk::CommandBuffer command) const
+{
+	for (size_t i = 0; i < barrier_batches.size(); i++)
+	{
+		const auto& batch = barrier_batches[i];
+		if (!batch.empty())
+		{
+			command.pipelineBarrier(
+				batch.src_stages,
+				batch.dst_stages,
+				vk::DependencyFlags(),
+				0, nullptr,
+				static_cast<uint32_t>(batch.buffer_barriers.size()), batch.buffer_barriers.data(),
+				static_cast<uint32_t>(batch.image_barriers.size()), batch.image_barriers.data()
+			);
+		}
+
+		if (i < passes.size())
+		{
+			passes[i].record(command);
+		}
+	}
+}
+
+uint32_t VFrameGraph::getBarrierCount() const
+{
+	uint32_t count = 0;
+	for (const auto& batch : barrier_batches)
+	{
+		if (!batch.empty())
+		{
+			count++;
+		}
+	}
+	return count;
+}
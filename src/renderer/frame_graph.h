@@ -0,0 +1,118 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+* The passes of a frame recorded into a single command buffer.
+* Every pass declares how it accesses the images and buffers it shares with the other passes,
+* compile() derives the pipeline barriers and layout transitions between them from that,
+* merged into one vkCmdPipelineBarrier per pass at most.
+* Barriers inside a pass, and on resources no other pass touches, are left to the pass itself.
+* Rebuilt every frame: reset(), add the resources and passes, compile(), execute()
+*/
+class VFrameGraph
+{
+public:
+	using ResourceId = uint32_t;
+
+	struct Access
+	{
+		ResourceId resource;
+		vk::PipelineStageFlags stages;
+		vk::AccessFlags access;
+		vk::ImageLayout layout = vk::ImageLayout::eUndefined; // images only
+	};
+
+	void reset();
+
+	/**
+	* An image in initial_layout, eUndefined if its content can be discarded.
+	* initial_stages is where the work before the graph last used it, e.g. the wait stage of the semaphore of a swap chain image
+	*/
+	ResourceId addImage(vk::Image image, vk::ImageAspectFlags aspect, vk::ImageLayout initial_layout
+		, vk::PipelineStageFlags initial_stages = vk::PipelineStageFlagBits::eTopOfPipe);
+	ResourceId addBuffer(vk::Buffer buffer, vk::DeviceSize offset = 0, vk::DeviceSize size = VK_WHOLE_SIZE);
+
+	/**
+	* Passes run in the order they are added, record is called by execute() after the barriers the pass needs
+	*/
+	void addPass(const std::string& name, std::vector<Access> accesses, std::function<void(vk::CommandBuffer)> record);
+
+	/**
+	* How the resource is used after the graph, e.g. presenting or a host read back. Without one it's left as the last pass left it
+	*/
+	void setFinalState(ResourceId resource, vk::PipelineStageFlags stages, vk::AccessFlags access
+		, vk::ImageLayout layout = vk::ImageLayout::eUndefined);
+
+	void compile();
+	void execute(vk::CommandBuffer command) const;
+
+	/**
+	* vkCmdPipelineBarrier calls execute() records, after compile()
+	*/
+	uint32_t getBarrierCount() const;
+
+private:
+	struct Resource
+	{
+		vk::Image image;
+		vk::ImageAspectFlags aspect;
+		vk::Buffer buffer;
+		vk::DeviceSize offset = 0;
+		vk::DeviceSize size = 0;
+		vk::ImageLayout initial_layout = vk::ImageLayout::eUndefined;
+		vk::PipelineStageFlags initial_stages;
+		bool has_final_state = false;
+		Access final_state = {};
+	};
+
+	struct Pass
+	{
+		std::string name;
+		std::vector<Access> accesses;
+		std::function<void(vk::CommandBuffer)> record;
+	};
+
+	// the barriers recorded before a pass, merged into one call
+	struct BarrierBatch
+	{
+		vk::PipelineStageFlags src_stages;
+		vk::PipelineStageFlags dst_stages;
+		std::vector<vk::BufferMemoryBarrier> buffer_barriers;
+		std::vector<vk::ImageMemoryBarrier> image_barriers;
+
+		bool empty() const
+		{
+			return buffer_barriers.empty() && image_barriers.empty();
+		}
+	};
+
+	// what compile() knows about a resource after the passes so far
+	struct ResourceState
+	{
+		vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+		bool accessed = false;
+		// the last write or layout transition, and the reads since
+		vk::PipelineStageFlags write_stages;
+		vk::AccessFlags write_access; // still to be made available, none after a transition
+		vk::PipelineStageFlags read_stages;
+		// where the last write was made visible
+		vk::PipelineStageFlags visible_stages;
+		vk::AccessFlags visible_access;
+	};
+
+	void addDependency(BarrierBatch& batch, const Resource& resource, ResourceState& state, const Access& access) const;
+
+	std::vector<Resource> resources;
+	std::vector<Pass> passes;
+	std::vector<BarrierBatch> barrier_batches; // one before each pass, then the one for the final states
+};
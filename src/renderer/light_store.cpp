@@ -0,0 +1,333 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "light_store.h"
+#include "light_store_kernels.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(VFPR_LIGHT_KERNELS_AVX2) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#ifdef VFPR_LIGHT_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+const char* getLightKernelIsaName(LightKernelIsa isa)
+{
+	switch (isa)
+	{
+	case LightKernelIsa::AVX2: return "AVX2";
+	case LightKernelIsa::NEON: return "NEON";
+	default: return "scalar";
+	}
+}
+
+PointLightStore::PointLightStore()
+	: kernel_isa(getBestSupportedIsa())
+{}
+
+void PointLightStore::reserve(size_t count)
+{
+	for (auto array : { &pos_x, &pos_y, &pos_z, &radius, &intensity_r, &intensity_g, &intensity_b })
+	{
+		array->reserve(count);
+	}
+}
+
+void PointLightStore::clear()
+{
+	for (auto array : { &pos_x, &pos_y, &pos_z, &radius, &intensity_r, &intensity_g, &intensity_b })
+	{
+		array->clear();
+	}
+}
+
+void PointLightStore::push_back(const PointLight& light)
+{
+	pos_x.push_back(light.pos.x);
+	pos_y.push_back(light.pos.y);
+	pos_z.push_back(light.pos.z);
+	radius.push_back(light.radius);
+	intensity_r.push_back(light.intensity.r);
+	intensity_g.push_back(light.intensity.g);
+	intensity_b.push_back(light.intensity.b);
+}
+
+PointLight PointLightStore::get(size_t index) const
+{
+	return PointLight(
+		{ pos_x[index], pos_y[index], pos_z[index] },
+		radius[index],
+		{ intensity_r[index], intensity_g[index], intensity_b[index] }
+	);
+}
+
+void PointLightStore::set(size_t index, const PointLight& light)
+{
+	pos_x[index] = light.pos.x;
+	pos_y[index] = light.pos.y;
+	pos_z[index] = light.pos.z;
+	radius[index] = light.radius;
+	intensity_r[index] = light.intensity.r;
+	intensity_g[index] = light.intensity.g;
+	intensity_b[index] = light.intensity.b;
+}
+
+PointLightArrays PointLightStore::getArrays(size_t first) const
+{
+	// the kernels take non-const pointers, the const ones don't write through them
+	auto at = [first](const std::vector<float>& array) { return const_cast<float*>(array.data()) + first; };
+	return { at(pos_x), at(pos_y), at(pos_z), at(radius), at(intensity_r), at(intensity_g), at(intensity_b) };
+}
+
+void PointLightStore::animate(size_t first, size_t count, glm::vec3 velocity, float delta_time, glm::vec3 bounds_min, glm::vec3 bounds_max)
+{
+	LightAnimationParams params;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float extent = bounds_max[axis] - bounds_min[axis];
+		params.offset[axis] = velocity[axis] * delta_time;
+		params.bounds_min[axis] = bounds_min[axis];
+		params.extent[axis] = extent > 0.0f ? extent : 0.0f;
+		params.inverse_extent[axis] = extent > 0.0f ? 1.0f / extent : 0.0f;
+	}
+
+	auto lights = getArrays(first);
+	switch (kernel_isa)
+	{
+#ifdef VFPR_LIGHT_KERNELS_AVX2
+	case LightKernelIsa::AVX2: light_kernels_avx2::animate(lights, count, params); break;
+#endif
+#ifdef VFPR_LIGHT_KERNELS_NEON
+	case LightKernelIsa::NEON: light_kernels_neon::animate(lights, count, params); break;
+#endif
+	default: light_kernels_scalar::animate(lights, count, params); break;
+	}
+}
+
+size_t PointLightStore::cullSpheres(size_t first, size_t count, const std::array<glm::vec4, 6>& planes, uint8_t* visible) const
+{
+	float plane_array[6][4];
+	for (int i = 0; i < 6; i++)
+	{
+		for (int j = 0; j < 4; j++)
+		{
+			plane_array[i][j] = planes[i][j];
+		}
+	}
+
+	auto lights = getArrays(first);
+	switch (kernel_isa)
+	{
+#ifdef VFPR_LIGHT_KERNELS_AVX2
+	case LightKernelIsa::AVX2: return light_kernels_avx2::cullSpheres(lights, count, plane_array, visible);
+#endif
+#ifdef VFPR_LIGHT_KERNELS_NEON
+	case LightKernelIsa::NEON: return light_kernels_neon::cullSpheres(lights, count, plane_array, visible);
+#endif
+	default: return light_kernels_scalar::cullSpheres(lights, count, plane_array, visible);
+	}
+}
+
+void PointLightStore::pack(size_t first, size_t count, PointLight* dst) const
+{
+	auto lights = getArrays(first);
+	switch (kernel_isa)
+	{
+#ifdef VFPR_LIGHT_KERNELS_AVX2
+	case LightKernelIsa::AVX2: light_kernels_avx2::pack(lights, count, dst); break;
+#endif
+#ifdef VFPR_LIGHT_KERNELS_NEON
+	case LightKernelIsa::NEON: light_kernels_neon::pack(lights, count, dst); break;
+#endif
+	default: light_kernels_scalar::pack(lights, count, dst); break;
+	}
+}
+
+void PointLightStore::setKernelIsa(LightKernelIsa isa)
+{
+	// fall back to scalar for anything the CPU or the build doesn't have
+	kernel_isa = (isa == LightKernelIsa::SCALAR || isa == getBestSupportedIsa()) ? isa : LightKernelIsa::SCALAR;
+}
+
+LightKernelIsa PointLightStore::getBestSupportedIsa()
+{
+#if defined(VFPR_LIGHT_KERNELS_AVX2)
+#if defined(_MSC_VER)
+	// AVX2 needs the CPU flag and the OS saving the YMM registers
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return LightKernelIsa::SCALAR;
+	__cpuid(info, 1);
+	bool osxsave_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28));
+	if (!osxsave_avx || (_xgetbv(0) & 0x6) != 0x6) return LightKernelIsa::SCALAR;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) ? LightKernelIsa::AVX2 : LightKernelIsa::SCALAR;
+#else
+	return __builtin_cpu_supports("avx2") ? LightKernelIsa::AVX2 : LightKernelIsa::SCALAR;
+#endif
+#elif defined(VFPR_LIGHT_KERNELS_NEON)
+	return LightKernelIsa::NEON; // always there on AArch64
+#else
+	return LightKernelIsa::SCALAR;
+#endif
+}
+
+// scalar kernels, also used for the remainders of the vectorized ones
+
+void light_kernels_scalar::animate(const PointLightArrays& lights, size_t count, const LightAnimationParams& params)
+{
+	float* positions[3] = { lights.pos_x, lights.pos_y, lights.pos_z };
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float* pos = positions[axis];
+		float offset = params.offset[axis];
+		float bounds_min = params.bounds_min[axis];
+		float extent = params.extent[axis];
+		float inverse_extent = params.inverse_extent[axis];
+		for (size_t i = 0; i < count; i++)
+		{
+			float p = pos[i] + offset;
+			// extent is 0 on flat axes, which leaves them untouched
+			pos[i] = p - extent * std::floor((p - bounds_min) * inverse_extent);
+		}
+	}
+}
+
+size_t light_kernels_scalar::cullSpheres(const PointLightArrays& lights, size_t count, const float planes[6][4], uint8_t* visible)
+{
+	size_t visible_count = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		bool inside = true;
+		for (int p = 0; p < 6; p++)
+		{
+			float distance = planes[p][0] * lights.pos_x[i] + planes[p][1] * lights.pos_y[i] + planes[p][2] * lights.pos_z[i] + planes[p][3];
+			inside = inside && distance > -lights.radius[i];
+		}
+		visible[i] = inside ? 1 : 0;
+		visible_count += visible[i];
+	}
+	return visible_count;
+}
+
+void light_kernels_scalar::pack(const PointLightArrays& lights, size_t count, PointLight* dst)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		float light[8] = {
+			lights.pos_x[i], lights.pos_y[i], lights.pos_z[i], lights.radius[i],
+			lights.intensity_r[i], lights.intensity_g[i], lights.intensity_b[i], 0.0f
+		};
+		std::memcpy(dst + i, light, sizeof(light));
+	}
+}
+
+#ifdef VFPR_LIGHT_KERNELS_NEON
+
+void light_kernels_neon::animate(const PointLightArrays& lights, size_t count, const LightAnimationParams& params)
+{
+	float* positions[3] = { lights.pos_x, lights.pos_y, lights.pos_z };
+	size_t vector_count = count / 4 * 4;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float* pos = positions[axis];
+		float32x4_t offset = vdupq_n_f32(params.offset[axis]);
+		float32x4_t bounds_min = vdupq_n_f32(params.bounds_min[axis]);
+		float32x4_t extent = vdupq_n_f32(params.extent[axis]);
+		float32x4_t inverse_extent = vdupq_n_f32(params.inverse_extent[axis]);
+		for (size_t i = 0; i < vector_count; i += 4)
+		{
+			float32x4_t p = vaddq_f32(vld1q_f32(pos + i), offset);
+			float32x4_t wraps = vrndmq_f32(vmulq_f32(vsubq_f32(p, bounds_min), inverse_extent));
+			vst1q_f32(pos + i, vmlsq_f32(p, extent, wraps));
+		}
+	}
+
+	PointLightArrays rest = { lights.pos_x + vector_count, lights.pos_y + vector_count, lights.pos_z + vector_count
+		, lights.radius + vector_count, lights.intensity_r + vector_count, lights.intensity_g + vector_count, lights.intensity_b + vector_count };
+	light_kernels_scalar::animate(rest, count - vector_count, params);
+}
+
+size_t light_kernels_neon::cullSpheres(const PointLightArrays& lights, size_t count, const float planes[6][4], uint8_t* visible)
+{
+	size_t visible_count = 0;
+	size_t vector_count = count / 4 * 4;
+	for (size_t i = 0; i < vector_count; i += 4)
+	{
+		float32x4_t x = vld1q_f32(lights.pos_x + i);
+		float32x4_t y = vld1q_f32(lights.pos_y + i);
+		float32x4_t z = vld1q_f32(lights.pos_z + i);
+		float32x4_t negative_radius = vnegq_f32(vld1q_f32(lights.radius + i));
+		uint32x4_t inside = vdupq_n_u32(~0u);
+		for (int p = 0; p < 6; p++)
+		{
+			float32x4_t distance = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(vdupq_n_f32(planes[p][3]), x, planes[p][0]), y, planes[p][1]), z, planes[p][2]);
+			inside = vandq_u32(inside, vcgtq_f32(distance, negative_radius));
+		}
+		// lanes are all ones or all zeros
+		uint32x4_t flags = vshrq_n_u32(inside, 31);
+		visible[i] = static_cast<uint8_t>(vgetq_lane_u32(flags, 0));
+		visible[i + 1] = static_cast<uint8_t>(vgetq_lane_u32(flags, 1));
+		visible[i + 2] = static_cast<uint8_t>(vgetq_lane_u32(flags, 2));
+		visible[i + 3] = static_cast<uint8_t>(vgetq_lane_u32(flags, 3));
+		visible_count += vaddvq_u32(flags);
+	}
+
+	PointLightArrays rest = { lights.pos_x + vector_count, lights.pos_y + vector_count, lights.pos_z + vector_count
+		, lights.radius + vector_count, lights.intensity_r + vector_count, lights.intensity_g + vector_count, lights.intensity_b + vector_count };
+	return visible_count + light_kernels_scalar::cullSpheres(rest, count - vector_count, planes, visible + vector_count);
+}
+
+namespace
+{
+	// rows of a, b, c, d become columns
+	void transpose4(float32x4_t& a, float32x4_t& b, float32x4_t& c, float32x4_t& d)
+	{
+		float32x4x2_t ab = vtrnq_f32(a, b);
+		float32x4x2_t cd = vtrnq_f32(c, d);
+		a = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+		b = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+		c = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+		d = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+	}
+}
+
+void light_kernels_neon::pack(const PointLightArrays& lights, size_t count, PointLight* dst)
+{
+	// NEON has no non-temporal stores, plain stores still fill whole write-combining lines
+	float* out = reinterpret_cast<float*>(dst);
+	size_t vector_count = count / 4 * 4;
+	for (size_t i = 0; i < vector_count; i += 4)
+	{
+		float32x4_t x = vld1q_f32(lights.pos_x + i);
+		float32x4_t y = vld1q_f32(lights.pos_y + i);
+		float32x4_t z = vld1q_f32(lights.pos_z + i);
+		float32x4_t r = vld1q_f32(lights.radius + i);
+		float32x4_t ir = vld1q_f32(lights.intensity_r + i);
+		float32x4_t ig = vld1q_f32(lights.intensity_g + i);
+		float32x4_t ib = vld1q_f32(lights.intensity_b + i);
+		float32x4_t padding = vdupq_n_f32(0.0f);
+		transpose4(x, y, z, r);
+		transpose4(ir, ig, ib, padding);
+
+		float* light = out + i * 8;
+		vst1q_f32(light, x);
+		vst1q_f32(light + 4, ir);
+		vst1q_f32(light + 8, y);
+		vst1q_f32(light + 12, ig);
+		vst1q_f32(light + 16, z);
+		vst1q_f32(light + 20, ib);
+		vst1q_f32(light + 24, r);
+		vst1q_f32(light + 28, padding);
+	}
+
+	PointLightArrays rest = { lights.pos_x + vector_count, lights.pos_y + vector_count, lights.pos_z + vector_count
+		, lights.radius + vector_count, lights.intensity_r + vector_count, lights.intensity_g + vector_count, lights.intensity_b + vector_count };
+	light_kernels_scalar::pack(rest, count - vector_count, dst + vector_count);
+}
+
+#endif
@@ -0,0 +1,96 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include "lights.h"
+#include "light_store_kernels.h"
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+* Instruction sets the light kernels can run with
+*/
+enum class LightKernelIsa
+{
+	SCALAR,
+	AVX2,
+	NEON,
+};
+
+const char* getLightKernelIsaName(LightKernelIsa isa);
+
+/**
+* Point lights stored as a structure of arrays, so that the per frame kernels
+* (animation, bounds wrapping, frustum pre-culling and packing to the GPU layout) can be vectorized.
+* Every kernel works on a range of lights, so a range can be given to each worker thread.
+*/
+class PointLightStore
+{
+public:
+	PointLightStore();
+
+	size_t size() const
+	{
+		return pos_x.size();
+	}
+
+	bool empty() const
+	{
+		return pos_x.empty();
+	}
+
+	void reserve(size_t count);
+	void clear();
+	void push_back(const PointLight& light);
+	PointLight get(size_t index) const;
+	void set(size_t index, const PointLight& light);
+
+	/**
+	* Move the lights by velocity * delta_time and wrap them back into the bounds, axes where the bounds are flat stay put.
+	* Same as light_update.comp.glsl
+	*/
+	void animate(size_t first, size_t count, glm::vec3 velocity, float delta_time, glm::vec3 bounds_min, glm::vec3 bounds_max);
+
+	/**
+	* Write 1 to visible[i] if the sphere of light first + i is inside all the planes (xyz normal pointing inwards, w distance), 0 otherwise.
+	* Returns the number of visible lights
+	*/
+	size_t cullSpheres(size_t first, size_t count, const std::array<glm::vec4, 6>& planes, uint8_t* visible) const;
+
+	/**
+	* Write the lights in the GPU layout, with non-temporal stores when dst is 16 byte aligned
+	* since it usually goes to write-combined memory which isn't read back
+	*/
+	void pack(size_t first, size_t count, PointLight* dst) const;
+
+	/**
+	* The best instruction set the CPU supports is used by default, scalar can be forced for comparison
+	*/
+	void setKernelIsa(LightKernelIsa isa);
+
+	LightKernelIsa getKernelIsa() const
+	{
+		return kernel_isa;
+	}
+
+	static LightKernelIsa getBestSupportedIsa();
+
+private:
+	PointLightArrays getArrays(size_t first) const;
+
+	std::vector<float> pos_x;
+	std::vector<float> pos_y;
+	std::vector<float> pos_z;
+	std::vector<float> radius;
+	std::vector<float> intensity_r;
+	std::vector<float> intensity_g;
+	std::vector<float> intensity_b;
+
+	LightKernelIsa kernel_isa;
+};
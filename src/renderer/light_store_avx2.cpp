@@ -0,0 +1,137 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+// Built with AVX2 enabled (see CMakeLists.txt), only called after PointLightStore checked the CPU supports it
+
+#include "light_store_kernels.h"
+#include "lights.h"
+
+#ifdef VFPR_LIGHT_KERNELS_AVX2
+
+#include <immintrin.h>
+
+namespace
+{
+	PointLightArrays offsetArrays(const PointLightArrays& lights, size_t offset)
+	{
+		return { lights.pos_x + offset, lights.pos_y + offset, lights.pos_z + offset, lights.radius + offset
+			, lights.intensity_r + offset, lights.intensity_g + offset, lights.intensity_b + offset };
+	}
+}
+
+void light_kernels_avx2::animate(const PointLightArrays& lights, size_t count, const LightAnimationParams& params)
+{
+	float* positions[3] = { lights.pos_x, lights.pos_y, lights.pos_z };
+	size_t vector_count = count / 8 * 8;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float* pos = positions[axis];
+		__m256 offset = _mm256_set1_ps(params.offset[axis]);
+		__m256 bounds_min = _mm256_set1_ps(params.bounds_min[axis]);
+		__m256 extent = _mm256_set1_ps(params.extent[axis]);
+		__m256 inverse_extent = _mm256_set1_ps(params.inverse_extent[axis]);
+		for (size_t i = 0; i < vector_count; i += 8)
+		{
+			// no FMA so the results match the scalar kernel bit for bit
+			__m256 p = _mm256_add_ps(_mm256_loadu_ps(pos + i), offset);
+			__m256 wraps = _mm256_floor_ps(_mm256_mul_ps(_mm256_sub_ps(p, bounds_min), inverse_extent));
+			_mm256_storeu_ps(pos + i, _mm256_sub_ps(p, _mm256_mul_ps(extent, wraps)));
+		}
+	}
+
+	light_kernels_scalar::animate(offsetArrays(lights, vector_count), count - vector_count, params);
+}
+
+size_t light_kernels_avx2::cullSpheres(const PointLightArrays& lights, size_t count, const float planes[6][4], uint8_t* visible)
+{
+	__m256 plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+	for (int p = 0; p < 6; p++)
+	{
+		plane_x[p] = _mm256_set1_ps(planes[p][0]);
+		plane_y[p] = _mm256_set1_ps(planes[p][1]);
+		plane_z[p] = _mm256_set1_ps(planes[p][2]);
+		plane_w[p] = _mm256_set1_ps(planes[p][3]);
+	}
+	const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+
+	size_t visible_count = 0;
+	size_t vector_count = count / 8 * 8;
+	for (size_t i = 0; i < vector_count; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(lights.pos_x + i);
+		__m256 y = _mm256_loadu_ps(lights.pos_y + i);
+		__m256 z = _mm256_loadu_ps(lights.pos_z + i);
+		__m256 negative_radius = _mm256_xor_ps(_mm256_loadu_ps(lights.radius + i), sign_mask);
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int p = 0; p < 6; p++)
+		{
+			__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+				_mm256_mul_ps(plane_x[p], x), _mm256_mul_ps(plane_y[p], y)), _mm256_mul_ps(plane_z[p], z)), plane_w[p]);
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negative_radius, _CMP_GT_OQ));
+		}
+
+		int mask = _mm256_movemask_ps(inside);
+		for (int lane = 0; lane < 8; lane++)
+		{
+			visible[i + lane] = static_cast<uint8_t>((mask >> lane) & 1);
+		}
+		visible_count += _mm_popcnt_u32(static_cast<unsigned>(mask));
+	}
+
+	return visible_count + light_kernels_scalar::cullSpheres(offsetArrays(lights, vector_count), count - vector_count, planes, visible + vector_count);
+}
+
+void light_kernels_avx2::pack(const PointLightArrays& lights, size_t count, PointLight* dst)
+{
+	float* out = reinterpret_cast<float*>(dst);
+	// streaming stores skip the cache, the packed lights are only read by the GPU
+	bool stream = (reinterpret_cast<uintptr_t>(out) & 15) == 0;
+	size_t vector_count = count / 4 * 4;
+	for (size_t i = 0; i < vector_count; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(lights.pos_x + i);
+		__m128 y = _mm_loadu_ps(lights.pos_y + i);
+		__m128 z = _mm_loadu_ps(lights.pos_z + i);
+		__m128 r = _mm_loadu_ps(lights.radius + i);
+		__m128 ir = _mm_loadu_ps(lights.intensity_r + i);
+		__m128 ig = _mm_loadu_ps(lights.intensity_g + i);
+		__m128 ib = _mm_loadu_ps(lights.intensity_b + i);
+		__m128 padding = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(x, y, z, r);
+		_MM_TRANSPOSE4_PS(ir, ig, ib, padding);
+
+		// after the transposes x, y, z, r hold the positions of lights 0-3 and ir, ig, ib, padding their intensities
+		float* light = out + i * 8;
+		if (stream)
+		{
+			_mm_stream_ps(light, x);
+			_mm_stream_ps(light + 4, ir);
+			_mm_stream_ps(light + 8, y);
+			_mm_stream_ps(light + 12, ig);
+			_mm_stream_ps(light + 16, z);
+			_mm_stream_ps(light + 20, ib);
+			_mm_stream_ps(light + 24, r);
+			_mm_stream_ps(light + 28, padding);
+		}
+		else
+		{
+			_mm_storeu_ps(light, x);
+			_mm_storeu_ps(light + 4, ir);
+			_mm_storeu_ps(light + 8, y);
+			_mm_storeu_ps(light + 12, ig);
+			_mm_storeu_ps(light + 16, z);
+			_mm_storeu_ps(light + 20, ib);
+			_mm_storeu_ps(light + 24, r);
+			_mm_storeu_ps(light + 28, padding);
+		}
+	}
+	if (stream)
+	{
+		// make the streamed stores visible before the buffer is handed to the GPU
+		_mm_sfence();
+	}
+
+	light_kernels_scalar::pack(offsetArrays(lights, vector_count), count - vector_count, dst + vector_count);
+}
+
+#endif
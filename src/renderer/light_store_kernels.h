@@ -0,0 +1,63 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+// Kernels behind PointLightStore, one namespace per instruction set.
+// They work on raw arrays so that each instruction set can live in a translation unit with its own compiler flags.
+
+#include <cstddef>
+#include <cstdint>
+
+struct PointLight;
+
+/**
+* The arrays of a range of lights
+*/
+struct PointLightArrays
+{
+	float* pos_x;
+	float* pos_y;
+	float* pos_z;
+	float* radius;
+	float* intensity_r;
+	float* intensity_g;
+	float* intensity_b;
+};
+
+/**
+* Parameters of the animation kernel, precomputed once per call
+*/
+struct LightAnimationParams
+{
+	float offset[3]; // velocity * delta_time
+	float bounds_min[3];
+	float extent[3]; // 0 for axes which don't wrap
+	float inverse_extent[3];
+};
+
+namespace light_kernels_scalar
+{
+	void animate(const PointLightArrays& lights, size_t count, const LightAnimationParams& params);
+	size_t cullSpheres(const PointLightArrays& lights, size_t count, const float planes[6][4], uint8_t* visible);
+	void pack(const PointLightArrays& lights, size_t count, PointLight* dst);
+}
+
+#ifdef VFPR_LIGHT_KERNELS_AVX2
+namespace light_kernels_avx2
+{
+	void animate(const PointLightArrays& lights, size_t count, const LightAnimationParams& params);
+	size_t cullSpheres(const PointLightArrays& lights, size_t count, const float planes[6][4], uint8_t* visible);
+	void pack(const PointLightArrays& lights, size_t count, PointLight* dst);
+}
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define VFPR_LIGHT_KERNELS_NEON
+namespace light_kernels_neon
+{
+	void animate(const PointLightArrays& lights, size_t count, const LightAnimationParams& params);
+	size_t cullSpheres(const PointLightArrays& lights, size_t count, const float planes[6][4], uint8_t* visible);
+	void pack(const PointLightArrays& lights, size_t count, PointLight* dst);
+}
+#endif
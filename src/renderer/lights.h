@@ -0,0 +1,53 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+
+// GPU layouts of the light types, they must match the structs in light_culling.comp.glsl and forwardplus.frag (std140)
+
+struct PointLight
+{
+public:
+	//glm::vec3 pos = { 0.0f, 1.0f, 0.0f };
+	glm::vec3 pos;
+	float radius = { 5.0f };
+	glm::vec3 intensity = { 1.0f, 1.0f, 1.0f };
+	float padding;
+
+	PointLight() {}
+	PointLight(glm::vec3 pos, float radius, glm::vec3 intensity)
+		: pos(pos), radius(radius), intensity(intensity)
+	{};
+};
+
+struct SpotLight
+{
+public:
+	glm::vec3 pos;
+	float range = { 10.0f };
+	glm::vec3 direction = { 0.0f, -1.0f, 0.0f }; // normalized
+	float cos_outer_angle; // cosine of the half angle of the cone
+	glm::vec3 intensity = { 1.0f, 1.0f, 1.0f };
+	float cos_inner_angle; // falloff starts here
+
+	SpotLight() {}
+	/**
+	* angle is the half angle of the cone in radians, the falloff covers its outer quarter
+	*/
+	SpotLight(glm::vec3 pos, glm::vec3 direction, float angle, float range, glm::vec3 intensity)
+		: pos(pos), range(range), direction(glm::normalize(direction)), cos_outer_angle(std::cos(angle))
+		, intensity(intensity), cos_inner_angle(std::cos(angle * 0.75f))
+	{};
+
+	/**
+	* The point light which encloses the whole cone, for comparing against scenes which fake spot lights
+	*/
+	PointLight toEnclosingPointLight() const
+	{
+		return PointLight(pos, range, intensity);
+	}
+};
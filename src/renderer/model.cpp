@@ -5,13 +5,18 @@
 
 #include "vulkan_util.h"
 #include "context.h"
+#include "transfer_queue.h"
 #include "../util.h"
 
 #include <tiny_obj_loader.h>
 
+#include <algorithm>
+#include <cmath>
 #include <unordered_map>
 #include <vector>
 #include <string>
+#include <tuple>
+#include <utility>
 
 namespace std {
 	// hash function for Vertex
@@ -31,6 +36,25 @@ struct MaterialUbo
 	int has_normal_map;
 };
 
+// a material of the bindless material buffer, std430
+struct MaterialData
+{
+	int albedo_map_index; // into the textures of the model, -1 for none
+	int normal_map_index;
+};
+
+
+// the bounds of a mesh part in the bounds buffer, std430
+struct PartBounds
+{
+	glm::vec4 bounds_min;
+	glm::vec4 bounds_max;
+};
+
+// submit the recorded uploads once this much is staged, so the copies run while the rest of the model is read
+const vk::DeviceSize UPLOAD_BATCH_BYTES = 32 * 1024 * 1024;
+// a material group is split until no chunk has more triangles than this
+const size_t MAX_CHUNK_TRIANGLES = 4096;
 
 struct MeshMaterialGroup // grouped by material
 {
@@ -135,226 +159,527 @@ std::vector<MeshMaterialGroup> loadModel(const std::string& path)
 	return groups;
 }
 
+// a range of the indices of a material group, after splitIntoChunks() sorted its triangles
+struct MeshChunk
+{
+	size_t first_index = 0;
+	size_t index_count = 0;
+};
+
+/**
+* Split the triangles of a material group into spatially coherent chunks of at most MAX_CHUNK_TRIANGLES triangles.
+* A k-d split: the triangles of a chunk too large are halved at the median of their centroids along the longest axis
+* of the centroid bounds. The indices of the group are reordered so the triangles of every chunk are contiguous
+*/
+std::vector<MeshChunk> splitIntoChunks(MeshMaterialGroup& group)
+{
+	const auto& indices = group.vertex_indices;
+	size_t triangle_count = indices.size() / 3;
+	std::vector<glm::vec3> centroids(triangle_count);
+	for (size_t t = 0; t < triangle_count; t++)
+	{
+		centroids[t] = (group.vertices[indices[3 * t]].pos + group.vertices[indices[3 * t + 1]].pos + group.vertices[indices[3 * t + 2]].pos) / 3.0f;
+	}
+
+	std::vector<size_t> triangles(triangle_count);
+	for (size_t t = 0; t < triangle_count; t++)
+	{
+		triangles[t] = t;
+	}
+
+	// ranges of triangles still to split, taken from the back so the chunks come out in the order of the split
+	std::vector<MeshChunk> chunks;
+	std::vector<std::pair<size_t, size_t>> pending = { { 0, triangle_count } };
+	while (!pending.empty())
+	{
+		size_t begin, end;
+		std::tie(begin, end) = pending.back();
+		pending.pop_back();
+		if (end - begin <= MAX_CHUNK_TRIANGLES)
+		{
+			chunks.push_back({ 3 * begin, 3 * (end - begin) });
+			continue;
+		}
+
+		glm::vec3 centroid_min = centroids[triangles[begin]];
+		glm::vec3 centroid_max = centroid_min;
+		for (size_t i = begin; i < end; i++)
+		{
+			centroid_min = glm::min(centroid_min, centroids[triangles[i]]);
+			centroid_max = glm::max(centroid_max, centroids[triangles[i]]);
+		}
+		auto extent = centroid_max - centroid_min;
+		int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+		size_t middle = begin + (end - begin) / 2;
+		std::nth_element(triangles.begin() + begin, triangles.begin() + middle, triangles.begin() + end, [&centroids, axis](size_t a, size_t b)
+		{
+			return centroids[a][axis] < centroids[b][axis];
+		});
+		pending.emplace_back(middle, end);
+		pending.emplace_back(begin, middle);
+	}
+
+	std::vector<util::Vertex::index_t> chunked_indices;
+	chunked_indices.reserve(indices.size());
+	for (auto t : triangles)
+	{
+		chunked_indices.insert(chunked_indices.end(), indices.begin() + 3 * t, indices.begin() + 3 * t + 3);
+	}
+	group.vertex_indices = std::move(chunked_indices);
+	return chunks;
+}
+
+/**
+* Bounding box and sphere of the vertices a range of a group's indices refers to
+*/
+void computePartBounds(VMeshPart& part, const MeshMaterialGroup& group, const MeshChunk& chunk)
+{
+	const auto& indices = group.vertex_indices;
+	part.bounds_min = group.vertices[indices[chunk.first_index]].pos;
+	part.bounds_max = part.bounds_min;
+	for (size_t i = chunk.first_index; i < chunk.first_index + chunk.index_count; i++)
+	{
+		part.bounds_min = glm::min(part.bounds_min, group.vertices[indices[i]].pos);
+		part.bounds_max = glm::max(part.bounds_max, group.vertices[indices[i]].pos);
+	}
+
+	part.bounding_sphere_center = 0.5f * (part.bounds_min + part.bounds_max);
+	float radius_squared = 0.0f;
+	for (size_t i = chunk.first_index; i < chunk.first_index + chunk.index_count; i++)
+	{
+		auto offset = group.vertices[indices[i]].pos - part.bounding_sphere_center;
+		radius_squared = std::max(radius_squared, glm::dot(offset, offset));
+	}
+	part.bounding_sphere_radius = std::sqrt(radius_squared);
+}
+
+/**
+* Allocate and write the material descriptor set of a mesh part, the material uniform is uploaded through transfer_queue
+*/
+void createMaterialDescriptorSet(const vk::Device& device, const vk::Sampler& texture_sampler, const vk::DescriptorPool& descriptor_pool
+	, const vk::DescriptorSetLayout& material_descriptor_set_layout, VTransferQueue& transfer_queue
+	, VMeshPart& mesh_part, VBufferSection uniform_buffer_section)
+{
+	VkDescriptorSetLayout layouts[] = { material_descriptor_set_layout };
+	VkDescriptorSetAllocateInfo alloc_info = {};
+	alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	alloc_info.descriptorPool = descriptor_pool;
+	alloc_info.descriptorSetCount = 1; 
+	alloc_info.pSetLayouts = layouts;
+
+	auto descriptor_set = device.allocateDescriptorSets(alloc_info)[0];
+	MaterialUbo ubo{0, 0};
+
+	std::vector<vk::WriteDescriptorSet> descriptor_writes = {};
+
+	// refer to the uniform object buffer
+	vk::DescriptorBufferInfo uniform_buffer_info = {};
+	{
+		uniform_buffer_info.buffer = uniform_buffer_section.buffer;
+		uniform_buffer_info.offset = uniform_buffer_section.offset;
+		uniform_buffer_info.range = uniform_buffer_section.size;
+		// ubo
+		descriptor_writes.emplace_back(
+			descriptor_set,  //dstSet
+			0,  // dstBinding
+			0,  // dstArrayElement
+			1,  // descriptorCOunt
+			vk::DescriptorType::eUniformBuffer,  // descriptorType
+			nullptr,  // pImageInfo
+			&uniform_buffer_info,  // pBufferInfo
+			nullptr  // pTexelBufferView
+		);
+	}
+
+	vk::DescriptorImageInfo albedo_map_info = {};
+	if (mesh_part.albedo_map)
+	{
+		ubo.has_albedo_map = 1;
+		albedo_map_info.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+		albedo_map_info.imageView = mesh_part.albedo_map;
+		albedo_map_info.sampler = texture_sampler;
+
+		descriptor_writes.emplace_back(
+			descriptor_set,  //dstSet
+			1,  // dstBinding
+			0,  // dstArrayElement
+			1,  // descriptorCOunt
+			vk::DescriptorType::eCombinedImageSampler,  // descriptorType
+			&albedo_map_info,  // pImageInfo
+			nullptr,  // pBufferInfo
+			nullptr  // pTexelBufferView
+		);
+	}
+
+	vk::DescriptorImageInfo normalmap_info = {};
+	if (mesh_part.normal_map)
+	{
+		ubo.has_normal_map = 1;
+		normalmap_info.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+		normalmap_info.imageView = mesh_part.normal_map;
+		normalmap_info.sampler = texture_sampler;
+
+		descriptor_writes.emplace_back(
+			descriptor_set,  //dstSet
+			2,  // dstBinding
+			0,  // dstArrayElement
+			1,  // descriptorCOunt
+			vk::DescriptorType::eCombinedImageSampler,  // descriptorType
+			&normalmap_info,  // pImageInfo
+			nullptr,  // pBufferInfo
+			nullptr  // pTexelBufferView
+		);
+	}
+
+	device.updateDescriptorSets(descriptor_writes, std::array<vk::CopyDescriptorSet, 0>());
+
+	mesh_part.material_descriptor_set = descriptor_set;
+
+	transfer_queue.uploadBuffer(uniform_buffer_info.buffer, uniform_buffer_info.offset, &ubo, uniform_buffer_section.size
+		, vk::PipelineStageFlagBits::eFragmentShader, vk::AccessFlagBits::eUniformRead);
+
+}
+
+/**
+* Upload the materials into a storage buffer for bindless drawing, indexed by VMeshPart::material_index
+*/
+std::tuple<VRaii<VkBuffer>, VRaii<VkDeviceMemory>> createMaterialBuffer(VUtility& vulkan_utility, const std::vector<MaterialData>& materials
+	, VTransferQueue& transfer_queue)
+{
+	vk::DeviceSize buffer_size = sizeof(MaterialData) * std::max<size_t>(materials.size(), 1);
+	auto buffer = vulkan_utility.createBuffer(buffer_size
+		, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	if (!materials.empty())
+	{
+		transfer_queue.uploadBuffer(std::get<0>(buffer).get(), 0, materials.data(), sizeof(MaterialData) * materials.size()
+			, vk::PipelineStageFlagBits::eFragmentShader, vk::AccessFlagBits::eShaderRead);
+	}
+	return buffer;
+}
+
+/**
+* A VkDrawIndexedIndirectCommand per mesh part in part order, followed by the part count
+*/
+void VModel::createDrawCommandBuffer(VUtility& vulkan_utility, VTransferQueue& transfer_queue)
+{
+	std::vector<VkDrawIndexedIndirectCommand> commands;
+	commands.reserve(mesh_parts.size());
+	for (const auto& part : mesh_parts)
+	{
+		VkDrawIndexedIndirectCommand command = {};
+		command.indexCount = static_cast<uint32_t>(part.index_count);
+		command.instanceCount = 1;
+		command.firstIndex = part.first_index;
+		command.vertexOffset = part.vertex_offset;
+		command.firstInstance = part.material_index;
+		commands.push_back(command);
+	}
+	auto draw_count = static_cast<uint32_t>(commands.size());
+
+	vk::DeviceSize commands_size = sizeof(VkDrawIndexedIndirectCommand) * commands.size();
+	std::tie(draw_command_buffer, draw_command_buffer_memory) = vulkan_utility.createBuffer(commands_size + sizeof(draw_count)
+		, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	draw_command_buffer_section = { draw_command_buffer.get(), 0, commands_size };
+	draw_count_buffer_section = { draw_command_buffer.get(), commands_size, sizeof(draw_count) };
+
+	if (!commands.empty())
+	{
+		transfer_queue.uploadBuffer(draw_command_buffer.get(), 0, commands.data(), commands_size
+			, vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eComputeShader
+			, vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eShaderRead);
+	}
+	transfer_queue.uploadBuffer(draw_command_buffer.get(), commands_size, &draw_count, sizeof(draw_count)
+		, vk::PipelineStageFlagBits::eDrawIndirect, vk::AccessFlagBits::eIndirectCommandRead);
+}
+
+/**
+* The bounds of every mesh part in part order, read by GPU culling
+*/
+void VModel::createBoundsBuffer(VUtility& vulkan_utility, VTransferQueue& transfer_queue)
+{
+	std::vector<PartBounds> bounds;
+	bounds.reserve(mesh_parts.size());
+	for (const auto& part : mesh_parts)
+	{
+		bounds.push_back({ glm::vec4(part.bounds_min, 1.0f), glm::vec4(part.bounds_max, 1.0f) });
+	}
+
+	vk::DeviceSize bounds_size = sizeof(PartBounds) * bounds.size();
+	std::tie(bounds_buffer, bounds_buffer_memory) = vulkan_utility.createBuffer(std::max<vk::DeviceSize>(bounds_size, sizeof(PartBounds))
+		, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	bounds_buffer_section = { bounds_buffer.get(), 0, bounds_size };
+
+	if (!bounds.empty())
+	{
+		transfer_queue.uploadBuffer(bounds_buffer.get(), 0, bounds.data(), bounds_size
+			, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead);
+	}
+}
+
+std::vector<vk::ImageView> VModel::getTextures() const
+{
+	std::vector<vk::ImageView> textures;
+	textures.reserve(imageviews.size());
+	for (const auto& imageview : imageviews)
+	{
+		textures.push_back(imageview.get());
+	}
+	return textures;
+}
+
 /**
 * Load model from file and allocate vulkan resources needed
 */
-VModel VModel::loadModelFromFile(const VContext& vulkan_context, const std::string & path, const vk::Sampler& texture_sampler, const vk::DescriptorPool& descriptor_pool,
-	const vk::DescriptorSetLayout& material_descriptor_set_layout)
+VModel VModel::loadModelFromFile(const VContext& vulkan_context, const std::string & path, VTransferQueue& transfer_queue)
 {
 	VModel model;
 
-	auto device = vulkan_context.getDevice();
 	VUtility vulkan_utility{ vulkan_context };
 
 	//std::vector<util::Vertex> vertices, std::vector<util::Vertex::index_t> vertex_indices;
 	auto groups = loadModel(path);
-	vk::DeviceSize buffer_size = 0;
+	// the vertices of every group one after another, then the indices of every group
+	vk::DeviceSize vertex_region_size = 0;
+	vk::DeviceSize index_region_size = 0;
 	for (const auto& group : groups)
 	{
 		if (group.vertex_indices.size() <= 0)
 		{
 			continue;
 		}
-		vk::DeviceSize vertex_section_size = sizeof(group.vertices[0]) * group.vertices.size();
-		vk::DeviceSize index_section_size = sizeof(group.vertex_indices[0]) * group.vertex_indices.size();
-		buffer_size += vertex_section_size;
-		buffer_size += index_section_size;
+		vertex_region_size += sizeof(group.vertices[0]) * group.vertices.size();
+		index_region_size += sizeof(group.vertex_indices[0]) * group.vertex_indices.size();
 	}
 
-	std::tie(model.buffer, model.buffer_memory) = vulkan_utility.createBuffer(buffer_size
+	std::tie(model.buffer, model.buffer_memory) = vulkan_utility.createBuffer(vertex_region_size + index_region_size
 		, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT
 		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	model.vertex_buffer_section = { model.buffer.get(), 0, vertex_region_size };
+	model.index_buffer_section = { model.buffer.get(), vertex_region_size, index_region_size };
 
-	vk::DeviceSize current_offset = 0;
+	vk::DeviceSize vertex_offset = 0;
+	vk::DeviceSize index_offset = vertex_region_size;
+	std::vector<MaterialData> materials; // one per group, shared by the mesh parts of its chunks
 	
-	for (const auto& group : groups)
+	for (auto& group : groups)
 	{
 		if (group.vertex_indices.size() <= 0)
 		{
 			continue;
 		}
 
+		// reorders the indices of the group, before they are uploaded
+		auto chunks = splitIntoChunks(group);
+
 		vk::DeviceSize vertex_section_size = sizeof(group.vertices[0]) * group.vertices.size();
 		vk::DeviceSize index_section_size = sizeof(group.vertex_indices[0]) * group.vertex_indices.size();
 
-		VBufferSection vertex_buffer_section = { model.buffer.get(), current_offset, vertex_section_size };
-		// copy vertex data
-		{
-			auto staging_buffer_size = vertex_section_size;
-			auto host_data = group.vertices.data();
-
-			VRaii<VkBuffer> staging_buffer;
-			VRaii<VkDeviceMemory> staging_buffer_memory;
-			std::tie(staging_buffer, staging_buffer_memory) = vulkan_utility.createBuffer(staging_buffer_size
-				, VK_BUFFER_USAGE_TRANSFER_SRC_BIT // to be transfered from
-				, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-			);
-
-			void* data = device.mapMemory(staging_buffer_memory.get(), 0, staging_buffer_size, vk::MemoryMapFlags());
-			memcpy(data, host_data, static_cast<size_t>(staging_buffer_size)); // may not be immediate due to memory caching or write operation not visiable without VK_MEMORY_PROPERTY_HOST_COHERENT_BIT or explict flusing
-			device.unmapMemory(staging_buffer_memory.get());
-
-			vulkan_utility.copyBuffer(staging_buffer.get(), model.buffer.get(), staging_buffer_size, 0, current_offset);
-
-			current_offset += staging_buffer_size;
-		}
-
-		VBufferSection index_buffer_section = { model.buffer.get(), current_offset, index_section_size };
-		// copy index data
-		{
-			auto staging_buffer_size = index_section_size;
-			auto host_data = group.vertex_indices.data();
+		VBufferSection vertex_buffer_section = { model.buffer.get(), vertex_offset, vertex_section_size };
+		transfer_queue.uploadBuffer(model.buffer.get(), vertex_offset, group.vertices.data(), vertex_section_size
+			, vk::PipelineStageFlagBits::eVertexInput, vk::AccessFlagBits::eVertexAttributeRead);
+		vertex_offset += vertex_section_size;
 
-			VRaii<VkBuffer> staging_buffer;
-			VRaii<VkDeviceMemory> staging_buffer_memory;
-			std::tie(staging_buffer, staging_buffer_memory) = vulkan_utility.createBuffer(staging_buffer_size
-				, VK_BUFFER_USAGE_TRANSFER_SRC_BIT // to be transfered from
-				, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-			);
-
-			void* data = device.mapMemory(staging_buffer_memory.get(), 0, staging_buffer_size, vk::MemoryMapFlags());
-			memcpy(data, host_data, static_cast<size_t>(staging_buffer_size)); // may not be immediate due to memory caching or write operation not visiable without VK_MEMORY_PROPERTY_HOST_COHERENT_BIT or explict flusing
-			device.unmapMemory(staging_buffer_memory.get());
-
-			vulkan_utility.copyBuffer(staging_buffer.get(), model.buffer.get(), staging_buffer_size, 0, current_offset);
-
-			current_offset += staging_buffer_size;
-		}
+		VBufferSection index_buffer_section = { model.buffer.get(), index_offset, index_section_size };
+		transfer_queue.uploadBuffer(model.buffer.get(), index_offset, group.vertex_indices.data(), index_section_size
+			, vk::PipelineStageFlagBits::eVertexInput, vk::AccessFlagBits::eIndexRead);
+		index_offset += index_section_size;
 
 		VMeshPart part = { vertex_buffer_section, index_buffer_section, group.vertex_indices.size() };
+		MaterialData material = { -1, -1 };
 
 		if (!group.albedo_map_path.empty())
 		{
 			model.images.emplace_back();
 			model.image_memories.emplace_back();
 			model.imageviews.emplace_back();
-			std::tie(model.images.back(), model.image_memories.back(), model.imageviews.back()) = vulkan_utility.loadImageFromFile(group.albedo_map_path);
+			std::tie(model.images.back(), model.image_memories.back(), model.imageviews.back()) = vulkan_utility.loadImageFromFile(group.albedo_map_path, transfer_queue);
 			part.albedo_map = model.imageviews.back().get();
+			material.albedo_map_index = static_cast<int>(model.imageviews.size() - 1);
 		}
 		if (!group.normal_map_path.empty())
 		{
 			model.images.emplace_back();
 			model.image_memories.emplace_back();
 			model.imageviews.emplace_back();
-			std::tie(model.images.back(), model.image_memories.back(), model.imageviews.back()) = vulkan_utility.loadImageFromFile(group.normal_map_path);
+			std::tie(model.images.back(), model.image_memories.back(), model.imageviews.back()) = vulkan_utility.loadImageFromFile(group.normal_map_path, transfer_queue);
 			part.normal_map = model.imageviews.back().get();
+			material.normal_map_index = static_cast<int>(model.imageviews.size() - 1);
+		}
+
+		part.material_index = static_cast<uint32_t>(materials.size());
+		materials.push_back(material);
+
+		// the chunks share the vertices of the group, each draws its own range of the indices
+		part.vertex_offset = static_cast<int32_t>(vertex_buffer_section.offset / sizeof(util::Vertex));
+		auto group_first_index = (index_buffer_section.offset - vertex_region_size) / sizeof(util::Vertex::index_t);
+		for (const auto& chunk : chunks)
+		{
+			part.index_buffer_section = { model.buffer.get(), index_buffer_section.offset + chunk.first_index * sizeof(util::Vertex::index_t)
+				, chunk.index_count * sizeof(util::Vertex::index_t) };
+			part.index_count = chunk.index_count;
+			part.first_index = static_cast<uint32_t>(group_first_index + chunk.first_index);
+			computePartBounds(part, group, chunk);
+			model.mesh_parts.push_back(part);
 		}
 
-		model.mesh_parts.push_back(part);
+		if (transfer_queue.getPendingBytes() >= UPLOAD_BATCH_BYTES)
+		{
+			transfer_queue.submit();
+		}
 	}
 
-	auto createMaterialDescriptorSet = [&vulkan_utility, &device, &texture_sampler, &descriptor_pool, &material_descriptor_set_layout, &uniform_buffer_memory = model.uniform_buffer_memory.get()](
-		VMeshPart& mesh_part
-		, VBufferSection uniform_buffer_section
-	)
-	{
-		VkDescriptorSetLayout layouts[] = { material_descriptor_set_layout };
-		VkDescriptorSetAllocateInfo alloc_info = {};
-		alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		alloc_info.descriptorPool = descriptor_pool;
-		alloc_info.descriptorSetCount = 1; 
-		alloc_info.pSetLayouts = layouts;
 
-		auto descriptor_set = device.allocateDescriptorSets(alloc_info)[0];
-		MaterialUbo ubo{0, 0};
 
-		std::vector<vk::WriteDescriptorSet> descriptor_writes = {};
+	std::tie(model.material_buffer, model.material_buffer_memory) = createMaterialBuffer(vulkan_utility, materials, transfer_queue);
+	model.material_buffer_section = { model.material_buffer.get(), 0, sizeof(MaterialData) * materials.size() };
+	model.createDrawCommandBuffer(vulkan_utility, transfer_queue);
+	model.createBoundsBuffer(vulkan_utility, transfer_queue);
+
+	model.upload_value = transfer_queue.submit();
+
+	return model;
+}
+
+
+VModel VModel::createSyntheticModel(const VContext& vulkan_context, size_t part_count, glm::vec3 min_pos, glm::vec3 max_pos
+	, VTransferQueue& transfer_queue)
+{
+	using util::Vertex;
+
+	VModel model;
 
-		// refer to the uniform object buffer
-		vk::DescriptorBufferInfo uniform_buffer_info = {};
+	VUtility vulkan_utility{ vulkan_context };
+
+	// a unit cube with a flat normal per face, moved into place for every part
+	const glm::vec3 face_normals[] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+	std::vector<Vertex> cube_vertices;
+	std::vector<Vertex::index_t> cube_indices;
+	for (const auto& normal : face_normals)
+	{
+		glm::vec3 tangent = normal.y != 0 ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+		glm::vec3 bitangent = glm::cross(normal, tangent);
+		auto first = static_cast<Vertex::index_t>(cube_vertices.size());
+		for (glm::vec2 corner : { glm::vec2(-1, -1), glm::vec2(1, -1), glm::vec2(1, 1), glm::vec2(-1, 1) })
 		{
-			uniform_buffer_info.buffer = uniform_buffer_section.buffer;
-			uniform_buffer_info.offset = uniform_buffer_section.offset;
-			uniform_buffer_info.range = uniform_buffer_section.size;
-			// ubo
-			descriptor_writes.emplace_back(
-				descriptor_set,  //dstSet
-				0,  // dstBinding
-				0,  // dstArrayElement
-				1,  // descriptorCOunt
-				vk::DescriptorType::eUniformBuffer,  // descriptorType
-				nullptr,  // pImageInfo
-				&uniform_buffer_info,  // pBufferInfo
-				nullptr  // pTexelBufferView
-			);
+			Vertex vertex = {};
+			vertex.pos = 0.5f * (normal + corner.x * tangent + corner.y * bitangent) + glm::vec3(0.0f, 0.5f, 0.0f); // standing on y = 0
+			vertex.color = glm::vec3(1.0f);
+			vertex.tex_coord = 0.5f * corner + 0.5f;
+			vertex.normal = normal;
+			cube_vertices.push_back(vertex);
 		}
-
-		vk::DescriptorImageInfo albedo_map_info = {};
-		if (mesh_part.albedo_map)
+		for (Vertex::index_t index : { 0u, 1u, 2u, 2u, 3u, 0u })
 		{
-			ubo.has_albedo_map = 1;
-			albedo_map_info.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-			albedo_map_info.imageView = mesh_part.albedo_map;
-			albedo_map_info.sampler = texture_sampler;
-
-			descriptor_writes.emplace_back(
-				descriptor_set,  //dstSet
-				1,  // dstBinding
-				0,  // dstArrayElement
-				1,  // descriptorCOunt
-				vk::DescriptorType::eCombinedImageSampler,  // descriptorType
-				&albedo_map_info,  // pImageInfo
-				nullptr,  // pBufferInfo
-				nullptr  // pTexelBufferView
-			);
+			cube_indices.push_back(first + index);
 		}
+	}
 
-		vk::DescriptorImageInfo normalmap_info = {};
-		if (mesh_part.normal_map)
+	// the vertices of every cube one after another, then the indices of one cube which every part shares
+	vk::DeviceSize vertex_section_size = sizeof(cube_vertices[0]) * cube_vertices.size();
+	vk::DeviceSize index_section_size = sizeof(cube_indices[0]) * cube_indices.size();
+	vk::DeviceSize vertex_region_size = vertex_section_size * part_count;
+	std::tie(model.buffer, model.buffer_memory) = vulkan_utility.createBuffer(vertex_region_size + index_section_size
+		, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	model.vertex_buffer_section = { model.buffer.get(), 0, vertex_region_size };
+	model.index_buffer_section = { model.buffer.get(), vertex_region_size, index_section_size };
+	transfer_queue.uploadBuffer(model.buffer.get(), vertex_region_size, cube_indices.data(), index_section_size
+		, vk::PipelineStageFlagBits::eVertexInput, vk::AccessFlagBits::eIndexRead);
+
+	// as square a grid as the part count allows, each cube takes half of its cell
+	auto columns = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(part_count))));
+	auto rows = (part_count + columns - 1) / columns;
+	glm::vec2 cell_size = glm::vec2(max_pos.x - min_pos.x, max_pos.z - min_pos.z) / glm::vec2(columns, rows);
+	float cube_size = 0.5f * std::min(cell_size.x, cell_size.y);
+
+	std::vector<Vertex> part_vertices(cube_vertices.size());
+	vk::DeviceSize current_offset = 0;
+	for (size_t i = 0; i < part_count; i++)
+	{
+		glm::vec3 center = { min_pos.x + cell_size.x * (i % columns + 0.5f), min_pos.y, min_pos.z + cell_size.y * (i / columns + 0.5f) };
+		for (size_t v = 0; v < cube_vertices.size(); v++)
 		{
-			ubo.has_normal_map = 1;
-			normalmap_info.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-			normalmap_info.imageView = mesh_part.normal_map;
-			normalmap_info.sampler = texture_sampler;
-
-			descriptor_writes.emplace_back(
-				descriptor_set,  //dstSet
-				2,  // dstBinding
-				0,  // dstArrayElement
-				1,  // descriptorCOunt
-				vk::DescriptorType::eCombinedImageSampler,  // descriptorType
-				&normalmap_info,  // pImageInfo
-				nullptr,  // pBufferInfo
-				nullptr  // pTexelBufferView
-			);
+			part_vertices[v] = cube_vertices[v];
+			part_vertices[v].pos = center + cube_vertices[v].pos * cube_size;
 		}
 
-		device.updateDescriptorSets(descriptor_writes, std::array<vk::CopyDescriptorSet, 0>());
+		VBufferSection vertex_buffer_section = { model.buffer.get(), current_offset, vertex_section_size };
+		transfer_queue.uploadBuffer(model.buffer.get(), current_offset, part_vertices.data(), vertex_section_size
+			, vk::PipelineStageFlagBits::eVertexInput, vk::AccessFlagBits::eVertexAttributeRead);
+		current_offset += vertex_section_size;
+
+		model.mesh_parts.emplace_back(vertex_buffer_section, model.index_buffer_section, cube_indices.size());
+		model.mesh_parts.back().vertex_offset = static_cast<int32_t>(i * cube_vertices.size());
+		// the unit cube spans -0.5 to 0.5 around x and z and stands on y = 0
+		model.mesh_parts.back().bounds_min = center + glm::vec3(-0.5f, 0.0f, -0.5f) * cube_size;
+		model.mesh_parts.back().bounds_max = center + glm::vec3(0.5f, 1.0f, 0.5f) * cube_size;
+		model.mesh_parts.back().bounding_sphere_center = center + glm::vec3(0.0f, 0.5f, 0.0f) * cube_size;
+		model.mesh_parts.back().bounding_sphere_radius = 0.5f * std::sqrt(3.0f) * cube_size;
+
+		if (transfer_queue.getPendingBytes() >= UPLOAD_BATCH_BYTES)
+		{
+			transfer_queue.submit();
+		}
+	}
 
-		mesh_part.material_descriptor_set = descriptor_set;
+	// one material for every part, the descriptor pool only has room for so many sets
+	std::vector<MaterialData> materials = { { -1, -1 } };
+	std::tie(model.material_buffer, model.material_buffer_memory) = createMaterialBuffer(vulkan_utility, materials, transfer_queue);
+	model.material_buffer_section = { model.material_buffer.get(), 0, sizeof(MaterialData) };
+	model.createDrawCommandBuffer(vulkan_utility, transfer_queue);
+	model.createBoundsBuffer(vulkan_utility, transfer_queue);
 
-		vk::DeviceSize staging_buffer_size = uniform_buffer_section.size;
-		VRaii<VkBuffer> staging_buffer;
-		VRaii<VkDeviceMemory> staging_buffer_memory;
-		std::tie(staging_buffer, staging_buffer_memory) = vulkan_utility.createBuffer(staging_buffer_size
-			, VK_BUFFER_USAGE_TRANSFER_SRC_BIT // to be transfered from
-			, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-		);
+	model.upload_value = transfer_queue.submit();
 
-		void* data = device.mapMemory(staging_buffer_memory.get(), 0, staging_buffer_size, vk::MemoryMapFlags());
-		memcpy(data, &ubo, static_cast<size_t>(staging_buffer_size)); // may not be immediate due to memory caching or write operation not visiable without VK_MEMORY_PROPERTY_HOST_COHERENT_BIT or explict flusing
-		device.unmapMemory(staging_buffer_memory.get());
+	return model;
+}
 
-		vulkan_utility.copyBuffer(staging_buffer.get(), uniform_buffer_info.buffer, staging_buffer_size, 0, uniform_buffer_info.offset);
+/**
+* A material descriptor set per material, shared by the mesh parts using it, with the material uniforms in a buffer of their own
+*/
+void VModel::createMaterialDescriptorSets(const VContext& vulkan_context, const vk::Sampler& texture_sampler, const vk::DescriptorPool& descriptor_pool
+	, const vk::DescriptorSetLayout& material_descriptor_set_layout, VTransferQueue& transfer_queue)
+{
+	if (mesh_parts.empty())
+	{
+		return;
+	}
 
-	};
+	auto device = vulkan_context.getDevice();
+	VUtility vulkan_utility{ vulkan_context };
 
+	uint32_t material_count = 0;
+	for (const auto& part : mesh_parts)
+	{
+		material_count = std::max(material_count, part.material_index + 1);
+	}
 
 	auto min_alignment = vulkan_context.getPhysicalDeviceProperties().limits.minUniformBufferOffsetAlignment;
 	vk::DeviceSize alignment_offset = ((sizeof(MaterialUbo) - 1) / min_alignment + 1) * min_alignment;
 
-	vk::DeviceSize uniform_buffer_size = alignment_offset * model.mesh_parts.size();
-	std::tie(model.uniform_buffer, model.uniform_buffer_memory) = vulkan_utility.createBuffer(uniform_buffer_size
+	vk::DeviceSize uniform_buffer_size = alignment_offset * material_count;
+	std::tie(uniform_buffer, uniform_buffer_memory) = vulkan_utility.createBuffer(uniform_buffer_size
 		, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
 		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-	vk::DeviceSize uniform_buffer_total_offset = 0;
-	for (auto& part : model.mesh_parts)
+	// the descriptor pool only has room for so many sets, the parts of a material share one
+	std::vector<vk::DescriptorSet> material_descriptor_sets(material_count);
+	for (auto& part : mesh_parts)
 	{
-		createMaterialDescriptorSet(part, VBufferSection(model.uniform_buffer.get(), uniform_buffer_total_offset, sizeof(MaterialUbo)));
-		uniform_buffer_total_offset += alignment_offset;
+		auto& material_descriptor_set = material_descriptor_sets[part.material_index];
+		if (material_descriptor_set)
+		{
+			part.material_descriptor_set = material_descriptor_set;
+			continue;
+		}
+		createMaterialDescriptorSet(device, texture_sampler, descriptor_pool, material_descriptor_set_layout, transfer_queue
+			, part, VBufferSection(uniform_buffer.get(), alignment_offset * part.material_index, sizeof(MaterialUbo)));
+		material_descriptor_set = part.material_descriptor_set;
 	}
 
-	return model;
+	upload_value = transfer_queue.submit();
 }
-
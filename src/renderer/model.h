@@ -6,10 +6,13 @@
 #include "raii.h"
 
 #include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
 
 #include <vector>
 
 class VContext;
+class VTransferQueue;
+class VUtility;
 
 /**
 * A structure that points to a part of a buffer
@@ -38,6 +41,16 @@ struct VMeshPart
 	VBufferSection material_uniform_buffer_section = {};
 	size_t index_count = 0;
 	vk::DescriptorSet material_descriptor_set = {};  // TODO: I still need a per-instance descriptor set
+	uint32_t material_index = 0; // into the material buffer of the model, drawn as the first instance so the shaders see it in gl_InstanceIndex
+	// where the part starts in the vertex and index buffers of the whole model, its indices are relative to vertex_offset
+	uint32_t first_index = 0;
+	int32_t vertex_offset = 0;
+	// axis aligned bounds of the part's vertices in object space, for culling
+	glm::vec3 bounds_min = glm::vec3(0.0f);
+	glm::vec3 bounds_max = glm::vec3(0.0f);
+	// a sphere around the same vertices, centered on the bounds, for the cheaper tests
+	glm::vec3 bounding_sphere_center = glm::vec3(0.0f);
+	float bounding_sphere_radius = 0.0f;
 
 
 	// handles for images (no ownership or so)
@@ -65,14 +78,93 @@ public:
 	VModel(VModel&&) = default;
 	VModel& operator= (VModel&&) = default;
 
+	/**
+	* The parts grouped by material, which is the order the shading pass draws them in.
+	* A material's triangles are split into spatially coherent chunks, each its own part sharing the material
+	*/
 	const std::vector<VMeshPart>& getMeshParts() const
 	{
 		return mesh_parts;
 	}
 
-	static VModel loadModelFromFile(const VContext& vulkan_context, const std::string& path
-		, const vk::Sampler& texture_sampler, const vk::DescriptorPool& descriptor_pool,
-		const vk::DescriptorSetLayout& material_descriptor_set_layout);
+	/**
+	* Every material of the model for bindless drawing, a storage buffer of std430 { int albedo_map_index; int normal_map_index; }
+	* indexed by VMeshPart::material_index, the map indices are into getTextures() and -1 for none
+	*/
+	VBufferSection getMaterialBufferSection() const
+	{
+		return material_buffer_section;
+	}
+
+	std::vector<vk::ImageView> getTextures() const;
+
+	/**
+	* The vertices and indices of every mesh part, bound once and drawn with VMeshPart::first_index and vertex_offset
+	*/
+	VBufferSection getVertexBufferSection() const
+	{
+		return vertex_buffer_section;
+	}
+
+	VBufferSection getIndexBufferSection() const
+	{
+		return index_buffer_section;
+	}
+
+	/**
+	* A VkDrawIndexedIndirectCommand for every mesh part in the order of getMeshParts(), drawing it with its material as the first instance.
+	* Also a storage buffer, GPU culling copies the commands of the visible parts out of it
+	*/
+	VBufferSection getDrawCommandBufferSection() const
+	{
+		return draw_command_buffer_section;
+	}
+
+	/**
+	* A uint32_t holding the mesh part count, for vkCmdDrawIndexedIndirectCount
+	*/
+	VBufferSection getDrawCountBufferSection() const
+	{
+		return draw_count_buffer_section;
+	}
+
+	/**
+	* The bounds of every mesh part in the order of getMeshParts() for culling on the GPU,
+	* a storage buffer of std430 { vec4 bounds_min; vec4 bounds_max; } in object space
+	*/
+	VBufferSection getBoundsBufferSection() const
+	{
+		return bounds_buffer_section;
+	}
+
+	/**
+	* The data is uploaded through transfer_queue and the call returns without waiting for it,
+	* wait for getUploadValue() and acquire the uploads before drawing the model.
+	* The materials can be read bindless through getMaterialBufferSection() right away,
+	* drawing with a descriptor set per material needs createMaterialDescriptorSets() first
+	*/
+	static VModel loadModelFromFile(const VContext& vulkan_context, const std::string& path, VTransferQueue& transfer_queue);
+
+	/**
+	* A grid of part_count cubes spread over the floor of the box from min_pos to max_pos, for stressing the per part costs.
+	* Every cube is a mesh part of its own with its own vertex and index range, they share one untextured material.
+	* Uploaded like loadModelFromFile()
+	*/
+	static VModel createSyntheticModel(const VContext& vulkan_context, size_t part_count, glm::vec3 min_pos, glm::vec3 max_pos
+		, VTransferQueue& transfer_queue);
+
+	/**
+	* Give every mesh part the material descriptor set of its material, of material_descriptor_set_layout from descriptor_pool.
+	* The material uniforms are uploaded through transfer_queue, getUploadValue() covers them afterwards
+	*/
+	void createMaterialDescriptorSets(const VContext& vulkan_context, const vk::Sampler& texture_sampler, const vk::DescriptorPool& descriptor_pool
+		, const vk::DescriptorSetLayout& material_descriptor_set_layout, VTransferQueue& transfer_queue);
+
+	// the transfer queue value after which every upload of the model is done
+	uint64_t getUploadValue() const
+	{
+		return upload_value;
+	}
 
 	VModel(const VModel&) = delete;
 	VModel& operator= (const VModel&) = delete;
@@ -80,13 +172,29 @@ public:
 private:
 	VRaii<VkBuffer> buffer;
 	VRaii<VkDeviceMemory> buffer_memory;
+	VBufferSection vertex_buffer_section;
+	VBufferSection index_buffer_section;
+	VRaii<VkBuffer> draw_command_buffer;
+	VRaii<VkDeviceMemory> draw_command_buffer_memory;
+	VBufferSection draw_command_buffer_section;
+	VBufferSection draw_count_buffer_section;
+	VRaii<VkBuffer> bounds_buffer;
+	VRaii<VkDeviceMemory> bounds_buffer_memory;
+	VBufferSection bounds_buffer_section;
 	std::vector<VRaii<VkImage>> images;
 	std::vector<VRaii<VkImageView>> imageviews;
 	std::vector<VRaii<VkDeviceMemory>> image_memories; //TODO: use a single memory, or two
 	VRaii<VkBuffer> uniform_buffer;
 	VRaii<VkDeviceMemory> uniform_buffer_memory;
+	VRaii<VkBuffer> material_buffer;
+	VRaii<VkDeviceMemory> material_buffer_memory;
+	VBufferSection material_buffer_section;
 
 	std::vector<VMeshPart> mesh_parts;
+	uint64_t upload_value = 0;
+
+	void createDrawCommandBuffer(VUtility& vulkan_utility, VTransferQueue& transfer_queue);
+	void createBoundsBuffer(VUtility& vulkan_utility, VTransferQueue& transfer_queue);
 
 };
 
@@ -0,0 +1,58 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "thread_command_pools.h"
+
+#include "context.h"
+
+VThreadCommandPools::VThreadCommandPools(const VContext& context, uint32_t frame_count, size_t thread_count)
+	: device(context.getDevice())
+	, thread_count(thread_count)
+	, pools(frame_count * thread_count)
+{
+	// the pools are only ever reset as a whole, so the command buffers don't need to be resettable one by one
+	vk::CommandPoolCreateInfo pool_info = {
+		vk::CommandPoolCreateFlagBits::eTransient,
+		static_cast<uint32_t>(context.getQueueFamilyIndices().graphics_family)
+	};
+	for (auto& thread_pool : pools)
+	{
+		thread_pool.pool = device.createCommandPool(pool_info, nullptr);
+	}
+}
+
+VThreadCommandPools::~VThreadCommandPools()
+{
+	for (auto& thread_pool : pools)
+	{
+		device.destroyCommandPool(thread_pool.pool, nullptr); // frees its command buffers too
+	}
+}
+
+void VThreadCommandPools::beginFrame(uint32_t frame)
+{
+	for (size_t thread = 0; thread < thread_count; thread++)
+	{
+		auto& thread_pool = getPool(frame, thread);
+		if (thread_pool.used > 0)
+		{
+			device.resetCommandPool(thread_pool.pool, vk::CommandPoolResetFlags());
+			thread_pool.used = 0;
+		}
+	}
+}
+
+vk::CommandBuffer VThreadCommandPools::allocateSecondary(uint32_t frame, size_t thread_index)
+{
+	auto& thread_pool = getPool(frame, thread_index);
+	if (thread_pool.used == thread_pool.command_buffers.size())
+	{
+		vk::CommandBufferAllocateInfo alloc_info = {
+			thread_pool.pool, // command pool
+			vk::CommandBufferLevel::eSecondary, // level
+			1 // commandBufferCount
+		};
+		thread_pool.command_buffers.push_back(device.allocateCommandBuffers(alloc_info)[0]);
+	}
+	return thread_pool.command_buffers[thread_pool.used++];
+}
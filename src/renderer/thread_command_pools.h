@@ -0,0 +1,65 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vulkan/vulkan.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class VContext;
+
+/**
+* A graphics command pool for every recording thread of every frame in flight, handing out secondary command buffers.
+* A thread only allocates from its own pool, so threads record in parallel without locking.
+* beginFrame() resets every pool of the frame at once and the command buffers allocated there are reused,
+* the caller must make sure the GPU is done with the frame first.
+* Must be destructed before the vk::Device used to construct it
+*/
+class VThreadCommandPools
+{
+public:
+	VThreadCommandPools(const VContext& context, uint32_t frame_count, size_t thread_count);
+	~VThreadCommandPools();
+
+	VThreadCommandPools(VThreadCommandPools&&) = delete;
+	VThreadCommandPools& operator= (VThreadCommandPools&&) = delete;
+	VThreadCommandPools(const VThreadCommandPools&) = delete;
+	VThreadCommandPools& operator= (const VThreadCommandPools&) = delete;
+
+	/**
+	* Reset the pools of the frame, the secondary command buffers allocated from them before can be handed out again
+	*/
+	void beginFrame(uint32_t frame);
+
+	/**
+	* A secondary command buffer from the pool of the thread in the frame, valid until the next beginFrame() of that frame.
+	* Only call it from the thread the index belongs to
+	*/
+	vk::CommandBuffer allocateSecondary(uint32_t frame, size_t thread_index);
+
+	size_t getThreadCount() const
+	{
+		return thread_count;
+	}
+
+private:
+	struct ThreadCommandPool
+	{
+		vk::CommandPool pool;
+		std::vector<vk::CommandBuffer> command_buffers;
+		size_t used = 0; // command buffers handed out since the last reset
+	};
+
+	ThreadCommandPool& getPool(uint32_t frame, size_t thread_index)
+	{
+		return pools[frame * thread_count + thread_index];
+	}
+
+	vk::Device device;
+	size_t thread_count = 0;
+	std::vector<ThreadCommandPool> pools; // frame by frame, then thread by thread
+};
@@ -0,0 +1,480 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "transfer_queue.h"
+
+#include "context.h"
+#include "vulkan_util.h"
+
+#include <cstring>
+#include <limits>
+
+namespace
+{
+	// the smallest staging block, most textures and mesh groups fit in one
+	const vk::DeviceSize STAGING_BLOCK_SIZE = 8 * 1024 * 1024;
+	const vk::DeviceSize MAX_FREE_BLOCK_BYTES = 128 * 1024 * 1024; // kept for reuse over all size classes
+	const vk::DeviceSize STAGING_ALIGNMENT = 16; // covers the texel size of every format copied to images
+
+	// the smallest size class with blocks of at least size bytes, class_count if none is big enough
+	size_t stagingSizeClass(vk::DeviceSize size, size_t class_count)
+	{
+		size_t size_class = 0;
+		while (size_class < class_count && (STAGING_BLOCK_SIZE << size_class) < size)
+		{
+			size_class++;
+		}
+		return size_class;
+	}
+}
+
+VTransferQueue::VTransferQueue(const VContext& context)
+	: context(&context)
+	, device(context.getDevice())
+	, transfer_queue(context.getTransferQueue())
+	, graphics_queue(context.getGraphicsQueue())
+	, transfer_command_pool(context.getTransferCommandPool())
+	, graphics_command_pool(context.getGraphicsCommandPool())
+	, transfer_family(static_cast<uint32_t>(context.getQueueFamilyIndices().transfer_family))
+	, graphics_family(static_cast<uint32_t>(context.getQueueFamilyIndices().graphics_family))
+	, separate_family(context.hasSeparateTransferFamily())
+	, use_timeline(context.supportsTimelineSemaphores())
+{
+	if (use_timeline)
+	{
+		VkSemaphoreTypeCreateInfoKHR type_info = {};
+		type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+		type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+		type_info.initialValue = 0;
+
+		VkSemaphoreCreateInfo semaphore_info = {};
+		semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphore_info.pNext = &type_info;
+
+		VkSemaphore semaphore;
+		vulkan_util::checkResult(vkCreateSemaphore(static_cast<VkDevice>(device), &semaphore_info, nullptr, &semaphore), "Failed to create timeline semaphore!");
+		timeline = VRaii<vk::Semaphore>(
+			vk::Semaphore(semaphore),
+			[device = device](auto& obj)
+			{
+				device.destroySemaphore(obj);
+			}
+		);
+	}
+}
+
+VTransferQueue::~VTransferQueue()
+{
+	if (recording)
+	{
+		submit();
+	}
+	if (!batches.empty())
+	{
+		wait(batches.back().value);
+	}
+	for (auto& acquire : acquires)
+	{
+		vk::Fence fence = acquire.fence.get();
+		device.waitForFences(1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+		device.freeCommandBuffers(graphics_command_pool, 1, &acquire.command);
+	}
+	for (auto& batch : batches)
+	{
+		device.freeCommandBuffers(transfer_command_pool, 1, &batch.command);
+	}
+}
+
+VRaii<vk::Fence> VTransferQueue::createFence()
+{
+	return VRaii<vk::Fence>(
+		device.createFence({}, nullptr),
+		[device = device](auto& obj)
+		{
+			device.destroyFence(obj);
+		}
+	);
+}
+
+VTransferQueue::Batch& VTransferQueue::recordingBatch()
+{
+	if (recording)
+	{
+		return batches.back();
+	}
+
+	batches.emplace_back();
+	auto& batch = batches.back();
+	batch.value = next_value;
+
+	vk::CommandBufferAllocateInfo alloc_info = {};
+	alloc_info.commandPool = transfer_command_pool;
+	alloc_info.level = vk::CommandBufferLevel::ePrimary;
+	alloc_info.commandBufferCount = 1;
+	batch.command = device.allocateCommandBuffers(alloc_info)[0];
+	batch.command.begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+
+	recording = true;
+	return batch;
+}
+
+std::tuple<vk::Buffer, vk::DeviceSize> VTransferQueue::stage(const void* data, vk::DeviceSize size)
+{
+	auto& batch = recordingBatch();
+
+	auto fits = [size](const StagingBlock& block)
+	{
+		return (block.head + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT * STAGING_ALIGNMENT + size <= block.size;
+	};
+
+	if (batch.staging_blocks.empty() || !fits(batch.staging_blocks.back()))
+	{
+		auto size_class = stagingSizeClass(size, STAGING_SIZE_CLASS_COUNT);
+		if (size_class < STAGING_SIZE_CLASS_COUNT && !free_blocks[size_class].empty())
+		{
+			batch.staging_blocks.push_back(std::move(free_blocks[size_class].back()));
+			free_blocks[size_class].pop_back();
+			free_block_bytes -= batch.staging_blocks.back().size;
+			batch.staging_blocks.back().head = 0;
+		}
+		else
+		{
+			VUtility vulkan_utility{ *context };
+
+			StagingBlock block;
+			block.size = size_class < STAGING_SIZE_CLASS_COUNT ? STAGING_BLOCK_SIZE << size_class : size;
+			std::tie(block.buffer, block.memory) = vulkan_utility.createBuffer(block.size
+				, VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+				, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+			// mapped for as long as the block lives, freeing the memory unmaps it
+			void* mapped;
+			vulkan_util::checkResult(vkMapMemory(static_cast<VkDevice>(device), block.memory.get(), 0, block.size, 0, &mapped), "Failed to map staging block!");
+			block.mapped = static_cast<char*>(mapped);
+			batch.staging_blocks.push_back(std::move(block));
+			staging_block_allocations++;
+		}
+	}
+
+	auto& block = batch.staging_blocks.back();
+	auto offset = (block.head + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT * STAGING_ALIGNMENT;
+	memcpy(block.mapped + offset, data, static_cast<size_t>(size));
+	block.head = offset + size;
+	pending_bytes += size;
+
+	return std::make_tuple(vk::Buffer(block.buffer.get()), offset);
+}
+
+void VTransferQueue::uploadBuffer(vk::Buffer dst, vk::DeviceSize dst_offset, const void* data, vk::DeviceSize size
+	, vk::PipelineStageFlags dst_stages, vk::AccessFlags dst_access)
+{
+	vk::Buffer staging_buffer;
+	vk::DeviceSize staging_offset;
+	std::tie(staging_buffer, staging_offset) = stage(data, size);
+
+	auto& batch = recordingBatch();
+	vk::BufferCopy copy_region = { staging_offset, dst_offset, size };
+	batch.command.copyBuffer(staging_buffer, dst, 1, &copy_region);
+
+	vk::BufferMemoryBarrier barrier = {};
+	barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+	barrier.dstAccessMask = dst_access;
+	barrier.srcQueueFamilyIndex = separate_family ? transfer_family : VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = separate_family ? graphics_family : VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = dst;
+	barrier.offset = dst_offset;
+	barrier.size = size;
+	batch.buffer_barriers.push_back(barrier);
+	batch.dst_stages |= dst_stages;
+}
+
+void VTransferQueue::uploadImage(vk::Image dst_image, uint32_t width, uint32_t height, const void* pixels, vk::DeviceSize size)
+{
+	vk::Buffer staging_buffer;
+	vk::DeviceSize staging_offset;
+	std::tie(staging_buffer, staging_offset) = stage(pixels, size);
+
+	auto& batch = recordingBatch();
+
+	vk::ImageSubresourceRange subresource_range = { vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 };
+
+	// the old content is thrown away
+	vk::ImageMemoryBarrier to_transfer_dst = {};
+	to_transfer_dst.srcAccessMask = {};
+	to_transfer_dst.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+	to_transfer_dst.oldLayout = vk::ImageLayout::eUndefined;
+	to_transfer_dst.newLayout = vk::ImageLayout::eTransferDstOptimal;
+	to_transfer_dst.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	to_transfer_dst.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	to_transfer_dst.image = dst_image;
+	to_transfer_dst.subresourceRange = subresource_range;
+	batch.command.pipelineBarrier(
+		vk::PipelineStageFlagBits::eTopOfPipe,
+		vk::PipelineStageFlagBits::eTransfer,
+		vk::DependencyFlags(),
+		0, nullptr,
+		0, nullptr,
+		1, &to_transfer_dst
+	);
+
+	vk::BufferImageCopy region = {};
+	region.bufferOffset = staging_offset;
+	region.bufferRowLength = 0; // tightly packed
+	region.bufferImageHeight = 0;
+	region.imageSubresource = { vk::ImageAspectFlagBits::eColor, 0, 0, 1 };
+	region.imageOffset = vk::Offset3D(0, 0, 0);
+	region.imageExtent = vk::Extent3D(width, height, 1);
+	batch.command.copyBufferToImage(staging_buffer, dst_image, vk::ImageLayout::eTransferDstOptimal, 1, &region);
+
+	// the layout change is part of the ownership transfer, so the acquire repeats it
+	vk::ImageMemoryBarrier to_shader_read = {};
+	to_shader_read.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+	to_shader_read.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+	to_shader_read.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+	to_shader_read.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+	to_shader_read.srcQueueFamilyIndex = separate_family ? transfer_family : VK_QUEUE_FAMILY_IGNORED;
+	to_shader_read.dstQueueFamilyIndex = separate_family ? graphics_family : VK_QUEUE_FAMILY_IGNORED;
+	to_shader_read.image = dst_image;
+	to_shader_read.subresourceRange = subresource_range;
+	batch.image_barriers.push_back(to_shader_read);
+	batch.dst_stages |= vk::PipelineStageFlagBits::eFragmentShader;
+}
+
+uint64_t VTransferQueue::submit()
+{
+	if (!recording)
+	{
+		return next_value - 1;
+	}
+
+	auto& batch = batches.back();
+	if (separate_family)
+	{
+		// release, the destination access only matters on the acquiring queue
+		auto buffer_barriers = batch.buffer_barriers;
+		auto image_barriers = batch.image_barriers;
+		for (auto& barrier : buffer_barriers)
+		{
+			barrier.dstAccessMask = {};
+		}
+		for (auto& barrier : image_barriers)
+		{
+			barrier.dstAccessMask = {};
+		}
+		batch.command.pipelineBarrier(
+			vk::PipelineStageFlagBits::eTransfer,
+			vk::PipelineStageFlagBits::eBottomOfPipe,
+			vk::DependencyFlags(),
+			0, nullptr,
+			static_cast<uint32_t>(buffer_barriers.size()), buffer_barriers.data(),
+			static_cast<uint32_t>(image_barriers.size()), image_barriers.data()
+		);
+	}
+	else
+	{
+		batch.command.pipelineBarrier(
+			vk::PipelineStageFlagBits::eTransfer,
+			batch.dst_stages,
+			vk::DependencyFlags(),
+			0, nullptr,
+			static_cast<uint32_t>(batch.buffer_barriers.size()), batch.buffer_barriers.data(),
+			static_cast<uint32_t>(batch.image_barriers.size()), batch.image_barriers.data()
+		);
+		batch.acquired = true; // nothing to acquire on the same queue
+	}
+	batch.command.end();
+
+	VkCommandBuffer command_buffers[] = { static_cast<VkCommandBuffer>(batch.command) };
+	VkSubmitInfo submit_info = {};
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = command_buffers;
+
+	VkFence fence = VK_NULL_HANDLE;
+	VkSemaphore signal_semaphores[] = { static_cast<VkSemaphore>(timeline.get()) };
+	VkTimelineSemaphoreSubmitInfoKHR timeline_info = {};
+	if (use_timeline)
+	{
+		timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+		timeline_info.signalSemaphoreValueCount = 1;
+		timeline_info.pSignalSemaphoreValues = &batch.value;
+		submit_info.pNext = &timeline_info;
+		submit_info.signalSemaphoreCount = 1;
+		submit_info.pSignalSemaphores = signal_semaphores;
+	}
+	else
+	{
+		batch.fence = createFence();
+		fence = static_cast<VkFence>(batch.fence.get());
+	}
+	vulkan_util::checkResult(vkQueueSubmit(static_cast<VkQueue>(transfer_queue), 1, &submit_info, fence), "Failed to submit uploads!");
+
+	next_value++;
+	recording = false;
+	pending_bytes = 0;
+	return batch.value;
+}
+
+void VTransferQueue::collect()
+{
+	if (use_timeline)
+	{
+		completed_value = context->getSemaphoreCounterValue(timeline.get());
+	}
+	else
+	{
+		for (auto& batch : batches)
+		{
+			if (batch.value <= completed_value)
+			{
+				continue;
+			}
+			if (!batch.fence.get() || device.getFenceStatus(batch.fence.get()) != vk::Result::eSuccess)
+			{
+				break;
+			}
+			completed_value = batch.value;
+		}
+	}
+
+	// a finished batch is kept until its resources are acquired, it holds the barriers for that
+	while (!batches.empty() && batches.front().value <= completed_value && batches.front().acquired)
+	{
+		auto& batch = batches.front();
+		device.freeCommandBuffers(transfer_command_pool, 1, &batch.command);
+		for (auto& block : batch.staging_blocks)
+		{
+			auto size_class = stagingSizeClass(block.size, STAGING_SIZE_CLASS_COUNT);
+			if (size_class < STAGING_SIZE_CLASS_COUNT && free_block_bytes + block.size <= MAX_FREE_BLOCK_BYTES)
+			{
+				free_block_bytes += block.size;
+				free_blocks[size_class].push_back(std::move(block));
+			}
+		}
+		batches.pop_front();
+	}
+
+	while (!acquires.empty() && device.getFenceStatus(acquires.front().fence.get()) == vk::Result::eSuccess)
+	{
+		device.freeCommandBuffers(graphics_command_pool, 1, &acquires.front().command);
+		acquires.pop_front();
+	}
+}
+
+bool VTransferQueue::isComplete(uint64_t value)
+{
+	collect();
+	return completed_value >= value;
+}
+
+void VTransferQueue::wait(uint64_t value)
+{
+	if (recording && value >= batches.back().value)
+	{
+		submit();
+	}
+
+	if (use_timeline)
+	{
+		context->waitSemaphore(timeline.get(), value);
+	}
+	else
+	{
+		for (auto& batch : batches)
+		{
+			if (batch.value > value)
+			{
+				break;
+			}
+			if (batch.fence.get())
+			{
+				vk::Fence fence = batch.fence.get();
+				device.waitForFences(1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+			}
+		}
+	}
+	collect();
+}
+
+void VTransferQueue::acquireCompleted()
+{
+	collect();
+	if (!separate_family)
+	{
+		return;
+	}
+
+	std::vector<vk::BufferMemoryBarrier> buffer_barriers;
+	std::vector<vk::ImageMemoryBarrier> image_barriers;
+	vk::PipelineStageFlags dst_stages = {};
+	uint64_t wait_value = 0;
+	for (auto& batch : batches)
+	{
+		if (batch.value > completed_value)
+		{
+			break;
+		}
+		if (batch.acquired)
+		{
+			continue;
+		}
+		for (auto barrier : batch.buffer_barriers)
+		{
+			barrier.srcAccessMask = {}; // the source access only matters on the releasing queue
+			buffer_barriers.push_back(barrier);
+		}
+		for (auto barrier : batch.image_barriers)
+		{
+			barrier.srcAccessMask = {};
+			image_barriers.push_back(barrier);
+		}
+		dst_stages |= batch.dst_stages;
+		wait_value = batch.value;
+		batch.acquired = true;
+	}
+	if (wait_value == 0)
+	{
+		return;
+	}
+
+	Acquire acquire;
+	vk::CommandBufferAllocateInfo alloc_info = {};
+	alloc_info.commandPool = graphics_command_pool;
+	alloc_info.level = vk::CommandBufferLevel::ePrimary;
+	alloc_info.commandBufferCount = 1;
+	acquire.command = device.allocateCommandBuffers(alloc_info)[0];
+	acquire.command.begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+	acquire.command.pipelineBarrier(
+		vk::PipelineStageFlagBits::eTopOfPipe,
+		dst_stages,
+		vk::DependencyFlags(),
+		0, nullptr,
+		static_cast<uint32_t>(buffer_barriers.size()), buffer_barriers.data(),
+		static_cast<uint32_t>(image_barriers.size()), image_barriers.data()
+	);
+	acquire.command.end();
+
+	// the batches are done already, the wait just orders the release before the acquire for the validation layers
+	VkSemaphore wait_semaphores[] = { static_cast<VkSemaphore>(timeline.get()) };
+	VkPipelineStageFlags wait_stages[] = { VK_PIPELINE_STAGE_ALL_COMMANDS_BIT };
+	VkTimelineSemaphoreSubmitInfoKHR timeline_info = {};
+	timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+	timeline_info.waitSemaphoreValueCount = 1;
+	timeline_info.pWaitSemaphoreValues = &wait_value;
+
+	VkCommandBuffer command_buffers[] = { static_cast<VkCommandBuffer>(acquire.command) };
+	VkSubmitInfo submit_info = {};
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.pNext = &timeline_info;
+	submit_info.waitSemaphoreCount = 1;
+	submit_info.pWaitSemaphores = wait_semaphores;
+	submit_info.pWaitDstStageMask = wait_stages;
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = command_buffers;
+
+	acquire.fence = createFence();
+	vulkan_util::checkResult(vkQueueSubmit(static_cast<VkQueue>(graphics_queue), 1, &submit_info, static_cast<VkFence>(acquire.fence.get())), "Failed to submit upload acquires!");
+	acquires.push_back(std::move(acquire));
+
+	collect();
+}
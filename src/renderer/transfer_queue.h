@@ -0,0 +1,147 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include "raii.h"
+
+#include <vulkan/vulkan.h>
+#include <vulkan/vulkan.hpp>
+
+#include <deque>
+#include <tuple>
+#include <vector>
+
+class VContext;
+
+/**
+* Uploads buffer and image data on the transfer queue of the context without blocking the caller.
+* Uploads are recorded into a batch, submit() sends the batch off and returns the value that marks it done.
+* When the transfer queue has its own family, the uploaded resources are released to the graphics family
+* and acquireCompleted() acquires the finished ones on the graphics queue, so call it before drawing with them.
+* Staging memory is kept until the batch is done.
+* Must be destructed before the vk::Device used to construct it
+*/
+class VTransferQueue
+{
+public:
+	explicit VTransferQueue(const VContext& context);
+	~VTransferQueue(); // waits for the uploads in flight
+
+	VTransferQueue(VTransferQueue&&) = delete;
+	VTransferQueue& operator= (VTransferQueue&&) = delete;
+	VTransferQueue(const VTransferQueue&) = delete;
+	VTransferQueue& operator= (const VTransferQueue&) = delete;
+
+	/**
+	* Copy size bytes of data into dst at dst_offset, data can be freed once this returns.
+	* dst_stages and dst_access are where the graphics queue reads the data afterwards
+	*/
+	void uploadBuffer(vk::Buffer dst, vk::DeviceSize dst_offset, const void* data, vk::DeviceSize size
+		, vk::PipelineStageFlags dst_stages, vk::AccessFlags dst_access);
+
+	/**
+	* Fill a whole RGBA8 image created with TRANSFER_DST usage, it ends up in SHADER_READ_ONLY_OPTIMAL for the fragment shader
+	*/
+	void uploadImage(vk::Image dst_image, uint32_t width, uint32_t height, const void* pixels, vk::DeviceSize size);
+
+	/**
+	* Submit the uploads recorded so far, returns the value which isComplete() and wait() take.
+	* Returns the value of the last batch if nothing was recorded since
+	*/
+	uint64_t submit();
+
+	bool isComplete(uint64_t value);
+
+	/**
+	* Block until the batch of the value is done, submits it first if it is still being recorded
+	*/
+	void wait(uint64_t value);
+
+	/**
+	* Queue the ownership acquires of every finished batch on the graphics queue, a no op when uploads run on the graphics queue.
+	* Graphics work submitted afterwards can use the uploaded resources
+	*/
+	void acquireCompleted();
+
+	/**
+	* Bytes recorded into the batch which hasn't been submitted yet
+	*/
+	vk::DeviceSize getPendingBytes() const
+	{
+		return pending_bytes;
+	}
+
+	/**
+	* Staging blocks allocated so far, the others were reused from finished batches
+	*/
+	uint64_t getStagingBlockAllocations() const
+	{
+		return staging_block_allocations;
+	}
+
+private:
+	// staging blocks come in sizes of the smallest block times a power of two, so finished ones can be reused for
+	// uploads of about their size, uploads bigger than the largest class get a block of their own which isn't kept
+	static const size_t STAGING_SIZE_CLASS_COUNT = 5;
+
+	struct StagingBlock
+	{
+		VRaii<VkBuffer> buffer;
+		VRaii<VkDeviceMemory> memory;
+		char* mapped = nullptr;
+		vk::DeviceSize size = 0;
+		vk::DeviceSize head = 0;
+	};
+
+	struct Batch
+	{
+		uint64_t value = 0;
+		vk::CommandBuffer command = {};
+		VRaii<vk::Fence> fence; // only without timeline semaphores
+		std::vector<StagingBlock> staging_blocks;
+
+		// recorded as release barriers on the transfer queue and again as acquire barriers on the graphics queue,
+		// or as plain barriers when both are the same queue
+		std::vector<vk::BufferMemoryBarrier> buffer_barriers;
+		std::vector<vk::ImageMemoryBarrier> image_barriers;
+		vk::PipelineStageFlags dst_stages = {};
+		bool acquired = false;
+	};
+
+	struct Acquire
+	{
+		vk::CommandBuffer command = {};
+		VRaii<vk::Fence> fence;
+	};
+
+	Batch& recordingBatch();
+	// staging memory for size bytes in the recording batch, returns the buffer and offset to copy from
+	std::tuple<vk::Buffer, vk::DeviceSize> stage(const void* data, vk::DeviceSize size);
+	// pop the finished batches and acquires off the front of their queues
+	void collect();
+	VRaii<vk::Fence> createFence();
+
+	const VContext* context;
+	vk::Device device;
+	vk::Queue transfer_queue;
+	vk::Queue graphics_queue;
+	vk::CommandPool transfer_command_pool;
+	vk::CommandPool graphics_command_pool;
+	uint32_t transfer_family = 0;
+	uint32_t graphics_family = 0;
+	bool separate_family = false;
+	bool use_timeline = false;
+
+	VRaii<vk::Semaphore> timeline; // its value is the value of the last finished batch
+	uint64_t next_value = 1;
+	uint64_t completed_value = 0;
+
+	std::deque<Batch> batches; // submitted batches in order, the last one may still be recording
+	bool recording = false;
+	vk::DeviceSize pending_bytes = 0;
+	std::deque<Acquire> acquires;
+	std::vector<StagingBlock> free_blocks[STAGING_SIZE_CLASS_COUNT]; // blocks of finished batches by size class, reused
+	vk::DeviceSize free_block_bytes = 0;
+	uint64_t staging_block_allocations = 0;
+};
@@ -0,0 +1,130 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "upload_ring.h"
+
+#include "context.h"
+#include "vulkan_util.h"
+
+#include <algorithm>
+#include <array>
+#include <tuple>
+
+VUploadRing::VUploadRing(const VContext& context, vk::DeviceSize frame_region_size, uint32_t frame_count, VkBufferUsageFlags usage)
+	: context(&context)
+	, usage(usage)
+	, frame_count(frame_count)
+{
+	alignment = getAlignment(context);
+	this->frame_region_size = align(frame_region_size);
+
+	createRingBuffer();
+}
+
+/**
+* Create and map the buffer holding every frame region, at the current frame region size
+*/
+void VUploadRing::createRingBuffer()
+{
+	VUtility vulkan_utility{ *context };
+
+	auto buffer_size = frame_region_size * frame_count;
+
+	// read by the graphics queue and by light culling on the compute queue
+	auto graphics_family = context->getQueueFamilyIndices().graphics_family;
+	auto compute_family = context->getQueueFamilyIndices().compute_family;
+
+	// only the memory types a buffer like this one can be bound to count, a probe buffer with the same parameters tells which
+	std::array<uint32_t, 2> families = { static_cast<uint32_t>(graphics_family), static_cast<uint32_t>(compute_family) };
+	bool concurrent = graphics_family >= 0 && compute_family >= 0 && graphics_family != compute_family; // as createBuffer() decides
+	vk::BufferCreateInfo probe_info = {
+		vk::BufferCreateFlags(), // flags
+		buffer_size, // size
+		vk::BufferUsageFlags(usage), // usage
+		concurrent ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive, // sharingMode
+		concurrent ? static_cast<uint32_t>(families.size()) : 0, // queueFamilyIndexCount
+		concurrent ? families.data() : nullptr // pQueueFamilyIndices
+	};
+	auto device = context->getDevice();
+	auto probe = device.createBuffer(probe_info, nullptr);
+	auto memory_type_bits = device.getBufferMemoryRequirements(probe).memoryTypeBits;
+	device.destroyBuffer(probe, nullptr);
+
+	// device local memory that the host can see (resizable BAR, integrated GPUs) saves the GPU from reading over the bus
+	VkMemoryPropertyFlags host_visible = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	VkMemoryPropertyFlags device_local_host_visible = host_visible | VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	auto memory_properties = context->getPhysicalDevice().getMemoryProperties();
+	device_local = false;
+	for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++)
+	{
+		bool type_supported = (memory_type_bits & (1u << i)) != 0;
+		if (type_supported && (static_cast<VkMemoryPropertyFlags>(memory_properties.memoryTypes[i].propertyFlags) & device_local_host_visible) == device_local_host_visible)
+		{
+			device_local = true;
+			break;
+		}
+	}
+
+	std::tie(buffer, buffer_memory) = vulkan_utility.createBuffer(buffer_size, usage
+		, device_local ? device_local_host_visible : host_visible, graphics_family, compute_family);
+
+	void* data;
+	vulkan_util::checkResult(vkMapMemory(static_cast<VkDevice>(context->getDevice()), buffer_memory.get(), 0, buffer_size, 0, &data), "Failed to map upload ring!");
+	mapped = static_cast<char*>(data);
+}
+
+vk::DeviceSize VUploadRing::getAlignment(const VContext& context)
+{
+	// dynamic offsets of both uniform and storage buffers have to respect these
+	const auto& limits = context.getPhysicalDeviceProperties().limits;
+	return std::max<vk::DeviceSize>({ 16, limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment });
+}
+
+void VUploadRing::beginFrame(uint32_t frame_index)
+{
+	current_frame = frame_index % frame_count;
+	current_head = 0;
+
+	// the GPU is done with this frame region, once that held for every region since a buffer was replaced nothing reads it anymore
+	for (auto& retired : retired_buffers)
+	{
+		retired.frames_left--;
+	}
+	retired_buffers.erase(std::remove_if(retired_buffers.begin(), retired_buffers.end()
+		, [](const RetiredBuffer& retired) { return retired.frames_left == 0; }), retired_buffers.end());
+}
+
+VUploadAllocation VUploadRing::allocate(vk::DeviceSize size)
+{
+	auto aligned_size = align(size);
+	if (current_head + aligned_size > frame_region_size)
+	{
+		grow(aligned_size);
+	}
+
+	VUploadAllocation allocation;
+	allocation.buffer = buffer.get();
+	allocation.offset = getFrameOffset(current_frame) + current_head;
+	allocation.data = mapped + allocation.offset;
+	allocation.size = size;
+	current_head += aligned_size;
+	return allocation;
+}
+
+/**
+* Replace the buffer with one whose frame regions are at least twice as large and hold min_frame_region_size.
+* The old one stays mapped until every frame that may read it is done, so the allocations of this frame remain valid
+*/
+void VUploadRing::grow(vk::DeviceSize min_frame_region_size)
+{
+	RetiredBuffer retired;
+	retired.frames_left = frame_count;
+	retired.memory = std::move(buffer_memory);
+	retired.buffer = std::move(buffer);
+	retired_buffers.push_back(std::move(retired));
+
+	frame_region_size = align(std::max(frame_region_size * 2, min_frame_region_size));
+	createRingBuffer();
+	current_head = 0;
+	growth_count++;
+}
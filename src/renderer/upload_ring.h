@@ -0,0 +1,133 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include "raii.h"
+
+#include <vulkan/vulkan.h>
+#include <vulkan/vulkan.hpp>
+
+#include <vector>
+
+class VContext;
+
+/**
+* A piece of the upload ring that was handed out for this frame
+*/
+struct VUploadAllocation
+{
+	vk::Buffer buffer = {}; // the ring buffer at the time of the allocation, see VUploadRing::allocate()
+	void* data = nullptr; // persistently mapped, write to it directly
+	vk::DeviceSize offset = 0; // from the start of the ring buffer, used as dynamic offset or copy source offset
+	vk::DeviceSize size = 0;
+};
+
+/**
+* A host visible buffer which is mapped once and split into one region per frame in flight.
+* Per frame data is written into the region of the current frame and read by the GPU from there,
+* so there is no staging copy or queue wait for it.
+* The caller must make sure the GPU is done with a frame region before calling beginFrame() on it again.
+* Must be destructed before the vk::Device used to construct it
+*/
+class VUploadRing
+{
+public:
+	VUploadRing() = default;
+	VUploadRing(const VContext& context, vk::DeviceSize frame_region_size, uint32_t frame_count, VkBufferUsageFlags usage);
+	~VUploadRing() = default; // freeing the memory unmaps it
+
+	VUploadRing(VUploadRing&&) = default;
+	VUploadRing& operator= (VUploadRing&&) = default;
+	VUploadRing(const VUploadRing&) = delete;
+	VUploadRing& operator= (const VUploadRing&) = delete;
+
+	/**
+	* Start handing out memory from the region of the given frame, everything allocated there before is overwritten
+	*/
+	void beginFrame(uint32_t frame_index);
+
+	/**
+	* Allocate from the region of the current frame, aligned so that the offset can be used as a dynamic offset.
+	* When the region is full the ring grows into a new buffer, the earlier allocations stay in the old one.
+	* A ring bound through descriptor sets has to be laid out so that it never grows, see getGrowthCount()
+	*/
+	VUploadAllocation allocate(vk::DeviceSize size);
+
+	/**
+	* Alignment of every allocation, so that offsets can be used as dynamic offsets of uniform and storage buffers
+	*/
+	static vk::DeviceSize getAlignment(const VContext& context);
+
+	/**
+	* Round up to the alignment of allocations, for laying out a frame region ahead of time
+	*/
+	static vk::DeviceSize align(vk::DeviceSize size, vk::DeviceSize alignment)
+	{
+		return (size + alignment - 1) / alignment * alignment;
+	}
+
+	vk::DeviceSize align(vk::DeviceSize size) const
+	{
+		return align(size, alignment);
+	}
+
+	vk::DeviceSize getFrameOffset(uint32_t frame_index) const
+	{
+		return frame_region_size * frame_index;
+	}
+
+	vk::Buffer getBuffer() const
+	{
+		return buffer.get();
+	}
+
+	uint32_t getFrameCount() const
+	{
+		return frame_count;
+	}
+
+	uint32_t getCurrentFrame() const
+	{
+		return current_frame;
+	}
+
+	// true if the ring lives in device local memory which the host can write to (e.g. resizable BAR)
+	bool isDeviceLocal() const
+	{
+		return device_local;
+	}
+
+	// how often allocate() replaced the buffer with a larger one
+	uint32_t getGrowthCount() const
+	{
+		return growth_count;
+	}
+
+private:
+	// a buffer replaced by grow(), freed when frames_left frame regions have been begun again
+	struct RetiredBuffer
+	{
+		uint32_t frames_left = 0;
+		VRaii<VkDeviceMemory> memory;
+		VRaii<VkBuffer> buffer; // declared after the memory, so destroyed before it
+	};
+
+	const VContext* context = nullptr;
+	VkBufferUsageFlags usage = 0;
+	VRaii<VkBuffer> buffer;
+	VRaii<VkDeviceMemory> buffer_memory;
+	char* mapped = nullptr;
+	bool device_local = false;
+	std::vector<RetiredBuffer> retired_buffers;
+	uint32_t growth_count = 0;
+
+	vk::DeviceSize alignment = 1;
+	vk::DeviceSize frame_region_size = 0;
+	uint32_t frame_count = 0;
+	uint32_t current_frame = 0;
+	vk::DeviceSize current_head = 0; // next free byte in the region of the current frame
+
+	void createRingBuffer();
+	void grow(vk::DeviceSize min_frame_region_size);
+};
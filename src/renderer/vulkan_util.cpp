@@ -4,6 +4,7 @@
 #include "vulkan_util.h"
 
 #include "context.h"
+#include "transfer_queue.h"
 #include "../util.h"
 
 #include <stb_image.h>
@@ -241,7 +242,7 @@ void VUtility::copyBuffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize
 
 std::tuple<VRaii<VkImage>, VRaii<VkDeviceMemory>> VUtility::createImage(uint32_t image_width, uint32_t image_height
 	, VkFormat format, VkImageTiling tiling
-	, VkImageUsageFlags usage, VkMemoryPropertyFlags memory_properties)
+	, VkImageUsageFlags usage, VkMemoryPropertyFlags memory_properties, uint32_t mip_levels)
 {
 	VkImageCreateInfo image_info = {};
 	image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -249,7 +250,7 @@ std::tuple<VRaii<VkImage>, VRaii<VkDeviceMemory>> VUtility::createImage(uint32_t
 	image_info.extent.width = image_width;
 	image_info.extent.height = image_height;
 	image_info.extent.depth = 1;
-	image_info.mipLevels = 1;
+	image_info.mipLevels = mip_levels;
 	image_info.arrayLayers = 1;
 
 	image_info.format = format; //VK_FORMAT_R8G8B8A8_UNORM;
@@ -320,7 +321,8 @@ void VUtility::transitImageLayout(VkImage image, VkImageLayout old_layout, VkIma
 
 }
 
-void VUtility::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask, VkImageView* p_image_view)
+void VUtility::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask, VkImageView* p_image_view
+	, uint32_t base_mip_level, uint32_t mip_level_count)
 {
 	VkImageViewCreateInfo viewInfo = {};
 	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -335,8 +337,8 @@ void VUtility::createImageView(VkImage image, VkFormat format, VkImageAspectFlag
 	viewInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
 
 	viewInfo.subresourceRange.aspectMask = aspect_mask;
-	viewInfo.subresourceRange.baseMipLevel = 0;
-	viewInfo.subresourceRange.levelCount = 1;
+	viewInfo.subresourceRange.baseMipLevel = base_mip_level;
+	viewInfo.subresourceRange.levelCount = mip_level_count;
 	viewInfo.subresourceRange.baseArrayLayer = 0;
 	viewInfo.subresourceRange.layerCount = 1;
 
@@ -347,10 +349,11 @@ void VUtility::createImageView(VkImage image, VkFormat format, VkImageAspectFlag
 }
 
 
-VRaii<VkImageView> VUtility::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask)
+VRaii<VkImageView> VUtility::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask
+	, uint32_t base_mip_level, uint32_t mip_level_count)
 {
 	VkImageView img_view;
-	createImageView(image, format, aspect_mask, &img_view);
+	createImageView(image, format, aspect_mask, &img_view, base_mip_level, mip_level_count);
 	return VRaii<VkImageView>(img_view, [device = this->device](auto& obj) {device.destroyImageView(obj); });
 }
 
@@ -420,6 +423,40 @@ std::tuple<VRaii<VkImage>, VRaii<VkDeviceMemory>, VRaii<VkImageView>> VUtility::
 	return std::make_tuple(std::move(image), std::move(image_memory), std::move(image_view));
 }
 
+std::tuple<VRaii<VkImage>, VRaii<VkDeviceMemory>, VRaii<VkImageView>> VUtility::loadImageFromFile(std::string path, VTransferQueue& transfer_queue)
+{
+	int tex_width, tex_height, tex_channels;
+
+	stbi_uc * pixels = stbi_load(path.c_str()
+		, &tex_width, &tex_height
+		, &tex_channels
+		, STBI_rgb_alpha);
+
+	VkDeviceSize image_size = tex_width * tex_height * 4;
+	if (!pixels)
+	{
+		throw std::runtime_error("Failed to load image" + path);
+	}
+
+	VRaii<VkImage> image;
+	VRaii<VkDeviceMemory> image_memory;
+	std::tie(image, image_memory) = createImage(
+		tex_width, tex_height
+		, VK_FORMAT_R8G8B8A8_UNORM
+		, VK_IMAGE_TILING_OPTIMAL
+		, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+		, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+	);
+
+	// the pixels are copied into staging memory right away
+	transfer_queue.uploadImage(image.get(), tex_width, tex_height, pixels, image_size);
+	stbi_image_free(pixels);
+
+	auto image_view = createImageView(image.get(), VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
+
+	return std::make_tuple(std::move(image), std::move(image_memory), std::move(image_view));
+}
+
 // create a temperorary command buffer for one-time use
 // and begin recording
 VkCommandBuffer VUtility::beginSingleTimeCommands()
@@ -21,6 +21,7 @@ namespace vulkan_util
 }
 
 class VContext;
+class VTransferQueue;
 
 /**
 * a utility module for vulkan context
@@ -55,15 +56,19 @@ public:
 
 	std::tuple<VRaii<VkImage>, VRaii<VkDeviceMemory>> createImage(uint32_t image_width, uint32_t image_height
 		, VkFormat format, VkImageTiling tiling
-		, VkImageUsageFlags usage, VkMemoryPropertyFlags memory_properties);
+		, VkImageUsageFlags usage, VkMemoryPropertyFlags memory_properties, uint32_t mip_levels = 1);
 
 	void copyImage(VkImage src_image, VkImage dst_image, uint32_t width, uint32_t height);
 	void transitImageLayout(VkImage image, VkImageLayout old_layout, VkImageLayout new_layout);
 
-	void createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask, VkImageView* p_image_view);
-	VRaii<VkImageView> createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask);
+	void createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask, VkImageView* p_image_view
+		, uint32_t base_mip_level = 0, uint32_t mip_level_count = 1);
+	VRaii<VkImageView> createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect_mask
+		, uint32_t base_mip_level = 0, uint32_t mip_level_count = 1);
 
 	std::tuple<VRaii<VkImage>, VRaii<VkDeviceMemory>, VRaii<VkImageView>> loadImageFromFile(std::string path);
+	// uploads through the transfer queue instead of waiting for the copy, the image is usable once the batch is done and acquired
+	std::tuple<VRaii<VkImage>, VRaii<VkDeviceMemory>, VRaii<VkImageView>> loadImageFromFile(std::string path, VTransferQueue& transfer_queue);
 
 	VkCommandBuffer beginSingleTimeCommands();
 	void endSingleTimeCommands(VkCommandBuffer commandBuffer);
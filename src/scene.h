@@ -41,6 +41,22 @@ struct TestSceneConfiguration
 	int light_num;
 	glm::vec3 camera_position;
 	glm::quat camera_rotation;
+	int spot_light_num = 0;
+	float spot_light_range = 10.0f;
+	float spot_light_angle = 30.0f; // half angle of the cone in degrees
+	int max_point_light_per_tile = 1023; // light list budget of a tile, saturated tiles keep the most important lights
+	bool emulate_spot_lights = false; // upload spot lights as enclosing point lights, for comparison
+	int frames_in_flight = 2; // frames the CPU can prepare while the GPU renders earlier ones, 1 to 3
+	bool async_compute = true; // light culling on a compute queue of its own when the device has one
+	bool frame_graph = true; // without async compute, record each frame through the frame graph and submit it once
+	int synthetic_mesh_parts = 0; // > 0 draws a generated grid of this many cubes instead of model_file
+	bool bindless_materials = true; // one material descriptor set indexed per draw when the device supports descriptor indexing
+	bool indirect_draws = true; // with bindless materials, draw every mesh part through one indirect draw when the device supports it
+	bool gpu_culling = true; // with indirect draws, cull the mesh parts on the GPU against the frustum and the Hi-Z pyramid
+	bool draw_sorting = true; // draw the large mesh parts first and front to back in the depth prepass
+	bool cpu_culling = true; // without GPU culling, draw only the mesh parts in the view frustum
+	int window_width = 1920; // size the window is created with, the swap chain follows its framebuffer
+	int window_height = 1080;
 };
 
 TestSceneConfiguration& getGlobalTestSceneConfiguration();
\ No newline at end of file
@@ -2,5 +2,18 @@
 
 glslangValidator -V forwardplus.vert -o ../../content/forwardplus_vert.spv
 glslangValidator -V forwardplus.frag -o ../../content/forwardplus_frag.spv
+glslangValidator -V -DDEBUG_VIEW=1 forwardplus.frag -o ../../content/forwardplus_debug1_frag.spv
+glslangValidator -V -DDEBUG_VIEW=2 forwardplus.frag -o ../../content/forwardplus_debug2_frag.spv
+glslangValidator -V -DDEBUG_VIEW=3 forwardplus.frag -o ../../content/forwardplus_debug3_frag.spv
+glslangValidator -V -DDEBUG_VIEW=4 forwardplus.frag -o ../../content/forwardplus_debug4_frag.spv
+glslangValidator -V -DBINDLESS_MATERIALS forwardplus.frag -o ../../content/forwardplus_bindless_frag.spv
+glslangValidator -V -DBINDLESS_MATERIALS -DDEBUG_VIEW=1 forwardplus.frag -o ../../content/forwardplus_bindless_debug1_frag.spv
+glslangValidator -V -DBINDLESS_MATERIALS -DDEBUG_VIEW=2 forwardplus.frag -o ../../content/forwardplus_bindless_debug2_frag.spv
+glslangValidator -V -DBINDLESS_MATERIALS -DDEBUG_VIEW=3 forwardplus.frag -o ../../content/forwardplus_bindless_debug3_frag.spv
+glslangValidator -V -DBINDLESS_MATERIALS -DDEBUG_VIEW=4 forwardplus.frag -o ../../content/forwardplus_bindless_debug4_frag.spv
 glslangValidator -V light_culling.comp.glsl -o ../../content/light_culling_comp.spv -S comp
+glslangValidator -V --target-env vulkan1.1 -DUSE_SUBGROUP_APPEND light_culling.comp.glsl -o ../../content/light_culling_subgroup_comp.spv -S comp
+glslangValidator -V light_update.comp.glsl -o ../../content/light_update_comp.spv -S comp
+glslangValidator -V hiz_build.comp.glsl -o ../../content/hiz_build_comp.spv -S comp
+glslangValidator -V mesh_culling.comp.glsl -o ../../content/mesh_culling_comp.spv -S comp
 glslangValidator -V depth.vert -o ../../content/depth_vert.spv
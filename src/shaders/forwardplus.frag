@@ -1,7 +1,19 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#ifdef BINDLESS_MATERIALS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
 
-const int TILE_SIZE = 16;
+// set by the renderer through VkSpecializationInfo, the values here are only defaults
+layout(constant_id = 0) const int TILE_SIZE = 16;
+layout(constant_id = 1) const uint MAX_POINT_LIGHT_PER_TILE = 1023u;
+layout(constant_id = 7) const uint MAX_SPOT_LIGHT_PER_TILE = 255u;
+
+// picked at compile time so the render view carries no debug branches, see CompileShaders.sh
+// 0: render 1: heat map with render 2: heat map 3: depth 4: normal
+#ifndef DEBUG_VIEW
+#define DEBUG_VIEW 0
+#endif
 
 struct PointLight {
 	vec3 pos;
@@ -9,18 +21,19 @@ struct PointLight {
 	vec3 intensity;
 };
 
-#define MAX_POINT_LIGHT_PER_TILE 1023
-struct LightVisiblity
-{
-	uint count;
-	uint lightindices[MAX_POINT_LIGHT_PER_TILE];
+struct SpotLight {
+	vec3 pos;
+	float range;
+	vec3 direction;
+	float cos_outer_angle;
+	vec3 intensity;
+	float cos_inner_angle;
 };
 
 layout(push_constant) uniform PushConstantObject
 {
 	ivec2 viewport_size;
 	ivec2 tile_nums;
-    int debugview_index;
 } push_constants;
 
 layout(std140, set = 0, binding = 0) uniform SceneObjectUbo
@@ -39,19 +52,47 @@ layout(std140, set = 1, binding = 0) buffer readonly CameraUbo // FIXME: change
     vec3 cam_pos;
 } camera;
 
+// MAX_POINT_LIGHT_PER_TILE + 1 uints per tile: the light count followed by the light indices
 layout(std430, set = 2, binding = 0) buffer readonly TileLightVisiblities
 {
-    LightVisiblity light_visiblities[];
+    uint light_visiblities[];
 };
 
 layout(std140, set = 2, binding = 1) buffer readonly PointLights // FIXME: change back to uniform // readonly buffer PointLights
 {
 	int light_num;
-	PointLight pointlights[20000];
+	PointLight pointlights[];
+};
+
+layout(std140, set = 2, binding = 3) buffer readonly SpotLights
+{
+	int spot_light_num;
+	SpotLight spotlights[];
+};
+
+// MAX_SPOT_LIGHT_PER_TILE + 1 uints per tile: the spot light count followed by the spot light indices
+layout(std430, set = 2, binding = 4) buffer readonly TileSpotLightVisiblities
+{
+    uint spot_light_visiblities[];
 };
 
 layout(set = 3, binding = 0) uniform sampler2D depth_sampler;
 
+// bindless materials index every texture of the model through the material of the draw, see CompileShaders.sh
+#ifdef BINDLESS_MATERIALS
+struct Material {
+	int albedo_map_index; // into textures, -1 for none
+	int normal_map_index;
+};
+
+layout(std430, set = 4, binding = 0) buffer readonly Materials
+{
+	Material materials[];
+};
+
+layout(set = 4, binding = 1) uniform sampler texture_sampler;
+layout(set = 4, binding = 2) uniform texture2D textures[];
+#else
 layout(std140, set = 4, binding = 0) uniform MaterialUbo
 {
     int has_albedo_map;
@@ -60,11 +101,13 @@ layout(std140, set = 4, binding = 0) uniform MaterialUbo
 
 layout(set = 4, binding = 1) uniform sampler2D albedo_sampler;
 layout(set = 4, binding = 2) uniform sampler2D normal_sampler;
+#endif
 
 layout(location = 0) in vec3 frag_color;
 layout(location = 1) in vec2 frag_tex_coord;
 layout(location = 2) in vec3 frag_normal;
 layout(location = 3) in vec3 frag_pos_world;
+layout(location = 4) flat in int frag_material_index;
 
 layout(location = 0) out vec4 out_color;
 
@@ -82,6 +125,22 @@ vec3 applyNormalMap(vec3 geomnor, vec3 normap)
 void main()
 {
 
+#ifdef BINDLESS_MATERIALS
+    // neighbouring fragments may belong to other draws, so the material isn't dynamically uniform
+    Material material = materials[frag_material_index];
+
+    vec3 diffuse = vec3(1.0);
+    if (material.albedo_map_index >= 0)
+    {
+        diffuse = texture(sampler2D(textures[nonuniformEXT(material.albedo_map_index)], texture_sampler), frag_tex_coord).rgb;
+    }
+
+    vec3 normal = frag_normal;
+    if (material.normal_map_index >= 0)
+    {
+        normal = applyNormalMap(frag_normal, texture(sampler2D(textures[nonuniformEXT(material.normal_map_index)], texture_sampler), frag_tex_coord).rgb);
+    }
+#else
     vec3 diffuse;
     if (material.has_albedo_map > 0)
     {
@@ -101,39 +160,39 @@ void main()
     {
         normal = frag_normal;
     }
+#endif
 
     ivec2 tile_id = ivec2(gl_FragCoord.xy / TILE_SIZE);
     uint tile_index = tile_id.y * push_constants.tile_nums.x + tile_id.x;   // 第几行瓦片 x 每行瓦片数量 + 该行第几个瓦片
+    uint tile_offset = tile_index * (MAX_POINT_LIGHT_PER_TILE + 1);
+    uint spot_tile_offset = tile_index * (MAX_SPOT_LIGHT_PER_TILE + 1);
+#if DEBUG_VIEW == 1 || DEBUG_VIEW == 2
+    uint tile_total_light_num = light_visiblities[tile_offset] + spot_light_visiblities[spot_tile_offset];
+#endif
 
     // debug view
-    if (push_constants.debugview_index > 1)
-    {
-        if (push_constants.debugview_index == 2)
-        {
-			//heat map debug view
-			float intensity = float(light_visiblities[tile_index].count) / 64;
-            out_color = vec4(vec3(intensity), 1.0) ; //light culling debug
-		}
-		else if (push_constants.debugview_index == 3)
-        {
-            // depth debug view
-            float pre_depth = texture(depth_sampler, (gl_FragCoord.xy/push_constants.viewport_size) ).x;
-            out_color = vec4(vec3( pre_depth ),1.0);
-        }
-        else if (push_constants.debugview_index == 4)
-        {
-            // normal debug view
-            out_color = vec4(abs(normal), 1.0);
-        }
-        return;
-    }
+#if DEBUG_VIEW == 2
+    //heat map debug view
+    float intensity = float(tile_total_light_num) / 64;
+    out_color = vec4(vec3(intensity), 1.0) ; //light culling debug
+    return;
+#elif DEBUG_VIEW == 3
+    // depth debug view
+    float pre_depth = texture(depth_sampler, (gl_FragCoord.xy/push_constants.viewport_size) ).x;
+    out_color = vec4(vec3( pre_depth ),1.0);
+    return;
+#elif DEBUG_VIEW == 4
+    // normal debug view
+    out_color = vec4(abs(normal), 1.0);
+    return;
+#endif
 
 
     vec3 illuminance = vec3(0.0);
-    uint tile_light_num = light_visiblities[tile_index].count;
+    uint tile_light_num = light_visiblities[tile_offset];
     for (int i = 0; i < tile_light_num; i++)
 	{
-        PointLight light = pointlights[light_visiblities[tile_index].lightindices[i]];
+        PointLight light = pointlights[light_visiblities[tile_offset + 1 + i]];
 		vec3 light_dir = normalize(light.pos - frag_pos_world);
         float lambertian = max(dot(light_dir, normal), 0.0);
 
@@ -155,14 +214,39 @@ void main()
         }
 	}
 
-    //heat map with render debug view
-    if (push_constants.debugview_index == 1)
+    uint tile_spot_light_num = spot_light_visiblities[spot_tile_offset];
+    for (int i = 0; i < tile_spot_light_num; i++)
     {
-        float intensity = float(light_visiblities[tile_index].count) / (64 / 2.0);
-        out_color = vec4(vec3(intensity, intensity * 0.5, intensity * 0.5) + illuminance * 0.25, 1.0) ; //light culling debug
-        return;
+        SpotLight light = spotlights[spot_light_visiblities[spot_tile_offset + 1 + i]];
+        vec3 light_dir = normalize(light.pos - frag_pos_world);
+        float lambertian = max(dot(light_dir, normal), 0.0);
+
+        if (lambertian > 0.0)
+        {
+            float light_distance = distance(light.pos, frag_pos_world);
+            // smooth falloff between the inner and outer cone
+            float cone = smoothstep(light.cos_outer_angle, light.cos_inner_angle, dot(-light_dir, light.direction));
+            if (light_distance > light.range || cone <= 0.0)
+            {
+                continue;
+            }
+
+            vec3 viewDir = normalize(camera.cam_pos - frag_pos_world);
+            vec3 halfDir = normalize(light_dir + viewDir);
+            float spec = max(dot(halfDir, normal), 0.0);
+            float specular = pow(spec, 32.0);
+
+            float att = clamp(1.0 - light_distance * light_distance / (light.range * light.range), 0.0, 1.0);
+            illuminance += light.intensity * att * cone * (lambertian * diffuse + specular);
+        }
     }
 
+#if DEBUG_VIEW == 1
+    //heat map with render debug view
+    float intensity = float(tile_total_light_num) / (64 / 2.0);
+    out_color = vec4(vec3(intensity, intensity * 0.5, intensity * 0.5) + illuminance * 0.25, 1.0) ; //light culling debug
+#else
     // render view
     out_color = vec4(illuminance, 1.0);
+#endif
 }
@@ -23,6 +23,7 @@ layout(location = 0) out vec3 frag_color;
 layout(location = 1) out vec2 frag_tex_coord;
 layout(location = 2) out vec3 frag_normal;
 layout(location = 3) out vec3 frag_pos_world;
+layout(location = 4) flat out int frag_material_index; // every mesh part is drawn as one instance starting at its material index
 
 out gl_PerVertex
 {
@@ -43,4 +44,5 @@ void main()
     // TODO: do everything view or projection space
     frag_normal = normalize((invtransmodel * vec4(in_normal, 0.0)).xyz);    // 世界空间中顶点的法向量
     frag_pos_world = vec3(transform.model * vec4(in_position, 1.0));        // 世界空间中顶点的位置向量
+    frag_material_index = gl_InstanceIndex;
 }
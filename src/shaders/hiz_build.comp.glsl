@@ -0,0 +1,47 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Builds one level of the Hi-Z pyramid: min and max depth of the texels of the level above it,
+// or of the depth image for level 0. A level is half the size of its source, rounded down,
+// the last texel of a row or column also takes the odd texel left over, so every depth sample is covered
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(push_constant) uniform HiZPushConstants
+{
+	int source_is_depth; // the source only has depth in r, instead of min and max in rg
+} params;
+
+// read with texelFetch, the sampler doesn't filter
+layout(set = 0, binding = 0) uniform sampler2D source;
+layout(set = 0, binding = 1, rg32f) uniform writeonly image2D destination;
+
+void main()
+{
+	ivec2 dst_size = imageSize(destination);
+	ivec2 dst_coord = ivec2(gl_GlobalInvocationID.xy);
+	if (any(greaterThanEqual(dst_coord, dst_size)))
+	{
+		return;
+	}
+
+	ivec2 src_size = textureSize(source, 0);
+	ivec2 src_begin = dst_coord * 2;
+	ivec2 src_end = min(mix(src_begin + 1, src_size - 1, equal(dst_coord, dst_size - 1)), src_size - 1);
+
+	vec2 bounds = vec2(1.0, 0.0);
+	for (int y = src_begin.y; y <= src_end.y; y++)
+	{
+		for (int x = src_begin.x; x <= src_end.x; x++)
+		{
+			vec2 texel = texelFetch(source, ivec2(x, y), 0).rg;
+			if (params.source_is_depth != 0)
+			{
+				texel.g = texel.r;
+			}
+			bounds = vec2(min(bounds.x, texel.x), max(bounds.y, texel.y));
+		}
+	}
+
+	imageStore(destination, dst_coord, vec4(bounds, 0.0, 0.0));
+}
@@ -1,10 +1,34 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+// USE_SUBGROUP_APPEND is defined for the variant the renderer picks when the device supports subgroup ballot,
+// see CompileShaders.sh
+#ifdef USE_SUBGROUP_APPEND
+#extension GL_KHR_shader_subgroup_ballot : enable
+#endif
 
-// TODO: it should be better done in view space
 // TODO: 3d position based clustered shading
 
-const int TILE_SIZE = 16;
+// set by the renderer through VkSpecializationInfo, the values here are only defaults
+layout(constant_id = 0) const int TILE_SIZE = 16;
+layout(constant_id = 1) const uint MAX_POINT_LIGHT_PER_TILE = 1023u;
+layout(local_size_x_id = 3) in; // light culling workgroup size
+// sphere-vs-tile test, matches LightCullingTest in VulkanRenderer.cpp
+// 0: six frustum planes plus the 8 corner bbox rejection
+// 1: sphere vs the view space AABB of the tile
+// 2: view space AABB first, frustum planes for the lights that pass it
+layout(constant_id = 4) const int LIGHT_CULLING_TEST = 2;
+// measurement mode: count accepted lights which reach none of the depth samples of their tile
+layout(constant_id = 5) const bool LIGHT_CULLING_STATS = false;
+layout(constant_id = 7) const uint MAX_SPOT_LIGHT_PER_TILE = 255u;
+// read the depth bounds of a tile from the Hi-Z pyramid rather than from every depth sample in it
+layout(constant_id = 8) const bool HIZ_DEPTH_BOUNDS = true;
+
+// buckets of the light importance histogram used to truncate saturated tiles
+const uint IMPORTANCE_BUCKET_COUNT = 64;
+
+const int LIGHT_CULLING_TEST_FRUSTUM_PLANES = 0;
+const int LIGHT_CULLING_TEST_VIEW_AABB = 1;
+const int LIGHT_CULLING_TEST_TWO_PHASE = 2;
 
 struct PointLight {
 	vec3 pos;
@@ -12,11 +36,13 @@ struct PointLight {
 	vec3 intensity;
 };
 
-#define MAX_POINT_LIGHT_PER_TILE 1023
-struct LightVisiblity
-{
-	uint count;
-	uint lightindices[MAX_POINT_LIGHT_PER_TILE];
+struct SpotLight {
+	vec3 pos;
+	float range;
+	vec3 direction;
+	float cos_outer_angle;
+	vec3 intensity;
+	float cos_inner_angle;
 };
 
 layout(push_constant) uniform PushConstantObject
@@ -25,15 +51,40 @@ layout(push_constant) uniform PushConstantObject
 	ivec2 tile_nums;
 } push_constants;
 
-layout(std430, set = 0, binding = 0) buffer writeonly TileLightVisiblities
+// Each tile takes MAX_POINT_LIGHT_PER_TILE + 1 uints: the light count followed by the light indices.
+// It's a flat array since the stride of a runtime array can't depend on a specialization constant
+layout(std430, set = 0, binding = 0) buffer TileLightVisiblities
 {
-    LightVisiblity light_visiblities[];
+    uint light_visiblities[];
 };
 
 layout(std140, set = 0, binding = 1) buffer readonly PointLights // FIXME: change back to uniform
 {
 	int light_num;
-	PointLight pointlights[1000];
+	PointLight pointlights[]; // sized by the buffer, which grows with the light count
+};
+
+// cleared by the renderer before each dispatch and read back on the host
+layout(std430, set = 0, binding = 2) buffer LightCullingStats
+{
+	uint accepted_light_count; // sum of the per-tile light counts, only with LIGHT_CULLING_STATS
+	uint zero_contribution_light_count; // accepted lights out of range of every depth sample in their tile, only with LIGHT_CULLING_STATS
+	uint overflowed_tile_count; // tiles which had more than MAX_POINT_LIGHT_PER_TILE lights
+	uint dropped_light_count; // lights dropped from those tiles
+	uint max_tile_light_count; // most lights seen by a single tile before truncation
+	uint dropped_spot_light_count; // spot lights dropped from tiles with more than MAX_SPOT_LIGHT_PER_TILE
+} stats;
+
+layout(std140, set = 0, binding = 3) buffer readonly SpotLights
+{
+	int spot_light_num;
+	SpotLight spotlights[];
+};
+
+// MAX_SPOT_LIGHT_PER_TILE + 1 uints per tile, laid out like light_visiblities
+layout(std430, set = 0, binding = 4) buffer writeonly TileSpotLightVisiblities
+{
+	uint spot_light_visiblities[];
 };
 
 layout(std140, set = 1, binding = 0) buffer readonly CameraUbo // FIXME: change back to uniform
@@ -45,6 +96,8 @@ layout(std140, set = 1, binding = 0) buffer readonly CameraUbo // FIXME: change
 } camera;
 
 layout(set = 2, binding = 0) uniform sampler2D depth_sampler;
+// min and max depth in rg, level 0 is half the depth resolution, see hiz_build.comp.glsl
+layout(set = 2, binding = 1) uniform sampler2D hiz_pyramid;
 
 // OpenGL 的 NDC 坐标系默认是左手坐标系，其原点位于屏幕正中间，X 轴向右，Y 轴向上，Z 轴朝屏幕内。(-1,-1)在左下角。
 // Vulkan 的 NDC 坐标系默认是右手坐标系，其原点位于屏幕正中间，X 轴向右，Y 轴向下，Z 轴朝屏幕内。(-1,-1)在左上角。
@@ -62,12 +115,23 @@ struct ViewFrustum
 	vec3 points[8]; // frustum vertex array, 0-3 near 4-7 far
 };
 
-layout(local_size_x = 32) in;
-
 shared ViewFrustum frustum;
+shared vec3 tile_aabb_min; // view space
+shared vec3 tile_aabb_max;
 shared uint light_count_for_tile;
+shared uint spot_light_count_for_tile;
+// for truncating saturated tiles to the most important lights
+shared uint importance_histogram[IMPORTANCE_BUCKET_COUNT];
+shared uint max_importance_bits; // floatBitsToUint of the largest importance in the tile, the bits of non-negative floats order like the floats
+shared uint threshold_bucket; // lights in higher buckets are all kept
+shared uint above_threshold_count;
+shared uint above_threshold_cursor;
+shared uint threshold_cursor;
 shared float min_depth;
 shared float max_depth;
+// the depth bounds while the invocations reduce them, floatBitsToUint of depths in [0, 1] orders like the depths
+shared uint min_depth_bits;
+shared uint max_depth_bits;
 
 // Construct view frustum
 ViewFrustum createFrustum(ivec2 tile_id)
@@ -141,11 +205,11 @@ ViewFrustum createFrustum(ivec2 tile_id)
 	return frustum;
 }
 
-bool isCollided(PointLight light, ViewFrustum frustum)
+bool isCollidedPlanes(PointLight light, ViewFrustum frustum)
 {
 	bool result = true;
 
-    // Step1: sphere-plane test
+    // sphere-plane test
 	// 球-平面相交判断：判断球心到平面的距离是否大于球的半径，若大于则不相交，否则相交
 	// 点-平面距离：根据平面方程的海森法线形式，如果点是在平面法线指向的那一侧空间内，点面间的距离大于零；如果在另一侧那么点面距离小于零
 	for (int i = 0; i < 6; i++)
@@ -158,7 +222,13 @@ bool isCollided(PointLight light, ViewFrustum frustum)
 		}
 	}
 
-    if (!result)
+	return result;
+}
+
+bool isCollided(PointLight light, ViewFrustum frustum)
+{
+    // Step1: sphere-plane test
+    if (!isCollidedPlanes(light, frustum))
     {
         return false;
     }
@@ -177,28 +247,204 @@ bool isCollided(PointLight light, ViewFrustum frustum)
 	return true;
 }
 
+// Sphere vs view space AABB of the tile frustum. Unlike the plane test it doesn't accept
+// spheres which sit outside the corners where two planes meet, which is where most false
+// positives of long thin tiles come from
+bool isCollidedViewAABB(vec3 light_pos_view, float radius)
+{
+	vec3 d = max(vec3(0.0), max(tile_aabb_min - light_pos_view, light_pos_view - tile_aabb_max));
+	return dot(d, d) <= radius * radius;
+}
+
+bool isLightInTile(PointLight light)
+{
+	if (LIGHT_CULLING_TEST == LIGHT_CULLING_TEST_FRUSTUM_PLANES)
+	{
+		return isCollided(light, frustum);
+	}
+
+	vec3 light_pos_view = (camera.view * vec4(light.pos, 1.0)).xyz;
+	if (!isCollidedViewAABB(light_pos_view, light.radius))
+	{
+		return false;
+	}
+	return LIGHT_CULLING_TEST == LIGHT_CULLING_TEST_VIEW_AABB || isCollidedPlanes(light, frustum);
+}
+
+// Cone vs the bounding sphere of the tile AABB, in view space. The bounding sphere of the whole
+// cone would be a much bigger point light, this only keeps tiles the cone can actually reach
+bool isSpotLightInTile(SpotLight light)
+{
+	vec3 light_pos_view = (camera.view * vec4(light.pos, 1.0)).xyz;
+	if (!isCollidedViewAABB(light_pos_view, light.range))
+	{
+		return false;
+	}
+
+	vec3 direction_view = mat3(camera.view) * light.direction;
+	vec3 tile_center = 0.5 * (tile_aabb_min + tile_aabb_max);
+	float tile_radius = 0.5 * length(tile_aabb_max - tile_aabb_min);
+
+	vec3 v = tile_center - light_pos_view;
+	float v_len_sq = dot(v, v);
+	float v1_len = dot(v, direction_view); // distance along the cone axis
+	float sin_outer_angle = sqrt(max(1.0 - light.cos_outer_angle * light.cos_outer_angle, 0.0));
+	// distance from the sphere center to the cone surface
+	float distance_to_cone = light.cos_outer_angle * sqrt(max(v_len_sq - v1_len * v1_len, 0.0)) - v1_len * sin_outer_angle;
+
+	bool angle_cull = distance_to_cone > tile_radius;
+	bool front_cull = v1_len > tile_radius + light.range;
+	bool back_cull = v1_len < -tile_radius;
+	return !(angle_cull || front_cull || back_cull);
+}
+
+// Reserve a slot in the tile's light list for an accepted light. The subgroup variant
+// ballots the accepted lanes, does a single atomicAdd for the whole subgroup and
+// hands out consecutive slots by lane, instead of one atomic per accepted light
+uint reserveLightSlot(bool accepted)
+{
+#ifdef USE_SUBGROUP_APPEND
+	uvec4 ballot = subgroupBallot(accepted);
+	uint base = 0;
+	if (subgroupElect())
+	{
+		base = atomicAdd(light_count_for_tile, subgroupBallotBitCount(ballot));
+	}
+	return subgroupBroadcastFirst(base) + subgroupBallotExclusiveBitCount(ballot);
+#else
+	return accepted ? atomicAdd(light_count_for_tile, 1) : 0;
+#endif
+}
+
+// Same as reserveLightSlot() for the spot light list
+uint reserveSpotLightSlot(bool accepted)
+{
+#ifdef USE_SUBGROUP_APPEND
+	uvec4 ballot = subgroupBallot(accepted);
+	uint base = 0;
+	if (subgroupElect())
+	{
+		base = atomicAdd(spot_light_count_for_tile, subgroupBallotBitCount(ballot));
+	}
+	return subgroupBroadcastFirst(base) + subgroupBallotExclusiveBitCount(ballot);
+#else
+	return accepted ? atomicAdd(spot_light_count_for_tile, 1) : 0;
+#endif
+}
+
+// Estimated contribution of the light at the center of the tile AABB, used to pick the lights to keep
+// when a tile has more than MAX_POINT_LIGHT_PER_TILE of them
+float lightImportance(PointLight light)
+{
+	vec3 light_pos_view = (camera.view * vec4(light.pos, 1.0)).xyz;
+	vec3 to_tile = 0.5 * (tile_aabb_min + tile_aabb_max) - light_pos_view;
+	// same attenuation as forwardplus.frag, floored so lights touching the tile still rank by intensity
+	float att = max(1.0 - dot(to_tile, to_tile) / (light.radius * light.radius), 0.01);
+	return att * max(light.intensity.r, max(light.intensity.g, light.intensity.b));
+}
+
+// The importance relative to the most important light of the tile, so the buckets cover the intensities of the scene
+// whether they are far below or above 1. Needs max_importance_bits
+uint importanceBucket(PointLight light)
+{
+	float max_importance = max(uintBitsToFloat(max_importance_bits), 1e-20);
+	return min(uint(lightImportance(light) / max_importance * IMPORTANCE_BUCKET_COUNT), IMPORTANCE_BUCKET_COUNT - 1);
+}
+
+// Depth bounds of the tile from the coarsest pyramid level whose texels are no bigger than the tile.
+// That's a single texel for power of two tile sizes, at most 3x3 otherwise. The texels can reach past
+// the tile, which only widens the bounds. A small swap chain has fewer levels, the last one has more texels per tile then
+vec2 tileDepthBoundsFromHiZ(ivec2 tile_id)
+{
+	vec2 depth_bounds = vec2(1.0, 0.0);
+	int level = clamp(findMSB(TILE_SIZE) - 1, 0, textureQueryLevels(hiz_pyramid) - 1);
+	ivec2 level_size = textureSize(hiz_pyramid, level);
+	ivec2 first_pixel = tile_id * TILE_SIZE;
+	ivec2 last_pixel = min(first_pixel + TILE_SIZE, push_constants.viewport_size) - 1;
+	ivec2 first_texel = min(first_pixel >> (level + 1), level_size - 1);
+	ivec2 last_texel = min(last_pixel >> (level + 1), level_size - 1);
+	for (int y = first_texel.y; y <= last_texel.y; y++)
+	{
+		for (int x = first_texel.x; x <= last_texel.x; x++)
+		{
+			vec2 bounds = texelFetch(hiz_pyramid, ivec2(x, y), level).rg;
+			depth_bounds.x = min(depth_bounds.x, bounds.x);
+			depth_bounds.y = max(depth_bounds.y, bounds.y);
+		}
+	}
+	return depth_bounds;
+}
+
+// Whether the light reaches at least one depth sample of the tile, only used for stats
+bool reachesTileSamples(PointLight light, ivec2 tile_id)
+{
+	mat4 inv_projview = inverse(camera.projview);
+	float radius_sq = light.radius * light.radius;
+	for (int y = 0; y < TILE_SIZE; y++)
+	{
+		for (int x = 0; x < TILE_SIZE; x++)
+		{
+			vec2 sample_loc = (vec2(TILE_SIZE, TILE_SIZE) * tile_id + vec2(x, y) + 0.5) / push_constants.viewport_size;
+			float pre_depth = texture(depth_sampler, sample_loc).x;
+			vec4 world_pos = inv_projview * vec4(sample_loc * 2.0 - 1.0, pre_depth, 1.0);
+			vec3 to_light = light.pos - world_pos.xyz / world_pos.w;
+			if (dot(to_light, to_light) <= radius_sq)
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
 void main()
 {
 	ivec2 tile_id = ivec2(gl_WorkGroupID.xy);
 	uint tile_index = tile_id.y * push_constants.tile_nums.x + tile_id.x;   // 第几行瓦片 x 每行瓦片数量 + 该行第几个瓦片
+	uint tile_offset = tile_index * (MAX_POINT_LIGHT_PER_TILE + 1);
+	int tile_light_candidates = min(light_num, pointlights.length());
 
 	// TODO: depth culling???
 
 	if (gl_LocalInvocationIndex == 0)
 	{
-		min_depth = 1.0;
-		max_depth = 0.0;
+		min_depth_bits = floatBitsToUint(1.0);
+		max_depth_bits = floatBitsToUint(0.0);
+	}
+
+	barrier();
 
-		for (int y = 0; y < TILE_SIZE; y++)
+	// the pyramid needs a few texels per tile, the depth buffer a texel per pixel which the invocations share
+	vec2 depth_bounds = vec2(1.0, 0.0);
+	if (HIZ_DEPTH_BOUNDS)
+	{
+		if (gl_LocalInvocationIndex == 0)
 		{
-			for (int x = 0; x < TILE_SIZE; x++)
-			{
-				vec2 sample_loc = (vec2(TILE_SIZE, TILE_SIZE) * tile_id + vec2(x, y) ) / push_constants.viewport_size;
-				float pre_depth = texture(depth_sampler, sample_loc).x;
-				min_depth = min(min_depth, pre_depth);
-				max_depth = max(max_depth, pre_depth); //TODO: parallize this
-			}
+			depth_bounds = tileDepthBoundsFromHiZ(tile_id);
 		}
+	}
+	else
+	{
+		for (uint i = gl_LocalInvocationIndex; i < TILE_SIZE * TILE_SIZE; i += gl_WorkGroupSize.x)
+		{
+			vec2 sample_loc = (vec2(TILE_SIZE, TILE_SIZE) * tile_id + vec2(i % TILE_SIZE, i / TILE_SIZE)) / push_constants.viewport_size;
+			float pre_depth = texture(depth_sampler, sample_loc).x;
+			depth_bounds.x = min(depth_bounds.x, pre_depth);
+			depth_bounds.y = max(depth_bounds.y, pre_depth);
+		}
+	}
+	if (depth_bounds.x <= depth_bounds.y)
+	{
+		atomicMin(min_depth_bits, floatBitsToUint(depth_bounds.x));
+		atomicMax(max_depth_bits, floatBitsToUint(depth_bounds.y));
+	}
+
+	barrier();
+
+	if (gl_LocalInvocationIndex == 0)
+	{
+		min_depth = uintBitsToFloat(min_depth_bits);
+		max_depth = uintBitsToFloat(max_depth_bits);
 
 		if (min_depth >= max_depth)
 		{
@@ -207,30 +453,164 @@ void main()
 
 		frustum = createFrustum(tile_id);
 		light_count_for_tile = 0;
+		spot_light_count_for_tile = 0;
+
+		tile_aabb_min = vec3(1e30);
+		tile_aabb_max = vec3(-1e30);
+		for (int i = 0; i < 8; i++)
+		{
+			vec3 point_view = (camera.view * vec4(frustum.points[i], 1.0)).xyz;
+			tile_aabb_min = min(tile_aabb_min, point_view);
+			tile_aabb_max = max(tile_aabb_max, point_view);
+		}
 	}
 
 	barrier();
 
 	// 每个瓦片对应的子视椎体都要遍历所有光源判断是否在其体内，所以每个工作组都要对所有光源进行剔除计算。
-	// 因为工作组被定义为长度为32的一维工作组，所以一个工作组一次同时处理连续的32个光源：
+	// 工作组是长度为 gl_WorkGroupSize.x（由特化常量指定，默认32）的一维工作组，以32为例，一个工作组一次同时处理连续的32个光源：
 	// 0号工作项调用从光源0开始处理，处理完光源0后，0号工作项调用处理光源32，接着处理光源64，…，直到处理到最大光源数或瓦片允许的最大光源数为止；
 	// 1号工作项调用从光源1开始处理，处理完光源1后，1号工作项调用处理光源33，接着处理光源65，…，直到处理到最大光源数或瓦片允许的最大光源数为止；
 	// ……
 	// 31号工作项调用从光源31开始处理，处理完光源31后，31号工作项调用处理光源63，接着处理光源95，…，直到处理到最大光源数或瓦片允许的最大光源数为止。
-	for (uint i = gl_LocalInvocationIndex; i < light_num && light_count_for_tile < MAX_POINT_LIGHT_PER_TILE; i += gl_WorkGroupSize.x)
+	// 所有光源都要遍历完，以便得到瓦片的完整光源数，判断是否溢出
+	for (uint i = gl_LocalInvocationIndex; i < tile_light_candidates; i += gl_WorkGroupSize.x)
 	{
-		if (isCollided(pointlights[i], frustum))
+		// every lane has to reach the ballot, so reserve before branching on the result
+		bool accepted = isLightInTile(pointlights[i]);
+		uint slot = reserveLightSlot(accepted);
+		if (accepted && slot < MAX_POINT_LIGHT_PER_TILE)
 		{
-			uint slot = atomicAdd(light_count_for_tile, 1);
-			if (slot >= MAX_POINT_LIGHT_PER_TILE) {break;}
-			light_visiblities[tile_index].lightindices[slot] = i;
+			light_visiblities[tile_offset + 1 + slot] = i;
+		}
+	}
+
+	// spot lights go to their own list, saturated tiles keep whichever ones came first
+	int tile_spot_light_candidates = min(spot_light_num, spotlights.length());
+	for (uint i = gl_LocalInvocationIndex; i < tile_spot_light_candidates; i += gl_WorkGroupSize.x)
+	{
+		bool accepted = isSpotLightInTile(spotlights[i]);
+		uint slot = reserveSpotLightSlot(accepted);
+		if (accepted && slot < MAX_SPOT_LIGHT_PER_TILE)
+		{
+			spot_light_visiblities[tile_index * (MAX_SPOT_LIGHT_PER_TILE + 1) + 1 + slot] = i;
 		}
 	}
 
 	barrier();
 
+	// The tile is saturated: rather than keeping whichever lights won the atomicAdd race,
+	// rebuild the list from the MAX_POINT_LIGHT_PER_TILE most important ones.
+	// light_count_for_tile is only written before the barrier above, so every invocation takes the same branch
+	uint tile_light_count = light_count_for_tile;
+	if (tile_light_count > MAX_POINT_LIGHT_PER_TILE)
+	{
+		for (uint b = gl_LocalInvocationIndex; b < IMPORTANCE_BUCKET_COUNT; b += gl_WorkGroupSize.x)
+		{
+			importance_histogram[b] = 0;
+		}
+		if (gl_LocalInvocationIndex == 0)
+		{
+			max_importance_bits = 0;
+		}
+
+		barrier();
+
+		for (uint i = gl_LocalInvocationIndex; i < tile_light_candidates; i += gl_WorkGroupSize.x)
+		{
+			if (isLightInTile(pointlights[i]))
+			{
+				atomicMax(max_importance_bits, floatBitsToUint(lightImportance(pointlights[i])));
+			}
+		}
+
+		barrier();
+
+		for (uint i = gl_LocalInvocationIndex; i < tile_light_candidates; i += gl_WorkGroupSize.x)
+		{
+			if (isLightInTile(pointlights[i]))
+			{
+				atomicAdd(importance_histogram[importanceBucket(pointlights[i])], 1);
+			}
+		}
+
+		barrier();
+
+		// find the bucket where the budget runs out, everything above it fits
+		if (gl_LocalInvocationIndex == 0)
+		{
+			uint kept = 0;
+			uint b = IMPORTANCE_BUCKET_COUNT - 1;
+			while (b > 0 && kept + importance_histogram[b] < MAX_POINT_LIGHT_PER_TILE)
+			{
+				kept += importance_histogram[b];
+				b--;
+			}
+			threshold_bucket = b;
+			above_threshold_count = kept;
+			above_threshold_cursor = 0;
+			threshold_cursor = 0;
+
+			atomicAdd(stats.overflowed_tile_count, 1);
+			atomicAdd(stats.dropped_light_count, tile_light_count - MAX_POINT_LIGHT_PER_TILE);
+		}
+
+		barrier();
+
+		// lights above the threshold go first, the threshold bucket fills what is left
+		for (uint i = gl_LocalInvocationIndex; i < tile_light_candidates; i += gl_WorkGroupSize.x)
+		{
+			if (isLightInTile(pointlights[i]))
+			{
+				uint bucket = importanceBucket(pointlights[i]);
+				if (bucket > threshold_bucket)
+				{
+					uint slot = atomicAdd(above_threshold_cursor, 1);
+					light_visiblities[tile_offset + 1 + slot] = i;
+				}
+				else if (bucket == threshold_bucket)
+				{
+					uint slot = above_threshold_count + atomicAdd(threshold_cursor, 1);
+					if (slot < MAX_POINT_LIGHT_PER_TILE)
+					{
+						light_visiblities[tile_offset + 1 + slot] = i;
+					}
+				}
+			}
+		}
+	}
+
+	uint kept_light_count = min(MAX_POINT_LIGHT_PER_TILE, tile_light_count);
+
 	if (gl_LocalInvocationIndex == 0)
 	{
-		light_visiblities[tile_index].count = min(MAX_POINT_LIGHT_PER_TILE, light_count_for_tile);
+		light_visiblities[tile_offset] = kept_light_count;
+		atomicMax(stats.max_tile_light_count, tile_light_count);
+
+		uint kept_spot_light_count = min(MAX_SPOT_LIGHT_PER_TILE, spot_light_count_for_tile);
+		spot_light_visiblities[tile_index * (MAX_SPOT_LIGHT_PER_TILE + 1)] = kept_spot_light_count;
+		if (spot_light_count_for_tile > MAX_SPOT_LIGHT_PER_TILE)
+		{
+			atomicAdd(stats.dropped_spot_light_count, spot_light_count_for_tile - MAX_SPOT_LIGHT_PER_TILE);
+		}
+
+		if (LIGHT_CULLING_STATS)
+		{
+			atomicAdd(stats.accepted_light_count, kept_light_count + kept_spot_light_count);
+		}
+	}
+
+	if (LIGHT_CULLING_STATS)
+	{
+		memoryBarrierBuffer();
+		barrier();
+
+		for (uint slot = gl_LocalInvocationIndex; slot < kept_light_count; slot += gl_WorkGroupSize.x)
+		{
+			if (!reachesTileSamples(pointlights[light_visiblities[tile_offset + 1 + slot]], tile_id))
+			{
+				atomicAdd(stats.zero_contribution_light_count, 1);
+			}
+		}
 	}
 }
\ No newline at end of file
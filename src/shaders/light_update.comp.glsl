@@ -0,0 +1,73 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Moves every light by its velocity and wraps it back into the light bounds of the scene,
+// in place in the light buffers, so the CPU doesn't upload them every frame
+
+layout(local_size_x_id = 0) in; // LIGHT_UPDATE_WORKGROUP_SIZE of the renderer
+
+struct PointLight {
+	vec3 pos;
+	float radius;
+	vec3 intensity;
+};
+
+struct SpotLight {
+	vec3 pos;
+	float range;
+	vec3 direction;
+	float cos_outer_angle;
+	vec3 intensity;
+	float cos_inner_angle;
+};
+
+layout(push_constant) uniform LightUpdatePushConstants
+{
+	vec4 bounds_min;
+	vec4 bounds_max;
+	float delta_time;
+	int spot_velocity_offset; // the point light capacity, spot light velocities follow the point light ones
+} params;
+
+layout(std140, set = 0, binding = 1) buffer PointLights
+{
+	int light_num;
+	PointLight pointlights[]; // sized by the buffer, which grows with the light count
+};
+
+layout(std140, set = 0, binding = 3) buffer SpotLights
+{
+	int spot_light_num;
+	SpotLight spotlights[];
+};
+
+// point light velocities first, spot light velocities start at params.spot_velocity_offset
+layout(std430, set = 0, binding = 5) buffer readonly LightVelocities
+{
+	vec4 velocities[];
+};
+
+vec3 moveAndWrap(vec3 pos, vec3 velocity)
+{
+	pos += velocity * params.delta_time;
+
+	// a light leaving the bounds comes back in from the other side, flat axes stay where they are
+	vec3 extent = params.bounds_max.xyz - params.bounds_min.xyz;
+	vec3 wrapped = pos - extent * floor((pos - params.bounds_min.xyz) / max(extent, vec3(1e-6)));
+	return mix(pos, wrapped, greaterThan(extent, vec3(0.0)));
+}
+
+void main()
+{
+	uint i = gl_GlobalInvocationID.x;
+
+	if (i < min(light_num, pointlights.length()))
+	{
+		pointlights[i].pos = moveAndWrap(pointlights[i].pos, velocities[i].xyz);
+	}
+
+	if (i < min(spot_light_num, spotlights.length()))
+	{
+		spotlights[i].pos = moveAndWrap(spotlights[i].pos, velocities[params.spot_velocity_offset + i].xyz);
+	}
+}
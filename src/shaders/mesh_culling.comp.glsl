@@ -0,0 +1,296 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Culls every mesh part against the camera frustum and the Hi-Z pyramid, and appends the draw commands
+// of the visible ones for vkCmdDrawIndexedIndirectCount. It runs twice per depth prepass:
+// phase 0 before it, drawing the parts which were visible the last time without an occlusion test,
+// phase 1 after the pyramid was built from that depth, testing every part against it,
+// drawing the visible ones phase 0 left out and remembering the visibility for the next phase 0.
+// Phases 2 to 4 run right after phase 1 and list the parts either phase drew once more, in the order of the model,
+// so the shading pass draws them grouped by material. They compact the drawn flags with a prefix sum
+// in every workgroup and one over the workgroups
+
+layout(local_size_x = 64) in;
+
+struct DrawCommand // VkDrawIndexedIndirectCommand
+{
+	uint index_count;
+	uint instance_count;
+	uint first_index;
+	int vertex_offset;
+	uint first_instance;
+};
+
+struct PartBounds
+{
+	vec4 bounds_min;
+	vec4 bounds_max;
+};
+
+layout(push_constant) uniform MeshCullingPushConstants
+{
+	mat4 model;
+	ivec2 viewport_size;
+	uint part_count;
+	int phase;
+} params;
+
+layout(std140, set = 0, binding = 0) buffer readonly CameraUbo // FIXME: change back to uniform
+{
+	mat4 view;
+	mat4 proj;
+	mat4 projview;
+	vec3 cam_pos;
+} camera;
+
+layout(std430, set = 1, binding = 0) buffer readonly MeshPartBounds
+{
+	PartBounds part_bounds[];
+};
+
+// the draw command of every mesh part, in part order
+layout(std430, set = 1, binding = 1) buffer readonly MeshPartDraws
+{
+	DrawCommand part_draws[];
+};
+
+// the draw counts are cleared by the renderer before phase 0
+layout(std430, set = 1, binding = 2) buffer CulledDraws
+{
+	uint draw_counts[4]; // of each phase, padded to 16 bytes
+	DrawCommand culled_draws[]; // part_count for each phase, 0 to 2
+};
+
+// bit 0 for the parts visible after the last phase 1, shared by every frame,
+// bit 1 for the parts drawn by either phase of the frame, written by phase 1 for phases 2 to 4
+layout(std430, set = 1, binding = 3) buffer MeshPartVisibility
+{
+	uint part_visibility[];
+};
+
+// cleared by the renderer before phase 0 and read back on the host
+layout(std430, set = 1, binding = 4) buffer MeshCullingStats
+{
+	uint phase0_draw_count;
+	uint phase1_draw_count;
+	uint frustum_culled_count;
+	uint occlusion_culled_count;
+	uint drawn_triangle_count;
+} stats;
+
+// min and max depth in rg, level 0 is half the depth resolution, see hiz_build.comp.glsl
+layout(set = 1, binding = 5) uniform sampler2D hiz_pyramid;
+
+// the parts in the order the depth prepass draws them, the appends roughly keep it
+layout(std430, set = 1, binding = 6) buffer readonly MeshPartOrder
+{
+	uint part_order[];
+};
+
+// per workgroup of phases 2 to 4, the drawn parts of its 64 parts, then where they start in the shading list
+layout(std430, set = 1, binding = 7) buffer DrawnGroupOffsets
+{
+	uint group_offsets[];
+};
+
+shared uint prefix_sums[gl_WorkGroupSize.x];
+
+// inclusive prefix sum of value over the workgroup and the sum of all, every invocation has to call it
+uint workgroupPrefixSum(uint value, out uint total)
+{
+	uint lane = gl_LocalInvocationID.x;
+	prefix_sums[lane] = value;
+	barrier();
+	for (uint offset = 1u; offset < gl_WorkGroupSize.x; offset <<= 1)
+	{
+		uint before = lane >= offset ? prefix_sums[lane - offset] : 0u;
+		barrier();
+		prefix_sums[lane] += before;
+		barrier();
+	}
+	uint sum = prefix_sums[lane];
+	total = prefix_sums[gl_WorkGroupSize.x - 1u];
+	barrier(); // the next call overwrites prefix_sums
+	return sum;
+}
+
+bool isDrawn(uint part)
+{
+	return part < params.part_count && (part_visibility[part] & 2u) != 0u;
+}
+
+// phase 2: the number of drawn parts of every workgroup
+void countDrawnParts()
+{
+	uint total;
+	workgroupPrefixSum(isDrawn(gl_GlobalInvocationID.x) ? 1u : 0u, total);
+	if (gl_LocalInvocationID.x == 0u)
+	{
+		group_offsets[gl_WorkGroupID.x] = total;
+	}
+}
+
+// phase 3, a single workgroup: the counts of phase 2 into the offsets of the workgroups, 64 of them at a time
+void scanDrawnCounts()
+{
+	uint group_count = (params.part_count + gl_WorkGroupSize.x - 1u) / gl_WorkGroupSize.x;
+	uint draw_count = 0u;
+	for (uint first = 0u; first < group_count; first += gl_WorkGroupSize.x)
+	{
+		uint group = first + gl_LocalInvocationID.x;
+		uint count = group < group_count ? group_offsets[group] : 0u;
+		uint total;
+		uint sum = workgroupPrefixSum(count, total);
+		if (group < group_count)
+		{
+			group_offsets[group] = draw_count + sum - count;
+		}
+		draw_count += total;
+	}
+
+	if (gl_LocalInvocationID.x == 0u)
+	{
+		draw_counts[2] = draw_count;
+	}
+}
+
+// phase 4: the draws of the drawn parts of every workgroup from its offset, in part order
+void writeDrawnParts()
+{
+	uint part = gl_GlobalInvocationID.x;
+	bool drawn = isDrawn(part);
+	uint total;
+	uint sum = workgroupPrefixSum(drawn ? 1u : 0u, total);
+	if (drawn)
+	{
+		culled_draws[2u * params.part_count + group_offsets[gl_WorkGroupID.x] + sum - 1u] = part_draws[part];
+	}
+}
+
+void appendDraw(uint phase, uint part)
+{
+	uint slot = atomicAdd(draw_counts[phase], 1);
+	culled_draws[phase * params.part_count + slot] = part_draws[part];
+	atomicAdd(stats.drawn_triangle_count, part_draws[part].index_count / 3);
+}
+
+// whether the nearest depth of the bounds lies behind the farthest depth of every pyramid texel under their screen rectangle
+bool isOccluded(vec3 ndc_min, vec3 ndc_max)
+{
+	vec2 viewport = vec2(params.viewport_size);
+	vec2 pixel_min = clamp((ndc_min.xy * 0.5 + 0.5) * viewport, vec2(0.0), viewport - 1.0);
+	vec2 pixel_max = clamp((ndc_max.xy * 0.5 + 0.5) * viewport, vec2(0.0), viewport - 1.0);
+
+	// a texel of level l covers 2^(l+1) pixels, so the rectangle spans at most 2x2 texels of the level picked here
+	vec2 size = pixel_max - pixel_min;
+	int level = clamp(int(ceil(log2(max(max(size.x, size.y), 1.0)))) - 1, 0, textureQueryLevels(hiz_pyramid) - 1);
+
+	// the last texel of a row or column also covers the odd pixel left over, clamping the range picks it up
+	ivec2 level_size = textureSize(hiz_pyramid, level);
+	ivec2 texel_min = min(ivec2(pixel_min) >> (level + 1), level_size - 1);
+	ivec2 texel_max = min(ivec2(pixel_max) >> (level + 1), level_size - 1);
+
+	float farthest = 0.0;
+	for (int y = texel_min.y; y <= texel_max.y; y++)
+	{
+		for (int x = texel_min.x; x <= texel_max.x; x++)
+		{
+			farthest = max(farthest, texelFetch(hiz_pyramid, ivec2(x, y), level).g);
+		}
+	}
+	return ndc_min.z > farthest;
+}
+
+void main()
+{
+	// every invocation takes part in the prefix sums of phases 2 to 4
+	if (params.phase == 2)
+	{
+		countDrawnParts();
+		return;
+	}
+	if (params.phase == 3)
+	{
+		scanDrawnCounts();
+		return;
+	}
+	if (params.phase == 4)
+	{
+		writeDrawnParts();
+		return;
+	}
+	if (gl_GlobalInvocationID.x >= params.part_count)
+	{
+		return;
+	}
+	uint part = part_order[gl_GlobalInvocationID.x];
+
+	// the corners in clip space: outside the frustum if all of them are outside one of its planes,
+	// the occlusion test needs all of them in front of the camera
+	mat4 mvp = camera.projview * params.model;
+	vec3 bounds_min = part_bounds[part].bounds_min.xyz;
+	vec3 bounds_max = part_bounds[part].bounds_max.xyz;
+	uint outside_all = 63u;
+	bool behind_camera = false;
+	vec3 ndc_min = vec3(1.0e30);
+	vec3 ndc_max = vec3(-1.0e30);
+	for (int i = 0; i < 8; i++)
+	{
+		vec3 corner = mix(bounds_min, bounds_max, vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));
+		vec4 clip = mvp * vec4(corner, 1.0);
+
+		uint outside = 0u;
+		outside |= clip.x < -clip.w ? 1u : 0u;
+		outside |= clip.x > clip.w ? 2u : 0u;
+		outside |= clip.y < -clip.w ? 4u : 0u;
+		outside |= clip.y > clip.w ? 8u : 0u;
+		outside |= clip.z < 0.0 ? 16u : 0u;
+		outside |= clip.z > clip.w ? 32u : 0u;
+		outside_all &= outside;
+
+		if (clip.w <= 0.0)
+		{
+			behind_camera = true;
+		}
+		else
+		{
+			vec3 ndc = clip.xyz / clip.w;
+			ndc_min = min(ndc_min, ndc);
+			ndc_max = max(ndc_max, ndc);
+		}
+	}
+	bool in_frustum = outside_all == 0u;
+	bool was_visible = (part_visibility[part] & 1u) != 0u;
+
+	if (params.phase == 0)
+	{
+		if (in_frustum && was_visible)
+		{
+			appendDraw(0, part);
+			atomicAdd(stats.phase0_draw_count, 1);
+		}
+		return;
+	}
+
+	bool visible = in_frustum && (behind_camera || !isOccluded(ndc_min, ndc_max));
+	bool drawn = in_frustum && (was_visible || visible);
+	part_visibility[part] = (visible ? 1u : 0u) | (drawn ? 2u : 0u);
+
+	// a part visible the last time was drawn by phase 0 already, even if it's hidden now
+	if (!in_frustum)
+	{
+		atomicAdd(stats.frustum_culled_count, 1);
+	}
+	else if (!was_visible)
+	{
+		if (visible)
+		{
+			appendDraw(1, part);
+			atomicAdd(stats.phase1_draw_count, 1);
+		}
+		else
+		{
+			atomicAdd(stats.occlusion_culled_count, 1);
+		}
+	}
+}
@@ -0,0 +1,132 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace
+{
+	thread_local size_t current_thread_index = 0;
+}
+
+ThreadPool::ThreadPool(size_t thread_count)
+	: next_chunk(0)
+{
+	if (thread_count == 0)
+	{
+		thread_count = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	for (size_t i = 1; i < thread_count; i++)
+	{
+		workers.emplace_back([this, i]() { workerLoop(i); });
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	work_available.notify_all();
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+void ThreadPool::parallelFor(size_t count, size_t chunk_size, const std::function<void(size_t first, size_t count)>& task)
+{
+	chunk_size = std::max<size_t>(chunk_size, 1);
+	if (count == 0)
+	{
+		return;
+	}
+	if (workers.empty() || count <= chunk_size)
+	{
+		// not worth waking anyone up
+		task(0, count);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		current_task = &task;
+		current_count = count;
+		current_chunk_size = chunk_size;
+		next_chunk = 0;
+		busy_workers = workers.size();
+		generation++;
+	}
+	work_available.notify_all();
+
+	runChunks();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	work_done.wait(lock, [this]() { return busy_workers == 0; });
+	current_task = nullptr;
+
+	// rethrown only now, the workers are done with the task
+	if (task_exception)
+	{
+		auto exception = task_exception;
+		task_exception = nullptr;
+		std::rethrow_exception(exception);
+	}
+}
+
+size_t ThreadPool::getCurrentThreadIndex()
+{
+	return current_thread_index;
+}
+
+void ThreadPool::workerLoop(size_t thread_index)
+{
+	current_thread_index = thread_index;
+	uint64_t seen_generation = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			work_available.wait(lock, [this, seen_generation]() { return stopping || generation != seen_generation; });
+			if (stopping)
+			{
+				return;
+			}
+			seen_generation = generation;
+		}
+
+		runChunks();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			busy_workers--;
+		}
+		work_done.notify_one();
+	}
+}
+
+void ThreadPool::runChunks()
+{
+	auto chunk_count = (current_count + current_chunk_size - 1) / current_chunk_size;
+	for (auto chunk = next_chunk++; chunk < chunk_count; chunk = next_chunk++)
+	{
+		auto first = chunk * current_chunk_size;
+		try
+		{
+			(*current_task)(first, std::min(current_chunk_size, current_count - first));
+		}
+		catch (...)
+		{
+			// an exception leaving a worker would terminate, keep the first for parallelFor() and skip the rest
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!task_exception)
+			{
+				task_exception = std::current_exception();
+			}
+			next_chunk = chunk_count;
+		}
+	}
+}
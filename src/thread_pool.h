@@ -0,0 +1,68 @@
+// Copyright(c) 2016 Ruoyu Fan (Windy Darian), Xueyin Wan
+// MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+* A fixed set of worker threads for splitting a loop into chunks.
+* The calling thread works on chunks too and parallelFor() returns once every chunk is done
+*/
+class ThreadPool
+{
+public:
+	/**
+	* thread_count includes the calling thread, 0 means one per hardware thread
+	*/
+	explicit ThreadPool(size_t thread_count = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator= (const ThreadPool&) = delete;
+
+	size_t getThreadCount() const
+	{
+		return workers.size() + 1;
+	}
+
+	/**
+	* Call task(first, count) for chunks of [0, count) no bigger than chunk_size, spread over the threads.
+	* If a task throws, the chunks not started yet are skipped and the first exception is rethrown
+	* once every thread is done. Not reentrant, call it from one thread at a time
+	*/
+	void parallelFor(size_t count, size_t chunk_size, const std::function<void(size_t first, size_t count)>& task);
+
+	/**
+	* Index of the calling thread inside a task, 0 for the thread which called parallelFor()
+	* and 1 to getThreadCount() - 1 for the workers, e.g. to pick per thread resources
+	*/
+	static size_t getCurrentThreadIndex();
+
+private:
+	void workerLoop(size_t thread_index);
+	void runChunks();
+
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable work_available;
+	std::condition_variable work_done;
+	bool stopping = false;
+	uint64_t generation = 0; // bumped for every parallelFor() so the workers notice new work
+	size_t busy_workers = 0;
+
+	const std::function<void(size_t, size_t)>* current_task = nullptr;
+	size_t current_count = 0;
+	size_t current_chunk_size = 0;
+	std::atomic<size_t> next_chunk;
+	std::exception_ptr task_exception; // the first one thrown by the current task, guarded by mutex
+};